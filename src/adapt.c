@@ -0,0 +1,236 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/adapt.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "adapt.h"
+
+/* buffer growing for updates in row is pressure before high percent */
+#define ADAPT_RISING 3u
+
+bool
+adapt_parse(struct adapt_cfg *cfg, const char *spec)
+{
+  char buf[128];
+  char *save = NULL;
+  char *tok;
+  char *end;
+
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->quality_min = 50u;
+  cfg->quality_max = 90u;
+  cfg->quality_step = 10u;
+  cfg->high_percent = 30u;
+  cfg->low_percent = 15u;
+  cfg->down_hold = 2.0;
+  cfg->up_hold = 30.0;
+  if (strlen(spec) >= sizeof(buf)) {
+    fprintf(stderr, "! adapt: spec too long\n");
+    return false;
+  }
+  strcpy(buf, spec);
+
+  for (tok = strtok_r(buf, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    if (!strncmp(tok, "quality=", 8)) {
+      cfg->quality_min = (unsigned)strtoul(tok + 8, &end, 10);
+      if (*end != '-') {
+        fprintf(stderr, "! adapt: expect quality=<min>-<max>[:<step>]\n");
+        return false;
+      }
+      cfg->quality_max = (unsigned)strtoul(end + 1, &end, 10);
+      if (*end == ':')
+        cfg->quality_step = (unsigned)strtoul(end + 1, &end, 10);
+      if (*end || !cfg->quality_min || cfg->quality_max > 100u ||
+          cfg->quality_min > cfg->quality_max || !cfg->quality_step) {
+        fprintf(stderr, "! adapt: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "fps=", 4)) {
+      cfg->fps_min = (unsigned)strtoul(tok + 4, &end, 10);
+      if (*end || !cfg->fps_min) {
+        fprintf(stderr, "! adapt: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strcmp(tok, "resolution")) {
+      cfg->resolution = true;
+    } else if (!strncmp(tok, "buffer=", 7)) {
+      cfg->high_percent = (unsigned)strtoul(tok + 7, &end, 10);
+      if (*end != ':') {
+        fprintf(stderr, "! adapt: expect buffer=<high>:<low>\n");
+        return false;
+      }
+      cfg->low_percent = (unsigned)strtoul(end + 1, &end, 10);
+      if (*end || cfg->high_percent > 100u ||
+          cfg->low_percent >= cfg->high_percent) {
+        fprintf(stderr, "! adapt: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "hold=", 5)) {
+      cfg->down_hold = strtod(tok + 5, &end);
+      if (*end != ':') {
+        fprintf(stderr, "! adapt: expect hold=<down>:<up>\n");
+        return false;
+      }
+      cfg->up_hold = strtod(end + 1, &end);
+      if (*end || cfg->down_hold < 0.0 || cfg->up_hold < 0.0) {
+        fprintf(stderr, "! adapt: invalid '%s'\n", tok);
+        return false;
+      }
+    } else {
+      fprintf(stderr, "! adapt: unknown option '%s'\n", tok);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* quality levels, first is quality_max, last is quality_min */
+static unsigned
+adapt_quality_levels(const struct adapt_cfg *cfg)
+{
+  return (cfg->quality_max - cfg->quality_min + cfg->quality_step - 1u) /
+         cfg->quality_step + 1u;
+}
+
+/* frame rate halvings not below fps_min */
+static unsigned
+adapt_fps_levels(const struct adapt *a)
+{
+  unsigned n = 0u;
+
+  if (!a->cfg.fps_min)
+    return 0u;
+  while ((a->fps >> (n + 1u)) >= a->cfg.fps_min)
+    n++;
+  return n;
+}
+
+void
+adapt_init(struct adapt *a, const struct adapt_cfg *cfg, unsigned fps)
+{
+  memset(a, 0, sizeof(*a));
+  a->cfg = *cfg;
+  a->fps = fps;
+  a->levels = adapt_quality_levels(cfg) + adapt_fps_levels(a) +
+              (cfg->resolution ? 1u : 0u);
+}
+
+void
+adapt_level(const struct adapt *a, unsigned level, struct adapt_level *l)
+{
+  unsigned nq = adapt_quality_levels(&a->cfg);
+  unsigned nf = adapt_fps_levels(a);
+  unsigned q;
+
+  l->quality = a->cfg.quality_min;
+  l->fps = a->fps;
+  l->scale = 1u;
+  if (level < nq) {
+    q = level * a->cfg.quality_step;
+    if (a->cfg.quality_max - a->cfg.quality_min > q)
+      l->quality = a->cfg.quality_max - q;
+  } else if (level - nq < nf) {
+    l->fps = a->fps >> (level - nq + 1u);
+  } else {
+    l->fps = a->fps >> nf;
+    l->scale = 2u;
+  }
+}
+
+static void
+adapt_step(struct adapt *a, uint64_t now_ns, unsigned level,
+           struct adapt_level *l)
+{
+  const char *why = level > a->level ? "down" : "up";
+
+  if (level > a->level)
+    a->steps_down++;
+  else
+    a->steps_up++;
+  a->level = level;
+  a->changed_ns = now_ns;
+  adapt_level(a, level, l);
+  fprintf(stderr, "@ adapt: %s to level %u/%u: quality %u, fps %u, "
+          "resolution 1/%u (buffer %u%%, in %.2f MB/s, out %.2f MB/s, "
+          "saturated %.2f MB/s)\n",
+          why, level, a->levels - 1u, l->quality, l->fps, l->scale,
+          a->percent, a->in_rate / 1e6, a->out_rate / 1e6,
+          a->capacity / 1e6);
+}
+
+bool
+adapt_update(struct adapt *a, uint64_t now_ns, unsigned percent,
+             uint64_t queued, uint64_t written, struct adapt_level *l)
+{
+  double dt = (now_ns - a->update_ns) / 1e9;
+  double low;
+  bool pressure;
+
+  if (!a->update_ns || dt <= 0.0) {
+    a->update_ns = now_ns;
+    a->changed_ns = now_ns;
+    a->queued = queued;
+    a->written = written;
+    a->percent = percent;
+    return false;
+  }
+
+  a->in_rate = (queued - a->queued) / dt;
+  a->out_rate = (written - a->written) / dt;
+  /* writer was busy all window: its rate is what disk takes now,
+   * higher rate seen at any time raises it
+   */
+  if ((a->percent >= a->cfg.high_percent && a->out_rate > 0.0) ||
+      a->out_rate > a->capacity)
+    a->capacity = a->out_rate;
+
+  if (percent > a->percent && percent > a->cfg.low_percent)
+    a->rising++;
+  else
+    a->rising = 0u;
+
+  /* above high and not draining: last step was not enough */
+  pressure = a->rising >= ADAPT_RISING ||
+             (percent >= a->cfg.high_percent &&
+              (percent > a->percent || a->in_rate >= a->out_rate));
+
+  a->update_ns = now_ns;
+  a->queued = queued;
+  a->written = written;
+  a->percent = percent;
+
+  if (pressure) {
+    a->low_since_ns = 0u;
+    if (a->level + 1u < a->levels &&
+        now_ns - a->changed_ns >= (uint64_t)(a->cfg.down_hold * 1e9)) {
+      a->rising = 0u;
+      adapt_step(a, now_ns, a->level + 1u, l);
+      return true;
+    }
+    return false;
+  }
+
+  if (percent > a->cfg.low_percent) {
+    a->low_since_ns = 0u;
+    return false;
+  }
+
+  if (!a->low_since_ns)
+    a->low_since_ns = now_ns;
+  low = (now_ns - a->low_since_ns) / 1e9;
+  /* saturated rate is not trusted after long quiet time: disk recovers */
+  if (a->level && low >= a->cfg.up_hold &&
+      now_ns - a->changed_ns >= (uint64_t)(a->cfg.up_hold * 1e9) &&
+      (!a->capacity || a->in_rate * 1.25 < a->capacity ||
+       low >= a->cfg.up_hold * 4.0)) {
+    a->low_since_ns = now_ns;
+    adapt_step(a, now_ns, a->level - 1u, l);
+    return true;
+  }
+  return false;
+}
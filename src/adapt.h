@@ -0,0 +1,100 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/adapt.h
+ */
+#ifndef _ADAPT_1562145871_H_
+#define _ADAPT_1562145871_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * adaptive quality: step camera settings down while write thread does
+ * not keep up and back up when it does, so sustained overload costs
+ * quality instead of dropped frames.
+ *
+ * levels from best: JPEG quality from max to min, then frame rate
+ * halved down to fps min, then half resolution.
+ *
+ * spec: comma separated list of
+ *   quality=<min>-<max>[:<step>]  JPEG quality, default 50-90:10
+ *   fps=<min>                     lowest frame rate, default nominal
+ *   resolution                    half resolution as last level
+ *   buffer=<high>:<low>           write buffer percent, default 30:15
+ *   hold=<down>:<up>              seconds between steps, default 2:30
+ *
+ * step down: buffer above high and not draining, or growing above low
+ * for 3 updates.
+ * step up: buffer below low for up hold seconds and input rate with
+ * 25% headroom below write rate measured while buffer was above high,
+ * or buffer below low for 4 up holds
+ */
+struct adapt_cfg {
+  unsigned quality_min;
+  unsigned quality_max;
+  unsigned quality_step;
+  /* 0 = nominal frame rate only */
+  unsigned fps_min;
+  bool resolution;
+  unsigned high_percent;
+  unsigned low_percent;
+  double down_hold;
+  double up_hold;
+};
+
+/* camera settings of level */
+struct adapt_level {
+  unsigned quality;
+  unsigned fps;
+  /* resolution divisor: 1 or 2 */
+  unsigned scale;
+};
+
+struct adapt {
+  struct adapt_cfg cfg;
+  /* nominal frame rate */
+  unsigned fps;
+  /* current, 0 = best */
+  unsigned level;
+  unsigned levels;
+
+  /* CLOCK_MONOTONIC ns of last step, start of low buffer, last update */
+  uint64_t changed_ns;
+  uint64_t low_since_ns;
+  uint64_t update_ns;
+  /* counters at last update */
+  uint64_t queued;
+  uint64_t written;
+  unsigned percent;
+  /* updates with buffer growing above low */
+  unsigned rising;
+  /* bytes/s: input and written at last update,
+   * written while buffer above high (0 = not seen)
+   */
+  double in_rate;
+  double out_rate;
+  double capacity;
+
+  uint64_t steps_down;
+  uint64_t steps_up;
+};
+
+/* parse spec, return false on invalid spec */
+bool
+adapt_parse(struct adapt_cfg *cfg, const char *spec);
+
+/* fps: nominal frame rate of camera */
+void
+adapt_init(struct adapt *a, const struct adapt_cfg *cfg, unsigned fps);
+
+void
+adapt_level(const struct adapt *a, unsigned level, struct adapt_level *l);
+
+/*
+ * call each second or so: write buffer percent, counters of bytes
+ * queued to write thread and written by it.
+ * return true when level changed, settings of new level in *l
+ */
+bool
+adapt_update(struct adapt *a, uint64_t now_ns, unsigned percent,
+             uint64_t queued, uint64_t written, struct adapt_level *l);
+
+#endif /* _ADAPT_1562145871_H_ */
@@ -0,0 +1,366 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/alog.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "alog.h"
+#include "clock.h"
+
+/* formatting thread sleep when all rings are empty */
+#define ALOG_IDLE_NS 10000000u
+#define ALOG_LINE_SIZE 1024
+#define ALOG_OUT_SIZE 65536
+
+struct alog_ring {
+  struct alog_ring *next;
+  /* owned by thread */
+  atomic_bool used;
+  atomic_size_t head;
+  atomic_size_t tail;
+  atomic_ulong dropped;
+  /* reported by formatting thread */
+  unsigned long dropped_reported;
+  struct alog_rec rec[ALOG_RING_SIZE];
+};
+
+int alog_level = ALOG_DEBUG;
+
+static const char *const level_names[] = {
+  [ALOG_ERROR] = "ERROR",
+  [ALOG_WARN] = "WARN",
+  [ALOG_INFO] = "INFO",
+  [ALOG_DEBUG] = "DEBUG",
+  [ALOG_TRACE] = "TRACE"
+};
+
+static _Atomic(struct alog_ring *) rings;
+static _Thread_local struct alog_ring *self;
+/* record for synchronous output */
+static _Thread_local struct alog_rec scratch;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+static atomic_bool running;
+static atomic_bool stopping;
+static pthread_t thread;
+
+static char out[ALOG_OUT_SIZE];
+static size_t out_len;
+
+static void
+ring_release(void *p)
+{
+  struct alog_ring *r = p;
+
+  /* records left in ring will be formatted anyway */
+  atomic_store_explicit(&r->used, false, memory_order_release);
+}
+
+static void
+key_init(void)
+{
+  pthread_key_create(&key, ring_release);
+}
+
+static struct alog_ring *
+ring_acquire(void)
+{
+  struct alog_ring *r;
+  bool expected;
+
+  pthread_once(&key_once, key_init);
+
+  /* reuse ring of finished thread */
+  for (r = atomic_load(&rings); r; r = r->next) {
+    expected = false;
+    if (atomic_load(&r->head) == atomic_load(&r->tail) &&
+        atomic_compare_exchange_strong(&r->used, &expected, true)) {
+      pthread_setspecific(key, r);
+      return r;
+    }
+  }
+
+  if (!(r = calloc(1, sizeof(*r))))
+    return NULL;
+  atomic_init(&r->used, true);
+  r->next = atomic_load(&rings);
+  while (!atomic_compare_exchange_weak(&rings, &r->next, r));
+  pthread_setspecific(key, r);
+  return r;
+}
+
+struct alog_rec *
+alog_begin(enum alog_level level, const char *module, const char *fmt)
+{
+  struct alog_rec *rec;
+  size_t head;
+
+  if (!atomic_load_explicit(&running, memory_order_relaxed)) {
+    rec = &scratch;
+  } else {
+    if (!self && !(self = ring_acquire()))
+      return NULL;
+    head = atomic_load_explicit(&self->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&self->tail, memory_order_acquire) >=
+        ALOG_RING_SIZE) {
+      atomic_fetch_add_explicit(&self->dropped, 1u, memory_order_relaxed);
+      return NULL;
+    }
+    rec = &self->rec[head & (ALOG_RING_SIZE - 1u)];
+  }
+
+  rec->ts = now_ns();
+  rec->module = module;
+  rec->fmt = fmt;
+  rec->level = (uint8_t)level;
+  rec->nargs = 0u;
+  rec->str_used = 0u;
+  return rec;
+}
+
+/* one conversion with stored argument, return length as snprintf */
+static int
+format_arg(char *p, size_t size, const char *spec, char conv,
+           const struct alog_rec *r, unsigned i)
+{
+  if (i >= r->nargs)
+    return snprintf(p, size, "<?>");
+
+  switch (conv) {
+  case 'd':
+  case 'i':
+  case 'o':
+  case 'u':
+  case 'x':
+  case 'X':
+    if (r->type[i] == ALOG_T_INT)
+      return snprintf(p, size, spec, (long long)r->arg[i].i);
+    if (r->type[i] == ALOG_T_UINT)
+      return snprintf(p, size, spec, (unsigned long long)r->arg[i].u);
+    break;
+  case 'c':
+    if (r->type[i] == ALOG_T_INT)
+      return snprintf(p, size, spec, (int)r->arg[i].i);
+    if (r->type[i] == ALOG_T_UINT)
+      return snprintf(p, size, spec, (int)r->arg[i].u);
+    break;
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    if (r->type[i] == ALOG_T_DOUBLE)
+      return snprintf(p, size, spec, r->arg[i].d);
+    break;
+  case 's':
+    if (r->type[i] == ALOG_T_STR)
+      return snprintf(p, size, spec, &r->str[r->arg[i].s]);
+    break;
+  case 'p':
+    if (r->type[i] == ALOG_T_PTR)
+      return snprintf(p, size, spec, r->arg[i].p);
+    break;
+  }
+  return snprintf(p, size, "<?>");
+}
+
+/* format record to line, return length */
+static size_t
+format_rec(char *line, size_t size, const struct alog_rec *r)
+{
+  const char *f = r->fmt;
+  char spec[32];
+  size_t len;
+  size_t sl;
+  unsigned i = 0u;
+  int n;
+
+  n = snprintf(line, size, "%s: [%s] ",
+               r->level < sizeof(level_names) / sizeof(*level_names) ?
+               level_names[r->level] : "?", r->module);
+  len = n > 0 ? (size_t)n : 0u;
+
+  while (*f && len < size - 2u) {
+    if (*f != '%') {
+      line[len++] = *f++;
+      continue;
+    }
+    if (f[1] == '%') {
+      line[len++] = '%';
+      f += 2;
+      continue;
+    }
+
+    /* flags, width and precision are kept, length modifier replaced */
+    sl = 0u;
+    spec[sl++] = *f++;
+    while (*f && strchr("-+ #0123456789.", *f) && sl < sizeof(spec) - 4u)
+      spec[sl++] = *f++;
+    while (*f && strchr("hlLqjzt", *f))
+      f++;
+    if (!*f)
+      break;
+    if (strchr("diouxX", *f)) {
+      spec[sl++] = 'l';
+      spec[sl++] = 'l';
+    }
+    spec[sl++] = *f;
+    spec[sl] = '\0';
+
+    n = format_arg(line + len, size - 1u - len, spec, *f++, r, i++);
+    if (n > 0)
+      len += (size_t)n < size - 1u - len ? (size_t)n : size - 2u - len;
+  }
+
+  line[len++] = '\n';
+  line[len] = '\0';
+  return len;
+}
+
+static void
+out_flush(void)
+{
+  size_t done = 0u;
+  ssize_t r;
+
+  while (done < out_len) {
+    r = write(STDERR_FILENO, out + done, out_len - done);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+    done += (size_t)r;
+  }
+  out_len = 0u;
+}
+
+static void
+out_line(const char *line, size_t len)
+{
+  if (out_len + len > sizeof(out))
+    out_flush();
+  memcpy(out + out_len, line, len);
+  out_len += len;
+}
+
+void
+alog_commit(struct alog_rec *r)
+{
+  char line[ALOG_LINE_SIZE];
+  size_t len;
+
+  if (r == &scratch) {
+    len = format_rec(line, sizeof(line), r);
+    fwrite(line, 1, len, stderr);
+    return;
+  }
+  atomic_store_explicit(&self->head,
+                        atomic_load_explicit(&self->head,
+                                             memory_order_relaxed) + 1u,
+                        memory_order_release);
+}
+
+/* format oldest records of all rings, return count */
+static size_t
+drain(void)
+{
+  char line[ALOG_LINE_SIZE];
+  struct alog_ring *r;
+  struct alog_ring *oldest;
+  struct alog_rec *oldest_rec = NULL;
+  struct alog_rec *rec;
+  unsigned long dropped;
+  size_t count = 0u;
+  size_t tail;
+  size_t len;
+
+  for (;;) {
+    oldest = NULL;
+    for (r = atomic_load(&rings); r; r = r->next) {
+      tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+      if (tail == atomic_load_explicit(&r->head, memory_order_acquire))
+        continue;
+      rec = &r->rec[tail & (ALOG_RING_SIZE - 1u)];
+      if (!oldest || rec->ts < oldest_rec->ts) {
+        oldest = r;
+        oldest_rec = rec;
+      }
+    }
+    if (!oldest)
+      break;
+
+    len = format_rec(line, sizeof(line), oldest_rec);
+    tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+    atomic_store_explicit(&oldest->tail, tail + 1u, memory_order_release);
+    out_line(line, len);
+    count++;
+  }
+
+  for (r = atomic_load(&rings); r; r = r->next) {
+    dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    if (dropped != r->dropped_reported) {
+      len = (size_t)snprintf(line, sizeof(line),
+                             "WARN: [log] %lu records dropped\n",
+                             dropped - r->dropped_reported);
+      out_line(line, len);
+      r->dropped_reported = dropped;
+    }
+  }
+
+  out_flush();
+  return count;
+}
+
+static void *
+alog_thread(void *arg)
+{
+  struct timespec idle = {.tv_sec = 0, .tv_nsec = ALOG_IDLE_NS};
+
+  while (!atomic_load(&stopping)) {
+    if (!drain())
+      nanosleep(&idle, NULL);
+  }
+  drain();
+  return NULL;
+}
+
+bool
+alog_start(void)
+{
+  int r;
+
+  if (atomic_load(&running))
+    return true;
+  atomic_store(&stopping, false);
+  atomic_store(&running, true);
+  if ((r = pthread_create(&thread, NULL, alog_thread, NULL)) != 0) {
+    atomic_store(&running, false);
+    fprintf(stderr, "ERROR: log thread not started: %s\n", strerror(r));
+    return false;
+  }
+  return true;
+}
+
+void
+alog_stop(void)
+{
+  if (!atomic_load(&running))
+    return;
+  /* new records go to stderr directly */
+  atomic_store(&running, false);
+  atomic_store(&stopping, true);
+  pthread_join(thread, NULL);
+}
@@ -0,0 +1,197 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/alog.h
+ */
+#ifndef _ALOG_1561712284_H_
+#define _ALOG_1561712284_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * asynchronous logging:
+ * caller stores format pointer and binary arguments to record
+ * in ring of own thread (single producer, single consumer, no locks),
+ * background thread merges rings by time and formats to stderr.
+ *
+ * module and format must be string literals: only pointers are stored.
+ * string arguments are copied (truncated to ALOG_STR_SIZE in sum).
+ * when ring is full record is dropped and counted.
+ * without alog_start() records are formatted in place (synchronous).
+ *
+ * ALOG_LEVEL: records above this level are not compiled
+ * alog_level: records above this level are skipped at runtime
+ */
+enum alog_level {
+  ALOG_ERROR = 0,
+  ALOG_WARN,
+  ALOG_INFO,
+  ALOG_DEBUG,
+  ALOG_TRACE
+};
+
+#ifndef ALOG_LEVEL
+# define ALOG_LEVEL ALOG_TRACE
+#endif
+
+#define ALOG_ARGS_MAX 12
+#define ALOG_STR_SIZE 128
+/* records in ring of each thread, power of 2 */
+#define ALOG_RING_SIZE 1024
+
+enum alog_type {
+  ALOG_T_INT = 0,
+  ALOG_T_UINT,
+  ALOG_T_DOUBLE,
+  ALOG_T_PTR,
+  ALOG_T_STR
+};
+
+struct alog_rec {
+  /* CLOCK_MONOTONIC, ns */
+  uint64_t ts;
+  const char *module;
+  const char *fmt;
+  uint8_t level;
+  uint8_t nargs;
+  uint16_t str_used;
+  uint8_t type[ALOG_ARGS_MAX];
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void *p;
+    /* offset in str */
+    uint16_t s;
+  } arg[ALOG_ARGS_MAX];
+  char str[ALOG_STR_SIZE];
+};
+
+extern int alog_level;
+
+/* start formatting thread */
+bool
+alog_start(void);
+
+/* format all pending records and stop thread */
+void
+alog_stop(void);
+
+/* reserve record in ring of current thread, NULL when ring is full */
+struct alog_rec *
+alog_begin(enum alog_level level, const char *module, const char *fmt);
+
+/* publish record to formatting thread */
+void
+alog_commit(struct alog_rec *r);
+
+static inline void
+alog_arg_int(struct alog_rec *r, int64_t v)
+{
+  if (r->nargs < ALOG_ARGS_MAX) {
+    r->type[r->nargs] = ALOG_T_INT;
+    r->arg[r->nargs++].i = v;
+  }
+}
+
+static inline void
+alog_arg_uint(struct alog_rec *r, uint64_t v)
+{
+  if (r->nargs < ALOG_ARGS_MAX) {
+    r->type[r->nargs] = ALOG_T_UINT;
+    r->arg[r->nargs++].u = v;
+  }
+}
+
+static inline void
+alog_arg_double(struct alog_rec *r, double v)
+{
+  if (r->nargs < ALOG_ARGS_MAX) {
+    r->type[r->nargs] = ALOG_T_DOUBLE;
+    r->arg[r->nargs++].d = v;
+  }
+}
+
+static inline void
+alog_arg_ptr(struct alog_rec *r, const void *v)
+{
+  if (r->nargs < ALOG_ARGS_MAX) {
+    r->type[r->nargs] = ALOG_T_PTR;
+    r->arg[r->nargs++].p = v;
+  }
+}
+
+static inline void
+alog_arg_str(struct alog_rec *r, const char *v)
+{
+  uint16_t off = r->str_used;
+
+  if (r->nargs >= ALOG_ARGS_MAX)
+    return;
+  if (!v)
+    v = "(null)";
+  while (*v && r->str_used < ALOG_STR_SIZE - 1u)
+    r->str[r->str_used++] = *v++;
+  if (r->str_used < ALOG_STR_SIZE)
+    r->str[r->str_used++] = '\0';
+  else
+    r->str[ALOG_STR_SIZE - 1u] = '\0';
+  r->type[r->nargs] = ALOG_T_STR;
+  r->arg[r->nargs++].s = off < ALOG_STR_SIZE ? off : ALOG_STR_SIZE - 1u;
+}
+
+#define ALOG_ARG(_r, _a)                                    \
+  _Generic((_a),                                            \
+           _Bool: alog_arg_uint,                            \
+           char: alog_arg_int,                              \
+           signed char: alog_arg_int,                       \
+           short: alog_arg_int,                             \
+           int: alog_arg_int,                               \
+           long: alog_arg_int,                              \
+           long long: alog_arg_int,                         \
+           unsigned char: alog_arg_uint,                    \
+           unsigned short: alog_arg_uint,                   \
+           unsigned: alog_arg_uint,                         \
+           unsigned long: alog_arg_uint,                    \
+           unsigned long long: alog_arg_uint,               \
+           float: alog_arg_double,                          \
+           double: alog_arg_double,                         \
+           char *: alog_arg_str,                            \
+           const char *: alog_arg_str,                      \
+           default: alog_arg_ptr)((_r), (_a))
+
+/* store arguments after format */
+#define ALOG_P0(_r, _f) ((void)0)
+#define ALOG_P1(_r, _f, _a) ALOG_ARG(_r, _a)
+#define ALOG_P2(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P1(_r, _f, __VA_ARGS__)
+#define ALOG_P3(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P2(_r, _f, __VA_ARGS__)
+#define ALOG_P4(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P3(_r, _f, __VA_ARGS__)
+#define ALOG_P5(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P4(_r, _f, __VA_ARGS__)
+#define ALOG_P6(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P5(_r, _f, __VA_ARGS__)
+#define ALOG_P7(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P6(_r, _f, __VA_ARGS__)
+#define ALOG_P8(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P7(_r, _f, __VA_ARGS__)
+#define ALOG_P9(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P8(_r, _f, __VA_ARGS__)
+#define ALOG_P10(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P9(_r, _f, __VA_ARGS__)
+#define ALOG_P11(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P10(_r, _f, __VA_ARGS__)
+#define ALOG_P12(_r, _f, _a, ...) ALOG_ARG(_r, _a); ALOG_P11(_r, _f, __VA_ARGS__)
+
+#define ALOG_SEL(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, \
+                 _n, ...) _n
+#define ALOG_FIRST(...) ALOG_FIRST_(__VA_ARGS__, 0)
+#define ALOG_FIRST_(_f, ...) _f
+
+/* alog(level, module, format, args...) */
+#define alog(_level, _module, ...)                                         \
+  do {                                                                     \
+    if ((_level) <= ALOG_LEVEL && (_level) <= alog_level) {                \
+      struct alog_rec *_alog_r =                                           \
+        alog_begin((_level), (_module), ALOG_FIRST(__VA_ARGS__));          \
+      if (_alog_r) {                                                       \
+        ALOG_SEL(__VA_ARGS__, ALOG_P12, ALOG_P11, ALOG_P10, ALOG_P9,       \
+                 ALOG_P8, ALOG_P7, ALOG_P6, ALOG_P5, ALOG_P4, ALOG_P3,     \
+                 ALOG_P2, ALOG_P1, ALOG_P0, 0)(_alog_r, __VA_ARGS__);      \
+        alog_commit(_alog_r);                                              \
+      }                                                                    \
+    }                                                                      \
+  } while (0)
+
+#endif /* _ALOG_1561712284_H_ */
@@ -0,0 +1,287 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/avi.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/uio.h>
+
+#include "avi.h"
+
+/* AVI 1.0 readers use signed 32-bit offsets */
+#define AVI_SIZE_LIMIT 0x7fffffffu
+/* hdrl list with one stream */
+#define AVI_HDRL_SIZE 200u
+/* RIFF header + hdrl list + movi list header */
+#define AVI_HEADER_SIZE (12u + AVI_HDRL_SIZE + 12u)
+#define AVI_CHUNK_SIZE 8u
+#define AVI_IDX1_ENTRY 16u
+/* idx1 entries per write */
+#define AVI_IDX1_BLK 256u
+
+#define AVIF_HASINDEX 0x10u
+#define AVIIF_KEYFRAME 0x10u
+
+static uint8_t *
+put_le16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  return p + 2;
+}
+
+static uint8_t *
+put_le32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+  return p + 4;
+}
+
+static uint8_t *
+put_fourcc(uint8_t *p, const char *fourcc)
+{
+  memcpy(p, fourcc, 4);
+  return p + 4;
+}
+
+static bool
+avi_writev(int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t r;
+
+  while (iovcnt) {
+    r = writev(fd, iov, iovcnt);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0) {
+      fprintf(stderr, "ERROR: write failure %s\n", strerror(errno));
+      return false;
+    }
+    while (iovcnt && (size_t)r >= iov->iov_len) {
+      r -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt) {
+      iov->iov_base = (uint8_t *)iov->iov_base + r;
+      iov->iov_len -= r;
+    }
+  }
+  return true;
+}
+
+static bool
+avi_write(int fd, const void *p, size_t size)
+{
+  struct iovec iov = {.iov_base = (void *)p, .iov_len = size};
+  return avi_writev(fd, &iov, 1);
+}
+
+bool
+avi_plan_frame(struct avi_mux *am, uint32_t size)
+{
+  uint32_t *sizes;
+  size_t alloc;
+
+  if (am->count == am->alloc) {
+    alloc = am->alloc ? am->alloc * 2 : 1024u;
+    sizes = realloc(am->sizes, alloc * sizeof(*sizes));
+    if (!sizes) {
+      fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+              alloc * sizeof(*sizes), strerror(errno));
+      return false;
+    }
+    am->sizes = sizes;
+    am->alloc = alloc;
+  }
+
+  am->sizes[am->count++] = size;
+  /* chunk data padded to even size */
+  am->movi_size += AVI_CHUNK_SIZE + size + (size & 1u);
+  if (size > am->max_frame)
+    am->max_frame = size;
+  return true;
+}
+
+bool
+avi_write_header(struct avi_mux *am, int fd)
+{
+  uint8_t hdr[AVI_HEADER_SIZE];
+  uint8_t *p = hdr;
+  uint64_t riff_size;
+  uint32_t usec_per_frame;
+
+  riff_size = 4u + AVI_HDRL_SIZE + 12u + am->movi_size +
+              AVI_CHUNK_SIZE + (uint64_t)am->count * AVI_IDX1_ENTRY;
+  if (riff_size > AVI_SIZE_LIMIT) {
+    fprintf(stderr, "ERROR: AVI size limit exceeded: %"PRIu64" bytes "
+            "in %zu frames, use shorter range\n", riff_size, am->count);
+    return false;
+  }
+
+  if (!am->rate || !am->scale) {
+    am->rate = 1u;
+    am->scale = 1u;
+  }
+  usec_per_frame = (uint32_t)((uint64_t)am->scale * 1000000u / am->rate);
+
+  fprintf(stderr, "INFO: AVI %ux%u, %"PRIu32"/%"PRIu32" fps, %zu frames, "
+          "%"PRIu64" bytes\n",
+          am->width, am->height, am->rate, am->scale, am->count,
+          riff_size + 8u);
+
+  p = put_fourcc(p, "RIFF");
+  p = put_le32(p, (uint32_t)riff_size);
+  p = put_fourcc(p, "AVI ");
+
+  p = put_fourcc(p, "LIST");
+  p = put_le32(p, AVI_HDRL_SIZE - 8u);
+  p = put_fourcc(p, "hdrl");
+
+  /* MainAVIHeader */
+  p = put_fourcc(p, "avih");
+  p = put_le32(p, 56u);
+  p = put_le32(p, usec_per_frame);
+  p = put_le32(p, (uint32_t)((uint64_t)am->max_frame * am->rate / am->scale));
+  p = put_le32(p, 0u);
+  p = put_le32(p, AVIF_HASINDEX);
+  p = put_le32(p, (uint32_t)am->count);
+  p = put_le32(p, 0u);
+  p = put_le32(p, 1u);
+  p = put_le32(p, am->max_frame + AVI_CHUNK_SIZE);
+  p = put_le32(p, am->width);
+  p = put_le32(p, am->height);
+  memset(p, 0, 16);
+  p += 16;
+
+  p = put_fourcc(p, "LIST");
+  p = put_le32(p, 4u + AVI_CHUNK_SIZE + 56u + AVI_CHUNK_SIZE + 40u);
+  p = put_fourcc(p, "strl");
+
+  /* AVIStreamHeader */
+  p = put_fourcc(p, "strh");
+  p = put_le32(p, 56u);
+  p = put_fourcc(p, "vids");
+  p = put_fourcc(p, "MJPG");
+  p = put_le32(p, 0u);
+  p = put_le16(p, 0u);
+  p = put_le16(p, 0u);
+  p = put_le32(p, 0u);
+  p = put_le32(p, am->scale);
+  p = put_le32(p, am->rate);
+  p = put_le32(p, 0u);
+  p = put_le32(p, (uint32_t)am->count);
+  p = put_le32(p, am->max_frame + AVI_CHUNK_SIZE);
+  p = put_le32(p, UINT32_MAX);
+  p = put_le32(p, 0u);
+  p = put_le16(p, 0u);
+  p = put_le16(p, 0u);
+  p = put_le16(p, (uint16_t)am->width);
+  p = put_le16(p, (uint16_t)am->height);
+
+  /* BITMAPINFOHEADER */
+  p = put_fourcc(p, "strf");
+  p = put_le32(p, 40u);
+  p = put_le32(p, 40u);
+  p = put_le32(p, am->width);
+  p = put_le32(p, am->height);
+  p = put_le16(p, 1u);
+  p = put_le16(p, 24u);
+  p = put_fourcc(p, "MJPG");
+  p = put_le32(p, am->width * am->height * 3u);
+  memset(p, 0, 16);
+  p += 16;
+
+  p = put_fourcc(p, "LIST");
+  p = put_le32(p, (uint32_t)(4u + am->movi_size));
+  p = put_fourcc(p, "movi");
+
+  am->written = 0u;
+  return avi_write(fd, hdr, (size_t)(p - hdr));
+}
+
+bool
+avi_write_frame(struct avi_mux *am, int fd, const uint8_t *p, size_t size)
+{
+  uint8_t chunk[AVI_CHUNK_SIZE];
+  uint8_t pad = 0u;
+  struct iovec iov[3];
+
+  if (am->written == am->count || am->sizes[am->written] != size) {
+    fprintf(stderr, "ERROR: AVI frame #%zu not planned: size %zu\n",
+            am->written, size);
+    return false;
+  }
+
+  put_le32(put_fourcc(chunk, "00dc"), (uint32_t)size);
+  iov[0].iov_base = chunk;
+  iov[0].iov_len = sizeof(chunk);
+  iov[1].iov_base = (void *)p;
+  iov[1].iov_len = size;
+  iov[2].iov_base = &pad;
+  iov[2].iov_len = size & 1u;
+
+  am->written++;
+  return avi_writev(fd, iov, 3);
+}
+
+bool
+avi_write_index(struct avi_mux *am, int fd)
+{
+  uint8_t blk[AVI_IDX1_BLK * AVI_IDX1_ENTRY];
+  uint8_t *p;
+  /* offsets from 'movi' fourcc */
+  uint32_t offset = 4u;
+  size_t i;
+
+  if (am->written != am->count) {
+    fprintf(stderr, "ERROR: AVI frames written %zu of %zu\n",
+            am->written, am->count);
+    return false;
+  }
+
+  p = put_fourcc(blk, "idx1");
+  p = put_le32(p, (uint32_t)(am->count * AVI_IDX1_ENTRY));
+  if (!avi_write(fd, blk, AVI_CHUNK_SIZE))
+    return false;
+
+  p = blk;
+  for (i = 0u; i < am->count; i++) {
+    p = put_fourcc(p, "00dc");
+    p = put_le32(p, AVIIF_KEYFRAME);
+    p = put_le32(p, offset);
+    p = put_le32(p, am->sizes[i]);
+    offset += AVI_CHUNK_SIZE + am->sizes[i] + (am->sizes[i] & 1u);
+    if (p == blk + sizeof(blk)) {
+      if (!avi_write(fd, blk, sizeof(blk)))
+        return false;
+      p = blk;
+    }
+  }
+
+  return avi_write(fd, blk, (size_t)(p - blk));
+}
+
+void
+avi_reset(struct avi_mux *am)
+{
+  am->count = 0u;
+  am->movi_size = 0u;
+  am->max_frame = 0u;
+  am->written = 0u;
+}
+
+void
+avi_free(struct avi_mux *am)
+{
+  free(am->sizes);
+  am->sizes = NULL;
+  am->alloc = 0u;
+  avi_reset(am);
+}
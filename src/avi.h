@@ -0,0 +1,62 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/avi.h
+ */
+#ifndef _AVI_1560525147_H_
+#define _AVI_1560525147_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * MJPEG in AVI 1.0 with idx1 index
+ *
+ * frames are planned first (sizes from frame index),
+ * so header and index written without seek on output:
+ *   avi_plan_frame() for each frame
+ *   avi_write_header()
+ *   avi_write_frame() for each planned frame
+ *   avi_write_index()
+ */
+struct avi_mux {
+  unsigned width;
+  unsigned height;
+  /* frame rate is rate / scale */
+  uint32_t rate;
+  uint32_t scale;
+
+  /* planned frame sizes */
+  uint32_t *sizes;
+  size_t count;
+  size_t alloc;
+  /* size of 'movi' list data */
+  uint64_t movi_size;
+  uint32_t max_frame;
+
+  /* frames written after header */
+  size_t written;
+};
+
+bool
+avi_plan_frame(struct avi_mux *am, uint32_t size);
+
+/* return false when output too large for AVI 1.0 or write failed */
+bool
+avi_write_header(struct avi_mux *am, int fd);
+
+/* frame size must be same as planned */
+bool
+avi_write_frame(struct avi_mux *am, int fd, const uint8_t *p, size_t size);
+
+/* write idx1, planned frames which was not written is error */
+bool
+avi_write_index(struct avi_mux *am, int fd);
+
+/* drop planned frames, keep allocated memory */
+void
+avi_reset(struct avi_mux *am);
+
+void
+avi_free(struct avi_mux *am);
+
+#endif /* _AVI_1560525147_H_ */
+
@@ -0,0 +1,916 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/bench_capture.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <ev.h>
+#include <pthread.h>
+
+#include "capture.h"
+#include "hist.h"
+#include "clock.h"
+#include "wth_fault.h"
+#include "alog.h"
+#include "trace.h"
+#include "rt.h"
+#include "mem.h"
+#include "adapt.h"
+#include "event.h"
+
+/*
+ * synthetic cameras drive capture_process() -> wth_write() -> files ring
+ * like camera_cb() does with frames from V4L2 device
+ */
+/* buffers of synthetic camera driver, as BUFFERS_SWAP_COUNT of capture */
+#define BENCH_BUFFERS 8u
+
+struct bench_camera {
+  struct devinfo dev;
+  struct wth_context wth;
+  ev_timer frame_timer;
+
+  unsigned no;
+  char dir[PATH_MAX];
+  int dirfd;
+  uint32_t rnd;
+  /* sensor schedule: frames due before wakeup are delivered as batch,
+   * as buffers queued in driver
+   */
+  uint64_t next_ns;
+  uint64_t period_ns;
+  /* frames lost because all buffers were filled */
+  uint64_t overruns;
+
+  uint64_t frames;
+  uint64_t bytes;
+  /* written by write thread before stop */
+  uint64_t written;
+  /* enqueue to write() return, all records of camera */
+  struct hist lat;
+  struct wth_fault fault;
+
+  /* adaptive quality, levels 0 when disabled */
+  struct adapt adapt;
+  ev_timer adapt_timer;
+  /* resolution divisor of level */
+  unsigned scale;
+  /* decimated stream in camN/<dir> */
+  struct capture_lapse lapse;
+  /* triggered recording */
+  struct event event;
+  ev_io event_io;
+  /* sensor time of first frame, ns */
+  uint64_t start_ns;
+};
+
+struct bench_options {
+  const char *dir;
+  unsigned cameras;
+  double fps;
+  /* mean frame size and +- jitter */
+  size_t frame_size;
+  unsigned jitter;
+  double seconds;
+  size_t size_limit;
+  size_t files_limit;
+  /* fault sink spec, NULL for plain files */
+  const char *fault;
+  /* timeline report interval, 0 = off */
+  double interval;
+  /* trace dump prefix, NULL = off */
+  const char *trace;
+  /* perf counters window in frames, 0 = off */
+  uint64_t pmu_window;
+  /* scheduling of write threads, NULL = default */
+  const struct rt_cfg *rt_writer;
+  /* enum mem_flags of write thread buffers */
+  unsigned mem_flags;
+  /* write thread flush deadline, ms, 0 = off */
+  uint64_t flush_age_ms;
+  /* overload policy spec, NULL = newest */
+  const char *overload;
+  /* adaptive quality, frame_size is size at quality_max */
+  const struct adapt_cfg *adapt;
+  /* decimated stream spec, NULL = off */
+  const char *lapse;
+  /* triggered recording, NULL = off, socket gets .<camera> suffix */
+  const struct event_cfg *event;
+  /* simulated motion: frames 3 times larger for motion_ns
+   * each motion_every_ns, 0 = off
+   */
+  uint64_t motion_every_ns;
+  uint64_t motion_ns;
+};
+
+struct bench_timeline {
+  ev_timer timer;
+  struct bench_camera *cams;
+  const struct bench_options *opt;
+  uint64_t start;
+  double startup;
+  uint64_t written_last;
+};
+
+static uint8_t *frame_data;
+
+/* run in write thread of camera */
+static void
+written_cb(struct wth_context *ctx, unsigned idx, size_t size,
+           const struct wth_times *t)
+{
+  struct bench_camera *cam = ctx->userdata;
+
+  hist_add(&cam->lat, t->written > t->enqueue ? t->written - t->enqueue : 0u);
+}
+
+/* relative JPEG size of quality: about 1 bit per pixel at 50,
+ * 1.5 at 75, 2.5 at 90 and 6 at 100
+ */
+static double
+jpeg_size_model(unsigned quality)
+{
+  return 12.0 / (112.0 - quality);
+}
+
+/* mean frame size for camera settings of adaptive quality */
+static size_t
+frame_size_mean(struct bench_camera *cam, const struct bench_options *opt)
+{
+  if (!cam->adapt.levels)
+    return opt->frame_size;
+  return (size_t)(opt->frame_size *
+                  jpeg_size_model(cam->dev.cam_info.quality) /
+                  jpeg_size_model(opt->adapt->quality_max) /
+                  (cam->scale * cam->scale));
+}
+
+static size_t
+frame_size_next(struct bench_camera *cam, const struct bench_options *opt)
+{
+  size_t mean = frame_size_mean(cam, opt);
+  size_t spread;
+
+  /* more detail in scene with motion: larger JPEG */
+  if (opt->motion_every_ns &&
+      (cam->next_ns - cam->start_ns) % opt->motion_every_ns < opt->motion_ns)
+    mean *= 3u;
+  spread = mean * opt->jitter / 100u;
+
+  /* xorshift32 */
+  cam->rnd ^= cam->rnd << 13;
+  cam->rnd ^= cam->rnd >> 17;
+  cam->rnd ^= cam->rnd << 5;
+
+  if (!spread)
+    return mean;
+  return mean - spread + cam->rnd % (spread * 2u + 1u);
+}
+
+/* simulated camera takes settings of level as V4L2 device would */
+static void
+adapt_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+  struct bench_camera *cam = (struct bench_camera *)
+    ((uint8_t *)w - offsetof(struct bench_camera, adapt_timer));
+  struct devinfo *dev = &cam->dev;
+  struct adapt_level l;
+
+  if (!adapt_update(&cam->adapt, now_ns(), cam->wth.occupied_percent,
+                    dev->c.bytes_queued, cam->wth.written, &l))
+    return;
+  dev->cam_info.quality = l.quality;
+  if (l.fps != dev->cam_info.frame_per_second) {
+    dev->cam_info.frame_per_second = l.fps;
+    cam->period_ns = 1000000000u / l.fps;
+  }
+  cam->scale = l.scale;
+  dev->frame_width = 1280u / l.scale;
+  dev->frame_height = 720u / l.scale;
+  capture_settings_changed(dev);
+}
+
+static void
+event_socket_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+  event_socket_read(w->data);
+}
+
+/* perf counters of main thread, all cameras */
+static struct pmu_group pmu;
+static struct pmu_stat pmu_capture;
+
+static void
+frame_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+  struct bench_camera *cam = (struct bench_camera *)
+    ((uint8_t *)w - offsetof(struct bench_camera, frame_timer));
+  const struct bench_options *opt = ev_userdata(loop);
+  struct devinfo *dev = &cam->dev;
+  struct v4l2_buffer buf[BENCH_BUFFERS];
+  uint64_t pmu_before[PMU_EVENTS];
+  uint64_t pmu_after[PMU_EVENTS];
+  uint64_t now = now_ns();
+  uint64_t skip;
+  size_t n = 0u;
+  size_t i;
+
+  if (pmu.mask)
+    pmu_read(&pmu, pmu_before);
+
+  /* drain due frames as capture does */
+  while (cam->next_ns <= now && n < BENCH_BUFFERS) {
+    buf[n] = (struct v4l2_buffer){
+      .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+      .memory = V4L2_MEMORY_USERPTR
+    };
+    buf[n].timestamp.tv_sec = cam->next_ns / 1000000000u;
+    buf[n].timestamp.tv_usec = cam->next_ns % 1000000000u / 1000u;
+    buf[n].flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    buf[n].sequence = (uint32_t)(dev->c.frames_arrived + n + cam->overruns);
+    buf[n].bytesused = (uint32_t)frame_size_next(cam, opt);
+    cam->next_ns += cam->period_ns;
+    n++;
+  }
+
+  wth_batch_begin(dev->trg.ctx);
+  capture_batch(dev, buf, n);
+  for (i = 0u; i < n; i++) {
+    dev->c.dqbuf_ns = now;
+    if (!dev->c.frames_arrived) {
+      struct timeval ttv = {0};
+
+      memcpy(&dev->c.first_frame_time, &buf[i].timestamp,
+             sizeof(struct timeval));
+      timersub(&dev->c.first_frame_time, &dev->c.start_time, &ttv);
+      timeradd(&dev->c.start_time_utc, &ttv, &dev->c.first_frame_time_utc);
+    }
+    memcpy(&dev->c.last_frame_time, &buf[i].timestamp,
+           sizeof(struct timeval));
+
+    dev->c.frames_arrived++;
+    trace_begin_arg("capture_process", cam->no);
+    capture_process(dev, &buf[i], frame_data);
+    trace_end("capture_process");
+
+    cam->frames++;
+    cam->bytes += buf[i].bytesused;
+  }
+  wth_batch_end(dev->trg.ctx);
+
+  if (cam->next_ns <= now) {
+    /* no free buffers in driver */
+    skip = (now - cam->next_ns) / cam->period_ns + 1u;
+    cam->overruns += skip;
+    cam->next_ns += skip * cam->period_ns;
+  }
+  if (n) {
+    dev->c.wakeups++;
+    if (n > dev->c.batch_max)
+      dev->c.batch_max = n;
+  }
+
+  if (pmu.mask && pmu_read(&pmu, pmu_after))
+    pmu_account(&pmu_capture, pmu_before, pmu_after, n);
+}
+
+static void
+stop_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+  ev_break(loop, EVBREAK_ALL);
+}
+
+static void
+sig_int_cb(struct ev_loop *loop, ev_signal *w, int revents)
+{
+  fprintf(stderr, "INFO: interrupted\n");
+  ev_break(loop, EVBREAK_ALL);
+}
+
+static uint64_t
+wth_pending(struct wth_context *ctx)
+{
+  uint64_t pending = 0u;
+  unsigned i;
+
+  for (i = 0u; i < WTH_MAX_FILES; i++) {
+    if (ctx->fd[i].acquired)
+      pending += atomic_load(&ctx->fd[i].pending_to_write);
+  }
+  return pending;
+}
+
+static bool
+camera_start(struct ev_loop *loop, struct bench_camera *cam,
+             const struct bench_options *opt)
+{
+  struct devinfo *dev = &cam->dev;
+  double interval = 1.0 / opt->fps;
+  struct timespec ts;
+
+  snprintf(cam->dir, sizeof(cam->dir), "%s/cam%u", opt->dir, cam->no);
+  if (mkdir(cam->dir, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "ERROR: mkdir('%s') failed: %s\n",
+            cam->dir, strerror(errno));
+    return false;
+  }
+  cam->dirfd = open(cam->dir, O_RDONLY | O_DIRECTORY);
+  if (cam->dirfd == -1) {
+    fprintf(stderr, "ERROR: open('%s') failed: %s\n",
+            cam->dir, strerror(errno));
+    return false;
+  }
+
+  if (!write_thread_start(&cam->wth, opt->mem_flags) ||
+      !wth_wait_ready(&cam->wth))
+    return false;
+  cam->wth.dirfd = cam->dirfd;
+  cam->wth.userdata = cam;
+  cam->wth.written_cb = written_cb;
+  cam->wth.pmu_window = opt->pmu_window;
+  cam->wth.rt = opt->rt_writer;
+  cam->wth.flush_age_ns = opt->flush_age_ms * 1000000u;
+  if (opt->fault) {
+    if (!wth_fault_parse(&cam->fault, opt->fault))
+      return false;
+    cam->fault.rnd += cam->no;
+    cam->wth.sink = &wth_fault_sink;
+    cam->wth.sink_data = &cam->fault;
+  }
+  cam->rnd = 2463534242u + cam->no;
+  hist_reset(&cam->lat);
+
+  dev->fd = -1;
+  dev->loop = loop;
+  snprintf(dev->path, sizeof(dev->path), "synthetic%u", cam->no);
+  dev->frame_width = 1280;
+  dev->frame_height = 720;
+  dev->cam_info.frame_per_second = (unsigned)opt->fps;
+  dev->trg.ctx = &cam->wth;
+  dev->trg.size_limit = opt->size_limit;
+  dev->trg.files_limit = opt->files_limit;
+  if (opt->overload && !capture_overload_parse(&dev->ovl, opt->overload))
+    return false;
+  if (opt->lapse &&
+      (!capture_lapse_parse(&cam->lapse, opt->lapse) ||
+       !capture_lapse_open(dev, &cam->lapse, cam->dirfd)))
+    return false;
+  if (opt->event) {
+    struct event_cfg cfg = *opt->event;
+
+    if (cfg.socket[0] &&
+        snprintf(cfg.socket, sizeof(cfg.socket), "%s.%u",
+                 opt->event->socket, cam->no) >= (int)sizeof(cfg.socket)) {
+      fprintf(stderr, "ERROR: event socket path too long\n");
+      return false;
+    }
+    if (!event_init(&cam->event, &cfg, opt->mem_flags))
+      return false;
+    dev->event = &cam->event;
+    if (cam->event.sock != -1) {
+      ev_io_init(&cam->event_io, event_socket_cb, cam->event.sock, EV_READ);
+      cam->event_io.data = &cam->event;
+      ev_io_start(loop, &cam->event_io);
+    }
+  }
+  cam->scale = 1u;
+  if (opt->adapt) {
+    adapt_init(&cam->adapt, opt->adapt, dev->cam_info.frame_per_second);
+    dev->cam_info.quality = opt->adapt->quality_max;
+    ev_timer_init(&cam->adapt_timer, adapt_timer_cb, 1.0, 1.0);
+    ev_timer_start(loop, &cam->adapt_timer);
+  }
+
+  memset(&dev->c, 0, sizeof(dev->c));
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  dev->c.start_time.tv_sec = ts.tv_sec;
+  dev->c.start_time.tv_usec = ts.tv_nsec / 1000;
+  gettimeofday(&dev->c.start_time_utc, NULL);
+
+  /* spread cameras over frame interval */
+  cam->period_ns = (uint64_t)(interval * 1e9);
+  cam->next_ns = now_ns() + cam->period_ns * cam->no / opt->cameras;
+  cam->start_ns = cam->next_ns;
+  ev_timer_init(&cam->frame_timer, frame_cb,
+                interval * cam->no / opt->cameras, interval);
+  ev_timer_start(loop, &cam->frame_timer);
+  return true;
+}
+
+/* close files, wait write thread, return drain time
+ * stage latency of camera added to stages
+ */
+static double
+camera_stop(struct ev_loop *loop, struct bench_camera *cam,
+            struct hist *stages)
+{
+  unsigned i;
+  struct devinfo *dev = &cam->dev;
+  uint64_t start = now_ns();
+
+  ev_timer_stop(loop, &cam->frame_timer);
+  ev_timer_stop(loop, &cam->adapt_timer);
+  ev_io_stop(loop, &cam->event_io);
+  capture_event_flush(dev, CAPTURE_FLUSH_TIMEOUT_MS);
+
+  while (wth_pending(&cam->wth)) {
+    ev_async_send(cam->wth.loop, &cam->wth.async_write);
+    usleep(1000);
+  }
+
+  capture_close(dev);
+  if (dev->event)
+    event_free(dev->event);
+  for (i = 0u; i < WTH_LAT_STAGES; i++)
+    hist_merge(&stages[i], &cam->wth.lat[i]);
+  write_thread_free(&cam->wth);
+  close(cam->dirfd);
+
+  return (now_ns() - start) / 1e9;
+}
+
+/* SIGHUP triggers recording of all cameras */
+static void
+sig_hup_cb(struct ev_loop *loop, ev_signal *w, int revents)
+{
+  const struct bench_options *opt = ev_userdata(loop);
+  struct bench_camera *cams = w->data;
+  unsigned i;
+
+  for (i = 0u; i < opt->cameras; i++) {
+    if (cams[i].dev.event)
+      event_trigger(cams[i].dev.event, "SIGHUP");
+  }
+}
+
+/* ring, drops and rotation over time, fields summed for all cameras */
+static void
+timeline_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+  struct bench_timeline *tl = (struct bench_timeline *)w;
+  struct bench_camera *cam;
+  unsigned ring = 0u;
+  uint64_t written = 0u;
+  uint64_t dropped = 0u;
+  uint64_t errors = 0u;
+  uint64_t stalls = 0u;
+  uint64_t segments = 0u;
+  unsigned level = 0u;
+  size_t i;
+
+  for (i = 0u; i < tl->opt->cameras; i++) {
+    cam = &tl->cams[i];
+    if (cam->adapt.level > level)
+      level = cam->adapt.level;
+    if (cam->wth.occupied_percent > ring)
+      ring = cam->wth.occupied_percent;
+    written += cam->wth.written;
+    dropped += cam->dev.c.frames_dropped;
+    errors += cam->wth.write_errors;
+    stalls += cam->fault.stalls;
+    segments += cam->dev.trg.file_idx;
+  }
+
+  printf("t = %7.2f s, ring = %3u%%, written = %8.2f MB/s, "
+         "dropped = %6"PRIu64", write errors = %6"PRIu64", "
+         "stalls = %4"PRIu64", segments = %4"PRIu64"\n",
+         (now_ns() - tl->start) / 1e9, ring,
+         (written - tl->written_last) / tl->opt->interval / 1e6,
+         dropped, errors, stalls, segments);
+  if (tl->opt->adapt)
+    printf("          adapt level max = %u\n", level);
+  tl->written_last = written;
+}
+
+static void
+print_result(const char *name, uint64_t frames, uint64_t dropped,
+             uint64_t offered, uint64_t written, unsigned ring_max,
+             double seconds, const struct hist *lat)
+{
+  printf("%-6s frames = %8"PRIu64", dropped = %6"PRIu64" (%5.2f%%), "
+         "offered = %8.2f MB/s, written = %8.2f MB/s, ring max = %3u%%\n",
+         name, frames, dropped,
+         frames ? dropped * 100.0 / frames : 0.0,
+         offered / seconds / 1e6, written / seconds / 1e6, ring_max);
+  printf("       enqueue-to-disk p50 = %.3f ms, p99 = %.3f ms, "
+         "p99.9 = %.3f ms, max = %.3f ms\n",
+         hist_permille(lat, 500u) / 1e6, hist_permille(lat, 990u) / 1e6,
+         hist_permille(lat, 999u) / 1e6, lat->max / 1e6);
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "capture pipeline benchmark with synthetic cameras\n");
+  fprintf(stderr, "usage: [-d <dir>] [-n <cameras>] [-f <fps>] "
+          "[-s <KB>] [-j <percent>] [-t <seconds>] [-l <MB>] [-L <files>]\n"
+          "       [-F <faults>] [-i <seconds>] [-T <trace prefix>]\n"
+          "       [-P <frames>] [-R capture|writer:<spec>] [-M] "
+          "[-H none|thp|hugetlb] [-A <ms>]\n"
+          "       [-O <policy>] [-Q <spec>] [-D <spec>] [-E <spec>] "
+          "[-m <s>:<s>]\n");
+  fprintf(stderr, "  -d  target directory, camN/ made for each camera, "
+          "default .\n");
+  fprintf(stderr, "  -n  cameras count, default 1\n");
+  fprintf(stderr, "  -f  frames per second for each camera, default 30\n");
+  fprintf(stderr, "  -s  mean frame size, default 200 KB\n");
+  fprintf(stderr, "  -j  frame size jitter, default 25%%\n");
+  fprintf(stderr, "  -t  duration, default 10 s\n");
+  fprintf(stderr, "  -l  segment size limit, default 128 MB\n");
+  fprintf(stderr, "  -L  files in ring, default 32\n");
+  fprintf(stderr, "  -F  write through fault sink: "
+          "latency=<us>,rate=<KB/s>,stall=<every ms>:<ms>,\n"
+          "      short=<%%>,enospc=<MB>\n");
+  fprintf(stderr, "  -i  print timeline each interval seconds, "
+          "default 1 with -F\n");
+  fprintf(stderr, "  -T  record timeline, dump to <prefix>.<n>.json "
+          "on frame drop and at end\n");
+  fprintf(stderr, "  -P  perf counters per frame, averaged over window "
+          "of frames\n");
+  fprintf(stderr, "  -R  scheduling of main or write threads, "
+          "spec as in capture\n");
+  fprintf(stderr, "  -M  lock process memory (mlockall)\n");
+  fprintf(stderr, "  -H  prefault and lock write buffers as capture does, "
+          "with huge pages mode\n");
+  fprintf(stderr, "  -A  flush deadline of write threads, default off\n");
+  fprintf(stderr, "  -O  overload policy, as in capture\n");
+  fprintf(stderr, "  -Q  adaptive quality, as in capture: -s is size "
+          "at best quality,\n"
+          "      simulated size follows JPEG quality, frame rate "
+          "and resolution\n");
+  fprintf(stderr, "  -D  decimated second stream, as in capture, "
+          "dir relative to camN/\n");
+  fprintf(stderr, "  -E  triggered recording, as in capture, SIGHUP "
+          "triggers all cameras,\n"
+          "      socket path gets .<camera> suffix\n");
+  fprintf(stderr, "  -m  simulated motion: 3 times larger frames for "
+          "second s each first s\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct ev_loop *loop = EV_DEFAULT;
+  struct bench_options opt = {
+    .dir = ".",
+    .cameras = 1u,
+    .fps = 30.0,
+    .frame_size = 200u * 1024u,
+    .jitter = 25u,
+    .seconds = 10.0,
+    .size_limit = 128u * 1024u * 1024u,
+    .files_limit = 32u,
+    .interval = -1.0
+  };
+  struct bench_timeline tl = {0};
+  struct bench_camera *cams;
+  struct hist *lat;
+  struct hist *stages;
+  ev_timer stop_timer;
+  ev_signal sigint;
+  uint64_t start;
+  double startup;
+  uint64_t frames = 0u;
+  uint64_t dropped = 0u;
+  uint64_t offered = 0u;
+  uint64_t written = 0u;
+  uint64_t write_errors = 0u;
+  uint64_t short_writes = 0u;
+  uint64_t stalls = 0u;
+  uint64_t segments = 0u;
+  uint64_t flushes = 0u;
+  uint64_t flushes_deadline = 0u;
+  uint64_t drops[CAPTURE_DROPS] = {0};
+  uint64_t gap_markers = 0u;
+  uint64_t gap_markers_lost = 0u;
+  uint64_t wakeups = 0u;
+  struct rt_cfg rt_capture;
+  struct rt_cfg rt_writer;
+  struct adapt_cfg adapt_cfg;
+  struct event_cfg event_cfg;
+  ev_signal sighup;
+  char *end;
+  uint64_t triggers = 0u;
+  uint64_t events = 0u;
+  uint64_t discarded = 0u;
+  uint64_t steps_down = 0u;
+  uint64_t steps_up = 0u;
+  uint64_t lapse_frames = 0u;
+  uint64_t lapse_gap_markers = 0u;
+  uint64_t lapse_segments = 0u;
+  bool rt_capture_set = false;
+  bool mlock = false;
+  uint64_t overruns = 0u;
+  size_t batch_max = 0u;
+  unsigned ring_max = 0u;
+  double elapsed;
+  double drain = 0.0;
+  size_t i;
+  size_t j;
+  int o;
+
+  while ((o = getopt(argc, argv, "d:n:f:s:j:t:l:L:F:i:T:P:R:MH:A:O:Q:D:E:m:")) != -1) {
+    switch (o) {
+    case 'd':
+      opt.dir = optarg;
+      break;
+    case 'n':
+      opt.cameras = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'f':
+      opt.fps = strtod(optarg, NULL);
+      break;
+    case 's':
+      opt.frame_size = strtoull(optarg, NULL, 10) * 1024u;
+      break;
+    case 'j':
+      opt.jitter = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      opt.seconds = strtod(optarg, NULL);
+      break;
+    case 'l':
+      opt.size_limit = strtoull(optarg, NULL, 10) * 1024u * 1024u;
+      break;
+    case 'L':
+      opt.files_limit = strtoull(optarg, NULL, 10);
+      break;
+    case 'F':
+      opt.fault = optarg;
+      break;
+    case 'i':
+      opt.interval = strtod(optarg, NULL);
+      break;
+    case 'T':
+      opt.trace = optarg;
+      break;
+    case 'P':
+      opt.pmu_window = strtoull(optarg, NULL, 10);
+      break;
+    case 'R':
+      if (!strncmp(optarg, "capture:", 8)) {
+        if (!rt_parse(&rt_capture, optarg + 8))
+          return EXIT_FAILURE;
+        rt_capture_set = true;
+      } else if (!strncmp(optarg, "writer:", 7)) {
+        if (!rt_parse(&rt_writer, optarg + 7))
+          return EXIT_FAILURE;
+        opt.rt_writer = &rt_writer;
+      } else {
+        usage();
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'M':
+      mlock = true;
+      break;
+    case 'H':
+      opt.mem_flags = MEM_PREFAULT | MEM_LOCK;
+      if (!mem_parse_huge(optarg, &opt.mem_flags)) {
+        usage();
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'A':
+      opt.flush_age_ms = strtoull(optarg, NULL, 10);
+      break;
+    case 'O':
+      opt.overload = optarg;
+      break;
+    case 'Q':
+      if (!adapt_parse(&adapt_cfg, optarg))
+        return EXIT_FAILURE;
+      opt.adapt = &adapt_cfg;
+      break;
+    case 'D':
+      opt.lapse = optarg;
+      break;
+    case 'E':
+      if (!event_parse(&event_cfg, optarg))
+        return EXIT_FAILURE;
+      opt.event = &event_cfg;
+      break;
+    case 'm':
+      opt.motion_every_ns = (uint64_t)(strtod(optarg, &end) * 1e9);
+      if (*end != ':') {
+        usage();
+        return EXIT_FAILURE;
+      }
+      opt.motion_ns = (uint64_t)(strtod(end + 1, NULL) * 1e9);
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (opt.interval < 0.0)
+    opt.interval = opt.fault ? 1.0 : 0.0;
+
+  if (!opt.cameras || opt.fps <= 0.0 || opt.fps > 255.0 ||
+      !opt.frame_size || opt.jitter > 100u || opt.seconds <= 0.0) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  frame_data = malloc(opt.frame_size * 2u + 1u);
+  cams = calloc(opt.cameras, sizeof(*cams));
+  lat = malloc(sizeof(*lat));
+  stages = calloc(WTH_LAT_STAGES, sizeof(*stages));
+  if (!frame_data || !cams || !lat || !stages) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return EXIT_FAILURE;
+  }
+  /* incompressible payload with JPEG SOI */
+  for (i = 0u; i < opt.frame_size * 2u + 1u; i++)
+    frame_data[i] = (uint8_t)(i * 2654435761u >> 24);
+  frame_data[0] = 0xff;
+  frame_data[1] = 0xd8;
+  hist_reset(lat);
+
+  /* log records of write threads as in capture */
+  if (!alog_start())
+    return EXIT_FAILURE;
+
+  trace_thread("bench_capture");
+  if (opt.trace && !trace_start(opt.trace))
+    return EXIT_FAILURE;
+
+  if (mlock)
+    rt_mlockall();
+
+  if (opt.pmu_window) {
+    pmu_open(&pmu);
+    pmu_stat_init(&pmu_capture, &pmu, opt.pmu_window);
+  }
+
+  ev_set_userdata(loop, &opt);
+  start = now_ns();
+  for (i = 0u; i < opt.cameras; i++) {
+    cams[i].no = (unsigned)i;
+    if (!camera_start(loop, &cams[i], &opt))
+      return EXIT_FAILURE;
+  }
+  startup = (now_ns() - start) / 1e6;
+  /* timers below count from end of startup */
+  ev_now_update(loop);
+
+  /* after write threads start: not inherited by them */
+  if (rt_capture_set)
+    rt_apply("capture", &rt_capture);
+
+  ev_signal_init(&sigint, sig_int_cb, SIGINT);
+  ev_signal_start(loop, &sigint);
+  ev_signal_init(&sighup, sig_hup_cb, SIGHUP);
+  sighup.data = cams;
+  ev_signal_start(loop, &sighup);
+  ev_timer_init(&stop_timer, stop_cb, opt.seconds, 0.0);
+  ev_timer_start(loop, &stop_timer);
+
+  ev_now_update(loop);
+  start = now_ns();
+  if (opt.interval > 0.0) {
+    tl.cams = cams;
+    tl.opt = &opt;
+    tl.start = start;
+    ev_timer_init(&tl.timer, timeline_cb, opt.interval, opt.interval);
+    ev_timer_start(loop, &tl.timer);
+  }
+  ev_run(loop, 0);
+  elapsed = (now_ns() - start) / 1e9;
+  trace_dump();
+
+  /* written while capture running */
+  for (i = 0u; i < opt.cameras; i++)
+    cams[i].written = cams[i].wth.written;
+
+  for (i = 0u; i < opt.cameras; i++) {
+    double d = camera_stop(loop, &cams[i], stages);
+    if (d > drain)
+      drain = d;
+  }
+  alog_stop();
+  trace_stop();
+
+  printf("# %u cameras, %.1f fps, %zu KB +-%u%%, %.1f s, '%s'\n",
+         opt.cameras, opt.fps, opt.frame_size / 1024u, opt.jitter,
+         elapsed, opt.dir);
+  printf("# startup of write threads: %.3f ms\n", startup);
+  for (i = 0u; i < opt.cameras; i++) {
+    char name[16];
+
+    snprintf(name, sizeof(name), "cam%zu", i);
+    print_result(name, cams[i].frames, cams[i].dev.c.frames_dropped,
+                 cams[i].bytes, cams[i].written,
+                 cams[i].wth.occupied_percent_max, elapsed, &cams[i].lat);
+    frames += cams[i].frames;
+    dropped += cams[i].dev.c.frames_dropped;
+    offered += cams[i].bytes;
+    written += cams[i].written;
+    if (cams[i].wth.occupied_percent_max > ring_max)
+      ring_max = cams[i].wth.occupied_percent_max;
+    hist_merge(lat, &cams[i].lat);
+  }
+  print_result("total", frames, dropped, offered, written, ring_max,
+               elapsed, lat);
+  printf("       drain after stop = %.3f s\n", drain);
+  for (i = 0u; i < opt.cameras; i++) {
+    wakeups += cams[i].dev.c.wakeups;
+    overruns += cams[i].overruns;
+    if (cams[i].dev.c.batch_max > batch_max)
+      batch_max = cams[i].dev.c.batch_max;
+  }
+  printf("       wakeups = %"PRIu64" (%.2f frames each), batch max = %zu, "
+         "sensor overruns = %"PRIu64"\n",
+         wakeups, wakeups ? (double)frames / wakeups : 0.0, batch_max,
+         overruns);
+  for (i = 0u; i < opt.cameras; i++) {
+    write_errors += cams[i].wth.write_errors;
+    short_writes += cams[i].wth.short_writes;
+    stalls += cams[i].fault.stalls;
+    segments += cams[i].dev.trg.file_idx;
+    flushes += cams[i].wth.flushes;
+    flushes_deadline += cams[i].wth.flushes_deadline;
+    for (j = 0u; j < CAPTURE_DROPS; j++)
+      drops[j] += cams[i].dev.c.drops[j];
+    gap_markers += cams[i].dev.c.gap_markers;
+    gap_markers_lost += cams[i].dev.c.gap_markers_lost;
+  }
+  printf("       segments = %"PRIu64", write errors = %"PRIu64", "
+         "short writes = %"PRIu64", stalls = %"PRIu64"\n",
+         segments, write_errors, short_writes, stalls);
+  printf("       flushes = %"PRIu64", by age deadline = %"PRIu64"\n",
+         flushes, flushes_deadline);
+  printf("       drops: buffer full = %"PRIu64", oldest = %"PRIu64", "
+         "decimated = %"PRIu64", gap markers = %"PRIu64" (%"PRIu64" lost)\n",
+         drops[CAPTURE_DROP_FULL], drops[CAPTURE_DROP_OLDEST],
+         drops[CAPTURE_DROP_DECIMATE], gap_markers, gap_markers_lost);
+  if (opt.adapt) {
+    for (i = 0u; i < opt.cameras; i++) {
+      steps_down += cams[i].adapt.steps_down;
+      steps_up += cams[i].adapt.steps_up;
+    }
+    printf("       adapt: steps down = %"PRIu64", up = %"PRIu64"\n",
+           steps_down, steps_up);
+    for (i = 0u; i < opt.cameras; i++) {
+      printf("       cam%zu: level %u/%u, quality %u, fps %u, %zux%zu\n",
+             i, cams[i].adapt.level, cams[i].adapt.levels - 1u,
+             cams[i].dev.cam_info.quality,
+             cams[i].dev.cam_info.frame_per_second,
+             cams[i].dev.frame_width, cams[i].dev.frame_height);
+    }
+  }
+  if (opt.lapse) {
+    for (i = 0u; i < opt.cameras; i++) {
+      lapse_frames += cams[i].lapse.frames;
+      lapse_gap_markers += cams[i].lapse.gap_markers;
+      lapse_segments += cams[i].lapse.trg.file_idx;
+    }
+    printf("       lapse: frames = %"PRIu64", gap markers = %"PRIu64", "
+           "segments = %"PRIu64"\n",
+           lapse_frames, lapse_gap_markers, lapse_segments);
+  }
+  if (opt.event) {
+    for (i = 0u; i < opt.cameras; i++) {
+      triggers += cams[i].event.triggers;
+      events += cams[i].event.events;
+      discarded += cams[i].event.discarded;
+    }
+    printf("       event: triggers = %"PRIu64", events = %"PRIu64", "
+           "idle frames discarded = %"PRIu64"\n",
+           triggers, events, discarded);
+  }
+  printf("# frame latency of pipeline stages\n");
+  wth_lat_print(stages, stdout);
+  if (opt.pmu_window) {
+    printf("# perf counters per frame, last window\n");
+    pmu_print("capture", &pmu_capture, stdout);
+    for (i = 0u; i < opt.cameras; i++) {
+      char name[32];
+
+      snprintf(name, sizeof(name), "cam%zu write", i);
+      pmu_print(name, &cams[i].wth.pmu_stat, stdout);
+    }
+    pmu_close(&pmu);
+  }
+
+  ev_timer_stop(loop, &tl.timer);
+  ev_timer_stop(loop, &stop_timer);
+  ev_signal_stop(loop, &sigint);
+  ev_signal_stop(loop, &sighup);
+  free(stages);
+  free(lat);
+  free(cams);
+  free(frame_data);
+  return EXIT_SUCCESS;
+}
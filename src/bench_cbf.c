@@ -0,0 +1,319 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/bench_cbf.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <ev.h>
+
+#include "main.h"
+#include "circle_buffer.h"
+#include "hist.h"
+#include "clock.h"
+
+struct cbf_op_stats {
+  const char *name;
+  struct hist lat;
+  uint64_t bytes;
+};
+
+static const size_t record_sizes[] = {
+  /* index record */
+  sizeof(frame_index_t),
+  1024u,
+  64u * 1024u,
+  /* big MJPEG frame */
+  500u * 1024u
+};
+
+static const size_t ring_sizes[] = {
+  1u * 1024u * 1024u,
+  16u * 1024u * 1024u,
+  /* write thread buffer */
+  90u * 1024u * 1024u
+};
+
+/* producer rates for write thread path, MB/s, 0 = unlimited */
+static const unsigned producer_rates[] = {0u, 200u, 20u};
+
+static void
+lat_print(struct hist *h)
+{
+  printf("p50 = %7"PRIu64", p99 = %7"PRIu64", p99.9 = %8"PRIu64", "
+         "max = %9"PRIu64" ns",
+         hist_permille(h, 500u), hist_permille(h, 990u),
+         hist_permille(h, 999u), h->max);
+}
+
+static void
+op_print(struct cbf_op_stats *op)
+{
+  double ns = op->lat.count ? (double)op->lat.sum / op->lat.count : 0.0;
+
+  printf("  %-8s ns/op = %10.1f, %7.2f GB/s, ",
+         op->name, ns, ns > 0.0 ? op->bytes / (double)op->lat.sum : 0.0);
+  lat_print(&op->lat);
+  printf("\n");
+}
+
+/*
+ * steady producer/consumer on one ring:
+ * save record, get and discard oldest record
+ * wrap: ring size not multiple of record size, most records split by end
+ */
+static bool
+bench_cbf_ops(size_t ring_size, size_t record_size, bool wrap,
+              uint64_t budget)
+{
+  struct circle_buffer cbf;
+  struct cbf_op_stats op[3] = {
+    {.name = "save"},
+    {.name = "get"},
+    {.name = "discard"}
+  };
+  uint8_t *in;
+  uint8_t *out;
+  uint64_t t;
+  uint64_t i;
+  uint64_t ops;
+
+  if (wrap)
+    ring_size = record_size * 2u + record_size / 2u + 1u;
+
+  in = malloc(record_size);
+  out = malloc(record_size);
+  if (!in || !out || !cbf_init(&cbf, ring_size)) {
+    fprintf(stderr, "ERROR: allocate failed\n");
+    free(in);
+    free(out);
+    return false;
+  }
+  memset(in, 0xa5, record_size);
+
+  /* half filled ring */
+  while (cbf_free_space(&cbf) >= record_size &&
+         cbf_occupied_space(&cbf) + record_size <= ring_size / 2u) {
+    cbf_save(&cbf, in, record_size);
+  }
+
+  ops = budget / record_size;
+  if (ops < 1000u)
+    ops = 1000u;
+
+  for (i = 0u; i < ops; i++) {
+    t = now_ns();
+    cbf_save(&cbf, in, record_size);
+    hist_add(&op[0].lat, now_ns() - t);
+
+    t = now_ns();
+    cbf_get(&cbf, out, record_size);
+    hist_add(&op[1].lat, now_ns() - t);
+
+    t = now_ns();
+    cbf_discard(&cbf, record_size);
+    hist_add(&op[2].lat, now_ns() - t);
+  }
+
+  printf("ring = %9zu, record = %7zu%s, ops = %"PRIu64"\n",
+         ring_size, record_size, wrap ? " (wrap)" : "", ops);
+  for (i = 0u; i < 3u; i++) {
+    op[i].bytes = ops * record_size;
+    op_print(&op[i]);
+  }
+
+  cbf_destroy(&cbf);
+  free(in);
+  free(out);
+  return true;
+}
+
+static uint64_t
+wth_pending(struct wth_context *ctx)
+{
+  uint64_t pending = 0u;
+  unsigned i;
+
+  for (i = 0u; i < WTH_MAX_FILES; i++) {
+    if (ctx->fd[i].acquired)
+      pending += atomic_load(&ctx->fd[i].pending_to_write);
+  }
+  return pending;
+}
+
+/*
+ * producer thread calls wth_write() for `seconds`,
+ * write thread drains ring to output file
+ */
+static void
+bench_wth(struct wth_context *ctx, const char *path, size_t record_size,
+          unsigned rate_mb, double seconds)
+{
+  static struct hist lat;
+  char fpath[FH_PATH_SIZE + 1] = {0};
+  uint8_t *p;
+  uint64_t start;
+  uint64_t end;
+  uint64_t t;
+  uint64_t next;
+  uint64_t period_ns = 0u;
+  uint64_t written = 0u;
+  uint64_t dropped = 0u;
+  uint64_t drained;
+  unsigned load_max = 0u;
+  wth_fd fd;
+
+  p = malloc(record_size);
+  if (!p)
+    return;
+  memset(p, 0x5a, record_size);
+  hist_reset(&lat);
+  snprintf(fpath, sizeof(fpath), "%s", path);
+
+  if (rate_mb)
+    period_ns = (uint64_t)record_size * 1000u / rate_mb;
+
+  fd = wth_open(ctx, fpath);
+  if (fd == -1) {
+    free(p);
+    return;
+  }
+
+  start = now_ns();
+  end = start + (uint64_t)(seconds * 1e9);
+  next = start;
+  while ((t = now_ns()) < end) {
+    if (period_ns) {
+      if (t < next)
+        continue;
+      next += period_ns;
+    }
+
+    if (wth_write(ctx, fd, p, record_size))
+      written++;
+    else
+      dropped++;
+    hist_add(&lat, now_ns() - t);
+    if (ctx->occupied_percent > load_max)
+      load_max = ctx->occupied_percent;
+  }
+
+  /* wake write thread for tail below 10% threshold */
+  end = now_ns();
+  while (wth_pending(ctx)) {
+    ev_async_send(ctx->loop, &ctx->async_write);
+    usleep(100);
+  }
+  drained = now_ns() - end;
+  wth_close(ctx, fd);
+
+  printf("record = %7zu, rate = ", record_size);
+  if (rate_mb)
+    printf("%4u MB/s", rate_mb);
+  else
+    printf("  no limit");
+  printf(", written = %7.1f MB/s, dropped = %5.2f%%, ring max = %3u%%, "
+         "drain = %6.2f ms\n",
+         written * record_size / ((end - start) / 1e3),
+         written + dropped ? dropped * 100.0 / (written + dropped) : 0.0,
+         load_max, drained / 1e6);
+  printf("  wth_write ");
+  lat_print(&lat);
+  printf("\n");
+  free(p);
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "circle buffer and write thread throughput\n");
+  fprintf(stderr, "usage: [-b <MB per case>] [-t <seconds>] [-o <file>] "
+          "[-c] [-w]\n");
+  fprintf(stderr, "  -b  bytes passed through ring in each cbf case, "
+          "default 256 MB\n");
+  fprintf(stderr, "  -t  duration of each write thread case, default 1 s\n");
+  fprintf(stderr, "  -o  write thread output file, default /dev/null\n");
+  fprintf(stderr, "  -c  only cbf_* cases\n");
+  fprintf(stderr, "  -w  only write thread cases\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct wth_context ctx;
+  uint64_t budget = 256u * 1024u * 1024u;
+  double seconds = 1.0;
+  const char *path = "/dev/null";
+  bool cbf_cases = true;
+  bool wth_cases = true;
+  size_t i;
+  size_t j;
+  int opt;
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  while ((opt = getopt(argc, argv, "b:t:o:cw")) != -1) {
+    switch (opt) {
+    case 'b':
+      budget = strtoull(optarg, NULL, 10) * 1024u * 1024u;
+      break;
+    case 't':
+      seconds = strtod(optarg, NULL);
+      break;
+    case 'o':
+      path = optarg;
+      break;
+    case 'c':
+      wth_cases = false;
+      break;
+    case 'w':
+      cbf_cases = false;
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (strlen(path) > FH_PATH_SIZE) {
+    fprintf(stderr, "ERROR: output path longer than %u\n", FH_PATH_SIZE);
+    return EXIT_FAILURE;
+  }
+
+  if (cbf_cases) {
+    printf("# cbf_save/cbf_get/cbf_discard, %"PRIu64" MB per case\n",
+           budget / 1024u / 1024u);
+    for (i = 0u; i < sizeof(ring_sizes) / sizeof(*ring_sizes); i++) {
+      for (j = 0u; j < sizeof(record_sizes) / sizeof(*record_sizes); j++) {
+        if (record_sizes[j] * 2u > ring_sizes[i])
+          continue;
+        if (!bench_cbf_ops(ring_sizes[i], record_sizes[j], false, budget))
+          return EXIT_FAILURE;
+      }
+    }
+    for (j = 0u; j < sizeof(record_sizes) / sizeof(*record_sizes); j++) {
+      if (!bench_cbf_ops(0u, record_sizes[j], true, budget))
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (wth_cases) {
+    printf("# wth_write -> async_write_cb to '%s', %.1f s per case\n",
+           path, seconds);
+    if (!write_thread_alloc(&ctx))
+      return EXIT_FAILURE;
+    for (i = 0u; i < sizeof(producer_rates) / sizeof(*producer_rates); i++) {
+      for (j = 0u; j < sizeof(record_sizes) / sizeof(*record_sizes); j++)
+        bench_wth(&ctx, path, record_sizes[j], producer_rates[i], seconds);
+    }
+    write_thread_free(&ctx);
+  }
+
+  return EXIT_SUCCESS;
+}
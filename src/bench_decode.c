@@ -0,0 +1,205 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/bench_decode.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <jpeglib.h>
+
+#include "decode.h"
+
+#define BENCH_PATTERNS 8
+
+struct jpeg_frame {
+  unsigned char *p;
+  unsigned long size;
+};
+
+/* make frame with gradient and noise, like camera picture */
+static bool
+make_jpeg(struct jpeg_frame *jf, unsigned width, unsigned height,
+          unsigned seed)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  JSAMPROW row;
+  uint8_t *line;
+  unsigned x;
+  unsigned y;
+  uint32_t rnd = seed * 2654435761u + 1u;
+
+  line = malloc((size_t)width * 3);
+  if (!line)
+    return false;
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  jf->p = NULL;
+  jf->size = 0u;
+  jpeg_mem_dest(&cinfo, &jf->p, &jf->size);
+
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 85, TRUE);
+  /* 4:2:2 as usual for UVC cameras */
+  cinfo.comp_info[0].h_samp_factor = 2;
+  cinfo.comp_info[0].v_samp_factor = 1;
+  jpeg_start_compress(&cinfo, TRUE);
+
+  for (y = 0u; y < height; y++) {
+    for (x = 0u; x < width; x++) {
+      rnd = rnd * 1103515245u + 12345u;
+      line[x * 3] = (uint8_t)(x + seed * 8 + ((rnd >> 16) & 0x1f));
+      line[x * 3 + 1] = (uint8_t)(y + ((rnd >> 20) & 0x1f));
+      line[x * 3 + 2] = (uint8_t)((x ^ y) + ((rnd >> 24) & 0x1f));
+    }
+    row = line;
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  free(line);
+  return true;
+}
+
+static double
+time_diff(struct timespec *start, struct timespec *end)
+{
+  return (double)(end->tv_sec - start->tv_sec) +
+         (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "MJPEG decode throughput by worker count\n");
+  fprintf(stderr, "usage: [-w <width>] [-h <height>] [-n <frames>] "
+          "[-j <max workers>] [-S <scale>] [-o <file>]\n");
+  fprintf(stderr, "  -o  write synthetic MJPEG stream to file and exit\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct jpeg_frame jf[BENCH_PATTERNS];
+  struct decode_pool dp;
+  struct timespec start;
+  struct timespec end;
+  unsigned width = 1280u;
+  unsigned height = 720u;
+  unsigned frames = 600u;
+  unsigned max_workers = 0u;
+  unsigned scale = 1u;
+  unsigned workers;
+  unsigned i;
+  const char *mjpeg_path = NULL;
+  double base_fps = 0.0;
+  double elapsed;
+  size_t jpeg_bytes = 0u;
+  int null_fd;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "w:h:n:j:S:o:")) != -1) {
+    switch (opt) {
+    case 'w':
+      width = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'h':
+      height = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      frames = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'j':
+      max_workers = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'S':
+      scale = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'o':
+      mjpeg_path = optarg;
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!max_workers) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    max_workers = cpus > 0 ? (unsigned)cpus : 1u;
+  }
+
+  for (i = 0u; i < BENCH_PATTERNS; i++) {
+    if (!make_jpeg(&jf[i], width, height, i)) {
+      fprintf(stderr, "ERROR: frame not compressed\n");
+      return EXIT_FAILURE;
+    }
+    jpeg_bytes += jf[i].size;
+  }
+
+  if (mjpeg_path) {
+    FILE *f = fopen(mjpeg_path, "wb");
+    if (!f) {
+      perror("fopen");
+      return EXIT_FAILURE;
+    }
+    for (i = 0u; i < frames; i++)
+      fwrite(jf[i % BENCH_PATTERNS].p, 1, jf[i % BENCH_PATTERNS].size, f);
+    fclose(f);
+    return EXIT_SUCCESS;
+  }
+
+  null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd == -1) {
+    perror("open");
+    return EXIT_FAILURE;
+  }
+
+  printf("# %ux%u, scale 1/%u, %u frames, avg jpeg size %zu bytes\n",
+         width, height, scale, frames, jpeg_bytes / BENCH_PATTERNS);
+
+  for (workers = 1u; workers <= max_workers; workers *= 2) {
+    if (!dec_init(&dp, workers, scale, DEC_FORMAT_Y4M, null_fd))
+      return EXIT_FAILURE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0u; i < frames; i++) {
+      if (!dec_push(&dp, jf[i % BENCH_PATTERNS].p, jf[i % BENCH_PATTERNS].size))
+        break;
+    }
+    dec_flush(&dp);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = time_diff(&start, &end);
+    if (workers == 1u)
+      base_fps = frames / elapsed;
+
+    printf("workers = %2u, time = %7.3f s, fps = %8.1f, "
+           "input = %7.1f MB/s, speedup = %5.2f, failed = %"PRIu64"\n",
+           workers, elapsed, frames / elapsed,
+           (double)jpeg_bytes / BENCH_PATTERNS * frames / elapsed / 1e6,
+           frames / elapsed / base_fps, dp.failed);
+    dec_destroy(&dp);
+
+    if (workers < max_workers && workers * 2 > max_workers)
+      workers = max_workers / 2;
+  }
+
+  close(null_fd);
+  for (i = 0u; i < BENCH_PATTERNS; i++)
+    free(jf[i].p);
+  return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,714 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/bench_extract.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <ev.h>
+#include <pthread.h>
+
+#include "capture.h"
+#include "reader.h"
+#include "hist.h"
+#include "clock.h"
+
+#define READ_BLOCK_SIZE (1024u * 1024u)
+
+struct gen_options {
+  time_t utc;
+  double duration;
+  double fps;
+  /* clock drift of camera, parts per million */
+  double drift_ppm;
+  /* camera outage `gap_len` seconds each `gap_every` seconds */
+  double gap_every;
+  double gap_len;
+  size_t frame_size;
+  unsigned jitter;
+  size_t size_limit;
+  size_t files_limit;
+};
+
+struct bench_options {
+  unsigned seeks;
+  /* archive seconds read in each sustained run */
+  double read_seconds;
+  bool cold;
+  bool warm;
+  /* path to extract binary, NULL = reader library only */
+  const char *extract;
+};
+
+/* process counters */
+struct usage_sample {
+  uint64_t ns;
+  uint64_t syscr;
+  uint64_t syscw;
+  uint64_t read_bytes;
+  uint64_t minflt;
+  uint64_t majflt;
+};
+
+/* sums of counters for one case */
+struct usage_total {
+  uint64_t runs;
+  uint64_t bytes;
+  uint64_t syscalls;
+  uint64_t read_bytes;
+  uint64_t minflt;
+  uint64_t majflt;
+  struct hist ttfb;
+  double seconds;
+};
+
+/* read syscr, syscw and read_bytes from /proc/<pid>/io */
+static void
+proc_io(const char *path, struct usage_sample *us)
+{
+  char line[128];
+  unsigned long long v;
+  FILE *f;
+
+  f = fopen(path, "r");
+  if (!f)
+    return;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "syscr: %llu", &v) == 1)
+      us->syscr = v;
+    else if (sscanf(line, "syscw: %llu", &v) == 1)
+      us->syscw = v;
+    else if (sscanf(line, "read_bytes: %llu", &v) == 1)
+      us->read_bytes = v;
+  }
+  fclose(f);
+}
+
+static void
+usage_sample(struct usage_sample *us)
+{
+  struct rusage ru;
+
+  memset(us, 0, sizeof(*us));
+  proc_io("/proc/self/io", us);
+  getrusage(RUSAGE_SELF, &ru);
+  us->minflt = ru.ru_minflt;
+  us->majflt = ru.ru_majflt;
+  us->ns = now_ns();
+}
+
+/* syscalls of usage_sample() itself */
+static uint64_t usage_syscalls;
+
+static void
+usage_calibrate(void)
+{
+  struct usage_sample a;
+  struct usage_sample b;
+
+  usage_sample(&a);
+  usage_sample(&b);
+  usage_syscalls = (b.syscr - a.syscr) + (b.syscw - a.syscw);
+}
+
+static void
+usage_add(struct usage_total *ut, const struct usage_sample *a,
+          const struct usage_sample *b, bool self)
+{
+  uint64_t syscalls = (b->syscr - a->syscr) + (b->syscw - a->syscw);
+
+  if (self)
+    syscalls = syscalls > usage_syscalls ? syscalls - usage_syscalls : 0u;
+  ut->runs++;
+  ut->syscalls += syscalls;
+  ut->read_bytes += b->read_bytes - a->read_bytes;
+  ut->minflt += b->minflt - a->minflt;
+  ut->majflt += b->majflt - a->majflt;
+  ut->seconds += (b->ns - a->ns) / 1e9;
+}
+
+static void
+usage_print(const char *name, const struct usage_total *ut)
+{
+  double runs = ut->runs ? (double)ut->runs : 1.0;
+
+  printf("%-14s runs = %5"PRIu64", ", name, ut->runs);
+  if (ut->ttfb.count) {
+    printf("ttfb p50 = %8.3f ms, p99 = %8.3f ms, max = %8.3f ms, ",
+           hist_permille(&ut->ttfb, 500u) / 1e6,
+           hist_permille(&ut->ttfb, 990u) / 1e6, ut->ttfb.max / 1e6);
+  }
+  if (ut->bytes) {
+    printf("%8.2f MB/s, ", ut->seconds > 0.0 ?
+                           ut->bytes / ut->seconds / 1e6 : 0.0);
+  }
+  printf("per run: syscalls = %8.1f, majflt = %8.1f, minflt = %9.1f, "
+         "disk read = %8.2f MB\n",
+         ut->syscalls / runs, ut->majflt / runs, ut->minflt / runs,
+         ut->read_bytes / runs / 1e6);
+}
+
+/* drop archive files from page cache or read them to cache */
+static void
+cache_set(int dirfd, bool drop)
+{
+  static uint8_t blk[READ_BLOCK_SIZE];
+  struct dirent *de;
+  DIR *dir;
+  int fd;
+
+  fd = dup(dirfd);
+  if (fd == -1 || !(dir = fdopendir(fd))) {
+    fprintf(stderr, "ERROR: directory not opened: %s\n", strerror(errno));
+    return;
+  }
+  rewinddir(dir);
+  while ((de = readdir(dir)) != NULL) {
+    if (strncmp(de->d_name, FILE_IDX_PREFIX, sizeof(FILE_IDX_PREFIX) - 1) &&
+        strncmp(de->d_name, FILE_FRM_PREFIX, sizeof(FILE_FRM_PREFIX) - 1)) {
+      continue;
+    }
+    fd = openat(dirfd, de->d_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      continue;
+    if (drop) {
+      /* dirty pages are not dropped */
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    } else {
+      while (read(fd, blk, sizeof(blk)) > 0);
+    }
+    close(fd);
+  }
+  closedir(dir);
+}
+
+/* touch each cache line of frame, like output copy does */
+static uint64_t
+frame_touch(const uint8_t *p, size_t size)
+{
+  uint64_t sum = 0u;
+  size_t i;
+
+  for (i = 0u; i < size; i += 64u)
+    sum += p[i];
+  if (size)
+    sum += p[size - 1u];
+  return sum;
+}
+
+static uint32_t
+xorshift(uint32_t *rnd)
+{
+  *rnd ^= *rnd << 13;
+  *rnd ^= *rnd >> 17;
+  *rnd ^= *rnd << 5;
+  return *rnd;
+}
+
+static void
+random_utc(uint32_t *rnd, const struct timeval *start,
+           const struct timeval *end, double reserve, struct timeval *utc)
+{
+  double span = (end->tv_sec - start->tv_sec) +
+                (end->tv_usec - start->tv_usec) / 1e6 - reserve;
+  double off;
+
+  if (span < 0.0)
+    span = 0.0;
+  off = span * (xorshift(rnd) / 4294967296.0);
+  utc->tv_sec = start->tv_sec + (time_t)off;
+  utc->tv_usec = start->tv_usec;
+}
+
+/*
+ * archive generator: synthetic camera through capture_process()
+ * and write thread, so files are written by capture code itself
+ */
+static bool
+generate(const char *dirpath, const struct gen_options *opt)
+{
+  struct wth_context wth;
+  struct devinfo dev;
+  struct v4l2_buffer buf = {
+                            .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                            .memory = V4L2_MEMORY_USERPTR
+                           };
+  uint8_t *data;
+  size_t data_size = opt->frame_size * 2u + 1u;
+  size_t spread = opt->frame_size * opt->jitter / 100u;
+  uint64_t frames = (uint64_t)(opt->duration * opt->fps);
+  uint64_t bytes = 0u;
+  uint64_t start = now_ns();
+  uint32_t rnd = 2463534242u;
+  double period = (1.0 + opt->drift_ppm / 1e6) / opt->fps;
+  double t = 0.0;
+  double next_gap = opt->gap_every;
+  uint64_t i;
+  int dirfd;
+
+  if (mkdir(dirpath, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "ERROR: mkdir('%s') failed: %s\n",
+            dirpath, strerror(errno));
+    return false;
+  }
+  dirfd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  data = malloc(data_size);
+  if (dirfd == -1 || !data) {
+    fprintf(stderr, "ERROR: '%s' not opened: %s\n", dirpath, strerror(errno));
+    free(data);
+    return false;
+  }
+  for (i = 0u; i < data_size; i++)
+    data[i] = (uint8_t)(i * 2654435761u >> 24);
+  data[0] = 0xff;
+  data[1] = 0xd8;
+
+  if (!write_thread_alloc(&wth))
+    return false;
+  wth.dirfd = dirfd;
+
+  memset(&dev, 0, sizeof(dev));
+  dev.fd = -1;
+  dev.loop = EV_DEFAULT;
+  dev.frame_width = 1280;
+  dev.frame_height = 720;
+  dev.cam_info.frame_per_second = (unsigned)(opt->fps + 0.5);
+  dev.trg.ctx = &wth;
+  dev.trg.size_limit = opt->size_limit;
+  dev.trg.files_limit = opt->files_limit;
+  dev.c.start_time_utc.tv_sec = opt->utc;
+
+  for (i = 0u; i < frames; i++) {
+    if (opt->gap_len > 0.0 && t >= next_gap) {
+      t += opt->gap_len;
+      next_gap += opt->gap_every;
+    }
+    buf.timestamp.tv_sec = (time_t)t;
+    buf.timestamp.tv_usec = (suseconds_t)((t - (time_t)t) * 1e6);
+    buf.bytesused = (uint32_t)opt->frame_size;
+    if (spread)
+      buf.bytesused += xorshift(&rnd) % (spread * 2u + 1u) - spread;
+
+    if (!dev.c.frames_arrived) {
+      memcpy(&dev.c.first_frame_time, &buf.timestamp, sizeof(buf.timestamp));
+      timeradd(&dev.c.start_time_utc, &buf.timestamp,
+               &dev.c.first_frame_time_utc);
+    }
+    memcpy(&dev.c.last_frame_time, &buf.timestamp, sizeof(buf.timestamp));
+
+    /* backpressure instead of drops */
+    while (cbf_free_space(&wth.buffer) < buf.bytesused + READ_BLOCK_SIZE) {
+      ev_async_send(wth.loop, &wth.async_write);
+      usleep(1000);
+    }
+
+    dev.c.frames_arrived++;
+    capture_process(&dev, &buf, data);
+    if (dev.trg.frame.fd == -1 || dev.trg.index.fd == -1)
+      break;
+    bytes += buf.bytesused;
+    t += period;
+  }
+
+  while (cbf_occupied_space(&wth.buffer)) {
+    ev_async_send(wth.loop, &wth.async_write);
+    usleep(1000);
+  }
+  if (dev.trg.frame.fd > 0)
+    wth_close(&wth, dev.trg.frame.fd);
+  if (dev.trg.index.fd > 0)
+    wth_close(&wth, dev.trg.index.fd);
+  write_thread_free(&wth);
+  close(dirfd);
+  free(data);
+
+  printf("# generated '%s': %"PRIu64" frames, %.1f MB, %"PRIu32" segments, "
+         "%.1f s\n", dirpath, frames, bytes / 1e6, dev.trg.file_idx,
+         (now_ns() - start) / 1e9);
+  return i == frames && dev.c.frames_dropped == 0u;
+}
+
+/* read archive headers */
+static void
+bench_open(const char *dirpath, bool cold, struct usage_total *ut)
+{
+  struct rdr_archive ar;
+  struct usage_sample a;
+  struct usage_sample b;
+
+  if (cold) {
+    int dirfd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd != -1) {
+      cache_set(dirfd, true);
+      close(dirfd);
+    }
+  }
+  usage_sample(&a);
+  if (!rdr_open(&ar, dirpath, false))
+    return;
+  usage_sample(&b);
+  usage_add(ut, &a, &b, true);
+  hist_add(&ut->ttfb, b.ns - a.ns);
+  rdr_close(&ar);
+}
+
+/* random seek, time to first frame data */
+static void
+bench_seek(struct rdr_archive *ar, const struct timeval *start,
+           const struct timeval *end, uint32_t *rnd, bool cold,
+           struct usage_total *ut)
+{
+  struct rdr_cursor c;
+  struct rdr_frame f;
+  struct timeval utc;
+  struct usage_sample a;
+  struct usage_sample b;
+  volatile uint64_t sum;
+
+  random_utc(rnd, start, end, 1.0, &utc);
+  if (cold)
+    cache_set(ar->dirfd, true);
+
+  usage_sample(&a);
+  rdr_cursor_init(&c, ar);
+  if (rdr_seek(&c, &utc) && rdr_next(&c, &f)) {
+    sum = frame_touch(f.data, f.size);
+    (void)sum;
+  }
+  usage_sample(&b);
+  rdr_cursor_close(&c);
+
+  usage_add(ut, &a, &b, true);
+  hist_add(&ut->ttfb, b.ns - a.ns);
+}
+
+/* sequential read from random position */
+static void
+bench_read(struct rdr_archive *ar, const struct timeval *start,
+           const struct timeval *end, uint32_t *rnd, double seconds,
+           bool cold, struct usage_total *ut)
+{
+  struct rdr_cursor c;
+  struct rdr_frame f;
+  struct timeval utc;
+  struct timeval stop;
+  struct timeval span = {
+    .tv_sec = (time_t)seconds,
+    .tv_usec = (suseconds_t)((seconds - (time_t)seconds) * 1e6)
+  };
+  struct usage_sample a;
+  struct usage_sample b;
+  volatile uint64_t sum = 0u;
+  uint64_t first = 0u;
+
+  random_utc(rnd, start, end, seconds, &utc);
+  timeradd(&utc, &span, &stop);
+  if (cold)
+    cache_set(ar->dirfd, true);
+
+  usage_sample(&a);
+  rdr_cursor_init(&c, ar);
+  if (rdr_seek(&c, &utc)) {
+    while (rdr_next(&c, &f) && timercmp(&f.utc, &stop, <)) {
+      sum += frame_touch(f.data, f.size);
+      ut->bytes += f.size;
+      if (!first)
+        first = now_ns();
+    }
+  }
+  usage_sample(&b);
+  rdr_cursor_close(&c);
+
+  usage_add(ut, &a, &b, true);
+  if (first)
+    hist_add(&ut->ttfb, first - a.ns);
+}
+
+/* run extract binary on random range, count stdout bytes */
+static void
+bench_extract_run(const char *extract, const char *dirpath,
+                  const struct timeval *start, const struct timeval *end,
+                  uint32_t *rnd, double seconds, bool cold, int dirfd,
+                  struct usage_total *ut)
+{
+  static uint8_t blk[READ_BLOCK_SIZE];
+  char utc_arg[32];
+  char duration_arg[32];
+  char io_path[64];
+  struct timeval utc;
+  struct usage_sample a = {0};
+  struct usage_sample b = {0};
+  struct rusage ru;
+  siginfo_t si;
+  uint64_t first = 0u;
+  uint64_t start_ns;
+  ssize_t r;
+  pid_t pid;
+  int pfd[2];
+  int null;
+
+  random_utc(rnd, start, end, seconds, &utc);
+  snprintf(utc_arg, sizeof(utc_arg), "%"PRIu64, (uint64_t)utc.tv_sec);
+  snprintf(duration_arg, sizeof(duration_arg), "%.0f", seconds);
+  if (cold)
+    cache_set(dirfd, true);
+
+  if (pipe(pfd) == -1) {
+    fprintf(stderr, "ERROR: pipe failed: %s\n", strerror(errno));
+    return;
+  }
+
+  start_ns = now_ns();
+  pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "ERROR: fork failed: %s\n", strerror(errno));
+    close(pfd[0]);
+    close(pfd[1]);
+    return;
+  }
+  if (!pid) {
+    null = open("/dev/null", O_RDWR);
+    dup2(pfd[1], STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(pfd[0]);
+    close(pfd[1]);
+    if (chdir(dirpath) == -1)
+      _exit(127);
+    execl(extract, extract, utc_arg, duration_arg, (char *)NULL);
+    _exit(127);
+  }
+
+  close(pfd[1]);
+  while ((r = read(pfd[0], blk, sizeof(blk))) != 0) {
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (!first)
+      first = now_ns();
+    ut->bytes += r;
+  }
+  close(pfd[0]);
+
+  /* counters of zombie still readable */
+  waitid(P_PID, pid, &si, WEXITED | WNOWAIT);
+  b.ns = now_ns();
+  snprintf(io_path, sizeof(io_path), "/proc/%d/io", (int)pid);
+  proc_io(io_path, &b);
+  wait4(pid, NULL, 0, &ru);
+  b.minflt = ru.ru_minflt;
+  b.majflt = ru.ru_majflt;
+  a.ns = start_ns;
+
+  usage_add(ut, &a, &b, false);
+  if (first)
+    hist_add(&ut->ttfb, first - start_ns);
+}
+
+static bool
+bench(const char *dirpath, const struct bench_options *opt)
+{
+  struct rdr_archive ar;
+  struct usage_total *ut;
+  struct timeval start;
+  struct timeval end;
+  uint32_t rnd = 2463534242u;
+  unsigned pass;
+  unsigned i;
+  bool cold;
+
+  ut = malloc(sizeof(*ut));
+  if (!ut)
+    return false;
+  usage_calibrate();
+
+  if (!rdr_open(&ar, dirpath, false) || !rdr_coverage(&ar, &start, &end)) {
+    fprintf(stderr, "ERROR: %s\n", rdr_error());
+    free(ut);
+    return false;
+  }
+  printf("# '%s': %zu segments, "TV_FMT" - "TV_FMT"\n",
+         dirpath, ar.seg_count, TV_ARGS(&start), TV_ARGS(&end));
+
+  for (pass = 0u; pass < 2u; pass++) {
+    cold = !pass;
+    if ((cold && !opt->cold) || (!cold && !opt->warm))
+      continue;
+    printf("# %s page cache\n", cold ? "cold" : "warm");
+    if (!cold)
+      cache_set(ar.dirfd, false);
+
+    memset(ut, 0, sizeof(*ut));
+    for (i = 0u; i < (opt->seeks < 10u ? opt->seeks : 10u); i++)
+      bench_open(dirpath, cold, ut);
+    usage_print("open", ut);
+
+    memset(ut, 0, sizeof(*ut));
+    for (i = 0u; i < opt->seeks; i++)
+      bench_seek(&ar, &start, &end, &rnd, cold, ut);
+    usage_print("seek", ut);
+
+    memset(ut, 0, sizeof(*ut));
+    for (i = 0u; i < (opt->seeks + 9u) / 10u; i++)
+      bench_read(&ar, &start, &end, &rnd, opt->read_seconds, cold, ut);
+    usage_print("read", ut);
+
+    if (opt->extract) {
+      memset(ut, 0, sizeof(*ut));
+      for (i = 0u; i < (opt->seeks + 9u) / 10u; i++) {
+        bench_extract_run(opt->extract, dirpath, &start, &end, &rnd,
+                          opt->read_seconds, cold, ar.dirfd, ut);
+      }
+      usage_print("extract", ut);
+    }
+  }
+
+  rdr_close(&ar);
+  free(ut);
+  return true;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "archive generator and extract/seek benchmark\n");
+  fprintf(stderr, "usage: -g [-u <utc>] [-D <seconds>] [-f <fps>] "
+          "[-p <ppm>] [-G <every>:<seconds>]\n"
+          "          [-s <KB>] [-j <percent>] [-l <MB>] [-L <files>] <dir>\n");
+  fprintf(stderr, "       [-n <seeks>] [-R <seconds>] [-c | -w] "
+          "[-x <extract>] <dir>\n");
+  fprintf(stderr, "  -g  generate archive in <dir>\n");
+  fprintf(stderr, "  -u  UTC time of first frame, default 1500000000\n");
+  fprintf(stderr, "  -D  duration, default 3600 s\n");
+  fprintf(stderr, "  -f  frames per second, default 25\n");
+  fprintf(stderr, "  -p  camera clock drift, default 0 ppm\n");
+  fprintf(stderr, "  -G  camera outage <seconds> each <every> seconds\n");
+  fprintf(stderr, "  -s  mean frame size, default 100 KB\n");
+  fprintf(stderr, "  -j  frame size jitter, default 25%%\n");
+  fprintf(stderr, "  -l  segment size limit, default 128 MB\n");
+  fprintf(stderr, "  -L  files in ring (wrap), default 0 (no wrap)\n");
+  fprintf(stderr, "  -n  random seeks, 1/10 of it for open and reads, "
+          "default 100\n");
+  fprintf(stderr, "  -R  archive seconds in each read, default 60\n");
+  fprintf(stderr, "  -c  cold page cache only\n");
+  fprintf(stderr, "  -w  warm page cache only\n");
+  fprintf(stderr, "  -x  also run extract binary for read ranges\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct gen_options gen = {
+    .utc = 1500000000,
+    .duration = 3600.0,
+    .fps = 25.0,
+    .frame_size = 100u * 1024u,
+    .jitter = 25u,
+    .size_limit = 128u * 1024u * 1024u
+  };
+  struct bench_options bo = {
+    .seeks = 100u,
+    .read_seconds = 60.0,
+    .cold = true,
+    .warm = true
+  };
+  bool generate_mode = false;
+  char *end;
+  int opt;
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  while ((opt = getopt(argc, argv, "gu:D:f:p:G:s:j:l:L:n:R:cwx:")) != -1) {
+    switch (opt) {
+    case 'g':
+      generate_mode = true;
+      break;
+    case 'u':
+      gen.utc = (time_t)strtoull(optarg, NULL, 10);
+      break;
+    case 'D':
+      gen.duration = strtod(optarg, NULL);
+      break;
+    case 'f':
+      gen.fps = strtod(optarg, NULL);
+      break;
+    case 'p':
+      gen.drift_ppm = strtod(optarg, NULL);
+      break;
+    case 'G':
+      gen.gap_every = strtod(optarg, &end);
+      if (*end != ':') {
+        usage();
+        return EXIT_FAILURE;
+      }
+      gen.gap_len = strtod(end + 1, NULL);
+      break;
+    case 's':
+      gen.frame_size = strtoull(optarg, NULL, 10) * 1024u;
+      break;
+    case 'j':
+      gen.jitter = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      gen.size_limit = strtoull(optarg, NULL, 10) * 1024u * 1024u;
+      break;
+    case 'L':
+      gen.files_limit = strtoull(optarg, NULL, 10);
+      break;
+    case 'n':
+      bo.seeks = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'R':
+      bo.read_seconds = strtod(optarg, NULL);
+      break;
+    case 'c':
+      bo.warm = false;
+      break;
+    case 'w':
+      bo.cold = false;
+      break;
+    case 'x':
+      bo.extract = optarg;
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  if (generate_mode) {
+    if (gen.fps <= 0.0 || gen.fps > 255.0 || gen.duration <= 0.0 ||
+        !gen.frame_size || gen.jitter > 100u ||
+        gen.frame_size * 2u > gen.size_limit ||
+        (gen.gap_len > 0.0 && gen.gap_every <= 0.0)) {
+      usage();
+      return EXIT_FAILURE;
+    }
+    return generate(argv[optind], &gen) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (!bo.seeks || bo.read_seconds <= 0.0) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  return bench(argv[optind], &bo) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
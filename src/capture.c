@@ -0,0 +1,791 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/capture.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <assert.h>
+#include <ev.h>
+#include <pthread.h>
+
+#include "capture.h"
+#include "trace.h"
+
+/* data to file of wb and, by write thread, to file of tee (or NULL) */
+static bool
+wbf_write_tee(struct devinfo *dev, struct wbf *wb, struct wbf *tee,
+              uint8_t *p, size_t len, const struct wth_times *t)
+{
+  ssize_t r;
+
+#if 0 /* SIMPLE_WRITE */
+  r = write(wb->fd, p, len);
+  if (tee && r == len)
+    r = write(tee->fd, p, len);
+#else
+  r = wth_write_tee(dev->trg.ctx, wb->fd, tee ? tee->fd : -1, p, len, t);
+#endif
+  if (r != len) {
+    fprintf(stderr, "! write to '%s' incomplete: %zd != %zu.\n",
+            wb->path, r, len);
+    return false;
+  }
+
+  wb->written += len;
+  if (tee)
+    tee->written += len;
+  return true;
+}
+
+static bool
+wbf_write(struct devinfo *dev, struct wbf *wb, uint8_t *p, size_t len,
+          const struct wth_times *t)
+{
+  return wbf_write_tee(dev, wb, NULL, p, len, t);
+}
+
+/* frame rate of stream written to target, at least 1 in header */
+static unsigned
+capture_target_fps(struct devinfo *dev, struct capture_target *tg)
+{
+  unsigned fps = dev->cam_info.frame_per_second;
+  unsigned lapse_fps;
+
+  if (tg == &dev->trg)
+    return fps;
+  if (dev->lapse->every) {
+    fps /= dev->lapse->every;
+  } else {
+    lapse_fps = (unsigned)(1000000u / dev->lapse->interval_us);
+    if (lapse_fps < fps)
+      fps = lapse_fps;
+  }
+  return fps ? fps : 1u;
+}
+
+/* frame_time: sensor time of first frame of files */
+static bool
+make_frame_header(struct devinfo *dev, struct capture_target *tg,
+                  const struct timeval *frame_time)
+{
+  struct frame_header fh = FH_INIT_VALUE;
+  struct timeval tv_diff = {0};
+
+  timersub(frame_time, &dev->c.first_frame_time, &tv_diff);
+
+  fh.seq_be = BSWAP_BE32(tg->file_idx);
+  fh.seq_limit_be = BSWAP_BE32(tg->files_limit);
+  fh.frame.fps = (uint8_t)capture_target_fps(dev, tg);
+  fh.frame.width_be = BSWAP_BE16((uint16_t)dev->frame_width);
+  fh.frame.height_be = BSWAP_BE16((uint16_t)dev->frame_height);
+  fh.frame.quality = (uint8_t)dev->cam_info.quality;
+  if (tg->resume)
+    fh.frame.flags |= FH_FLAG_EVENT;
+  /* mark current frame as first */
+  timebin_from_timeval(&fh.cap_time.local, &tv_diff);
+
+  timebin_from_timeval(&fh.cap_time.utc, &dev->c.first_frame_time_utc);
+  memcpy(fh.path, tg->frame.path, sizeof(fh.path));
+  return wbf_write(dev, &tg->index, (uint8_t*)&fh, sizeof(fh), NULL);
+}
+
+static void
+wbf_make_filename(struct capture_target *tg, struct wbf *wb, uint32_t file_no)
+{
+  if (wb == &tg->index) {
+    make_idx_file(wb->path, file_no);
+  } else if (wb == &tg->frame) {
+    make_frm_file(wb->path, file_no);
+  } else {
+    assert(0);
+  }
+}
+
+static bool
+wbf_make_file(struct devinfo *dev, struct capture_target *tg, struct wbf *wb)
+{
+  const char *dir = tg == &dev->trg ? "" : dev->lapse->dir;
+
+  if (tg->files_limit)
+    wbf_make_filename(tg, wb, tg->file_idx % tg->files_limit);
+  else
+    wbf_make_filename(tg, wb, tg->file_idx);
+
+#if 0 /* SIMPLE_WRITE */
+  if (wb->fd > 0)
+    close(wb->fd);
+
+  wb->fd = open(wb->path, O_CREAT | O_TRUNC | O_WRONLY,
+                  S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+#else
+  if (wb->fd > 0)
+    wth_close(tg->ctx, wb->fd);
+
+  if (tg == &dev->trg)
+    wb->fd = wth_open(tg->ctx, wb->path);
+  else
+    wb->fd = wth_open_at(tg->ctx, dev->lapse->dirfd, wb->path);
+#endif
+
+  if (wb->fd == -1) {
+    fprintf(stderr, "! file '%s%s%s' not openned for writing.\n",
+            dir, *dir ? "/" : "", wb->path);
+    return false;
+  } else {
+    fprintf(stderr, "@ open file '%s%s%s' writing. sequence = %"PRIu32"\n",
+            dir, *dir ? "/" : "", wb->path, tg->file_idx);
+    wb->written = 0u;
+  }
+  return true;
+}
+
+/* generate index and frames files */
+static bool
+wbf_make_increment(struct devinfo *dev, struct capture_target *tg,
+                   const struct timeval *frame_time)
+{
+  if (!wbf_make_file(dev, tg, &tg->frame))
+    return false;
+
+  if (!wbf_make_file(dev, tg, &tg->index))
+    return false;
+
+  if (!make_frame_header(dev, tg, frame_time)) {
+    fprintf(stderr, "! Frame header not writted: %s", strerror(errno));
+    return false;
+  }
+
+  tg->file_idx++;
+  tg->rotate = false;
+  tg->resume = false;
+  return true;
+}
+
+/* kept free in write buffer for gap markers and files headers */
+#define CAPTURE_RESERVE (64u * 1024u)
+
+bool
+capture_overload_parse(struct capture_overload *ovl, const char *spec)
+{
+  char buf[128];
+  char *save = NULL;
+  char *tok;
+  char *end;
+
+  memset(ovl, 0, sizeof(*ovl));
+  ovl->high_percent = 50u;
+  ovl->low_percent = 25u;
+  if (strlen(spec) >= sizeof(buf)) {
+    fprintf(stderr, "! overload: policy too long\n");
+    return false;
+  }
+  strcpy(buf, spec);
+
+  for (tok = strtok_r(buf, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    if (!strcmp(tok, "newest")) {
+      ovl->drop_oldest = false;
+    } else if (!strcmp(tok, "oldest")) {
+      ovl->drop_oldest = true;
+    } else if (!strncmp(tok, "decimate=", 9)) {
+      ovl->decimate = (unsigned)strtoul(tok + 9, &end, 10);
+      if (*end == ':') {
+        ovl->high_percent = (unsigned)strtoul(end + 1, &end, 10);
+        if (*end != ':') {
+          fprintf(stderr, "! overload: expect decimate=<N>:<high>:<low>\n");
+          return false;
+        }
+        ovl->low_percent = (unsigned)strtoul(end + 1, &end, 10);
+      }
+      if (*end || ovl->decimate < 2u || ovl->high_percent > 100u ||
+          ovl->low_percent >= ovl->high_percent) {
+        fprintf(stderr, "! overload: invalid '%s'\n", tok);
+        return false;
+      }
+    } else {
+      fprintf(stderr, "! overload: unknown policy '%s'\n", tok);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+capture_lapse_parse(struct capture_lapse *lapse, const char *spec)
+{
+  char buf[384];
+  char *save = NULL;
+  char *tok;
+  char *end;
+
+  memset(lapse, 0, sizeof(*lapse));
+  lapse->dirfd = -1;
+  lapse->trg.files_limit = 32u;
+  lapse->trg.size_limit = 1024u * 1024u * 128u;
+  strcpy(lapse->dir, "lapse");
+  if (strlen(spec) >= sizeof(buf)) {
+    fprintf(stderr, "! lapse: spec too long\n");
+    return false;
+  }
+  strcpy(buf, spec);
+
+  for (tok = strtok_r(buf, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    if (!strncmp(tok, "every=", 6)) {
+      lapse->every = (unsigned)strtoul(tok + 6, &end, 10);
+      if (*end || lapse->every < 2u) {
+        fprintf(stderr, "! lapse: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "interval=", 9)) {
+      lapse->interval_us = strtoull(tok + 9, &end, 10) * 1000u;
+      if (*end || !lapse->interval_us) {
+        fprintf(stderr, "! lapse: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "dir=", 4)) {
+      if (!tok[4] || strlen(tok + 4) >= sizeof(lapse->dir)) {
+        fprintf(stderr, "! lapse: invalid '%s'\n", tok);
+        return false;
+      }
+      strcpy(lapse->dir, tok + 4);
+    } else if (!strncmp(tok, "files=", 6)) {
+      lapse->trg.files_limit = strtoul(tok + 6, &end, 10);
+      if (*end) {
+        fprintf(stderr, "! lapse: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "size=", 5)) {
+      lapse->trg.size_limit = strtoul(tok + 5, &end, 10) * 1024u * 1024u;
+      if (*end || !lapse->trg.size_limit) {
+        fprintf(stderr, "! lapse: invalid '%s'\n", tok);
+        return false;
+      }
+    } else {
+      fprintf(stderr, "! lapse: unknown option '%s'\n", tok);
+      return false;
+    }
+  }
+  if (!lapse->every == !lapse->interval_us) {
+    fprintf(stderr, "! lapse: expect one of every=<N> or interval=<ms>\n");
+    return false;
+  }
+  return true;
+}
+
+bool
+capture_lapse_open(struct devinfo *dev, struct capture_lapse *lapse,
+                   int dirfd)
+{
+  if (mkdirat(dirfd, lapse->dir, 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "! lapse: directory '%s' not created: %s\n",
+            lapse->dir, strerror(errno));
+    return false;
+  }
+  lapse->dirfd = openat(dirfd, lapse->dir, O_RDONLY | O_DIRECTORY);
+  if (lapse->dirfd == -1) {
+    fprintf(stderr, "! lapse: directory '%s' not opened: %s\n",
+            lapse->dir, strerror(errno));
+    return false;
+  }
+  lapse->trg.ctx = dev->trg.ctx;
+  dev->lapse = lapse;
+  if (lapse->every)
+    fprintf(stderr, "@ lapse: every %u frame", lapse->every);
+  else
+    fprintf(stderr, "@ lapse: one frame per %.3f s",
+            lapse->interval_us / 1e6);
+  fprintf(stderr, " to '%s', %zu files of %zu MB\n",
+          lapse->dir, lapse->trg.files_limit, lapse->trg.size_limit >> 20);
+  return true;
+}
+
+static void
+capture_target_close(struct capture_target *tg)
+{
+  if (tg->frame.fd > 0)
+    wth_close(tg->ctx, tg->frame.fd);
+  if (tg->index.fd > 0)
+    wth_close(tg->ctx, tg->index.fd);
+  tg->frame.fd = -1;
+  tg->index.fd = -1;
+}
+
+void
+capture_close(struct devinfo *dev)
+{
+  capture_target_close(&dev->trg);
+  if (dev->lapse) {
+    capture_target_close(&dev->lapse->trg);
+    close(dev->lapse->dirfd);
+    dev->lapse->dirfd = -1;
+  }
+}
+
+void
+capture_settings_changed(struct devinfo *dev)
+{
+  struct event_record rec;
+
+  dev->trg.rotate = true;
+  if (dev->lapse)
+    dev->lapse->trg.rotate = true;
+  /* taken with old settings, would be written under new header.
+   * backlog of event (committed frames) is kept
+   */
+  while (dev->event && event_peek(dev->event, &rec) &&
+         !event_committed(dev->event, &rec)) {
+    event_discard(dev->event);
+    dev->event->discarded++;
+  }
+}
+
+/* frame goes to decimated stream too: counted by frames or by sensor time,
+ * interval keeps its cadence and restarts after gap longer than interval
+ */
+static bool
+capture_lapse_take(struct capture_lapse *lapse,
+                   const struct v4l2_buffer *cam_buf)
+{
+  struct timeval interval;
+  struct timeval late;
+
+  if (lapse->every) {
+    if (lapse->count) {
+      lapse->count--;
+      return false;
+    }
+    lapse->count = lapse->every - 1u;
+    return true;
+  }
+
+  if (timerisset(&lapse->next) &&
+      timercmp(&cam_buf->timestamp, &lapse->next, <))
+    return false;
+
+  interval.tv_sec = (time_t)(lapse->interval_us / 1000000u);
+  interval.tv_usec = (suseconds_t)(lapse->interval_us % 1000000u);
+  timeradd(&lapse->next, &interval, &late);
+  if (timerisset(&lapse->next) &&
+      timercmp(&cam_buf->timestamp, &late, <))
+    lapse->next = late;
+  else
+    timeradd(&cam_buf->timestamp, &interval, &lapse->next);
+  return true;
+}
+
+/* frame with its index record (and files header on rotation) fits */
+static bool
+capture_fits(struct devinfo *dev, size_t size, bool lapse)
+{
+  size_t need = size + sizeof(frame_index_t) + sizeof(frame_header_t) +
+                CAPTURE_RESERVE;
+
+  /* decimated stream: shared data, own index record and files header */
+  if (lapse)
+    need += sizeof(frame_index_t) + sizeof(frame_header_t);
+  return wth_space(dev->trg.ctx, lapse ? 5u : 3u) >= need;
+}
+
+void
+capture_batch(struct devinfo *dev, const struct v4l2_buffer *batch, size_t n)
+{
+  size_t need = 0u;
+  size_t keep = 0u;
+
+  dev->ovl.skip = 0u;
+  if (!dev->ovl.drop_oldest)
+    return;
+
+  /* newest frames first */
+  while (keep < n) {
+    need += batch[n - keep - 1u].bytesused + sizeof(frame_index_t) +
+            sizeof(frame_header_t);
+    if (!capture_fits(dev, need, false))
+      break;
+    keep++;
+  }
+  dev->ovl.skip = n - keep;
+}
+
+/* index record of frame just written to frames file of target,
+ * gap marker when size is 0
+ */
+static bool
+capture_index(struct devinfo *dev, struct capture_target *tg,
+              struct v4l2_buffer *cam_buf, size_t size, uint64_t seq)
+{
+  frame_index_t fi = FI_INIT_VALUE;
+  struct timeval frame_time;
+
+  timersub(&cam_buf->timestamp, &dev->c.first_frame_time, &frame_time);
+  timebin_from_timeval(&fi.tv, &frame_time);
+  fi.offset_be = BSWAP_BE64(tg->frame.written - size);
+  fi.size_be = BSWAP_BE32((uint32_t)size);
+  fi.seq_be = BSWAP_BE64(seq);
+
+  return wbf_write(dev, &tg->index, (uint8_t*)&fi, sizeof(fi), NULL);
+}
+
+/* gap marker, false when not recorded: no space or no index file yet */
+static bool
+capture_gap(struct devinfo *dev, struct capture_target *tg,
+            struct v4l2_buffer *cam_buf, uint64_t seq)
+{
+  if (tg->index.fd <= 0 ||
+      wth_space(tg->ctx, 1u) < sizeof(frame_index_t))
+    return false;
+  return capture_index(dev, tg, cam_buf, 0u, seq);
+}
+
+/* count dropped frame and record it in index */
+static void
+capture_drop(struct devinfo *dev, struct v4l2_buffer *cam_buf,
+             enum capture_drop why, uint64_t seq)
+{
+  dev->c.frames_dropped++;
+  dev->c.drops[why]++;
+  if (why != CAPTURE_DROP_DECIMATE)
+    trace_drop();
+
+  if (capture_gap(dev, &dev->trg, cam_buf, seq))
+    dev->c.gap_markers++;
+  else
+    dev->c.gap_markers_lost++;
+}
+
+/* frame of decimated stream not written */
+static void
+capture_lapse_drop(struct devinfo *dev, struct capture_lapse *lapse,
+                   struct v4l2_buffer *cam_buf)
+{
+  if (capture_gap(dev, &lapse->trg, cam_buf, lapse->seq))
+    lapse->gap_markers++;
+  lapse->seq++;
+}
+
+/* index record of frame written to decimated stream */
+static void
+capture_lapse_index(struct devinfo *dev, struct capture_lapse *lapse,
+                    struct v4l2_buffer *cam_buf)
+{
+  if (capture_index(dev, &lapse->trg, cam_buf, cam_buf->bytesused,
+                    lapse->seq)) {
+    lapse->frames++;
+    dev->c.bytes_queued += cam_buf->bytesused + sizeof(frame_index_t);
+  }
+  lapse->seq++;
+}
+
+/* new files before frame exceeding size limit or on request,
+ * false (and loop stopped) when files not created
+ */
+static bool
+capture_rotate(struct devinfo *dev, struct capture_target *tg,
+               struct v4l2_buffer *cam_buf)
+{
+  if (tg->index.written + sizeof(frame_index_t) +
+      tg->frame.written + cam_buf->bytesused <= tg->size_limit &&
+      tg->frame.fd > 0 && tg->index.fd > 0 && !tg->rotate)
+    return true;
+
+  trace_begin_arg("rotate", tg->file_idx);
+  if (!wbf_make_increment(dev, tg, &cam_buf->timestamp)) {
+    trace_end("rotate");
+    fprintf(stderr, "! error while create new files\n");
+    ev_break(dev->loop, EVBREAK_ALL);
+    return false;
+  }
+  trace_end("rotate");
+  return true;
+}
+
+/* frame dropped by main stream: decimated stream writes it alone */
+static void
+capture_lapse_alone(struct devinfo *dev, struct capture_lapse *lapse,
+                    struct v4l2_buffer *cam_buf, uint8_t *p,
+                    const struct wth_times *times)
+{
+  if (!capture_fits(dev, cam_buf->bytesused, false)) {
+    capture_lapse_drop(dev, lapse, cam_buf);
+    return;
+  }
+  if (!capture_rotate(dev, &lapse->trg, cam_buf))
+    return;
+  if (!wbf_write(dev, &lapse->trg.frame, p, cam_buf->bytesused, times)) {
+    capture_lapse_drop(dev, lapse, cam_buf);
+    return;
+  }
+  capture_lapse_index(dev, lapse, cam_buf);
+}
+
+/* reason to drop frame or CAPTURE_DROPS to write it,
+ * frames replayed from event ring are not of current batch:
+ * oldest frames skip of batch is not applied to them
+ */
+static enum capture_drop
+capture_admit(struct devinfo *dev, struct v4l2_buffer *cam_buf,
+              uint64_t seq, bool lapse, bool replay)
+{
+  struct capture_overload *ovl = &dev->ovl;
+  unsigned percent = dev->trg.ctx->occupied_percent;
+
+  if (ovl->skip && !replay) {
+    ovl->skip--;
+    return CAPTURE_DROP_OLDEST;
+  }
+
+  if (ovl->decimate) {
+    if (!ovl->decimating && percent >= ovl->high_percent) {
+      ovl->decimating = true;
+      fprintf(stderr, "@ overload: buffer %u%%, keep 1 of %u frames\n",
+              percent, ovl->decimate);
+    } else if (ovl->decimating && percent <= ovl->low_percent) {
+      ovl->decimating = false;
+      fprintf(stderr, "@ overload: buffer %u%%, keep all frames\n", percent);
+    }
+    if (ovl->decimating && seq % ovl->decimate)
+      return CAPTURE_DROP_DECIMATE;
+  }
+
+  if (!capture_fits(dev, cam_buf->bytesused, lapse))
+    return CAPTURE_DROP_FULL;
+  return CAPTURE_DROPS;
+}
+
+/* frame to main stream and, with lapse, to decimated stream */
+static void
+capture_write(struct devinfo *dev, struct v4l2_buffer *cam_buf, uint8_t *p,
+              uint64_t seq, const struct wth_times *times,
+              struct capture_lapse *lapse, bool replay)
+{
+  enum capture_drop why;
+  bool written;
+
+  /* frame and index record are written both or none */
+  if ((why = capture_admit(dev, cam_buf, seq, lapse != NULL, replay)) !=
+      CAPTURE_DROPS) {
+    capture_drop(dev, cam_buf, why, seq);
+    if (lapse)
+      capture_lapse_alone(dev, lapse, cam_buf, p, times);
+    return;
+  }
+
+  if (!capture_rotate(dev, &dev->trg, cam_buf) ||
+      (lapse && !capture_rotate(dev, &lapse->trg, cam_buf)))
+    return;
+
+  /* one copy in write buffer for both streams */
+  written = wbf_write_tee(dev, &dev->trg.frame,
+                          lapse ? &lapse->trg.frame : NULL,
+                          p, cam_buf->bytesused, times);
+  if (!written) {
+    fprintf(stderr, "! frame %"PRIu64" not written\n", seq);
+    capture_drop(dev, cam_buf, CAPTURE_DROP_FULL, seq);
+    if (lapse)
+      capture_lapse_drop(dev, lapse, cam_buf);
+    /* skip frame */
+    return;
+  }
+
+  if (capture_index(dev, &dev->trg, cam_buf, cam_buf->bytesused, seq)) {
+    dev->c.bytes_queued += cam_buf->bytesused + sizeof(frame_index_t);
+  } else {
+    /* not expected: space for index record checked with frame */
+    fprintf(stderr, "! write index for frame  %"PRIu64" failed\n", seq);
+    dev->c.frames_dropped++;
+    dev->c.drops[CAPTURE_DROP_FULL]++;
+    trace_drop();
+    /* skip frame info (result: frame droped) */
+  }
+
+  if (lapse)
+    capture_lapse_index(dev, lapse, cam_buf);
+}
+
+/* frames of event ring written per camera frame,
+ * bounds time of callback after trigger
+ */
+#define CAPTURE_EVENT_DRAIN 16u
+
+static void
+capture_event_buf(struct v4l2_buffer *buf, const struct event_record *rec)
+{
+  memset(buf, 0, sizeof(*buf));
+  buf->timestamp = rec->timestamp;
+  buf->flags = rec->flags;
+  buf->bytesused = rec->size;
+}
+
+/* committed frames of event ring to files, oldest first, while they fit */
+static void
+capture_event_drain(struct devinfo *dev, struct event *ev)
+{
+  struct event_record rec;
+  struct v4l2_buffer buf;
+  /* late frames: not counted in pipeline latency */
+  struct wth_times times = {0};
+  uint8_t *p;
+  unsigned n;
+
+  for (n = 0u; n < CAPTURE_EVENT_DRAIN; n++) {
+    if (!event_peek(ev, &rec) || !event_committed(ev, &rec) ||
+        !capture_fits(dev, rec.size, false))
+      break;
+    p = event_pop(ev, &rec);
+    capture_event_buf(&buf, &rec);
+    capture_write(dev, &buf, p, rec.seq, &times, NULL, true);
+  }
+}
+
+/* oldest frames out of event ring for need bytes and, idle frames,
+ * older than pre seconds before frame_time.
+ * committed frame out of ring is dropped frame of event
+ */
+static void
+capture_event_evict(struct devinfo *dev, struct event *ev, size_t need,
+                    const struct timeval *frame_time)
+{
+  struct event_record rec;
+  struct v4l2_buffer buf;
+  struct timeval age;
+
+  while (event_peek(ev, &rec)) {
+    timersub(frame_time, &rec.timestamp, &age);
+    if (cbf_free_space(&ev->ring) >= need &&
+        (event_committed(ev, &rec) ||
+         age.tv_sec + age.tv_usec / 1e6 <= ev->cfg.pre))
+      break;
+    event_discard(ev);
+    if (event_committed(ev, &rec)) {
+      capture_event_buf(&buf, &rec);
+      capture_drop(dev, &buf, CAPTURE_DROP_FULL, rec.seq);
+    } else {
+      ev->discarded++;
+    }
+  }
+}
+
+/* triggered recording: frame to files or to event ring */
+static void
+capture_event(struct devinfo *dev, struct v4l2_buffer *cam_buf, uint8_t *p,
+              const struct wth_times *times, struct capture_lapse *lapse)
+{
+  struct event *ev = dev->event;
+  struct event_record rec = {
+    .timestamp = cam_buf->timestamp,
+    .flags = cam_buf->flags,
+    .size = cam_buf->bytesused,
+    .seq = (uint64_t)dev->c.frames_arrived
+  };
+  bool stored = false;
+
+  event_update(ev, &cam_buf->timestamp, cam_buf->bytesused);
+  if (ev->started) {
+    /* frames before ring were not recorded: gap at files boundary */
+    dev->trg.rotate = true;
+    dev->trg.resume = true;
+  }
+  if (ev->recording) {
+    ev->commit = true;
+    ev->commit_seq = rec.seq;
+  }
+
+  capture_event_drain(dev, ev);
+  if (ev->recording && !ev->records) {
+    capture_write(dev, cam_buf, p, rec.seq, times, lapse, false);
+    return;
+  }
+
+  /* idle, or backlog of event not written yet: frame waits in ring */
+  if (event_need(rec.size) <= ev->ring.capacity) {
+    capture_event_evict(dev, ev, event_need(rec.size), &cam_buf->timestamp);
+    stored = event_push(ev, &rec, p);
+  }
+  if (!stored) {
+    if (ev->recording)
+      capture_drop(dev, cam_buf, CAPTURE_DROP_FULL, rec.seq);
+    else
+      ev->discarded++;
+  }
+  /* decimated stream records all the time */
+  if (lapse)
+    capture_lapse_alone(dev, lapse, cam_buf, p, times);
+}
+
+void
+capture_process(struct devinfo *dev,
+                struct v4l2_buffer *cam_buf, uint8_t *p)
+{
+  struct capture_lapse *lapse = NULL;
+  struct wth_times times = {.dqbuf = dev->c.dqbuf_ns};
+
+  if ((cam_buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+      V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+    times.sensor = (uint64_t)cam_buf->timestamp.tv_sec * 1000000000u +
+                   (uint64_t)cam_buf->timestamp.tv_usec * 1000u;
+  }
+
+  if (dev->lapse && capture_lapse_take(dev->lapse, cam_buf))
+    lapse = dev->lapse;
+
+  if (dev->event)
+    capture_event(dev, cam_buf, p, &times, lapse);
+  else
+    capture_write(dev, cam_buf, p, (uint64_t)dev->c.frames_arrived, &times,
+                  lapse, false);
+}
+
+void
+capture_event_flush(struct devinfo *dev, unsigned timeout_ms)
+{
+  struct event *ev = dev->event;
+  struct event_record rec;
+  struct v4l2_buffer buf;
+  /* late frames: not counted in pipeline latency */
+  struct wth_times times = {0};
+  uint64_t written = 0u;
+  uint64_t dropped = 0u;
+  unsigned waited = 0u;
+  uint8_t *p;
+
+  if (!ev)
+    return;
+
+  while (event_peek(ev, &rec)) {
+    if (!event_committed(ev, &rec)) {
+      event_discard(ev);
+      ev->discarded++;
+      continue;
+    }
+    if (!capture_fits(dev, rec.size, false)) {
+      if (waited < timeout_ms) {
+        /* space is freed by write thread only */
+        ev_async_send(dev->trg.ctx->loop, &dev->trg.ctx->async_write);
+        usleep(1000);
+        waited++;
+        continue;
+      }
+      event_discard(ev);
+      capture_event_buf(&buf, &rec);
+      capture_drop(dev, &buf, CAPTURE_DROP_FULL, rec.seq);
+      dropped++;
+      continue;
+    }
+    waited = 0u;
+    p = event_pop(ev, &rec);
+    capture_event_buf(&buf, &rec);
+    capture_write(dev, &buf, p, rec.seq, &times, NULL, true);
+    written++;
+  }
+  if (written || dropped)
+    fprintf(stderr, "@ event: backlog at exit: %"PRIu64" frames written, "
+            "%"PRIu64" dropped\n", written, dropped);
+}
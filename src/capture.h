@@ -0,0 +1,230 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/capture.h
+ */
+#ifndef _CAPTURE_1561370902_H_
+#define _CAPTURE_1561370902_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <ev.h>
+#include <pthread.h>
+
+#include <linux/videodev2.h>
+
+#include "main.h"
+#include "files.h"
+#include "event.h"
+
+/* write target */
+struct wbf {
+  int fd; /* -1 and 0 is invalid fd */
+  char path[FH_PATH_SIZE + 1];
+  uint64_t written;
+};
+
+/* v4l buffer pointer */
+struct bufinfo {
+  void *p;
+  /* size of allocated frame */
+  size_t size;
+};
+
+/* reason of frame drop */
+enum capture_drop {
+  /* no space in write thread buffer for frame and its index record */
+  CAPTURE_DROP_FULL,
+  /* older frames of batch dropped for newer ones */
+  CAPTURE_DROP_OLDEST,
+  /* skipped by decimation under load */
+  CAPTURE_DROP_DECIMATE,
+  CAPTURE_DROPS
+};
+
+/*
+ * handling of frames when write thread does not keep up.
+ * frame is accepted only together with its index record, dropped frame
+ * is recorded in index as gap marker (record without data, FI_IS_GAP)
+ */
+struct capture_overload {
+  /* drop oldest frames of dequeued batch instead of newest */
+  bool drop_oldest;
+  /* keep every Nth frame while write buffer occupied above high_percent
+   * until it is below low_percent, 0 = off
+   */
+  unsigned decimate;
+  unsigned high_percent;
+  unsigned low_percent;
+  bool decimating;
+  /* oldest frames of current batch to drop, set by capture_batch() */
+  size_t skip;
+};
+
+/* output queue: ring of frames and index files */
+struct capture_target {
+  struct wth_context *ctx;
+  /* if limit reached, wbf.index got zero */
+  size_t files_limit;
+  size_t size_limit;
+  uint32_t file_idx;
+  /* start new files before next frame: header records changed
+   * camera settings
+   */
+  bool rotate;
+  /* next files start triggered recording: FH_FLAG_EVENT */
+  bool resume;
+  struct wbf frame;
+  struct wbf index;
+};
+
+/*
+ * second, decimated stream: every Nth frame or one frame per interval
+ * into files ring of its own directory with own limits.
+ * frame data is shared with main stream: one copy in write buffer
+ * written by write thread to both frames files (wth_write_tee())
+ */
+struct capture_lapse {
+  /* keep every Nth frame, 0 = by interval */
+  unsigned every;
+  /* keep first frame at or after interval since last kept, us */
+  uint64_t interval_us;
+  /* relative to directory of main stream */
+  char dir[256];
+  int dirfd;
+  struct capture_target trg;
+
+  /* frames since last kept, sensor time of next frame to keep */
+  unsigned count;
+  struct timeval next;
+  /* index records: frames and gap markers */
+  uint64_t seq;
+  uint64_t frames;
+  uint64_t gap_markers;
+};
+
+/* device info */
+struct devinfo {
+  /* system values */
+  ev_io ev;
+  int fd;
+
+  struct ev_loop *loop;
+  /* preseted values */
+  char path[256];
+
+  /* size of uncompressed frame */
+  size_t frame_size;
+
+  size_t frame_width;
+  size_t frame_height;
+
+  /* calculated values */
+  /* input queue */
+  struct bufinfo *queue;
+  size_t queue_size;  
+  /* length of frame buffers mapping, see mem_alloc() */
+  size_t queue_length;
+  size_t queued; /* count of queued buffers */
+
+  /* output queue: frames and indexes */
+  struct capture_target trg;
+  /* NULL = off */
+  struct capture_lapse *lapse;
+  /* triggered recording with pre-event ring, NULL = write all frames */
+  struct event *event;
+
+  struct capture_overload ovl;
+
+  struct {
+    unsigned frame_per_second;
+    /* JPEG compression quality, 0 = unknown */
+    unsigned quality;
+  } cam_info;
+
+  /* counters */
+  struct {
+    /* time of send STREAMON */
+    struct timeval start_time;
+    struct timeval start_time_utc;
+    /* time of receive first frame after STREAMON */
+    struct timeval first_frame_time_utc;
+    struct timeval first_frame_time;
+    struct timeval last_frame_time;
+    size_t frames_arrived;
+    /* bytes of frames and index records passed to write thread
+     * to be written, frame shared by both streams counted twice
+     */
+    uint64_t bytes_queued;
+    /* frames not written, sum of drops[] */
+    size_t frames_dropped;
+    /* indexed by enum capture_drop */
+    uint64_t drops[CAPTURE_DROPS];
+    /* dropped frames recorded in index, not recorded (no space or
+     * no index file yet)
+     */
+    uint64_t gap_markers;
+    uint64_t gap_markers_lost;
+    /* CLOCK_MONOTONIC ns of VIDIOC_DQBUF return for current frame */
+    uint64_t dqbuf_ns;
+    /* camera_cb calls with frames and most frames dequeued in one call */
+    uint64_t wakeups;
+    size_t batch_max;
+  } c;
+};
+
+/* parse overload policy: newest|oldest[,decimate=<N>[:<high>:<low>]]
+ * newest (default) drops frames not fitting to write buffer,
+ * oldest drops older frames of batch for newer ones.
+ * decimate keeps every Nth frame above high% of write buffer
+ * until below low% (default 50:25)
+ */
+bool
+capture_overload_parse(struct capture_overload *ovl, const char *spec);
+
+/* parse decimated stream: every=<N>|interval=<ms>[,dir=<path>]
+ * [,files=<N>][,size=<MB>], default dir lapse, 32 files of 128 MB
+ */
+bool
+capture_lapse_parse(struct capture_lapse *lapse, const char *spec);
+
+/* create and open lapse->dir relative to dirfd,
+ * files ring shares write thread of main stream
+ */
+bool
+capture_lapse_open(struct devinfo *dev, struct capture_lapse *lapse,
+                   int dirfd);
+
+/* close files of both streams */
+void
+capture_close(struct devinfo *dev);
+
+/* camera settings changed: new files with new headers before next frame,
+ * idle frames of event ring are discarded
+ */
+void
+capture_settings_changed(struct devinfo *dev);
+
+/* before capture_process() of batch of dequeued frames, oldest first:
+ * with drop_oldest choose frames to drop so that newest fit
+ */
+void
+capture_batch(struct devinfo *dev, const struct v4l2_buffer *batch, size_t n);
+
+/* write frame and index record to files ring,
+ * rotate files when size_limit reached.
+ * with dev->event frame is kept in event ring until trigger
+ */
+void
+capture_process(struct devinfo *dev,
+                struct v4l2_buffer *cam_buf, uint8_t *p);
+
+/* at exit, before write thread stops: committed frames of event ring
+ * to files, waiting for write buffer space up to timeout_ms without
+ * progress. frames still not fitted are dropped with gap markers,
+ * idle frames are discarded
+ */
+#define CAPTURE_FLUSH_TIMEOUT_MS 5000u
+void
+capture_event_flush(struct devinfo *dev, unsigned timeout_ms);
+
+#endif /* _CAPTURE_1561370902_H_ */
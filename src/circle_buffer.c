@@ -5,6 +5,7 @@
 #include <stdlib.h>
 
 #include "circle_buffer.h"
+#include "mem.h"
 
 size_t
 cbf_occupied_space(struct circle_buffer *cbf)
@@ -20,9 +21,16 @@ cbf_free_space(struct circle_buffer *cbf)
 
 bool
 cbf_init(struct circle_buffer *cbf, size_t capacity)
+{
+  return cbf_init_mem(cbf, capacity, 0u);
+}
+
+bool
+cbf_init_mem(struct circle_buffer *cbf, size_t capacity, unsigned flags)
 {
   memset(cbf, 0u, sizeof(*cbf));
-  cbf->p = calloc(capacity, sizeof(uint8_t));
+  cbf->length = capacity;
+  cbf->p = mem_alloc("ring", &cbf->length, flags);
   if (!cbf->p)
     return false;
   cbf->capacity = capacity;
@@ -36,7 +44,7 @@ cbf_init(struct circle_buffer *cbf, size_t capacity)
 void
 cbf_destroy(struct circle_buffer *cbf)
 {
-  free(cbf->p);
+  mem_free(cbf->p, cbf->length);
   memset(cbf, 0, sizeof(*cbf));
 }
 
@@ -15,6 +15,8 @@ struct circle_buffer {
   uint8_t *e;
   /* size of allocated buffer */
   size_t capacity;
+  /* length of mapping, see mem_alloc() */
+  size_t length;
   size_t free_space;
 
   /* pointer to start stored area */
@@ -32,6 +34,10 @@ cbf_occupied_space(struct circle_buffer *cbf);
 bool
 cbf_init(struct circle_buffer *cbf, size_t capacity);
 
+/* cbf_init() with memory flags (enum mem_flags) */
+bool
+cbf_init_mem(struct circle_buffer *cbf, size_t capacity, unsigned flags);
+
 void
 cbf_dump(struct circle_buffer *cbf);
 
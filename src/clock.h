@@ -0,0 +1,19 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/clock.h
+ */
+#ifndef _CLOCK_1562311204_H_
+#define _CLOCK_1562311204_H_
+#include <stdint.h>
+#include <time.h>
+
+/* CLOCK_MONOTONIC, ns: times of pipeline, logs, traces and stats */
+static inline uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#endif /* _CLOCK_1562311204_H_ */
@@ -0,0 +1,412 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/decode.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "decode.h"
+
+/* slots per worker: decoding while previous frames are written */
+#define DEC_SLOTS_PER_WORKER 2
+
+struct dec_error {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jmp;
+};
+
+/* per worker decoder state */
+struct dec_worker {
+  struct decode_pool *dp;
+  struct jpeg_decompress_struct cinfo;
+  struct dec_error err;
+  /* two interleaved YCbCr rows */
+  uint8_t *rows;
+  size_t rows_alloc;
+};
+
+static void
+dec_error_exit(j_common_ptr cinfo)
+{
+  struct dec_error *err = (struct dec_error*)cinfo->err;
+  longjmp(err->jmp, 1);
+}
+
+static void
+dec_output_message(j_common_ptr cinfo)
+{
+  /* corrupted frames are counted, not printed */
+}
+
+static bool
+dec_grow(uint8_t **p, size_t *alloc, size_t size)
+{
+  uint8_t *np;
+
+  if (*alloc >= size)
+    return true;
+
+  np = realloc(*p, size);
+  if (!np) {
+    fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+            size, strerror(errno));
+    return false;
+  }
+  *p = np;
+  *alloc = size;
+  return true;
+}
+
+/* decode jpeg to planar 4:2:0 */
+static bool
+dec_decode(struct dec_worker *dw, struct dec_slot *slot)
+{
+  struct jpeg_decompress_struct *cinfo = &dw->cinfo;
+  JSAMPROW rows[2];
+  unsigned width;
+  unsigned height;
+  unsigned cwidth;
+  unsigned y;
+  unsigned x;
+  unsigned n;
+  unsigned got;
+  uint8_t *py;
+  uint8_t *pu;
+  uint8_t *pv;
+
+  if (setjmp(dw->err.jmp)) {
+    jpeg_abort_decompress(cinfo);
+    return false;
+  }
+
+  jpeg_mem_src(cinfo, slot->jpeg, slot->jpeg_size);
+  jpeg_read_header(cinfo, TRUE);
+  cinfo->out_color_space = JCS_YCbCr;
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = dw->dp->scale_denom;
+  cinfo->dct_method = JDCT_IFAST;
+  /* chroma subsampled again on output */
+  cinfo->do_fancy_upsampling = FALSE;
+  jpeg_start_decompress(cinfo);
+
+  width = cinfo->output_width;
+  height = cinfo->output_height;
+  cwidth = (width + 1) / 2;
+
+  slot->width = width;
+  slot->height = height;
+  slot->yuv_size = (size_t)width * height +
+                   2 * (size_t)cwidth * ((height + 1) / 2);
+  if (!dec_grow(&slot->yuv, &slot->yuv_alloc, slot->yuv_size) ||
+      !dec_grow(&dw->rows, &dw->rows_alloc, (size_t)width * 3 * 2)) {
+    jpeg_abort_decompress(cinfo);
+    return false;
+  }
+
+  rows[0] = dw->rows;
+  rows[1] = dw->rows + (size_t)width * 3;
+  py = slot->yuv;
+  pu = py + (size_t)width * height;
+  pv = pu + (size_t)cwidth * ((height + 1) / 2);
+
+  for (y = 0u; y < height; y += 2) {
+    n = (height - y > 1) ? 2 : 1;
+    for (got = 0u; got < n;) {
+      got += jpeg_read_scanlines(cinfo, rows + got, n - got);
+    }
+    if (n == 1)
+      memcpy(rows[1], rows[0], (size_t)width * 3);
+
+    for (x = 0u; x < width; x++) {
+      py[x] = rows[0][x * 3];
+      if (n == 2)
+        py[width + x] = rows[1][x * 3];
+    }
+
+    for (x = 0u; x < width; x += 2) {
+      unsigned x1 = (x + 1 < width) ? x + 1 : x;
+      pu[x / 2] = (rows[0][x * 3 + 1] + rows[0][x1 * 3 + 1] +
+                   rows[1][x * 3 + 1] + rows[1][x1 * 3 + 1] + 2) / 4;
+      pv[x / 2] = (rows[0][x * 3 + 2] + rows[0][x1 * 3 + 2] +
+                   rows[1][x * 3 + 2] + rows[1][x1 * 3 + 2] + 2) / 4;
+    }
+
+    py += (size_t)width * n;
+    pu += cwidth;
+    pv += cwidth;
+  }
+
+  jpeg_finish_decompress(cinfo);
+  return true;
+}
+
+static void *
+dec_worker_thread(struct dec_worker *dw)
+{
+  struct decode_pool *dp = dw->dp;
+  struct dec_slot *slot;
+  bool r;
+
+  dw->cinfo.err = jpeg_std_error(&dw->err.mgr);
+  dw->err.mgr.error_exit = dec_error_exit;
+  dw->err.mgr.output_message = dec_output_message;
+  jpeg_create_decompress(&dw->cinfo);
+
+  pthread_mutex_lock(&dp->lock);
+  while (true) {
+    while (!dp->stop && dp->seq_decode == dp->seq_push)
+      pthread_cond_wait(&dp->cv_job, &dp->lock);
+
+    if (dp->stop)
+      break;
+
+    slot = &dp->slot[dp->seq_decode % dp->slot_count];
+    dp->seq_decode++;
+    slot->state = DEC_SLOT_BUSY;
+    pthread_mutex_unlock(&dp->lock);
+
+    r = dec_decode(dw, slot);
+
+    pthread_mutex_lock(&dp->lock);
+    slot->failed = !r;
+    slot->state = DEC_SLOT_DONE;
+    pthread_cond_broadcast(&dp->cv_done);
+  }
+  pthread_mutex_unlock(&dp->lock);
+
+  jpeg_destroy_decompress(&dw->cinfo);
+  free(dw->rows);
+  free(dw);
+  return NULL;
+}
+
+static bool
+dec_write(int fd, const void *p, size_t size)
+{
+  const uint8_t *bp = p;
+  ssize_t r;
+
+  while (size) {
+    r = write(fd, bp, size);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0) {
+      fprintf(stderr, "ERROR: write failure %s\n", strerror(errno));
+      return false;
+    }
+    bp += r;
+    size -= r;
+  }
+  return true;
+}
+
+static bool
+dec_output(struct decode_pool *dp, struct dec_slot *slot)
+{
+  char header[128];
+  int len;
+
+  if (slot->failed) {
+    fprintf(stderr, "WARN: frame #%"PRIu64" not decoded, skip\n",
+            dp->seq_output);
+    dp->failed++;
+    return true;
+  }
+
+  if (!dp->header_written) {
+    dp->width = slot->width;
+    dp->height = slot->height;
+    dp->header_written = true;
+    if (dp->format == DEC_FORMAT_Y4M) {
+      len = snprintf(header, sizeof(header),
+                     "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n",
+                     dp->width, dp->height, dp->fps ? dp->fps : 25u);
+      if (!dec_write(dp->output_fd, header, len))
+        return false;
+    }
+  } else if (dp->width != slot->width || dp->height != slot->height) {
+    fprintf(stderr, "WARN: frame #%"PRIu64" size changed "
+            "(%ux%u -> %ux%u), skip\n",
+            dp->seq_output, dp->width, dp->height,
+            slot->width, slot->height);
+    dp->failed++;
+    return true;
+  }
+
+  if (dp->format == DEC_FORMAT_Y4M &&
+      !dec_write(dp->output_fd, "FRAME\n", 6)) {
+    return false;
+  }
+
+  dp->frames++;
+  return dec_write(dp->output_fd, slot->yuv, slot->yuv_size);
+}
+
+/* wait oldest frame and write it */
+static bool
+dec_output_next(struct decode_pool *dp)
+{
+  struct dec_slot *slot = &dp->slot[dp->seq_output % dp->slot_count];
+  bool r;
+
+  pthread_mutex_lock(&dp->lock);
+  while (slot->state != DEC_SLOT_DONE)
+    pthread_cond_wait(&dp->cv_done, &dp->lock);
+  pthread_mutex_unlock(&dp->lock);
+
+  /* slot owned by pusher until marked free */
+  r = dec_output(dp, slot);
+  slot->state = DEC_SLOT_FREE;
+  dp->seq_output++;
+  return r;
+}
+
+bool
+dec_push(struct decode_pool *dp, const uint8_t *p, size_t size)
+{
+  struct dec_slot *slot;
+  bool ready;
+
+  if (dp->seq_push - dp->seq_output == dp->slot_count) {
+    /* all slots in use */
+    if (!dec_output_next(dp))
+      return false;
+  }
+
+  slot = &dp->slot[dp->seq_push % dp->slot_count];
+  if (!dec_grow(&slot->jpeg, &slot->jpeg_alloc, size))
+    return false;
+  memcpy(slot->jpeg, p, size);
+  slot->jpeg_size = size;
+
+  pthread_mutex_lock(&dp->lock);
+  slot->state = DEC_SLOT_QUEUED;
+  dp->seq_push++;
+  pthread_cond_signal(&dp->cv_job);
+  pthread_mutex_unlock(&dp->lock);
+
+  /* write results already decoded */
+  while (dp->seq_output != dp->seq_push) {
+    pthread_mutex_lock(&dp->lock);
+    ready = (dp->slot[dp->seq_output % dp->slot_count].state == DEC_SLOT_DONE);
+    pthread_mutex_unlock(&dp->lock);
+    if (!ready)
+      break;
+    if (!dec_output_next(dp))
+      return false;
+  }
+  return true;
+}
+
+bool
+dec_flush(struct decode_pool *dp)
+{
+  while (dp->seq_output != dp->seq_push) {
+    if (!dec_output_next(dp))
+      return false;
+  }
+  return true;
+}
+
+void
+dec_reset_stream(struct decode_pool *dp, int output_fd)
+{
+  dp->output_fd = output_fd;
+  dp->header_written = false;
+}
+
+bool
+dec_init(struct decode_pool *dp, unsigned workers, unsigned scale_denom,
+         enum dec_format format, int output_fd)
+{
+  struct dec_worker *dw;
+  long cpus;
+
+  memset(dp, 0, sizeof(*dp));
+
+  if (scale_denom != 1 && scale_denom != 2 &&
+      scale_denom != 4 && scale_denom != 8) {
+    fprintf(stderr, "ERROR: invalid scale 1/%u, expected 1, 2, 4 or 8\n",
+            scale_denom);
+    return false;
+  }
+
+  if (!workers) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (unsigned)cpus : 1u;
+  }
+  if (workers > DEC_MAX_WORKERS)
+    workers = DEC_MAX_WORKERS;
+
+  dp->format = format;
+  dp->output_fd = output_fd;
+  dp->scale_denom = scale_denom;
+  dp->slot_count = workers * DEC_SLOTS_PER_WORKER;
+  dp->slot = calloc(dp->slot_count, sizeof(*dp->slot));
+  if (!dp->slot) {
+    fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+            dp->slot_count * sizeof(*dp->slot), strerror(errno));
+    return false;
+  }
+
+  pthread_mutex_init(&dp->lock, NULL);
+  pthread_cond_init(&dp->cv_job, NULL);
+  pthread_cond_init(&dp->cv_done, NULL);
+
+  for (dp->workers = 0u; dp->workers < workers; dp->workers++) {
+    dw = calloc(1, sizeof(*dw));
+    if (!dw) {
+      fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+              sizeof(*dw), strerror(errno));
+      break;
+    }
+    dw->dp = dp;
+    if (pthread_create(&dp->thread[dp->workers], NULL,
+                       (void*(*)(void*))&dec_worker_thread, dw)) {
+      fprintf(stderr, "ERROR: decode thread not started\n");
+      free(dw);
+      break;
+    }
+  }
+
+  if (!dp->workers) {
+    dec_destroy(dp);
+    return false;
+  }
+
+  fprintf(stderr, "INFO: decode with %u workers, scale 1/%u\n",
+          dp->workers, dp->scale_denom);
+  return true;
+}
+
+void
+dec_destroy(struct decode_pool *dp)
+{
+  unsigned i;
+
+  pthread_mutex_lock(&dp->lock);
+  dp->stop = true;
+  pthread_cond_broadcast(&dp->cv_job);
+  pthread_mutex_unlock(&dp->lock);
+
+  for (i = 0u; i < dp->workers; i++) {
+    pthread_join(dp->thread[i], NULL);
+  }
+
+  for (i = 0u; i < dp->slot_count; i++) {
+    free(dp->slot[i].jpeg);
+    free(dp->slot[i].yuv);
+  }
+  free(dp->slot);
+
+  pthread_cond_destroy(&dp->cv_done);
+  pthread_cond_destroy(&dp->cv_job);
+  pthread_mutex_destroy(&dp->lock);
+  memset(dp, 0, sizeof(*dp));
+}
+
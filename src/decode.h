@@ -0,0 +1,109 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/decode.h
+ */
+#ifndef _DECODE_1560340211_H_
+#define _DECODE_1560340211_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define DEC_MAX_WORKERS 64
+
+enum dec_format {
+  /* YUV4MPEG2 stream, 4:2:0 */
+  DEC_FORMAT_Y4M = 0,
+  /* raw planar I420 frames */
+  DEC_FORMAT_YUV
+};
+
+enum dec_slot_state {
+  DEC_SLOT_FREE = 0,
+  DEC_SLOT_QUEUED,
+  DEC_SLOT_BUSY,
+  DEC_SLOT_DONE
+};
+
+struct dec_slot {
+  enum dec_slot_state state;
+  bool failed;
+
+  /* compressed frame */
+  uint8_t *jpeg;
+  size_t jpeg_size;
+  size_t jpeg_alloc;
+
+  /* planar result: Y, U, V */
+  uint8_t *yuv;
+  size_t yuv_size;
+  size_t yuv_alloc;
+  unsigned width;
+  unsigned height;
+};
+
+/*
+ * decode frames in worker threads,
+ * results written to output_fd in push order
+ */
+struct decode_pool {
+  enum dec_format format;
+  int output_fd;
+  /* 1, 2, 4 or 8 */
+  unsigned scale_denom;
+  /* frame rate for Y4M header */
+  unsigned fps;
+
+  pthread_t thread[DEC_MAX_WORKERS];
+  unsigned workers;
+
+  pthread_mutex_t lock;
+  /* new frame pushed or stop requested */
+  pthread_cond_t cv_job;
+  /* frame decoded */
+  pthread_cond_t cv_done;
+  bool stop;
+
+  struct dec_slot *slot;
+  unsigned slot_count;
+
+  /* frame sequences: next to push, decode and write */
+  uint64_t seq_push;
+  uint64_t seq_decode;
+  uint64_t seq_output;
+
+  /* stream parameters of first written frame */
+  bool header_written;
+  unsigned width;
+  unsigned height;
+
+  /* counters */
+  uint64_t frames;
+  uint64_t failed;
+};
+
+/* start workers, when `workers` is zero use all cpus */
+bool
+dec_init(struct decode_pool *dp, unsigned workers, unsigned scale_denom,
+         enum dec_format format, int output_fd);
+
+/*
+ * queue copy of frame for decoding
+ * return false when output failed
+ */
+bool
+dec_push(struct decode_pool *dp, const uint8_t *p, size_t size);
+
+/* wait all queued frames and write it */
+bool
+dec_flush(struct decode_pool *dp);
+
+/* start new stream (new output or new header) after flush */
+void
+dec_reset_stream(struct decode_pool *dp, int output_fd);
+
+/* stop workers, queued frames discarded */
+void
+dec_destroy(struct decode_pool *dp);
+
+#endif /* _DECODE_1560340211_H_ */
+
@@ -9,9 +9,126 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include "frame_index.h"
+#include "reader.h"
+
+/* frames per second histogram size, fps stored in uint8_t */
+#define VERIFY_FPS_HIST 256
+
+/* result of one index file check */
+struct verify_stats {
+  bool failed;
+  uint64_t frames;
+  uint64_t first_seq;
+  uint64_t last_seq;
+  struct timeval first;
+  struct timeval last;
+
+  /* errors */
+  uint64_t invalid_keys;
+  uint64_t bad_usec;
+  uint64_t seq_gaps;
+  uint64_t lost_frames;
+  /* frames dropped by capture and recorded in index: not errors */
+  uint64_t gap_markers;
+  uint64_t seq_backwards;
+  uint64_t time_backwards;
+  uint64_t offset_overlaps;
+  uint64_t frm_overflow;
+
+  /* bytes of incomplete record: normal for file in writing */
+  uint64_t tail_bytes;
+  uint64_t frm_size;
+  /* end of last frame in frm file */
+  uint64_t frm_used;
+
+  /* count of whole seconds with N frames */
+  uint64_t fps_hist[VERIFY_FPS_HIST];
+};
+
+/* interval histogram: 10 us bins up to 1 s */
+#define ANALYZE_BIN_US 10u
+#define ANALYZE_BINS 100000u
+/* longest gaps in report */
+#define ANALYZE_TOP_GAPS 16u
+/* minute with effective fps below this percent of nominal is reported */
+#define ANALYZE_FPS_LOW_PERCENT 95u
+
+struct analyze_gap {
+  struct timeval utc;
+  uint64_t duration_us;
+  uint64_t missing;
+};
+
+/* frames with same UTC anchor (one capture run) */
+struct analyze_session {
+  struct timeval anchor;
+  struct timeval first;
+  struct timeval last;
+  uint64_t first_seq;
+  uint64_t last_seq;
+  uint64_t frames;
+  unsigned fps;
+  /* file mtime minus frame UTC time of last record */
+  int64_t drift_first_us;
+  int64_t drift_last_us;
+  struct timeval drift_first_at;
+  struct timeval drift_last_at;
+  bool drift_valid;
+};
+
+struct analyze_context {
+  uint64_t *hist;
+  uint64_t hist_over;
+  uint64_t intervals;
+  uint64_t interval_min;
+  uint64_t interval_max;
+  uint64_t interval_sum;
+  /* clock steps back between frames, not in interval stats */
+  uint64_t steps_back;
+
+  uint64_t gaps;
+  uint64_t gaps_missing;
+  struct analyze_gap top[ANALYZE_TOP_GAPS];
+  unsigned top_count;
+
+  /* current minute */
+  time_t minute;
+  uint64_t minute_frames;
+  bool minute_whole;
+  /* per-minute effective fps */
+  bool print_minutes;
+  bool minutes_printed;
+  uint64_t minutes;
+  uint64_t minutes_low;
+  double minute_fps_min;
+  double minute_fps_max;
+  double minute_fps_sum;
+
+  struct analyze_session *sessions;
+  size_t session_count;
+  size_t session_alloc;
+
+  /* previous frame */
+  struct timeval prev;
+  bool prev_valid;
+  uint64_t frames;
+};
+
+struct verify_context {
+  struct rdr_archive ar;
+  struct verify_stats *stats;
+
+  pthread_mutex_t lock;
+  /* next segment for check */
+  size_t next;
+};
 
 /* print header struct
  * return false when *fh is invalid
@@ -25,14 +142,16 @@ dump_fh(frame_header_t *fh, size_t file_size)
   timebin_to_timeval(&fh->cap_time.utc, &utc);
 
   printf("# HEADER [%"PRIu32"] < "
-         "frames = %zu, fps = %u [%dx%d], "
+         "frames = %zu, fps = %u [%dx%d], quality = %u, %s"
          "first frame time = "TV_FMT", "
          "UTC start time = "TV_FMT" "
          ">\n",
          BSWAP_BE32(fh->seq_be),
-         (file_size - sizeof(frame_header_t)) / sizeof(frame_index_t),
+         (file_size - FH_SIZE(fh)) / sizeof(frame_index_t),
          fh->frame.fps,
          BSWAP_BE16(fh->frame.width_be), BSWAP_BE16(fh->frame.height_be),
+         FH_QUALITY(fh),
+         (FH_FLAGS(fh) & FH_FLAG_EVENT) ? "event, " : "",
          TV_ARGS(&ltime),
          TV_ARGS(&utc));
   return true;
@@ -97,7 +216,8 @@ dump_fi(frame_index_t *pfi, frame_index_t *fi)
   printf("[%6llu] { %6"PRIu64" time = "TV_FMT", offset = %10"PRIu64", size = %10"PRIu32" } time diff: "TV_FMT"\n",
          seq, frame_seq, TV_ARGS(&ctime), offset, size, TV_ARGS(&tv_diff));
 
-  fps++;
+  if (!FI_IS_GAP(fi))
+    fps++;
 
   if (errors)
     return false;
@@ -108,65 +228,755 @@ dump_fi(frame_index_t *pfi, frame_index_t *fi)
 }
 
 
+#define VERIFY_ERRORS(_st) \
+  ((_st)->failed + (_st)->invalid_keys + (_st)->bad_usec + \
+   (_st)->seq_gaps + (_st)->seq_backwards + (_st)->time_backwards + \
+   (_st)->offset_overlaps + (_st)->frm_overflow)
+
+void
+verify_fps_count(struct verify_stats *st, unsigned count)
+{
+  st->fps_hist[count < VERIFY_FPS_HIST ? count : VERIFY_FPS_HIST - 1]++;
+}
+
+/* check records of one index file, frames file size from header path */
+void
+verify_segment(struct rdr_archive *ar, struct rdr_segment *seg,
+               struct verify_stats *st)
+{
+  struct rdr_index ix;
+  struct stat frm_st;
+  frame_index_t fi;
+  struct timeval tv;
+  struct timeval ptv = {0};
+  uint64_t seq;
+  uint64_t offset;
+  uint64_t end;
+  time_t second = 0;
+  unsigned count = 0u;
+  bool whole = false;
+  size_t i;
+
+  if (!rdr_index_open(&ix, ar->dirfd, seg->path)) {
+    fprintf(stderr, "WARN: %s\n", rdr_error());
+    st->failed = true;
+    return;
+  }
+
+  if (fstatat(ar->dirfd, seg->frm, &frm_st, 0) == 0)
+    st->frm_size = frm_st.st_size;
+
+  st->tail_bytes = ix.tail;
+  for (i = 0u; i < ix.count; i++) {
+    memcpy(&fi, &ix.fi[i], sizeof(fi));
+    if (!FI_KEY_VALID(&fi)) {
+      st->invalid_keys++;
+      continue;
+    }
+
+    if (BSWAP_BE32(fi.tv.usec_be) >= 1000000u)
+      st->bad_usec++;
+
+    timebin_to_timeval(&fi.tv, &tv);
+    seq = BSWAP_BE64(fi.seq_be);
+    offset = BSWAP_BE64(fi.offset_be);
+    end = offset + BSWAP_BE32(fi.size_be);
+
+    if (!st->frames && !st->gap_markers) {
+      st->first_seq = seq;
+      memcpy(&st->first, &tv, sizeof(tv));
+      second = tv.tv_sec;
+    } else {
+      if (seq <= st->last_seq) {
+        st->seq_backwards++;
+      } else if (seq != st->last_seq + 1) {
+        st->seq_gaps++;
+        st->lost_frames += seq - st->last_seq - 1;
+      }
+
+      if (timercmp(&tv, &ptv, <))
+        st->time_backwards++;
+
+      if (offset < st->frm_used)
+        st->offset_overlaps++;
+
+      if (tv.tv_sec > second) {
+        /* partial first second is not counted */
+        if (whole)
+          verify_fps_count(st, count);
+        for (second++; second < tv.tv_sec; second++)
+          verify_fps_count(st, 0u);
+        whole = true;
+        count = 0u;
+      }
+    }
+
+    if (end > st->frm_size)
+      st->frm_overflow++;
+    if (end > st->frm_used)
+      st->frm_used = end;
+
+    if (FI_IS_GAP(&fi)) {
+      st->gap_markers++;
+    } else {
+      count++;
+      st->frames++;
+    }
+    st->last_seq = seq;
+    memcpy(&st->last, &tv, sizeof(tv));
+    memcpy(&ptv, &tv, sizeof(tv));
+  }
+
+  rdr_index_close(&ix);
+}
+
+void *
+verify_worker(void *arg)
+{
+  struct verify_context *vc = arg;
+  size_t i;
+
+  while (true) {
+    pthread_mutex_lock(&vc->lock);
+    i = vc->next++;
+    pthread_mutex_unlock(&vc->lock);
+
+    if (i >= vc->ar.seg_count)
+      break;
+    verify_segment(&vc->ar, &vc->ar.segs[i], &vc->stats[i]);
+  }
+  return NULL;
+}
+
+/* string as quoted JSON string: file names are not trusted */
+void
+json_string(const char *str)
+{
+  const unsigned char *c;
+
+  putchar('"');
+  for (c = (const unsigned char *)str; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      printf("\\%c", *c);
+    else if (*c < 0x20u || *c == 0x7fu)
+      printf("\\u%04x", *c);
+    else
+      putchar(*c);
+  }
+  putchar('"');
+}
+
+void
+verify_print_segment(struct rdr_segment *seg, struct verify_stats *st,
+                     bool *first)
+{
+  printf("%s\n    {\"file\": ", *first ? "" : ",");
+  json_string(seg->path);
+  printf(", \"frm\": ");
+  json_string(seg->frm);
+  printf(", "
+         "\"seq\": %"PRIu32", \"fps\": %u, \"quality\": %u, "
+         "\"frames\": %"PRIu64", "
+         "\"failed\": %s, \"invalid_keys\": %"PRIu64", "
+         "\"bad_usec\": %"PRIu64", \"seq_gaps\": %"PRIu64", "
+         "\"lost_frames\": %"PRIu64", \"gap_markers\": %"PRIu64", "
+         "\"seq_backwards\": %"PRIu64", "
+         "\"time_backwards\": %"PRIu64", \"offset_overlaps\": %"PRIu64", "
+         "\"frm_overflow\": %"PRIu64", \"tail_bytes\": %"PRIu64", "
+         "\"frm_size\": %"PRIu64", \"frm_used\": %"PRIu64"}",
+         BSWAP_BE32(seg->fh.seq_be), seg->fh.frame.fps,
+         seg->fh.frame.quality, st->frames, st->failed ? "true" : "false", st->invalid_keys,
+         st->bad_usec, st->seq_gaps, st->lost_frames, st->gap_markers,
+         st->seq_backwards,
+         st->time_backwards, st->offset_overlaps, st->frm_overflow,
+         st->tail_bytes, st->frm_size, st->frm_used);
+  *first = false;
+}
+
+/* rdr_open() with messages of reader */
+bool
+dump_archive_open(struct rdr_archive *ar, const char *dirpath,
+                  bool allow_empty)
+{
+  if (!rdr_open(ar, dirpath, allow_empty)) {
+    fprintf(stderr, "ERROR: %s\n", rdr_error());
+    return false;
+  }
+  if (ar->skipped)
+    fprintf(stderr, "WARN: %zu index files skipped, last: %s\n",
+            ar->skipped, rdr_error());
+  fprintf(stderr, "INFO: %zu frame index files loaded\n", ar->seg_count);
+  return true;
+}
+
+/* check all index files in directory
+ * return false when archive has errors
+ */
+bool
+verify(const char *dirpath, unsigned workers)
+{
+  struct verify_context vc = {0};
+  struct verify_stats total = {0};
+  struct verify_stats *st;
+  struct verify_stats *prev = NULL;
+  pthread_t thread[64];
+  struct timeval start;
+  struct timeval end;
+  struct timeval tv;
+  uint64_t cross_gaps = 0u;
+  uint64_t cross_lost = 0u;
+  uint64_t seq_restarts = 0u;
+  /* gaps before files of triggered recording */
+  uint64_t events = 0u;
+  uint64_t idle_frames = 0u;
+  uint64_t errors;
+  bool first = true;
+  size_t i;
+  unsigned j;
+
+  if (!dump_archive_open(&vc.ar, dirpath, true))
+    return false;
+
+  vc.stats = calloc(vc.ar.seg_count, sizeof(*vc.stats));
+  if (!vc.stats) {
+    fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+            vc.ar.seg_count * sizeof(*vc.stats), strerror(errno));
+    rdr_close(&vc.ar);
+    return false;
+  }
+
+  if (!workers) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (unsigned)cpus : 1u;
+  }
+  if (workers > sizeof(thread) / sizeof(*thread))
+    workers = sizeof(thread) / sizeof(*thread);
+  if (workers > vc.ar.seg_count)
+    workers = vc.ar.seg_count;
+
+  pthread_mutex_init(&vc.lock, NULL);
+  for (j = 0u; j < workers; j++) {
+    if (pthread_create(&thread[j], NULL, verify_worker, &vc)) {
+      fprintf(stderr, "ERROR: thread not started\n");
+      break;
+    }
+  }
+  /* work in current thread when threads not started */
+  verify_worker(&vc);
+  while (j--)
+    pthread_join(thread[j], NULL);
+  pthread_mutex_destroy(&vc.lock);
+
+  rdr_coverage(&vc.ar, &start, &end);
+  for (i = 0u; i < vc.ar.seg_count; i++) {
+    st = &vc.stats[i];
+    if (st->frames || st->gap_markers) {
+      /* segments sorted by time: frames sequence continue */
+      if (prev) {
+        if (st->first_seq <= prev->last_seq) {
+          seq_restarts++;
+        } else if (st->first_seq != prev->last_seq + 1 &&
+                   (FH_FLAGS(&vc.ar.segs[i].fh) & FH_FLAG_EVENT)) {
+          idle_frames += st->first_seq - prev->last_seq - 1;
+        } else if (st->first_seq != prev->last_seq + 1) {
+          cross_gaps++;
+          cross_lost += st->first_seq - prev->last_seq - 1;
+        }
+      }
+      prev = st;
+    }
+
+    if (FH_FLAGS(&vc.ar.segs[i].fh) & FH_FLAG_EVENT)
+      events++;
+    total.failed |= st->failed;
+    total.frames += st->frames;
+    total.invalid_keys += st->invalid_keys;
+    total.bad_usec += st->bad_usec;
+    total.seq_gaps += st->seq_gaps;
+    total.lost_frames += st->lost_frames;
+    total.gap_markers += st->gap_markers;
+    total.seq_backwards += st->seq_backwards;
+    total.time_backwards += st->time_backwards;
+    total.offset_overlaps += st->offset_overlaps;
+    total.frm_overflow += st->frm_overflow;
+    total.frm_size += st->frm_size;
+    total.frm_used += st->frm_used;
+    /* last file can be in writing */
+    if (i + 1 != vc.ar.seg_count)
+      total.tail_bytes += st->tail_bytes;
+    for (j = 0u; j < VERIFY_FPS_HIST; j++)
+      total.fps_hist[j] += st->fps_hist[j];
+  }
+
+  errors = VERIFY_ERRORS(&total) + cross_gaps + (total.tail_bytes ? 1u : 0u);
+
+  printf("{\n");
+  printf("  \"ok\": %s,\n", errors ? "false" : "true");
+  printf("  \"errors\": %"PRIu64",\n", errors);
+  printf("  \"segments\": %zu,\n", vc.ar.seg_count);
+  printf("  \"frames\": %"PRIu64",\n", total.frames);
+  printf("  \"start\": "TV_FMT",\n", TV_ARGS(&start));
+  printf("  \"end\": "TV_FMT",\n", TV_ARGS(&end));
+  timersub(&end, &start, &tv);
+  printf("  \"duration\": "TV_FMT",\n", TV_ARGS(&tv));
+  printf("  \"invalid_keys\": %"PRIu64",\n", total.invalid_keys);
+  printf("  \"bad_usec\": %"PRIu64",\n", total.bad_usec);
+  printf("  \"seq_gaps\": %"PRIu64",\n", total.seq_gaps + cross_gaps);
+  printf("  \"lost_frames\": %"PRIu64",\n", total.lost_frames + cross_lost);
+  printf("  \"gap_markers\": %"PRIu64",\n", total.gap_markers);
+  printf("  \"seq_backwards\": %"PRIu64",\n", total.seq_backwards);
+  printf("  \"seq_restarts\": %"PRIu64",\n", seq_restarts);
+  printf("  \"events\": %"PRIu64",\n", events);
+  printf("  \"idle_frames\": %"PRIu64",\n", idle_frames);
+  printf("  \"time_backwards\": %"PRIu64",\n", total.time_backwards);
+  printf("  \"offset_overlaps\": %"PRIu64",\n", total.offset_overlaps);
+  printf("  \"frm_overflow\": %"PRIu64",\n", total.frm_overflow);
+  printf("  \"truncated_bytes\": %"PRIu64",\n", total.tail_bytes);
+  printf("  \"frm_size\": %"PRIu64",\n", total.frm_size);
+  printf("  \"frm_used\": %"PRIu64",\n", total.frm_used);
+
+  printf("  \"fps_histogram\": {");
+  for (j = 0u; j < VERIFY_FPS_HIST; j++) {
+    if (!total.fps_hist[j])
+      continue;
+    printf("%s\"%u\": %"PRIu64, first ? "" : ", ", j, total.fps_hist[j]);
+    first = false;
+  }
+  printf("},\n");
+
+  /* details only for files with errors */
+  printf("  \"bad_segments\": [");
+  first = true;
+  for (i = 0u; i < vc.ar.seg_count; i++) {
+    st = &vc.stats[i];
+    if (VERIFY_ERRORS(st) || (st->tail_bytes && i + 1 != vc.ar.seg_count))
+      verify_print_segment(&vc.ar.segs[i], st, &first);
+  }
+  printf("%s]\n", first ? "" : "\n  ");
+  printf("}\n");
+
+  free(vc.stats);
+  rdr_close(&vc.ar);
+  return !errors;
+}
+
+void
+analyze_gap_add(struct analyze_context *ac, struct timeval *utc,
+                uint64_t duration_us, uint64_t missing)
+{
+  unsigned i;
+
+  ac->gaps++;
+  ac->gaps_missing += missing;
+
+  /* keep longest gaps sorted by duration */
+  if (ac->top_count == ANALYZE_TOP_GAPS &&
+      ac->top[ANALYZE_TOP_GAPS - 1].duration_us >= duration_us)
+    return;
+  if (ac->top_count < ANALYZE_TOP_GAPS)
+    ac->top_count++;
+  for (i = ac->top_count - 1; i && ac->top[i - 1].duration_us < duration_us; i--)
+    ac->top[i] = ac->top[i - 1];
+  memcpy(&ac->top[i].utc, utc, sizeof(*utc));
+  ac->top[i].duration_us = duration_us;
+  ac->top[i].missing = missing;
+}
+
+void
+analyze_minute_done(struct analyze_context *ac, struct analyze_session *ss,
+                    time_t minute, uint64_t frames)
+{
+  double fps = frames / 60.0;
+
+  if (!ac->minutes || fps < ac->minute_fps_min)
+    ac->minute_fps_min = fps;
+  if (!ac->minutes || fps > ac->minute_fps_max)
+    ac->minute_fps_max = fps;
+  ac->minute_fps_sum += fps;
+  ac->minutes++;
+  if (fps * 100u < (double)ss->fps * ANALYZE_FPS_LOW_PERCENT)
+    ac->minutes_low++;
+
+  if (ac->print_minutes) {
+    printf("%s\n    [%"PRIu64", %.3f]", ac->minutes_printed ? "," : "",
+           (uint64_t)minute * 60u, fps);
+    ac->minutes_printed = true;
+  }
+}
+
+/* frame in UTC time, session contains frame */
+void
+analyze_frame(struct analyze_context *ac, struct analyze_session *ss,
+              struct timeval *utc, uint64_t seq)
+{
+  struct timeval diff;
+  uint64_t us;
+  uint64_t period_us;
+  time_t minute = utc->tv_sec / 60;
+
+  ac->frames++;
+  ss->frames++;
+  timersub(utc, &ac->prev, &diff);
+  if (!ac->prev_valid) {
+    /* first frame of session */
+    memcpy(&ss->first, utc, sizeof(*utc));
+    ss->first_seq = seq;
+    ac->minute = minute;
+    ac->minute_frames = 0u;
+    ac->minute_whole = false;
+  } else if (diff.tv_sec < 0) {
+    /* clock step back: not an interval, minutes counted from here */
+    ac->steps_back++;
+    ac->minute = minute;
+    ac->minute_frames = 0u;
+    ac->minute_whole = false;
+  } else {
+    us = (uint64_t)diff.tv_sec * 1000000u + diff.tv_usec;
+
+    if (us / ANALYZE_BIN_US < ANALYZE_BINS)
+      ac->hist[us / ANALYZE_BIN_US]++;
+    else
+      ac->hist_over++;
+    if (!ac->intervals || us < ac->interval_min)
+      ac->interval_min = us;
+    if (us > ac->interval_max)
+      ac->interval_max = us;
+    ac->interval_sum += us;
+    ac->intervals++;
+
+    /* gap: interval longer than 1.5 frame periods */
+    period_us = 1000000u / (ss->fps ? ss->fps : 1u);
+    if (us * 2u > period_us * 3u) {
+      analyze_gap_add(ac, &ac->prev, us,
+                      (us + period_us / 2u) / period_us - 1u);
+    }
+
+    if (minute != ac->minute) {
+      /* partial first minute of session not counted */
+      if (ac->minute_whole)
+        analyze_minute_done(ac, ss, ac->minute, ac->minute_frames);
+      for (ac->minute++; ac->minute < minute; ac->minute++)
+        analyze_minute_done(ac, ss, ac->minute, 0u);
+      ac->minute_whole = true;
+      ac->minute_frames = 0u;
+    }
+  }
+
+  ac->minute_frames++;
+  ss->last_seq = seq;
+  memcpy(&ss->last, utc, sizeof(*utc));
+  memcpy(&ac->prev, utc, sizeof(*utc));
+  ac->prev_valid = true;
+}
+
+struct analyze_session *
+analyze_session(struct analyze_context *ac, struct rdr_segment *seg)
+{
+  struct analyze_session *ss;
+  size_t alloc;
+
+  if (ac->session_count) {
+    ss = &ac->sessions[ac->session_count - 1];
+    if (!timercmp(&ss->anchor, &seg->utc, !=))
+      return ss;
+  }
+
+  if (ac->session_count == ac->session_alloc) {
+    alloc = ac->session_alloc ? ac->session_alloc * 2 : 16u;
+    ss = realloc(ac->sessions, alloc * sizeof(*ss));
+    if (!ss) {
+      fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+              alloc * sizeof(*ss), strerror(errno));
+      return NULL;
+    }
+    ac->sessions = ss;
+    ac->session_alloc = alloc;
+  }
+
+  /* new capture run: intervals and minutes not continued */
+  ac->prev_valid = false;
+  ss = &ac->sessions[ac->session_count++];
+  memset(ss, 0, sizeof(*ss));
+  memcpy(&ss->anchor, &seg->utc, sizeof(ss->anchor));
+  ss->fps = seg->fh.frame.fps;
+  return ss;
+}
+
+/* compare file write time with UTC time of last frame in file */
+void
+analyze_drift(struct rdr_archive *ar, struct rdr_segment *seg,
+              struct analyze_session *ss)
+{
+  struct stat st;
+  struct timeval last;
+  int64_t drift;
+
+  if (!seg->frame_count || fstatat(ar->dirfd, seg->path, &st, 0) == -1)
+    return;
+
+  timeradd(&seg->utc, &seg->last, &last);
+  drift = ((int64_t)st.st_mtim.tv_sec - last.tv_sec) * 1000000 +
+          (st.st_mtim.tv_nsec / 1000 - last.tv_usec);
+  if (!ss->drift_valid) {
+    ss->drift_first_us = drift;
+    memcpy(&ss->drift_first_at, &last, sizeof(last));
+    ss->drift_valid = true;
+  }
+  ss->drift_last_us = drift;
+  memcpy(&ss->drift_last_at, &last, sizeof(last));
+}
+
+uint64_t
+analyze_percentile(struct analyze_context *ac, unsigned permille)
+{
+  uint64_t rank;
+  uint64_t n = 0u;
+  size_t i;
+
+  if (!ac->intervals)
+    return 0u;
+
+  rank = (ac->intervals * permille + 999u) / 1000u;
+  if (!rank)
+    rank = 1u;
+  for (i = 0u; i < ANALYZE_BINS; i++) {
+    n += ac->hist[i];
+    if (n >= rank)
+      return (uint64_t)i * ANALYZE_BIN_US;
+  }
+  return ac->interval_max;
+}
+
+void
+analyze_print_session(struct analyze_session *ss, bool first)
+{
+  struct timeval span;
+  double span_s;
+  double efps = 0.0;
+  double ppm = 0.0;
+  double drift_ppm = 0.0;
+  double drift_span;
+
+  timersub(&ss->last, &ss->first, &span);
+  span_s = span.tv_sec + span.tv_usec / 1e6;
+  if (ss->frames > 1u && span_s > 0.0) {
+    efps = (ss->frames - 1u) / span_s;
+    /* frame period by sequence numbers: lost frames not affect it */
+    if (ss->fps && ss->last_seq > ss->first_seq)
+      ppm = (span_s * ss->fps / (ss->last_seq - ss->first_seq) - 1.0) * 1e6;
+  }
+
+  timersub(&ss->drift_last_at, &ss->drift_first_at, &span);
+  drift_span = span.tv_sec + span.tv_usec / 1e6;
+  if (drift_span > 0.0)
+    drift_ppm = (ss->drift_last_us - ss->drift_first_us) / drift_span;
+
+  printf("%s\n    {\"anchor\": "TV_FMT", \"start\": "TV_FMT", "
+         "\"end\": "TV_FMT", \"frames\": %"PRIu64", \"fps\": %u, "
+         "\"effective_fps\": %.4f, \"period_error_ppm\": %.1f, "
+         "\"wall_drift_first_us\": %"PRId64", "
+         "\"wall_drift_last_us\": %"PRId64", \"wall_drift_ppm\": %.1f}",
+         first ? "" : ",",
+         TV_ARGS(&ss->anchor), TV_ARGS(&ss->first), TV_ARGS(&ss->last),
+         ss->frames, ss->fps, efps, ppm,
+         ss->drift_first_us, ss->drift_last_us, drift_ppm);
+}
+
+/* stream all index files in time order and print timing report */
+bool
+analyze(const char *dirpath, bool print_minutes)
+{
+  struct analyze_context ac = {0};
+  struct rdr_archive ar;
+  struct rdr_index ix;
+  struct rdr_segment *seg;
+  struct analyze_session *ss;
+  frame_index_t fi;
+  struct timeval local;
+  struct timeval utc;
+  size_t i;
+  size_t k;
+  bool r = true;
+
+  if (!dump_archive_open(&ar, dirpath, false))
+    return false;
+
+  ac.hist = calloc(ANALYZE_BINS, sizeof(*ac.hist));
+  if (!ac.hist) {
+    fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+            ANALYZE_BINS * sizeof(*ac.hist), strerror(errno));
+    rdr_close(&ar);
+    return false;
+  }
+  ac.print_minutes = print_minutes;
+
+  printf("{\n");
+  if (print_minutes)
+    printf("  \"minutes\": [");
+
+  for (i = 0u; r && i < ar.seg_count; i++) {
+    seg = &ar.segs[i];
+    if (!(ss = analyze_session(&ac, seg))) {
+      r = false;
+      break;
+    }
+    analyze_drift(&ar, seg, ss);
+
+    if (!rdr_index_open(&ix, ar.dirfd, seg->path)) {
+      fprintf(stderr, "WARN: %s\n", rdr_error());
+      continue;
+    }
+    for (k = 0u; k < ix.count; k++) {
+      memcpy(&fi, &ix.fi[k], sizeof(fi));
+      /* dropped frame is gap in intervals */
+      if (!FI_KEY_VALID(&fi) || FI_IS_GAP(&fi))
+        continue;
+      timebin_to_timeval(&fi.tv, &local);
+      timeradd(&seg->utc, &local, &utc);
+      analyze_frame(&ac, ss, &utc, BSWAP_BE64(fi.seq_be));
+    }
+    rdr_index_close(&ix);
+  }
+
+  if (print_minutes)
+    printf("%s],\n", ac.minutes_printed ? "\n  " : "");
+
+  printf("  \"segments\": %zu,\n", ar.seg_count);
+  printf("  \"frames\": %"PRIu64",\n", ac.frames);
+  printf("  \"interval_us\": {\"min\": %"PRIu64", \"p50\": %"PRIu64", "
+         "\"p90\": %"PRIu64", \"p99\": %"PRIu64", \"p999\": %"PRIu64", "
+         "\"max\": %"PRIu64", \"mean\": %.1f, \"over_1s\": %"PRIu64"},\n",
+         ac.interval_min,
+         analyze_percentile(&ac, 500u), analyze_percentile(&ac, 900u),
+         analyze_percentile(&ac, 990u), analyze_percentile(&ac, 999u),
+         ac.interval_max,
+         ac.intervals ? (double)ac.interval_sum / ac.intervals : 0.0,
+         ac.hist_over);
+  printf("  \"clock_steps_back\": %"PRIu64",\n", ac.steps_back);
+
+  printf("  \"gaps\": {\"count\": %"PRIu64", \"missing_frames\": %"PRIu64", "
+         "\"longest\": [", ac.gaps, ac.gaps_missing);
+  for (k = 0u; k < ac.top_count; k++) {
+    printf("%s\n    {\"utc\": "TV_FMT", \"duration_us\": %"PRIu64", "
+           "\"missing\": %"PRIu64"}", k ? "," : "",
+           TV_ARGS(&ac.top[k].utc), ac.top[k].duration_us, ac.top[k].missing);
+  }
+  printf("%s]},\n", ac.top_count ? "\n  " : "");
+
+  printf("  \"minute_fps\": {\"minutes\": %"PRIu64", \"min\": %.3f, "
+         "\"max\": %.3f, \"mean\": %.3f, \"below_%u_percent\": %"PRIu64"},\n",
+         ac.minutes, ac.minute_fps_min, ac.minute_fps_max,
+         ac.minutes ? ac.minute_fps_sum / ac.minutes : 0.0,
+         ANALYZE_FPS_LOW_PERCENT, ac.minutes_low);
+
+  printf("  \"sessions\": [");
+  for (k = 0u; k < ac.session_count; k++)
+    analyze_print_session(&ac.sessions[k], !k);
+  printf("%s]\n", ac.session_count ? "\n  " : "");
+  printf("}\n");
+
+  free(ac.sessions);
+  free(ac.hist);
+  rdr_close(&ar);
+  return r;
+}
+
+void
+usage(void)
+{
+  printf("usage: <file name>\n");
+  printf("       -v [-j <workers>] [<directory>]\n");
+  printf("       -a [-m] [<directory>]\n");
+  printf("  -v  verify all index files in directory, print JSON summary\n");
+  printf("  -a  frame timing analysis of directory, print JSON report\n");
+  printf("  -m  add effective fps of each minute to report\n");
+  printf("  -j  verify threads, default is cpu count\n");
+}
+
 int
 main(int argc, char *argv[])
 {
-  int fd;
-  int r;
-  size_t file_size = 0u;
+  struct rdr_index ix;
+  size_t i;
   frame_header_t fh = FH_INIT_VALUE;
   frame_index_t fi = FI_INIT_VALUE;
   frame_index_t pfi = FI_INIT_VALUE;
 
-  if (argc < 2) {
-    printf("usage: <file name>\n");
-    return EXIT_FAILURE;
+  bool verify_mode = false;
+  bool analyze_mode = false;
+  bool minutes = false;
+  unsigned workers = 0u;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "vj:am")) != -1) {
+    switch (opt) {
+    case 'v':
+      verify_mode = true;
+      break;
+    case 'a':
+      analyze_mode = true;
+      break;
+    case 'm':
+      minutes = true;
+      break;
+    case 'j':
+      workers = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
   }
 
-  fd = open(argv[1], O_RDONLY);
-  if (fd == -1) {
-    perror("open");
-    return EXIT_FAILURE;
+  if (analyze_mode) {
+    if (!analyze(optind < argc ? argv[optind] : ".", minutes))
+      return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+  }
+
+  if (verify_mode) {
+    if (!verify(optind < argc ? argv[optind] : ".", workers))
+      return EXIT_FAILURE;
+    return EXIT_SUCCESS;
   }
 
-  file_size = lseek(fd, 0u, SEEK_END);
-  lseek(fd, 0u, SEEK_SET);
+  if (optind >= argc) {
+    usage();
+    return EXIT_FAILURE;
+  }
 
-  /* read header */
-  r = read(fd, &fh, sizeof(fh));
-  if (r != sizeof(fh)) {
-    printf("# header: unexpected end: %d bytes readed, expected %d\n",
-           r, (int)sizeof(fh));
-    close(fd);
+  if (!rdr_index_open(&ix, AT_FDCWD, argv[optind])) {
+    fprintf(stderr, "WARN: %s\n", rdr_error());
+    printf("# header: not readed\n");
     return EXIT_FAILURE;
   }
 
-  if (!dump_fh(&fh, file_size)) {
+  memcpy(&fh, ix.fh, sizeof(fh));
+  if (!dump_fh(&fh, ix.size)) {
     printf("# header: invalid data\n");
+    rdr_index_close(&ix);
     return EXIT_FAILURE;
   }
 
   /* read frames */
-  while (true) {
-    r = read(fd, &fi, sizeof(fi));
-    if (r == 0) {
-      printf("EOF\n");
+  for (i = 0u; i < ix.count; i++) {
+    memcpy(&fi, &ix.fi[i], sizeof(fi));
+    if (!dump_fi(&pfi, &fi)) {
+      printf("# index: invalid data\n");
       break;
     }
-    if (r != sizeof(fi)) {
+  }
+
+  if (i == ix.count) {
+    if (ix.tail) {
       printf("# index: unexpected end: %d bytes readed, expected %d\n",
-             r, (int)sizeof(fi));
-      close(fd);
+             (int)ix.tail, (int)sizeof(fi));
+      rdr_index_close(&ix);
       return EXIT_FAILURE;
     }
-
-    if (!dump_fi(&pfi, &fi)) {
-      printf("# index: invalid data\n");
-      break;
-    }
+    printf("EOF\n");
   }
 
-  close(fd);
+  rdr_index_close(&ix);
   return EXIT_SUCCESS;
 }
-
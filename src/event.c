@@ -0,0 +1,311 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/event.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "event.h"
+
+/* frames of frame size averages before activity is detected */
+#define EVENT_WARMUP 64u
+/* weights of last frame size in short and long average */
+#define EVENT_FAST (1.0 / 4.0)
+#define EVENT_SLOW (1.0 / 64.0)
+
+bool
+event_parse(struct event_cfg *cfg, const char *spec)
+{
+  char buf[256];
+  char *save = NULL;
+  char *tok;
+  char *end;
+
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->pre = 10.0;
+  cfg->post = 30.0;
+  cfg->ram = 64u * 1024u * 1024u;
+  if (strlen(spec) >= sizeof(buf)) {
+    fprintf(stderr, "! event: spec too long\n");
+    return false;
+  }
+  strcpy(buf, spec);
+
+  for (tok = strtok_r(buf, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    if (!strncmp(tok, "pre=", 4)) {
+      cfg->pre = strtod(tok + 4, &end);
+      if (*end || cfg->pre < 0.0) {
+        fprintf(stderr, "! event: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "post=", 5)) {
+      cfg->post = strtod(tok + 5, &end);
+      if (*end || cfg->post <= 0.0) {
+        fprintf(stderr, "! event: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "ram=", 4)) {
+      cfg->ram = strtoul(tok + 4, &end, 10) * 1024u * 1024u;
+      if (*end || !cfg->ram) {
+        fprintf(stderr, "! event: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "activity=", 9)) {
+      cfg->activity_percent = (unsigned)strtoul(tok + 9, &end, 10);
+      if (*end || !cfg->activity_percent) {
+        fprintf(stderr, "! event: invalid '%s'\n", tok);
+        return false;
+      }
+    } else if (!strncmp(tok, "socket=", 7)) {
+      if (!tok[7] || strlen(tok + 7) >= sizeof(cfg->socket)) {
+        fprintf(stderr, "! event: invalid '%s'\n", tok);
+        return false;
+      }
+      strcpy(cfg->socket, tok + 7);
+    } else {
+      fprintf(stderr, "! event: unknown option '%s'\n", tok);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool
+event_socket_open(struct event *ev)
+{
+  struct sockaddr_un sa = {.sun_family = AF_UNIX};
+
+  strcpy(sa.sun_path, ev->cfg.socket);
+  ev->sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (ev->sock == -1) {
+    fprintf(stderr, "! event: socket: %s\n", strerror(errno));
+    return false;
+  }
+  /* left by previous run */
+  unlink(ev->cfg.socket);
+  if (bind(ev->sock, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    fprintf(stderr, "! event: socket '%s' not bound: %s\n",
+            ev->cfg.socket, strerror(errno));
+    close(ev->sock);
+    ev->sock = -1;
+    return false;
+  }
+  return true;
+}
+
+bool
+event_init(struct event *ev, const struct event_cfg *cfg, unsigned mem_flags)
+{
+  memset(ev, 0, sizeof(*ev));
+  ev->cfg = *cfg;
+  ev->sock = -1;
+  if (!cbf_init_mem(&ev->ring, cfg->ram, mem_flags)) {
+    fprintf(stderr, "! event: ring of %zu MB not allocated\n",
+            cfg->ram >> 20);
+    return false;
+  }
+  if (cfg->socket[0] && !event_socket_open(ev)) {
+    cbf_destroy(&ev->ring);
+    return false;
+  }
+  fprintf(stderr, "@ event: %.1f s before and %.1f s after trigger, "
+          "ring %zu MB", cfg->pre, cfg->post, cfg->ram >> 20);
+  if (cfg->activity_percent)
+    fprintf(stderr, ", activity %u%%", cfg->activity_percent);
+  if (cfg->socket[0])
+    fprintf(stderr, ", socket '%s'", cfg->socket);
+  fprintf(stderr, "\n");
+  return true;
+}
+
+void
+event_free(struct event *ev)
+{
+  if (ev->sock != -1) {
+    close(ev->sock);
+    unlink(ev->cfg.socket);
+    ev->sock = -1;
+  }
+  cbf_destroy(&ev->ring);
+  free(ev->buf);
+  ev->buf = NULL;
+  ev->buf_size = 0u;
+}
+
+void
+event_trigger(struct event *ev, const char *source)
+{
+  ev->pending = source;
+}
+
+void
+event_socket_read(struct event *ev)
+{
+  struct sockaddr_un from;
+  socklen_t fromlen;
+  char cmd[64];
+  char reply[128];
+  ssize_t r;
+  int n;
+
+  while (true) {
+    fromlen = sizeof(from);
+    r = recvfrom(ev->sock, cmd, sizeof(cmd) - 1u, 0,
+                 (struct sockaddr *)&from, &fromlen);
+    if (r == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        fprintf(stderr, "! event: socket: %s\n", strerror(errno));
+      if (errno != EINTR)
+        return;
+      continue;
+    }
+    while (r && (cmd[r - 1] == '\n' || cmd[r - 1] == '\r'))
+      r--;
+    cmd[r] = '\0';
+
+    if (!strcmp(cmd, "trigger")) {
+      event_trigger(ev, "socket");
+      n = snprintf(reply, sizeof(reply), "ok\n");
+    } else if (!strcmp(cmd, "status")) {
+      n = snprintf(reply, sizeof(reply),
+                   "%s triggers=%"PRIu64" events=%"PRIu64" ring=%u%%\n",
+                   ev->pending ? "triggered" :
+                   ev->recording ? "recording" : "idle",
+                   ev->triggers, ev->events, event_percent(ev));
+    } else {
+      fprintf(stderr, "! event: unknown command '%s'\n", cmd);
+      n = snprintf(reply, sizeof(reply), "error: unknown command\n");
+    }
+    /* reply only to bound sender */
+    if (fromlen > sizeof(sa_family_t))
+      sendto(ev->sock, reply, (size_t)n, MSG_DONTWAIT,
+             (struct sockaddr *)&from, fromlen);
+  }
+}
+
+/* short average of frame size off long average: scene changed */
+static bool
+event_activity(struct event *ev, size_t size)
+{
+  double diff;
+
+  if (!ev->sized++) {
+    ev->fast = (double)size;
+    ev->slow = (double)size;
+    return false;
+  }
+  ev->fast += ((double)size - ev->fast) * EVENT_FAST;
+  ev->slow += ((double)size - ev->slow) * EVENT_SLOW;
+  diff = ev->fast > ev->slow ? ev->fast - ev->slow : ev->slow - ev->fast;
+  return ev->sized >= EVENT_WARMUP &&
+         diff * 100.0 >= ev->cfg.activity_percent * ev->slow;
+}
+
+void
+event_update(struct event *ev, const struct timeval *frame_time,
+             size_t size)
+{
+  struct event_record rec;
+  struct timeval post;
+  struct timeval pre = {0};
+
+  if (ev->cfg.activity_percent && event_activity(ev, size) && !ev->pending)
+    ev->pending = "activity";
+
+  ev->started = false;
+  if (ev->pending) {
+    ev->triggers++;
+    post.tv_sec = (time_t)ev->cfg.post;
+    post.tv_usec = (suseconds_t)((ev->cfg.post - post.tv_sec) * 1e6);
+    timeradd(frame_time, &post, &ev->until);
+    if (!ev->recording) {
+      ev->recording = true;
+      ev->started = true;
+      ev->events++;
+      if (event_peek(ev, &rec))
+        timersub(frame_time, &rec.timestamp, &pre);
+      fprintf(stderr, "@ event: start by %s, %zu frames (%.3f s) "
+              "before trigger\n", ev->pending, ev->records,
+              pre.tv_sec + pre.tv_usec / 1e6);
+    }
+    ev->pending = NULL;
+  } else if (ev->recording && !timercmp(frame_time, &ev->until, <)) {
+    ev->recording = false;
+    fprintf(stderr, "@ event: end, %.1f s after last trigger\n",
+            ev->cfg.post);
+  }
+}
+
+bool
+event_peek(struct event *ev, struct event_record *rec)
+{
+  if (!ev->records)
+    return false;
+  return cbf_get(&ev->ring, (uint8_t *)rec, sizeof(*rec)) == sizeof(*rec);
+}
+
+uint8_t *
+event_pop(struct event *ev, struct event_record *rec)
+{
+  size_t need;
+
+  if (!event_peek(ev, rec))
+    return NULL;
+  need = event_need(rec->size);
+  /* buf holds largest record since event_push() */
+  if (cbf_get(&ev->ring, ev->buf, need) != need)
+    return NULL;
+  cbf_discard(&ev->ring, need);
+  ev->records--;
+  return ev->buf + sizeof(*rec);
+}
+
+bool
+event_discard(struct event *ev)
+{
+  struct event_record rec;
+
+  if (!event_peek(ev, &rec))
+    return false;
+  cbf_discard(&ev->ring, event_need(rec.size));
+  ev->records--;
+  return true;
+}
+
+bool
+event_push(struct event *ev, const struct event_record *rec, uint8_t *p)
+{
+  size_t need = event_need(rec->size);
+  uint8_t *buf;
+
+  if (cbf_free_space(&ev->ring) < need)
+    return false;
+  if (need > ev->buf_size) {
+    if (!(buf = realloc(ev->buf, need))) {
+      fprintf(stderr, "! event: frame of %"PRIu32" bytes not stored\n",
+              rec->size);
+      return false;
+    }
+    ev->buf = buf;
+    ev->buf_size = need;
+  }
+  cbf_save(&ev->ring, (uint8_t *)rec, sizeof(*rec));
+  cbf_save(&ev->ring, p, rec->size);
+  ev->records++;
+  return true;
+}
+
+unsigned
+event_percent(struct event *ev)
+{
+  return (unsigned)((uint64_t)cbf_occupied_space(&ev->ring) * 100u /
+                    ev->ring.capacity);
+}
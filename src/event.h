@@ -0,0 +1,145 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/event.h
+ */
+#ifndef _EVENT_1562238107_H_
+#define _EVENT_1562238107_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include "circle_buffer.h"
+
+/*
+ * triggered recording: while idle, frames are kept only in RAM ring
+ * covering last pre seconds. trigger commits ring to files and frames
+ * are written until post seconds after last trigger.
+ *
+ * triggers: event_trigger() (SIGHUP in capture), "trigger" command
+ * on UNIX datagram socket, frame size activity heuristic.
+ *
+ * spec: comma separated list of
+ *   pre=<s>           seconds before trigger, default 10
+ *   post=<s>          seconds after last trigger, default 30
+ *   ram=<MB>          ring size, default 64
+ *   activity=<%>      trigger when short average of frame size differs
+ *                     from long average by percent, default off
+ *   socket=<path>     UNIX datagram socket for commands
+ */
+struct event_cfg {
+  double pre;
+  double post;
+  size_t ram;
+  /* 0 = off */
+  unsigned activity_percent;
+  /* empty = off */
+  char socket[108];
+};
+
+/* frame in ring, data follows */
+struct event_record {
+  struct timeval timestamp;
+  /* v4l2_buffer.flags */
+  uint32_t flags;
+  uint32_t size;
+  uint64_t seq;
+};
+
+struct event {
+  struct event_cfg cfg;
+  struct circle_buffer ring;
+  /* record of event_pop(), grown by event_push() */
+  uint8_t *buf;
+  size_t buf_size;
+  size_t records;
+
+  bool recording;
+  /* recording started by last event_update(): new files */
+  bool started;
+  /* source of trigger not processed yet, NULL = none */
+  const char *pending;
+  /* sensor time recording ends */
+  struct timeval until;
+  /* records up to seq are written, valid when commit */
+  bool commit;
+  uint64_t commit_seq;
+
+  /* frame size averages: short and long */
+  double fast;
+  double slow;
+  uint64_t sized;
+
+  int sock;
+
+  /* counters */
+  uint64_t triggers;
+  uint64_t events;
+  /* idle frames dropped from ring */
+  uint64_t discarded;
+};
+
+/* parse spec, return false on invalid spec */
+bool
+event_parse(struct event_cfg *cfg, const char *spec);
+
+/* allocate ring (enum mem_flags), open socket */
+bool
+event_init(struct event *ev, const struct event_cfg *cfg, unsigned mem_flags);
+
+void
+event_free(struct event *ev);
+
+/* trigger on next frame, source is static string for log */
+void
+event_trigger(struct event *ev, const char *source);
+
+/* read commands from socket, call when readable */
+void
+event_socket_read(struct event *ev);
+
+/* before store or write of frame: activity heuristic, pending trigger,
+ * end of recording
+ */
+void
+event_update(struct event *ev, const struct timeval *frame_time,
+             size_t size);
+
+/* record is written to files when recording */
+static inline bool
+event_committed(const struct event *ev, const struct event_record *rec)
+{
+  return ev->commit && rec->seq <= ev->commit_seq;
+}
+
+/* header of oldest record, false when ring is empty */
+bool
+event_peek(struct event *ev, struct event_record *rec);
+
+/* remove oldest record, return its data valid until next pop,
+ * NULL when ring is empty
+ */
+uint8_t *
+event_pop(struct event *ev, struct event_record *rec);
+
+/* remove oldest record without copy of data */
+bool
+event_discard(struct event *ev);
+
+/* store record, false when it does not fit:
+ * caller makes space with event_pop()
+ */
+bool
+event_push(struct event *ev, const struct event_record *rec, uint8_t *p);
+
+/* ring bytes of record with data size */
+static inline size_t
+event_need(size_t size)
+{
+  return sizeof(struct event_record) + size;
+}
+
+/* ring occupancy */
+unsigned
+event_percent(struct event *ev);
+
+#endif /* _EVENT_1562238107_H_ */
@@ -9,30 +9,74 @@
 #include <unistd.h>
 #include <time.h>
 #include <inttypes.h>
-#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <strings.h>
+#include <limits.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/inotify.h>
 
 #include "files.h"
 #include "frame_index.h"
+#include "decode.h"
+#include "avi.h"
+#include "reader.h"
 
-#define EXTRACT_BLK_SZ 4096
 /* write to stdout */
 #define OUTPUT_FD STDOUT_FILENO
+/* follow mode: recheck files if inotify keeps silence */
+#define FOLLOW_POLL_TIMEOUT_MS 1000
 
 struct frame_record {
   char frm[FH_PATH_SIZE + 1];
   frame_index_t fi;
 };
 
+struct time_range {
+  time_t start;
+  time_t duration;
+};
+
+#define RM_INIT_VALUE {.rm_key = {'S', 'W', 'I', 'R'}}
+
+/* written before frames of each range in concatenated output */
+struct __attribute__((packed)) range_marker {
+  char rm_key[4];
+  /* UTC seconds */
+  uint64_t start_be;
+  uint32_t duration_be;
+  /* range number after merge */
+  uint32_t number_be;
+};
+
+enum output_format {
+  /* frames as is */
+  OUTPUT_MJPEG = 0,
+  /* decoded frames */
+  OUTPUT_Y4M,
+  OUTPUT_YUV,
+  /* frames as is in AVI container */
+  OUTPUT_AVI
+};
+
+#define OUTPUT_DECODED(_f) ((_f) == OUTPUT_Y4M || (_f) == OUTPUT_YUV)
+
 struct walk_context {
   int fd;
 
   int output_fd;
+  enum output_format output_format;
+  /* decoder for OUTPUT_Y4M and OUTPUT_YUV */
+  struct decode_pool dec;
+  /* muxer for OUTPUT_AVI */
+  struct avi_mux avi;
+  /* collect frame sizes without reading frames */
+  bool plan;
+
   time_t start_time;
   time_t duration;
   struct timeval local_start;
@@ -42,13 +86,40 @@ struct walk_context {
   uint32_t file_seq_limit;
 
   uint64_t frame_seq;
+  bool frame_seq_valid;
 
-  char frm_path[FH_PATH_SIZE + 1];
+  /* index files sorted by time */
+  struct rdr_archive ar;
+
+  /* requested ranges */
+  struct time_range *ranges;
+  size_t range_count;
+  size_t range_alloc;
+
+  /* write each range to own file */
+  const char *output_prefix;
+  /* write range_marker in single stream */
+  bool markers;
 
+  /* pick one frame per interval using index only */
   struct {
-    int fd;
-    char path[FH_PATH_SIZE + 1];
-  } dump_ctx;
+    /* fixed interval or speed multiplier of frame rate */
+    struct timeval interval;
+    unsigned speed;
+    /* next sample time, UTC */
+    struct timeval next;
+    uint64_t last_seq;
+    bool last_valid;
+    /* frames picked in current file */
+    struct frame_record *fr;
+    size_t count;
+    size_t alloc;
+  } sample;
+
+  char frm_path[FH_PATH_SIZE + 1];
+
+  /* mapped frm file */
+  struct rdr_pack pack;
 
   struct {
     bool started;
@@ -57,8 +128,21 @@ struct walk_context {
     unsigned current;
     unsigned fps;
   } sort_ctx;
+
+  /* tail current frame pack while capture writes it */
+  struct {
+    bool enabled;
+    /* inotify descriptor, watch current directory */
+    int fd;
+    /* name of current and next index files */
+    char idx_path[FH_PATH_SIZE + 1];
+    char next_path[FH_PATH_SIZE + 1];
+  } follow;
 };
 
+bool
+reset_sort_context(struct walk_context *wlkc, unsigned fps);
+
 void
 dump_frame_index(frame_index_t *pfi)
 {
@@ -73,119 +157,63 @@ dump_frame_index(frame_index_t *pfi)
           BSWAP_BE32(pfi->size_be));
 }
 
+/* write frame to output in selected format */
 bool
-dump_frame(struct walk_context *wlkc,
-           frame_index_t *pfi, char path[FH_PATH_SIZE + 1])
+frame_output(struct walk_context *wlkc, const uint8_t *p, size_t size)
 {
-  off_t offset;
-  char buffer[EXTRACT_BLK_SZ];
-  size_t readed;
-  size_t frame_size;
-  int expect;
-  int r;
+  ssize_t r;
 
-  if (strcmp(wlkc->dump_ctx.path, path)) {
-    if (!wlkc->dump_ctx.path[0])
-      fprintf(stderr, "INFO: open frm pack '%s'\n", path);
-    else
-      fprintf(stderr, "INFO: change frm pack '%s' to '%s'\n",
-              wlkc->dump_ctx.path, path);
-    if (wlkc->dump_ctx.fd != -1)
-      close(wlkc->dump_ctx.fd);
-    memcpy(wlkc->dump_ctx.path, path, FH_PATH_SIZE + 1);
-    wlkc->dump_ctx.fd = open(wlkc->dump_ctx.path, O_RDONLY);
-    if (wlkc->dump_ctx.fd == -1) {
-      fprintf(stderr, "ERROR: open frm file '%s' failed: %s\n",
-              wlkc->dump_ctx.path, strerror(errno));
-      return false;
-    }
-  }
-  
-  offset = BSWAP_BE64(pfi->offset_be);
-  dump_frame_index(pfi);
-  if (lseek(wlkc->dump_ctx.fd, offset, SEEK_SET) != offset) {
-    fprintf(stderr, "ERROR: seek to frame start (%"PRIu64") "
-            "not possible in file '%s'\n",
-            (uint64_t)offset, wlkc->dump_ctx.path);
-    return false;
-  }
+  if (wlkc->output_format == OUTPUT_AVI)
+    return avi_write_frame(&wlkc->avi, wlkc->output_fd, p, size);
 
-  readed = 0u;
-  frame_size = BSWAP_BE32(pfi->size_be);
-  while (readed != frame_size) {
-    expect = (frame_size - readed) % EXTRACT_BLK_SZ;
-    if (!expect)
-      expect = EXTRACT_BLK_SZ;
-    r = read(wlkc->dump_ctx.fd, buffer, expect);
-    if (r == -1) {
-      fprintf(stderr, "ERROR: frm read failure: %s\n", strerror(errno));
-      return false;
-    }
-    readed += r;
-    if (r < expect) {
-      fprintf(stderr, "ERROR: frm unexpected EOF: readed=%zu, expected=%zu (%d, %d)\n",
-             readed, frame_size, r, expect);
-    }
+  if (OUTPUT_DECODED(wlkc->output_format))
+    return dec_push(&wlkc->dec, p, size);
 
-    if (wlkc->output_fd != -1) {
-      expect = r;
-      r = write(wlkc->output_fd, buffer, expect);
-      if (r == -1 || r == 0) {
-        fprintf(stderr, "ERROR: write failure %s\n", strerror(errno));
-        return false;
-      }
+  while (size) {
+    r = write(wlkc->output_fd, p, size);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r == -1 || r == 0) {
+      fprintf(stderr, "ERROR: write failure %s\n", strerror(errno));
+      return false;
     }
+    p += r;
+    size -= r;
   }
-
   return true;
 }
 
 bool
-frame_index_seek_down(struct walk_context *wlkc, frame_index_t *pfi)
+dump_frame(struct walk_context *wlkc,
+           frame_index_t *pfi, char path[FH_PATH_SIZE + 1])
 {
-  off_t r;
-  struct timeval tv;
+  const uint8_t *p;
 
-  /* seek until frame header */
-  do {
-    r = lseek(wlkc->fd, -(sizeof(*pfi) * 2), SEEK_CUR);
-    read(wlkc->fd, pfi, sizeof(*pfi));
-    /* dump_frame_index(pfi); */
-    timebin_to_timeval(&pfi->tv, &tv);
-    if (timercmp(&wlkc->local_start, &tv, <)) {
-      /* search next */
-      continue;
-    } else if (!timercmp(&wlkc->local_start, &tv, !=)) {
-      /* founded equal */
-      return true;
-    } else {
-      /* start at next frame */
-      read(wlkc->fd, pfi, sizeof(*pfi));
-      return true;
-    }
-  } while (r >= sizeof(frame_header_t));
-  return false;
-}
+  /* frame dropped by capture */
+  if (FI_IS_GAP(pfi))
+    return true;
 
-bool
-frame_index_seek_up(struct walk_context *wlkc, frame_index_t *pfi)
-{
-  struct timeval tv;
-  int r = 0;
+  if (wlkc->plan)
+    return avi_plan_frame(&wlkc->avi, BSWAP_BE32(pfi->size_be));
 
-  do {
-    r = read(wlkc->fd, pfi, sizeof(*pfi));
-    /* dump_frame_index(pfi); */
-    timebin_to_timeval(&pfi->tv, &tv);
-    if (timercmp(&wlkc->local_start, &tv, >)) {
-      /* search next */
-      continue;
-    } else {
-      /* found previous or equal */
-      return true;
-    }
-  } while (r != 0);
-  return false;
+  if (strcmp(wlkc->pack.path, path)) {
+    if (!wlkc->pack.path[0])
+      fprintf(stderr, "INFO: open frm pack '%s'\n", path);
+    else
+      fprintf(stderr, "INFO: change frm pack '%s' to '%s'\n",
+              wlkc->pack.path, path);
+  }
+
+  dump_frame_index(pfi);
+  if (!rdr_pack_frame(&wlkc->pack, wlkc->ar.dirfd, path, pfi, &p)) {
+    fprintf(stderr, "ERROR: %s\n", rdr_error());
+    return false;
+  }
+
+  if (wlkc->output_fd == -1)
+    return true;
+
+  return frame_output(wlkc, p, BSWAP_BE32(pfi->size_be));
 }
 
 bool
@@ -209,16 +237,21 @@ frame_index_open_next(struct walk_context *wlkc)
   wlkc->fd = new_fd;
   wlkc->file_seq++;
 
-  if (read(new_fd, &fh, sizeof(fh)) != sizeof(fh)) {
+  if (read(new_fd, &fh, FH_SIZE_MIN) != FH_SIZE_MIN ||
+      !FH_KEY_VALID(&fh) ||
+      read(new_fd, (uint8_t *)&fh + FH_SIZE_MIN,
+           FH_SIZE(&fh) - FH_SIZE_MIN) != FH_SIZE(&fh) - FH_SIZE_MIN) {
     fprintf(stderr, "ERROR: incomplete data: stripped frame header\n");
     return false;
   }
 
+  /* frame rate stepped by adaptive quality of capture */
   if (fh.frame.fps != wlkc->sort_ctx.fps) {
-    fprintf(stderr, "ERROR: inconsistent frame rate: "
-            "expected %u but value is %"PRIu8"\n",
+    fprintf(stderr, "INFO: frame rate changed: %u -> %"PRIu8"\n",
             wlkc->sort_ctx.fps, fh.frame.fps);
-    return false;
+    if (!reset_sort_context(wlkc, fh.frame.fps))
+      return false;
+    wlkc->dec.fps = fh.frame.fps;
   }
 
   if (BSWAP_BE32(fh.seq_be) != wlkc->file_seq) {
@@ -235,11 +268,162 @@ frame_index_open_next(struct walk_context *wlkc)
     return false;
   }
 
+  /* idle frames of triggered recording not written before pack */
+  if (FH_FLAGS(&fh) & FH_FLAG_EVENT)
+    wlkc->frame_seq_valid = false;
+
   snprintf(wlkc->frm_path, sizeof(wlkc->frm_path) - 1, "%s", fh.path);
 
   return true;
 }
 
+/* check next index pack already started
+ * (header of next pack written after last record of current pack)
+ */
+bool
+frame_index_next_ready(uint32_t file_seq, uint32_t file_seq_limit)
+{
+  uint32_t next_idx = file_seq + 1;
+  char path[FH_PATH_SIZE + 1];
+  frame_header_t fh;
+  int fd;
+  bool r;
+
+  if (file_seq_limit)
+    next_idx %= file_seq_limit;
+
+  make_idx_file(path, next_idx);
+  fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  /* file can be old pack from previous cycle or be truncated */
+  r = (read(fd, &fh, FH_SIZE_MIN) == FH_SIZE_MIN &&
+       FH_KEY_VALID(&fh) &&
+       BSWAP_BE32(fh.seq_be) == file_seq + 1);
+  close(fd);
+  return r;
+}
+
+void
+follow_update_paths(struct walk_context *wlkc)
+{
+  uint32_t idx = wlkc->file_seq;
+  uint32_t next_idx = wlkc->file_seq + 1;
+
+  if (wlkc->file_seq_limit) {
+    idx %= wlkc->file_seq_limit;
+    next_idx %= wlkc->file_seq_limit;
+  }
+
+  make_idx_file(wlkc->follow.idx_path, idx);
+  make_idx_file(wlkc->follow.next_path, next_idx);
+}
+
+/* wait until current or next index file changed
+ * return false on error
+ */
+bool
+follow_wait(struct walk_context *wlkc)
+{
+  char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd pfd = {.fd = wlkc->follow.fd, .events = POLLIN};
+  struct inotify_event *ev;
+  bool changed = false;
+  ssize_t len;
+  char *p;
+  int r;
+
+  while (!changed) {
+    r = poll(&pfd, 1, FOLLOW_POLL_TIMEOUT_MS);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+      return false;
+    }
+
+    if (!r) {
+      /* no events: check files anyway */
+      return true;
+    }
+
+    while ((len = read(wlkc->follow.fd, buf, sizeof(buf))) > 0) {
+      for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+        ev = (struct inotify_event*)p;
+        if (ev->mask & IN_Q_OVERFLOW) {
+          changed = true;
+        } else if (ev->len &&
+                   (!strcmp(ev->name, wlkc->follow.idx_path) ||
+                    !strcmp(ev->name, wlkc->follow.next_path))) {
+          changed = true;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+/* current index pack has no complete records:
+ * wait new records or switch to next pack
+ * return false when follow is not possible
+ */
+bool
+follow_next(struct walk_context *wlkc)
+{
+  struct stat st;
+  off_t pos;
+
+  if (!frame_index_next_ready(wlkc->file_seq, wlkc->file_seq_limit)) {
+    /* do not hold decoded frames while waiting */
+    if (OUTPUT_DECODED(wlkc->output_format) && !dec_flush(&wlkc->dec))
+      return false;
+    return follow_wait(wlkc);
+  }
+
+  /* records may be written between EOF and next pack check */
+  pos = lseek(wlkc->fd, 0, SEEK_CUR);
+  if (fstat(wlkc->fd, &st) == 0 &&
+      st.st_size - pos >= (off_t)sizeof(frame_index_t)) {
+    return true;
+  }
+
+  if (!frame_index_open_next(wlkc))
+    return false;
+
+  follow_update_paths(wlkc);
+  return true;
+}
+
+/* dump frame immediately, without sorting */
+bool
+follow_dump_frame(struct walk_context *wlkc, frame_index_t *pfi)
+{
+  struct stat st;
+  struct timeval tv;
+  off_t frame_end = BSWAP_BE64(pfi->offset_be) + BSWAP_BE32(pfi->size_be);
+
+  timebin_to_timeval(&pfi->tv, &tv);
+  if (timercmp(&tv, &wlkc->local_start, <)) {
+    /* frame before requested time */
+    return true;
+  }
+
+  if (wlkc->duration && !timercmp(&tv, &wlkc->local_end, <)) {
+    return true;
+  }
+
+  /* frame written before index record, wait only when it not true */
+  while (stat(wlkc->frm_path, &st) == 0 && st.st_size < frame_end) {
+    if (!follow_wait(wlkc))
+      return false;
+  }
+
+  return dump_frame(wlkc, pfi, wlkc->frm_path);
+}
+
 void
 frame_sort_dump(struct walk_context *wlkc)
 {
@@ -254,10 +438,18 @@ void
 frame_sort_normalize(struct walk_context *wlkc)
 {
   struct frame_record fr;
-  if (wlkc->sort_ctx.current == wlkc->sort_ctx.fps)
+  unsigned last = wlkc->sort_ctx.current;
+  if (!wlkc->sort_ctx.current ||
+      wlkc->sort_ctx.current == wlkc->sort_ctx.fps)
     return;
 
-  memcpy(&fr, &wlkc->sort_ctx.fr[wlkc->sort_ctx.current - 1], sizeof(fr));
+  /* gap marker has no frame to copy */
+  while (last && FI_IS_GAP(&wlkc->sort_ctx.fr[last - 1].fi))
+    last--;
+  if (!last)
+    return;
+
+  memcpy(&fr, &wlkc->sort_ctx.fr[last - 1], sizeof(fr));
   /* simple method: copy last frame to empty slots */
   for (; wlkc->sort_ctx.current < wlkc->sort_ctx.fps; wlkc->sort_ctx.current++) {
     memcpy(&wlkc->sort_ctx.fr[wlkc->sort_ctx.current], &fr, sizeof(fr));
@@ -274,6 +466,7 @@ frame_sort_income(struct walk_context *wlkc, frame_index_t *pfi)
     frame_sort_normalize(wlkc);
     frame_sort_dump(wlkc);
     wlkc->sort_ctx.current = 0u;
+    wlkc->sort_ctx.started = false;
     timerclear(&wlkc->sort_ctx.start_time);
     return;
   }
@@ -309,65 +502,63 @@ frame_sort_income(struct walk_context *wlkc, frame_index_t *pfi)
   wlkc->sort_ctx.current++;
 }
 
-/* dump frames until end */
+/* read next index record
+ * return false when no complete record in file
+ */
+bool
+frame_index_read(struct walk_context *wlkc, frame_index_t *pfi)
+{
+  ssize_t r;
+
+  r = read(wlkc->fd, pfi, sizeof(*pfi));
+  if (r == sizeof(*pfi))
+    return true;
+
+  if (r > 0) {
+    /* record not completely written: read it again later */
+    lseek(wlkc->fd, -r, SEEK_CUR);
+  }
+  return false;
+}
+
+/* dump frames until end of range */
 void
-frame_index_walk_until_end(struct walk_context *wlkc, frame_index_t *pfi)
+follow_walk(struct walk_context *wlkc, frame_index_t *pfi)
 {
   struct timeval tv = {0};
+  bool endless = !wlkc->duration;
 
-  frame_sort_income(wlkc, pfi);
+  if (!follow_dump_frame(wlkc, pfi))
+    return;
 
   wlkc->frame_seq = BSWAP_BE64(pfi->seq_be);
-  while (timercmp(&wlkc->local_end, &tv, >))
+  wlkc->frame_seq_valid = true;
+  while (endless || timercmp(&wlkc->local_end, &tv, >))
   {
-    if (read(wlkc->fd, pfi, sizeof(*pfi)) == 0) {
-      /* TODO: open next file in sequence */
-      if (!frame_index_open_next(wlkc)) {
-        fprintf(stderr, "ERROR: anormal result when switching to next frame pack\n");
+    if (!frame_index_read(wlkc, pfi)) {
+      if (!follow_next(wlkc)) {
+        fprintf(stderr, "ERROR: follow stopped\n");
         return;
       }
       continue;
     }
+    if (!wlkc->frame_seq_valid) {
+      fprintf(stderr, "INFO: event recording: %"PRIu64" idle frames "
+              "skipped\n", BSWAP_BE64(pfi->seq_be) - wlkc->frame_seq - 1);
+      wlkc->frame_seq = BSWAP_BE64(pfi->seq_be) - 1;
+      wlkc->frame_seq_valid = true;
+    }
     if (BSWAP_BE64(pfi->seq_be) != wlkc->frame_seq + 1) {
       fprintf(stderr, "ERROR: invalid frame sequence: "
               "expected: %"PRIu64" received: %"PRIu64"\n",
-              BSWAP_BE64(pfi->seq_be), wlkc->frame_seq + 1);
+              wlkc->frame_seq + 1, BSWAP_BE64(pfi->seq_be));
       return;
     }
     timebin_to_timeval(&pfi->tv, &tv);
     wlkc->frame_seq++;
-    frame_sort_income(wlkc, pfi);
-  }
-}
-
-void
-frame_index_walk(struct walk_context *wlkc)
-{
-  struct timeval frame_time;
-  frame_index_t fi = {0};
-  read(wlkc->fd, &fi, sizeof(frame_index_t));
-  
-  if (!FI_KEY_VALID(&fi)) {
-    fprintf(stderr, "WARN: invalid frame index magic key\n");
-    return;
-  }
-
-  timebin_to_timeval(&fi.tv, &frame_time);
-  if (timercmp(&wlkc->local_start, &frame_time, <)) {
-    /* TODO: seek down */
-    if (!frame_index_seek_down(wlkc, &fi)) {
-      fprintf(stderr, "ERROR: start frame not found\n");
-      return;
-    }
-  } else if (timercmp(&wlkc->local_start, &frame_time, >)) {
-    /* TODO: seek up */
-    if (!frame_index_seek_up(wlkc, &fi)) {
-      fprintf(stderr, "ERROR: start frame not found\n");
+    if (!follow_dump_frame(wlkc, pfi))
       return;
-    }
   }
-
-  frame_index_walk_until_end(wlkc, &fi);
 }
 
 bool
@@ -384,173 +575,745 @@ init_sort_context(struct walk_context *wlkc, unsigned fps)
   return true;
 }
 
+/* flush sort buffer when frame rate changed */
 bool
-index_process(struct walk_context *wlkc,
-              const char *filepath, size_t frame_count,
-              frame_header_t *fh, frame_index_t *fi)
-{
-  struct timeval fh_local;
-  struct timeval fh_utc;
-  struct timeval frame_time;
-  /* make start time */
-  timerclear(&wlkc->local_start);
-  wlkc->local_start.tv_sec = wlkc->start_time;
-  timebin_to_timeval(&fh->cap_time.utc, &fh_utc);
-  timebin_to_timeval(&fh->cap_time.local, &fh_local);
-  timeradd(&fh_utc, &fh_local, &frame_time);
-
-  /* check start time */
-  if (timercmp(&frame_time, &wlkc->local_start, >)) {
-    fprintf(stderr, "INFO: skip file '%s', record start time > request start time "
-           "("TV_FMT" > "TV_FMT")\n",
-           filepath, TV_ARGS(&frame_time), TV_ARGS(&wlkc->local_start));
+reset_sort_context(struct walk_context *wlkc, unsigned fps)
+{
+  if (wlkc->sort_ctx.fr && wlkc->sort_ctx.fps == fps)
     return true;
+
+  if (wlkc->sort_ctx.fr) {
+    frame_sort_income(wlkc, NULL);
+    free(wlkc->sort_ctx.fr);
+    wlkc->sort_ctx.fr = NULL;
   }
 
-  /* convert global time to local */
-  timersub(&wlkc->local_start, &fh_utc, &wlkc->local_start);
-  timerclear(&wlkc->local_end);
-  if (wlkc->local_start.tv_usec) {
-    /* round to upper */
-    wlkc->local_end.tv_sec = wlkc->local_start.tv_sec + wlkc->duration + 1;
-  } else {
-    wlkc->local_end.tv_sec = wlkc->local_start.tv_sec + wlkc->duration;
-  }
-  
-  timebin_to_timeval(&fi->tv, &frame_time);
-  /* check end time */
-  if (timercmp(&frame_time, &wlkc->local_start, <)) {
-    fprintf(stderr, "INFO: skip file '%s', last frame time < relative request start time "
-           "("TV_FMT" < "TV_FMT")\n",
-           filepath, TV_ARGS(&frame_time), TV_ARGS(&wlkc->local_start));
+  return init_sort_context(wlkc, fps);
+}
+
+int
+frame_record_offset_cmp(const void *a, const void *b)
+{
+  const struct frame_record *fa = a;
+  const struct frame_record *fb = b;
+  uint64_t oa = BSWAP_BE64(fa->fi.offset_be);
+  uint64_t ob = BSWAP_BE64(fb->fi.offset_be);
+
+  if (oa != ob)
+    return oa < ob ? -1 : 1;
+  return 0;
+}
+
+/* append frame to sample list */
+bool
+sample_add(struct walk_context *wlkc, struct rdr_segment *seg, frame_index_t *pfi)
+{
+  struct frame_record *fr;
+  size_t alloc;
+
+  if (wlkc->sample.last_valid &&
+      BSWAP_BE64(pfi->seq_be) == wlkc->sample.last_seq) {
+    /* interval shorter than frame period */
     return true;
   }
 
-  /* FIXME: check fi[0]->tv == fh->cap_time.local ? */
+  if (wlkc->sample.count == wlkc->sample.alloc) {
+    alloc = wlkc->sample.alloc ? wlkc->sample.alloc * 2 : 64u;
+    fr = realloc(wlkc->sample.fr, alloc * sizeof(*fr));
+    if (!fr) {
+      fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+              alloc * sizeof(*fr), strerror(errno));
+      return false;
+    }
+    wlkc->sample.fr = fr;
+    wlkc->sample.alloc = alloc;
+  }
+
+  fr = &wlkc->sample.fr[wlkc->sample.count++];
+  memcpy(&fr->fi, pfi, sizeof(fr->fi));
+  snprintf(fr->frm, sizeof(fr->frm), "%s", seg->frm);
+  wlkc->sample.last_seq = BSWAP_BE64(pfi->seq_be);
+  wlkc->sample.last_valid = true;
+  return true;
+}
+
+/* nearest real frame to local time when ix->fi[pos] is gap marker,
+ * looks both ways until first real frame or [start, end) border,
+ * returns count when none
+ */
+size_t
+sample_nearest_real(const struct rdr_index *ix, size_t count, size_t pos,
+                    const struct timeval *local, const struct timeval *start,
+                    const struct timeval *end)
+{
+  struct timebin tb;
+  struct timeval tv[2];
+  struct timeval diff[2];
+  size_t prev = count;
+  size_t next = count;
+  size_t i;
+
+  for (i = pos; i-- > 0u;) {
+    memcpy(&tb, &ix->fi[i].tv, sizeof(tb));
+    timebin_to_timeval(&tb, &tv[0]);
+    if (timercmp(&tv[0], start, <))
+      break;
+    if (FI_KEY_VALID(&ix->fi[i]) && !FI_IS_GAP(&ix->fi[i])) {
+      prev = i;
+      break;
+    }
+  }
+
+  for (i = pos + 1u; i < count; i++) {
+    memcpy(&tb, &ix->fi[i].tv, sizeof(tb));
+    timebin_to_timeval(&tb, &tv[1]);
+    if (!timercmp(&tv[1], end, <))
+      break;
+    if (FI_KEY_VALID(&ix->fi[i]) && !FI_IS_GAP(&ix->fi[i])) {
+      next = i;
+      break;
+    }
+  }
+
+  if (prev == count || next == count)
+    return prev == count ? next : prev;
+
+  if (timercmp(local, &tv[0], <))
+    timerclear(&diff[0]);
+  else
+    timersub(local, &tv[0], &diff[0]);
+  if (timercmp(&tv[1], local, <))
+    timerclear(&diff[1]);
+  else
+    timersub(&tv[1], local, &diff[1]);
+  return timercmp(&diff[0], &diff[1], >) ? next : prev;
+}
+
+/* dump frames nearest to sample times in range [start, end),
+ * frames data not touched until all frames of file picked
+ */
+bool
+segment_sample(struct walk_context *wlkc, struct rdr_segment *seg,
+               struct timeval *start, struct timeval *end)
+{
+  struct rdr_index ix;
+  frame_index_t fi[2];
+  struct timeval interval;
+  struct timeval seg_end;
+  struct timeval local_start;
+  struct timeval local_end;
+  struct timeval local;
+  struct timeval tv[2];
+  struct timeval diff[2];
+  size_t count;
+  size_t lo = 0u;
+  size_t pos;
+  size_t i;
+
+  if (!seg->frame_count)
+    return true;
+
+  memcpy(&interval, &wlkc->sample.interval, sizeof(interval));
+  if (wlkc->sample.speed) {
+    timerclear(&interval);
+    interval.tv_usec = (uint64_t)wlkc->sample.speed * 1000000u /
+                       (seg->fh.frame.fps ? seg->fh.frame.fps : 1u);
+    interval.tv_sec = interval.tv_usec / 1000000;
+    interval.tv_usec %= 1000000;
+  }
 
-  fprintf(stderr, "INFO: use file '%s' relative { start = "TV_FMT", end = "TV_FMT" }\n",
-         filepath, TV_ARGS(&wlkc->local_start), TV_ARGS(&wlkc->local_end));
+  if (!rdr_index_open(&ix, wlkc->ar.dirfd, seg->path)) {
+    fprintf(stderr, "WARN: %s\n", rdr_error());
+    return false;
+  }
+  count = seg->frame_count < ix.count ? seg->frame_count : ix.count;
+
+  timeradd(&seg->utc, &seg->last, &seg_end);
+  timersub(start, &seg->utc, &local_start);
+  timersub(end, &seg->utc, &local_end);
+  wlkc->sample.count = 0u;
+  while (count && timercmp(&wlkc->sample.next, end, <) &&
+         !timercmp(&wlkc->sample.next, &seg_end, >)) {
+    timersub(&wlkc->sample.next, &seg->utc, &local);
+    pos = rdr_index_lower_bound(&ix, lo, count, &local);
+
+    /* nearest of previous and next frames */
+    if (pos == count)
+      pos--;
+    lo = pos ? pos - 1 : pos;
+    memcpy(fi, &ix.fi[lo], sizeof(*fi) * (pos - lo + 1));
+
+    i = pos - lo;
+    timebin_to_timeval(&fi[0].tv, &tv[0]);
+    timebin_to_timeval(&fi[i].tv, &tv[i]);
+    if (i) {
+      timersub(&local, &tv[0], &diff[0]);
+      timersub(&tv[1], &local, &diff[1]);
+      if (!timercmp(&diff[0], &diff[1], >) ||
+          !timercmp(&tv[1], &local_end, <)) {
+        i = 0u;
+      }
+    }
 
-  wlkc->file_seq = BSWAP_BE32(fh->seq_be);
-  wlkc->file_seq_limit = BSWAP_BE32(fh->seq_limit_be);
-  snprintf(wlkc->frm_path, sizeof(wlkc->dump_ctx) - 1, "%s", fh->path);
-  init_sort_context(wlkc, fh->frame.fps);
+    if (FI_IS_GAP(&fi[i])) {
+      /* gap marker has no data, take real frame around it */
+      pos = sample_nearest_real(&ix, count, lo + i, &local,
+                                &local_start, &local_end);
+      if (pos != count) {
+        lo = pos;
+        i = 0u;
+        memcpy(&fi[0], &ix.fi[pos], sizeof(*fi));
+        timebin_to_timeval(&fi[0].tv, &tv[0]);
+      }
+    }
 
-  /* seek to frame */
-  {
-    off_t _seek_to_frame;
-    _seek_to_frame = (fh->frame.fps * (wlkc->local_start.tv_sec - fh_local.tv_sec));
-    if (_seek_to_frame > frame_count) {
-      _seek_to_frame = frame_count - 1;
+    if (FI_KEY_VALID(&fi[i]) && !FI_IS_GAP(&fi[i]) &&
+        !timercmp(&tv[i], &local_start, <) &&
+        timercmp(&tv[i], &local_end, <) &&
+        !sample_add(wlkc, seg, &fi[i])) {
+      break;
     }
-    _seek_to_frame = sizeof(frame_header_t) +
-                     (sizeof(frame_index_t) * _seek_to_frame);
-    lseek(wlkc->fd, _seek_to_frame, SEEK_SET);
+
+    lo += i;
+    timeradd(&wlkc->sample.next, &interval, &wlkc->sample.next);
   }
-  frame_index_walk(wlkc);
+  rdr_index_close(&ix);
 
-  /* correct start time */
-  timersub(&wlkc->local_start, &fh_utc, &wlkc->local_start);
-  return false;
+  fprintf(stderr, "INFO: use file '%s', %zu frames sampled\n",
+          seg->path, wlkc->sample.count);
+
+  /* read frames in file order */
+  qsort(wlkc->sample.fr, wlkc->sample.count, sizeof(*wlkc->sample.fr),
+        frame_record_offset_cmp);
+  for (i = 0u; i < wlkc->sample.count; i++) {
+    if (!dump_frame(wlkc, &wlkc->sample.fr[i].fi, wlkc->sample.fr[i].frm))
+      return false;
+  }
+  return true;
 }
 
-/* return `true` when walk not stopped */
+/* AVI stream parameters from first planned segment */
+void
+avi_stream_setup(struct walk_context *wlkc, struct rdr_segment *seg)
+{
+  wlkc->avi.width = BSWAP_BE16(seg->fh.frame.width_be);
+  wlkc->avi.height = BSWAP_BE16(seg->fh.frame.height_be);
+  if (timerisset(&wlkc->sample.interval)) {
+    /* one frame per interval */
+    wlkc->avi.rate = 1000000u;
+    wlkc->avi.scale = (uint32_t)(wlkc->sample.interval.tv_sec * 1000000u +
+                                 wlkc->sample.interval.tv_usec);
+  } else {
+    /* normalized stream or fast forward on same rate */
+    wlkc->avi.rate = seg->fh.frame.fps;
+    wlkc->avi.scale = 1u;
+  }
+}
+
+/* dump frames of one index file in range [start, end) */
 bool
-index_walk(struct walk_context *wlkc, const char *filepath)
+segment_extract(struct walk_context *wlkc, struct rdr_segment *seg,
+                struct timeval *start, struct timeval *end)
 {
-  bool r = false;
-  size_t frame_count = 0u;
-  frame_header_t fh = {0};
-  frame_index_t fi = {0};
+  struct rdr_index ix;
+  frame_index_t fi;
+  struct timeval local_start;
+  struct timeval local_end;
+  struct timeval tv;
+  size_t count;
+  size_t pos;
 
-  wlkc->fd = open(filepath, O_RDONLY);
-  if (wlkc->fd == -1) {
-    fprintf(stderr, "WARN: file '%s' not oppened: %s\n", filepath, strerror(errno));
-    /* try next */
+  if (!seg->frame_count)
     return true;
+
+  wlkc->dec.fps = seg->fh.frame.fps;
+  if (wlkc->plan && !wlkc->avi.count)
+    avi_stream_setup(wlkc, seg);
+
+  if (timerisset(&wlkc->sample.interval) || wlkc->sample.speed)
+    return segment_sample(wlkc, seg, start, end);
+
+  /* convert global time to local */
+  timersub(start, &seg->utc, &local_start);
+  timersub(end, &seg->utc, &local_end);
+
+  if (!rdr_index_open(&ix, wlkc->ar.dirfd, seg->path)) {
+    fprintf(stderr, "WARN: %s\n", rdr_error());
+    return false;
   }
 
-  /* get last record */
-  frame_count = lseek(wlkc->fd, -sizeof(frame_index_t), SEEK_END);
-  read(wlkc->fd, &fi, sizeof(fi));
-  if (!FI_KEY_VALID(&fi)) {
-    fprintf(stderr, "WARN: file '%s' has invalid last record magic key\n", filepath);
-    close(wlkc->fd);
-    /* try next */
-    return true;
+  count = seg->frame_count < ix.count ? seg->frame_count : ix.count;
+  pos = rdr_index_lower_bound(&ix, 0u, count, &local_start);
+
+  fprintf(stderr, "INFO: use file '%s' relative { start = "TV_FMT", end = "TV_FMT" } "
+          "from frame %zu\n",
+          seg->path, TV_ARGS(&local_start), TV_ARGS(&local_end), pos);
+
+  if (!reset_sort_context(wlkc, seg->fh.frame.fps)) {
+    rdr_index_close(&ix);
+    return false;
   }
-  lseek(wlkc->fd, 0, SEEK_SET);
-  
-  /* compute frames */
-  frame_count = (frame_count - sizeof(frame_header_t)) / sizeof(frame_index_t);
-
-  /* get header */
-  read(wlkc->fd, &fh, sizeof(fh));
-  if (!FH_KEY_VALID(&fh)) {
-    fprintf(stderr, "WARN: file '%s' has invalid header magic key\n", filepath);
-    close(wlkc->fd);
-    /* try next */
-    return true;
+  snprintf(wlkc->frm_path, sizeof(wlkc->frm_path), "%s", seg->frm);
+
+  /* idle frames of triggered recording not written before pack */
+  if (FH_FLAGS(&seg->fh) & FH_FLAG_EVENT)
+    wlkc->frame_seq_valid = false;
+
+  for (; pos < count; pos++) {
+    memcpy(&fi, &ix.fi[pos], sizeof(fi));
+    timebin_to_timeval(&fi.tv, &tv);
+    if (!timercmp(&tv, &local_end, <))
+      break;
+
+    if (!FI_KEY_VALID(&fi)) {
+      fprintf(stderr, "WARN: invalid frame index magic key in '%s' "
+              "at record %zu\n", seg->path, pos);
+      continue;
+    }
+
+    if (wlkc->frame_seq_valid &&
+        BSWAP_BE64(fi.seq_be) != wlkc->frame_seq + 1) {
+      fprintf(stderr, "WARN: frame sequence gap: "
+              "expected: %"PRIu64" received: %"PRIu64"\n",
+              wlkc->frame_seq + 1, BSWAP_BE64(fi.seq_be));
+    }
+    wlkc->frame_seq = BSWAP_BE64(fi.seq_be);
+    wlkc->frame_seq_valid = true;
+
+    /* dropped frame: slot padded by frame_sort_normalize() */
+    if (FI_IS_GAP(&fi))
+      continue;
+
+    frame_sort_income(wlkc, &fi);
   }
 
-  r = index_process(wlkc, filepath, frame_count, &fh, &fi);
-  close(wlkc->fd);
+  rdr_index_close(&ix);
+  return true;
+}
+
+/* dump frames of range, segments before *cursor ends before range */
+bool
+range_extract(struct walk_context *wlkc, struct time_range *rg, size_t *cursor)
+{
+  struct timeval start = {.tv_sec = rg->start};
+  struct timeval end = {.tv_sec = rg->start + rg->duration};
+  struct timeval seg_start;
+  struct timeval seg_end;
+  struct rdr_segment *seg;
+  size_t i;
+
+  wlkc->frame_seq_valid = false;
+  memcpy(&wlkc->sample.next, &start, sizeof(wlkc->sample.next));
+  wlkc->sample.last_valid = false;
+  for (i = *cursor; i < wlkc->ar.seg_count; i++) {
+    seg = &wlkc->ar.segs[i];
+    timeradd(&seg->utc, &seg->last, &seg_end);
+    if (timercmp(&seg_end, &start, <)) {
+      /* ranges sorted: not needed for next ranges too */
+      if (i == *cursor)
+        (*cursor)++;
+      continue;
+    }
+
+    timeradd(&seg->utc, &seg->first, &seg_start);
+    if (!timercmp(&seg_start, &end, <))
+      break;
+
+    if (!segment_extract(wlkc, seg, &start, &end))
+      return false;
+  }
 
   if (wlkc->sort_ctx.fr) {
     /* purge frames */
     frame_sort_income(wlkc, NULL);
-    free(wlkc->sort_ctx.fr);
   }
+  return true;
+}
+
+void
+range_print(struct time_range *rg)
+{
+  time_t end_time;
+  struct tm *tm_start;
+  struct tm *tm_end;
+  char bf_start[32];
+  char bf_end[32];
+
+  end_time = rg->start + rg->duration;
+  tm_start = gmtime(&rg->start);
+  strftime(bf_start, sizeof(bf_start), "%H:%M:%S", tm_start);
+  tm_end = gmtime(&end_time);
+  strftime(bf_end, sizeof(bf_end), "%H:%M:%S", tm_end);
+
+  fprintf(stderr, "INFO: get frames from %s to %s (%"PRIu64" seconds)\n",
+          bf_start, bf_end, (uint64_t)rg->duration);
+}
+
+/* collect sizes of frames in ranges [first, last) and write AVI header */
+bool
+avi_output_start(struct walk_context *wlkc, size_t first, size_t last)
+{
+  size_t cursor = 0u;
+  size_t i;
+  bool r = true;
+
+  avi_reset(&wlkc->avi);
+  wlkc->plan = true;
+  for (i = first; r && i < last; i++)
+    r = range_extract(wlkc, &wlkc->ranges[i], &cursor);
+  wlkc->plan = false;
+
+  if (!r)
+    return false;
+  return avi_write_header(&wlkc->avi, wlkc->output_fd);
+}
+
+/* switch output to range file or mark range start in stream */
+bool
+range_output_open(struct walk_context *wlkc, struct time_range *rg,
+                  unsigned number)
+{
+  struct range_marker rm = RM_INIT_VALUE;
+  char path[PATH_MAX];
+  static const char *ext[] = {
+    [OUTPUT_MJPEG] = "mjpeg",
+    [OUTPUT_Y4M] = "y4m",
+    [OUTPUT_YUV] = "yuv",
+    [OUTPUT_AVI] = "avi"
+  };
+
+  if (OUTPUT_DECODED(wlkc->output_format) && !dec_flush(&wlkc->dec))
+    return false;
+
+  if (wlkc->output_prefix) {
+    snprintf(path, sizeof(path), "%s%"PRIu64"+%"PRIu64".%s",
+             wlkc->output_prefix, (uint64_t)rg->start, (uint64_t)rg->duration,
+             ext[wlkc->output_format]);
+    wlkc->output_fd = open(path, O_CREAT | O_TRUNC | O_WRONLY,
+                           S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+    if (wlkc->output_fd == -1) {
+      fprintf(stderr, "ERROR: output file '%s' not openned: %s\n",
+              path, strerror(errno));
+      return false;
+    }
+    fprintf(stderr, "INFO: write range #%u to '%s'\n", number, path);
+    if (wlkc->output_format == OUTPUT_AVI)
+      return avi_output_start(wlkc, number, number + 1);
+    dec_reset_stream(&wlkc->dec, wlkc->output_fd);
+    return true;
+  }
+
+  if (wlkc->output_format == OUTPUT_AVI) {
+    /* single container for all ranges */
+    if (number || wlkc->output_fd == -1)
+      return true;
+    return avi_output_start(wlkc, 0u, wlkc->range_count);
+  }
+
+  if (wlkc->markers && wlkc->output_fd != -1) {
+    rm.start_be = BSWAP_BE64((uint64_t)rg->start);
+    rm.duration_be = BSWAP_BE32((uint32_t)rg->duration);
+    rm.number_be = BSWAP_BE32(number);
+    if (write(wlkc->output_fd, &rm, sizeof(rm)) != sizeof(rm)) {
+      fprintf(stderr, "ERROR: write failure %s\n", strerror(errno));
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+range_output_close(struct walk_context *wlkc, unsigned number)
+{
+  bool r = true;
 
-  if (wlkc->dump_ctx.fd != -1)
-    close(wlkc->dump_ctx.fd);
+  if (wlkc->output_format == OUTPUT_AVI && wlkc->output_fd != -1 &&
+      (wlkc->output_prefix || number + 1 == wlkc->range_count)) {
+    r = avi_write_index(&wlkc->avi, wlkc->output_fd);
+  } else if (OUTPUT_DECODED(wlkc->output_format)) {
+    r = dec_flush(&wlkc->dec);
+  }
 
+  if (wlkc->output_prefix && wlkc->output_fd != -1) {
+    close(wlkc->output_fd);
+    wlkc->output_fd = -1;
+  }
   return r;
 }
 
 bool
-dir_walk(struct walk_context *wlkc, const char *dirpath)
+ranges_add(struct walk_context *wlkc, time_t start, time_t duration)
 {
-  DIR *dirp;
-  struct dirent *rd;
-  size_t file_count = 0u;
+  struct time_range *rg;
+  size_t alloc;
+
+  if (wlkc->range_count == wlkc->range_alloc) {
+    alloc = wlkc->range_alloc ? wlkc->range_alloc * 2 : 16u;
+    rg = realloc(wlkc->ranges, alloc * sizeof(*rg));
+    if (!rg) {
+      fprintf(stderr, "ERROR: allocate %zu bytes failed: %s\n",
+              alloc * sizeof(*rg), strerror(errno));
+      return false;
+    }
+    wlkc->ranges = rg;
+    wlkc->range_alloc = alloc;
+  }
 
-  if ((dirp = opendir(dirpath)) == NULL) {
-    fprintf(stderr, "ERROR: directory not openned: %s\n", strerror(errno));
-    return false;
+  wlkc->ranges[wlkc->range_count].start = start;
+  wlkc->ranges[wlkc->range_count].duration = duration;
+  wlkc->range_count++;
+  return true;
+}
+
+/* read "<utc_seconds_start> <seconds_duration>" lines */
+bool
+ranges_load(struct walk_context *wlkc, const char *path)
+{
+  FILE *f = stdin;
+  unsigned long start;
+  unsigned long duration;
+  bool r = true;
+
+  if (strcmp(path, "-")) {
+    f = fopen(path, "r");
+    if (!f) {
+      fprintf(stderr, "ERROR: ranges file '%s' not openned: %s\n",
+              path, strerror(errno));
+      return false;
+    }
   }
 
-  while ((rd = readdir(dirp)) != NULL) {
-    if (!strncmp(rd->d_name, FILE_IDX_PREFIX, sizeof(FILE_IDX_PREFIX) - 1)) {
-      file_count++;
-      if (!index_walk(wlkc, rd->d_name)) {
-        closedir(dirp);
-        return false;
-      }
+  while (r && fscanf(f, "%lu %lu", &start, &duration) == 2) {
+    r = ranges_add(wlkc, (time_t)start, (time_t)duration);
+  }
+
+  if (f != stdin)
+    fclose(f);
+  return r;
+}
+
+int
+range_cmp(const void *a, const void *b)
+{
+  const struct time_range *ra = a;
+  const struct time_range *rb = b;
+
+  if (ra->start != rb->start)
+    return ra->start < rb->start ? -1 : 1;
+  return 0;
+}
+
+/* sort ranges and join overlapped or adjacent */
+void
+ranges_merge(struct walk_context *wlkc)
+{
+  struct time_range *rg = wlkc->ranges;
+  size_t n = 0u;
+  size_t i;
+
+  if (!wlkc->range_count)
+    return;
+
+  qsort(rg, wlkc->range_count, sizeof(*rg), range_cmp);
+  for (i = 1u; i < wlkc->range_count; i++) {
+    if (rg[i].start <= rg[n].start + rg[n].duration) {
+      if (rg[i].start + rg[i].duration > rg[n].start + rg[n].duration)
+        rg[n].duration = rg[i].start + rg[i].duration - rg[n].start;
+    } else {
+      rg[++n] = rg[i];
     }
   }
 
-  closedir(dirp);
+  if (n + 1 != wlkc->range_count) {
+    fprintf(stderr, "INFO: %zu ranges merged to %zu\n",
+            wlkc->range_count, n + 1);
+  }
+  wlkc->range_count = n + 1;
+}
 
-  if (!file_count) {
-    fprintf(stderr, "INFO: no frame index files found in path: '%s'\n", dirpath);
+/* find start frame and follow recording */
+bool
+follow_start(struct walk_context *wlkc)
+{
+  struct timeval start = {.tv_sec = wlkc->start_time};
+  struct timeval seg_end;
+  struct rdr_segment *seg = NULL;
+  struct rdr_index ix;
+  frame_index_t fi = {0};
+  size_t pos;
+  size_t i;
+
+  /* first file with frames after start time or file in writing */
+  for (i = 0u; i < wlkc->ar.seg_count; i++) {
+    timeradd(&wlkc->ar.segs[i].utc, &wlkc->ar.segs[i].last, &seg_end);
+    if (!timercmp(&seg_end, &start, <)) {
+      seg = &wlkc->ar.segs[i];
+      break;
+    }
   }
+
+  if (!seg)
+    seg = &wlkc->ar.segs[wlkc->ar.seg_count - 1];
+
+  wlkc->fd = open(seg->path, O_RDONLY);
+  if (wlkc->fd == -1) {
+    fprintf(stderr, "ERROR: file '%s' not oppened: %s\n",
+            seg->path, strerror(errno));
+    return false;
+  }
+
+  /* convert global time to local */
+  timersub(&start, &seg->utc, &wlkc->local_start);
+  memcpy(&wlkc->local_end, &wlkc->local_start, sizeof(wlkc->local_end));
+  wlkc->local_end.tv_sec += wlkc->duration;
+
+  fprintf(stderr, "INFO: follow file '%s' relative { start = "TV_FMT" }\n",
+          seg->path, TV_ARGS(&wlkc->local_start));
+
+  wlkc->file_seq = BSWAP_BE32(seg->fh.seq_be);
+  wlkc->file_seq_limit = BSWAP_BE32(seg->fh.seq_limit_be);
+  snprintf(wlkc->frm_path, sizeof(wlkc->frm_path), "%s", seg->frm);
+  if (!init_sort_context(wlkc, seg->fh.frame.fps))
+    return false;
+  follow_update_paths(wlkc);
+  wlkc->dec.fps = seg->fh.frame.fps;
+
+  if (!rdr_index_open(&ix, wlkc->ar.dirfd, seg->path)) {
+    fprintf(stderr, "WARN: %s\n", rdr_error());
+    return false;
+  }
+  pos = rdr_index_lower_bound(&ix, 0u, ix.count, &wlkc->local_start);
+  rdr_index_close(&ix);
+  lseek(wlkc->fd, FH_SIZE(&seg->fh) + pos * sizeof(frame_index_t),
+        SEEK_SET);
+
+  while (!frame_index_read(wlkc, &fi)) {
+    if (!follow_next(wlkc))
+      return false;
+  }
+
+  if (!FI_KEY_VALID(&fi)) {
+    fprintf(stderr, "WARN: invalid frame index magic key\n");
+    return false;
+  }
+
+  follow_walk(wlkc, &fi);
   return true;
 }
 
+void
+usage(void)
+{
+  fprintf(stderr, "Extract frames to stdout from current directory\n");
+  fprintf(stderr, "usage: [-f] [-m] [-o <prefix>] [-r <file>] "
+          "[-s <milliseconds> | -x <speed>] "
+          "[-O <format>] [-j <workers>] [-S <scale>] "
+          "<utc_seconds_start> <seconds_duration> ...\n");
+  fprintf(stderr, "  -f  follow recording, duration is optional (0 = endless)\n");
+  fprintf(stderr, "  -m  write range marker before frames of each range "
+          "(mjpeg only)\n");
+  fprintf(stderr, "  -o  write each range to file '<prefix><start>+<duration>.<format>'\n");
+  fprintf(stderr, "  -r  read '<utc_seconds_start> <seconds_duration>' lines "
+          "from file ('-' is stdin)\n");
+  fprintf(stderr, "  -s  write one frame nearest to each interval\n");
+  fprintf(stderr, "  -x  write one frame per <speed> frames periods "
+          "(fast forward)\n");
+  fprintf(stderr, "  -O  output format: mjpeg (default), avi (MJPEG with index), "
+          "y4m or yuv (decoded I420)\n");
+  fprintf(stderr, "  -j  decode threads, default is cpu count\n");
+  fprintf(stderr, "  -S  decode to 1/<scale> size: 1, 2, 4 or 8\n");
+}
+
 int
 main(int argc, char *argv[])
 {
 
   struct walk_context wlkc = {0};
+  size_t cursor = 0u;
+  size_t i;
+  unsigned workers = 0u;
+  unsigned scale = 1u;
+  int opt;
   wlkc.fd = -1;
-  wlkc.dump_ctx.fd = -1;
+  wlkc.ar.dirfd = -1;
+  rdr_pack_init(&wlkc.pack);
+  wlkc.follow.fd = -1;
   wlkc.output_fd = OUTPUT_FD;
 
-  if (argc < 3) {
-    fprintf(stderr, "Extract frames to stdout from current directory\n");
-    fprintf(stderr, "usage: <utc_seconds_start> <seconds_duration>\n");
-    return EXIT_FAILURE;
+  while ((opt = getopt(argc, argv, "fmo:r:s:x:O:j:S:")) != -1) {
+    switch (opt) {
+    case 'f':
+      wlkc.follow.enabled = true;
+      break;
+    case 'm':
+      wlkc.markers = true;
+      break;
+    case 'o':
+      wlkc.output_prefix = optarg;
+      break;
+    case 'r':
+      if (!ranges_load(&wlkc, optarg))
+        return EXIT_FAILURE;
+      break;
+    case 's':
+      {
+        unsigned long ms = strtoul(optarg, NULL, 10);
+        wlkc.sample.interval.tv_sec = ms / 1000u;
+        wlkc.sample.interval.tv_usec = (ms % 1000u) * 1000u;
+      }
+      break;
+    case 'x':
+      wlkc.sample.speed = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'O':
+      if (!strcmp(optarg, "mjpeg")) {
+        wlkc.output_format = OUTPUT_MJPEG;
+      } else if (!strcmp(optarg, "y4m")) {
+        wlkc.output_format = OUTPUT_Y4M;
+      } else if (!strcmp(optarg, "yuv")) {
+        wlkc.output_format = OUTPUT_YUV;
+      } else if (!strcmp(optarg, "avi")) {
+        wlkc.output_format = OUTPUT_AVI;
+      } else {
+        usage();
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'j':
+      workers = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'S':
+      scale = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (wlkc.follow.enabled) {
+    if (argc - optind < 1 || argc - optind > 2 || wlkc.range_count ||
+        timerisset(&wlkc.sample.interval) || wlkc.sample.speed ||
+        wlkc.output_format == OUTPUT_AVI) {
+      usage();
+      return EXIT_FAILURE;
+    }
+    wlkc.start_time = (time_t)strtoul(argv[optind], NULL, 10);
+    if (argc - optind > 1)
+      wlkc.duration = (time_t)strtoul(argv[optind + 1], NULL, 10);
+  } else {
+    if ((argc - optind) % 2 || (argc == optind && !wlkc.range_count) ||
+        (wlkc.markers && wlkc.output_format != OUTPUT_MJPEG)) {
+      usage();
+      return EXIT_FAILURE;
+    }
+    for (i = optind; i + 1 < argc; i += 2) {
+      if (!ranges_add(&wlkc,
+                      (time_t)strtoul(argv[i], NULL, 10),
+                      (time_t)strtoul(argv[i + 1], NULL, 10))) {
+        return EXIT_FAILURE;
+      }
+    }
   }
 
   if (isatty(wlkc.output_fd)) {
@@ -558,28 +1321,80 @@ main(int argc, char *argv[])
     fprintf(stderr, "INFO: disabling dump frames. Output is terminal\n");
   }
 
-  wlkc.start_time = (time_t)strtoul(argv[1], NULL, 10);
-  wlkc.duration = (time_t)strtoul(argv[2], NULL, 10);
+  if (wlkc.follow.enabled) {
+    wlkc.follow.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (wlkc.follow.fd == -1 ||
+        inotify_add_watch(wlkc.follow.fd, ".",
+                          IN_MODIFY | IN_CREATE | IN_MOVED_TO) == -1) {
+      fprintf(stderr, "ERROR: inotify not initialized: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
 
-  {
-    time_t end_time;
-    struct tm *tm_start;
-    struct tm *tm_end;
-    char bf_start[32];
-    char bf_end[32];
+  if (OUTPUT_DECODED(wlkc.output_format) &&
+      !dec_init(&wlkc.dec, workers, scale,
+                wlkc.output_format == OUTPUT_Y4M ?
+                DEC_FORMAT_Y4M : DEC_FORMAT_YUV,
+                wlkc.output_fd)) {
+    return EXIT_FAILURE;
+  }
 
-    end_time = wlkc.start_time + wlkc.duration;
-    tm_start = gmtime(&wlkc.start_time);
-    tm_end = gmtime(&end_time);
-    strftime(bf_start, sizeof(bf_start), "%H:%M:%S", tm_start);
-    strftime(bf_end, sizeof(bf_start), "%H:%M:%S", tm_end);
+  if (!rdr_open(&wlkc.ar, ".", wlkc.follow.enabled)) {
+    fprintf(stderr, "INFO: %s\n", rdr_error());
+    return EXIT_SUCCESS;
+  }
+  if (wlkc.ar.skipped)
+    fprintf(stderr, "WARN: %zu index files skipped, last: %s\n",
+            wlkc.ar.skipped, rdr_error());
+  fprintf(stderr, "INFO: %zu frame index files loaded\n", wlkc.ar.seg_count);
+
+  if (wlkc.follow.enabled) {
+    struct time_range rg = {.start = wlkc.start_time,
+                            .duration = wlkc.duration};
+    range_print(&rg);
+    follow_start(&wlkc);
+  } else {
+    ranges_merge(&wlkc);
+    for (i = 0u; i < wlkc.range_count; i++) {
+      range_print(&wlkc.ranges[i]);
+      if (!range_output_open(&wlkc, &wlkc.ranges[i], i)) {
+        /* file of range may be open, container not started */
+        if (wlkc.output_prefix && wlkc.output_fd != -1) {
+          close(wlkc.output_fd);
+          wlkc.output_fd = -1;
+        }
+        break;
+      }
+      if (!range_extract(&wlkc, &wlkc.ranges[i], &cursor)) {
+        /* as last range: finalize output with frames written so far */
+        range_output_close(&wlkc, wlkc.range_count - 1u);
+        break;
+      }
+      if (!range_output_close(&wlkc, i))
+        break;
+    }
+  }
 
-    fprintf(stderr, "INFO: get frames from %s to %s (%"PRIu64" seconds)\n",
-            bf_start, bf_end, (uint64_t)wlkc.duration);
+  if (OUTPUT_DECODED(wlkc.output_format)) {
+    dec_flush(&wlkc.dec);
+    fprintf(stderr, "INFO: %"PRIu64" frames decoded, %"PRIu64" failed\n",
+            wlkc.dec.frames, wlkc.dec.failed);
+    dec_destroy(&wlkc.dec);
   }
 
-  dir_walk(&wlkc, ".");
+  if (wlkc.fd != -1)
+    close(wlkc.fd);
+
+  rdr_pack_close(&wlkc.pack);
+
+  if (wlkc.follow.fd != -1)
+    close(wlkc.follow.fd);
+
+  free(wlkc.sort_ctx.fr);
+  rdr_close(&wlkc.ar);
+  free(wlkc.ranges);
+  free(wlkc.sample.fr);
+  avi_free(&wlkc.avi);
 
 	return EXIT_SUCCESS;
 }
-
@@ -4,6 +4,7 @@
 #ifndef _FRAME_INDEX_1551786768_H_
 #define _FRAME_INDEX_1551786768_H_
 
+#include <stddef.h>
 #include <byteswap.h> 
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
@@ -20,6 +21,10 @@
 
 #define FI_INIT_VALUE {.fi_key = {'A', 'Z'}};
 #define FI_KEY_VALID(_fi) ((_fi)->fi_key[0] == 'A' && (_fi)->fi_key[1] == 'Z')
+/* gap marker: frame dropped by capture, record has seq and time of frame,
+ * offset to end of previous frame and no data
+ */
+#define FI_IS_GAP(_fi) (!(_fi)->size_be)
 
 struct __attribute__((packed)) timebin {
   uint64_t sec_be;
@@ -36,8 +41,22 @@ typedef struct __attribute__((packed)) frame_index {
   uint64_t seq_be;
 } frame_index_t;
 
-#define FH_INIT_VALUE {.fh_key = {'S', 'W', 'I', 'C'}}
-#define FH_KEY_VALID(_fh) (!memcmp((_fh)->fh_key, "SWIC", 4))
+/* "SWIQ": header with frame.quality, "SWIC": without, older files */
+#define FH_INIT_VALUE {.fh_key = {'S', 'W', 'I', 'Q'}}
+#define FH_KEY_VALID(_fh) (!memcmp((_fh)->fh_key, "SWIQ", 4) || \
+                           !memcmp((_fh)->fh_key, "SWIC", 4))
+/* bytes before first index record, key must be valid */
+#define FH_SIZE_MIN offsetof(frame_header_t, frame.quality)
+#define FH_SIZE(_fh) \
+  ((_fh)->fh_key[3] == 'C' ? FH_SIZE_MIN : sizeof(frame_header_t))
+#define FH_QUALITY(_fh) ((_fh)->fh_key[3] == 'C' ? 0u : (_fh)->frame.quality)
+#define FH_FLAGS(_fh) ((_fh)->fh_key[3] == 'C' ? 0u : (_fh)->frame.flags)
+
+/* frame.flags */
+/* first files of triggered recording: frames before were not recorded,
+ * sequence gap to previous files is expected
+ */
+#define FH_FLAG_EVENT 0x01u
 
 /* file header */
 typedef struct __attribute__((packed)) frame_header {
@@ -59,6 +78,12 @@ typedef struct __attribute__((packed)) frame_header {
     uint8_t fps;
     uint16_t width_be;
     uint16_t height_be;
+    /* not in "SWIC" header:
+     * JPEG quality set on camera, 0 = unknown
+     */
+    uint8_t quality;
+    /* FH_FLAG_*, zero in files before flags */
+    uint8_t flags;
   } frame;
 } frame_header_t;
 
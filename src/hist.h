@@ -0,0 +1,103 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/hist.h
+ */
+#ifndef _HIST_1561370814_H_
+#define _HIST_1561370814_H_
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * log-linear histogram of nanoseconds:
+ * values below 64 are exact, above: 32 bins per power of two
+ * (relative error < 3.2%) up to UINT64_MAX
+ */
+#define HIST_SUB_BITS 5u
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_LINEAR (HIST_SUB * 2u)
+#define HIST_BINS (HIST_LINEAR + (64u - HIST_SUB_BITS - 1u) * HIST_SUB)
+
+struct hist {
+  uint64_t bins[HIST_BINS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+static inline void
+hist_reset(struct hist *h)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+static inline unsigned
+hist_bin(uint64_t v)
+{
+  unsigned e;
+
+  if (v < HIST_LINEAR)
+    return (unsigned)v;
+  e = 63u - (unsigned)__builtin_clzll(v);
+  return HIST_LINEAR + (e - HIST_SUB_BITS - 1u) * HIST_SUB +
+         (unsigned)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1u));
+}
+
+/* lower edge of bin */
+static inline uint64_t
+hist_bin_value(unsigned bin)
+{
+  unsigned e;
+
+  if (bin < HIST_LINEAR)
+    return bin;
+  e = (bin - HIST_LINEAR) / HIST_SUB + HIST_SUB_BITS + 1u;
+  return (uint64_t)(HIST_SUB + (bin - HIST_LINEAR) % HIST_SUB) <<
+         (e - HIST_SUB_BITS);
+}
+
+static inline void
+hist_add(struct hist *h, uint64_t v)
+{
+  h->bins[hist_bin(v)]++;
+  if (!h->count || v < h->min)
+    h->min = v;
+  if (v > h->max)
+    h->max = v;
+  h->sum += v;
+  h->count++;
+}
+
+static inline void
+hist_merge(struct hist *h, const struct hist *from)
+{
+  unsigned i;
+
+  if (!from->count)
+    return;
+  for (i = 0u; i < HIST_BINS; i++)
+    h->bins[i] += from->bins[i];
+  if (!h->count || from->min < h->min)
+    h->min = from->min;
+  if (from->max > h->max)
+    h->max = from->max;
+  h->sum += from->sum;
+  h->count += from->count;
+}
+
+/* value at permille rank, 999 = p99.9 */
+static inline uint64_t
+hist_permille(const struct hist *h, unsigned permille)
+{
+  uint64_t rank = (h->count * permille + 999u) / 1000u;
+  uint64_t n = 0u;
+  unsigned i;
+
+  for (i = 0u; i < HIST_BINS; i++) {
+    n += h->bins[i];
+    if (n && n >= rank)
+      return hist_bin_value(i) > h->max ? h->max : hist_bin_value(i);
+  }
+  return h->max;
+}
+
+#endif /* _HIST_1561370814_H_ */
@@ -21,9 +21,16 @@
 #include <linux/videodev2.h>
 
 #include "main.h"
-#include "files.h"
+#include "capture.h"
+#include "stats.h"
+#include "clock.h"
+#include "alog.h"
+#include "trace.h"
+#include "rt.h"
+#include "mem.h"
+#include "adapt.h"
+#include "event.h"
 
-#define LOG_NOISY 0
 #define FRAMES_DB "frames.mjpeg"
 #define INDEX_DB "frames_idx.db"
 
@@ -34,69 +41,39 @@
 # define BUFFERS_SWAP_COUNT VIDEO_MAX_FRAME
 #endif
 
-/* write target */
-struct wbf {
-  int fd; /* -1 and 0 is invalid fd */
-  char path[FH_PATH_SIZE + 1];
-  uint64_t written;
-};
-
-/* v4l buffer pointer */
-struct bufinfo {
-  void *p;
-  /* size of allocated frame */
-  size_t size;
-};
-
-/* device info */
-struct devinfo {
-  /* system values */
-  ev_io ev;
-  int fd;
-
-  struct ev_loop *loop;
-  /* preseted values */
-  char path[256];
-
-  /* size of uncompressed frame */
-  size_t frame_size;
-
-  size_t frame_width;
-  size_t frame_height;
-
-  /* calculated values */
-  /* input queue */
-  struct bufinfo *queue;
-  size_t queue_size;  
-  size_t queued; /* count of queued buffers */
-
-  /* output queue: frames and indexes */
-  struct {
-    struct wth_context *ctx;
-    /* if limit reached, wbf.index got zero */
-    size_t files_limit;
-    size_t size_limit;
-    uint32_t file_idx;
-    struct wbf frame;
-    struct wbf index;
-  } trg;
-
-  struct {
-    unsigned frame_per_second;
-  } cam_info;
-
-  /* counters */
-  struct {
-    /* time of send STREAMON */
-    struct timeval start_time;
-    struct timeval start_time_utc;
-    /* time of receive first frame after STREAMON */
-    struct timeval first_frame_time_utc;
-    struct timeval first_frame_time;
-    struct timeval last_frame_time;
-    size_t frames_arrived;
-  } c;
-} devinfo;
+struct devinfo devinfo;
+
+/* shared memory counters, NULL when disabled */
+static struct stats_page *stats;
+
+/* perf counters of capture thread, mask 0 when disabled */
+static struct pmu_group pmu;
+/* camera_cb per frame */
+static struct pmu_stat pmu_capture;
+
+/* enum mem_flags of frame buffers and write thread buffer */
+static unsigned mem_flags = MEM_PREFAULT | MEM_LOCK;
+
+/* adaptive quality, levels 0 when disabled */
+static struct adapt adapt;
+/* resolution of best level */
+static size_t adapt_width;
+static size_t adapt_height;
+
+/* startup steps, CLOCK_MONOTONIC ns */
+static struct {
+  uint64_t launch;
+  uint64_t device;
+  uint64_t writer;
+  uint64_t stream;
+  uint64_t first_dqbuf;
+  /* write thread only */
+  bool frame_written;
+  bool reported;
+} startup;
+
+_Static_assert(STATS_LAT_STAGES == WTH_LAT_STAGES,
+               "stats page latency stages");
 
 static inline int
 xioctl(int fh, unsigned long int request, void *arg)
@@ -130,11 +107,8 @@ deinit_device(struct devinfo *dev)
 {
   fprintf(stderr, "* close cam: %s\n", dev->path);
   close(dev->fd);
-  /* TODO: free queue buffer */
   if (dev->queue) {
-    if (dev->queue[0].p) {
-      free(dev->queue[0].p);
-    }
+    mem_free(dev->queue[0].p, dev->queue_length);
     free(dev->queue);
   }
   /* TODO: free circle_buffer */
@@ -159,7 +133,9 @@ init_device_rqueue_alloc(struct devinfo *dev)
     return false;
   }
 
-  dev->queue[0].p = calloc(dev->queue_size, dev->frame_size);
+  /* faulted and locked now, not on first frames */
+  dev->queue_length = dev->queue_size * dev->frame_size;
+  dev->queue[0].p = mem_alloc("frames", &dev->queue_length, mem_flags);
   if (!dev->queue[0].p) {
     fprintf(stderr, "! out of memory while allocating frame buffers\n");
     return false;
@@ -214,6 +190,12 @@ init_device_options(struct devinfo *dev)
 
   dev->cam_info.frame_per_second = fps;
 
+  cntr.id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+  if (xioctl(dev->fd, VIDIOC_G_CTRL, &cntr)) {
+    fprintf(stderr, "@ JPEG quality: %d\n", cntr.value);
+    dev->cam_info.quality = (unsigned)cntr.value;
+  }
+
   cntr.id = V4L2_CID_EXPOSURE_AUTO_PRIORITY;
   cntr.value = 0;
   if (!xioctl(dev->fd, VIDIOC_S_CTRL, &cntr)) {
@@ -313,8 +295,9 @@ init_device(struct ev_loop *loop, struct devinfo *dev)
   return true;
 }
 
-bool
-capture(struct devinfo *dev)
+/* request and queue all frame buffers to driver */
+static bool
+capture_queue(struct devinfo *dev)
 {
   struct v4l2_buffer buf = {0};
   struct v4l2_requestbuffers req = {0};
@@ -351,13 +334,23 @@ capture(struct devinfo *dev)
       dev->queued++;
     }
   }
+  return true;
+}
+
+bool
+capture(struct devinfo *dev)
+{
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+  if (!capture_queue(dev))
+    return false;
 
   /* start capture */
   memset(&dev->c, 0, sizeof(dev->c));
   get_precise_time(&dev->c.start_time);
   gettimeofday(&dev->c.start_time_utc, NULL);
 
-  if (!xioctl(dev->fd, VIDIOC_STREAMON, &buf.type)) {
+  if (!xioctl(dev->fd, VIDIOC_STREAMON, &type)) {
     perror("! ioctl(VIDIOC_STREAMON)");
     return false;
   }
@@ -369,190 +362,260 @@ capture(struct devinfo *dev)
   return true;
 }
 
+/* set frame interval, driver may round it: actual rate stored */
 static bool
-wbf_write(struct devinfo *dev, struct wbf *wb, uint8_t *p, size_t len)
+set_frame_rate(struct devinfo *dev, unsigned fps)
 {
-  ssize_t r;
+  struct v4l2_streamparm parm = {0};
 
-#if 0 /* SIMPLE_WRITE */
-  r = write(wb->fd, p, len);
-#else
-  r = wth_write(dev->trg.ctx, wb->fd, p, len);
-#endif
-  if (r != len) {
-    fprintf(stderr, "! write to '%s' incomplete: %zd != %zu.\n",
-            wb->path, r, len);
+  parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  parm.parm.capture.timeperframe.numerator = 1u;
+  parm.parm.capture.timeperframe.denominator = fps;
+  if (!xioctl(dev->fd, VIDIOC_S_PARM, &parm))
     return false;
-  }
-
-  wb->written += len;
+  if (parm.parm.capture.timeperframe.numerator)
+    dev->cam_info.frame_per_second =
+      parm.parm.capture.timeperframe.denominator /
+      parm.parm.capture.timeperframe.numerator;
   return true;
 }
 
+/*
+ * stream off, set format and frame rate, reallocate frame buffers
+ * and stream on. counters and files ring are kept:
+ * frames of new format go to new segment
+ */
 static bool
-make_frame_header(struct devinfo *dev)
+restart_device(struct devinfo *dev, size_t width, size_t height,
+               unsigned fps)
 {
-  struct frame_header fh = FH_INIT_VALUE;
-  struct timeval tv_diff = {0};
-
-  timersub(&dev->c.last_frame_time, &dev->c.first_frame_time, &tv_diff);
-
-  fh.seq_be = BSWAP_BE32(dev->trg.file_idx);
-  fh.seq_limit_be = BSWAP_BE32(dev->trg.files_limit);
-  fh.frame.fps = (uint8_t)dev->cam_info.frame_per_second;
-  fh.frame.width_be = BSWAP_BE16((uint16_t)dev->frame_width);
-  fh.frame.height_be = BSWAP_BE16((uint16_t)dev->frame_height);
-  /* mark current frame as first */
-  timebin_from_timeval(&fh.cap_time.local, &tv_diff);
-
-  timebin_from_timeval(&fh.cap_time.utc, &dev->c.first_frame_time_utc);
-  memcpy(fh.path, dev->trg.frame.path, sizeof(fh.path));
-  return wbf_write(dev, &dev->trg.index, (uint8_t*)&fh, sizeof(fh));
-}
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  struct v4l2_requestbuffers req = {0};
+  struct v4l2_format fmt = {0};
+  uint64_t start = now_ns();
 
-static void
-wbf_make_filename(struct devinfo *dev, struct wbf *wb, uint32_t file_no)
-{
-  if (wb == &dev->trg.index) {
-    make_idx_file(wb->path, file_no);
-  } else if (wb == &dev->trg.frame) {
-    make_frm_file(wb->path, file_no);
-  } else {
-    assert(0);
+  ev_io_stop(dev->loop, &dev->ev);
+  if (!xioctl(dev->fd, VIDIOC_STREAMOFF, &type)) {
+    perror("! ioctl(VIDIOC_STREAMOFF)");
+    return false;
   }
-}
+  dev->queued = 0u;
 
-static bool
-wbf_make_file(struct devinfo *dev, struct wbf *wb)
-{
-  if (dev->trg.files_limit)
-    wbf_make_filename(dev, wb, dev->trg.file_idx % dev->trg.files_limit);
-  else
-    wbf_make_filename(dev, wb, dev->trg.file_idx);
+  /* release buffers of driver before format change */
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = V4L2_MEMORY_USERPTR;
+  if (!xioctl(dev->fd, VIDIOC_REQBUFS, &req)) {
+    perror("! ioctl(VIDIOC_REQBUFS)");
+    return false;
+  }
 
-#if 0 /* SIMPLE_WRITE */
-  if (wb->fd > 0)
-    close(wb->fd);
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  fmt.fmt.pix.width = width;
+  fmt.fmt.pix.height = height;
+  fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+  fmt.fmt.pix.field = V4L2_FIELD_INTERLACED;
+  if (!xioctl(dev->fd, VIDIOC_S_FMT, &fmt)) {
+    fprintf(stderr, "! ioctl(VIDIOC_S_FMT) failed: %s\n", strerror(errno));
+    return false;
+  }
+  dev->frame_width = fmt.fmt.pix.width;
+  dev->frame_height = fmt.fmt.pix.height;
+  dev->frame_size = fmt.fmt.pix.sizeimage;
 
-  wb->fd = open(wb->path, O_CREAT | O_TRUNC | O_WRONLY,
-                  S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
-#else
-  if (wb->fd > 0)
-    wth_close(dev->trg.ctx, wb->fd);
+  if (!set_frame_rate(dev, fps))
+    fprintf(stderr, "! frame rate %u not set: %s\n", fps, strerror(errno));
 
-  wb->fd = wth_open(dev->trg.ctx, wb->path);
-#endif
+  mem_free(dev->queue[0].p, dev->queue_length);
+  free(dev->queue);
+  dev->queue = NULL;
+  if (!init_device_rqueue_alloc(dev) || !capture_queue(dev))
+    return false;
 
-  if (wb->fd == -1) {
-    fprintf(stderr, "! file '%s' not openned for writing.\n", wb->path);
+  if (!xioctl(dev->fd, VIDIOC_STREAMON, &type)) {
+    perror("! ioctl(VIDIOC_STREAMON)");
     return false;
-  } else {
-    fprintf(stderr, "@ open file '%s' writing. sequence = %"PRIu32"\n",
-            wb->path, dev->trg.file_idx);
-    wb->written = 0u;
   }
+  ev_io_start(dev->loop, &dev->ev);
+  fprintf(stderr, "@ restart: %zux%zu, %u fps in %.3f ms\n",
+          dev->frame_width, dev->frame_height,
+          dev->cam_info.frame_per_second, (now_ns() - start) / 1e6);
   return true;
 }
 
-/* generate index and frames files */
+/*
+ * set camera to adaptive quality level,
+ * next frame starts new segment with header of new settings
+ */
 static bool
-wbf_make_increment(struct devinfo *dev)
+adapt_apply(struct devinfo *dev, const struct adapt_level *l)
 {
-  if (!wbf_make_file(dev, &dev->trg.frame))
-    return false;
+  struct v4l2_control cntr = {0};
+  size_t width = adapt_width / l->scale;
+  size_t height = adapt_height / l->scale;
+  bool restart = width != dev->frame_width || height != dev->frame_height;
+
+  if (l->quality != dev->cam_info.quality) {
+    cntr.id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+    cntr.value = (int)l->quality;
+    if (!xioctl(dev->fd, VIDIOC_S_CTRL, &cntr))
+      fprintf(stderr, "! adapt: quality %u not set: %s\n",
+              l->quality, strerror(errno));
+    else
+      dev->cam_info.quality = l->quality;
+  }
 
-  if (!wbf_make_file(dev, &dev->trg.index))
-    return false;
+  /* most drivers change frame interval only with stream off */
+  if (!restart && l->fps != dev->cam_info.frame_per_second &&
+      !set_frame_rate(dev, l->fps)) {
+    if (errno != EBUSY) {
+      fprintf(stderr, "! adapt: frame rate %u not set: %s\n",
+              l->fps, strerror(errno));
+    } else {
+      restart = true;
+    }
+  }
 
-  if (!make_frame_header(dev)) {
-    fprintf(stderr, "! Frame header not writted: %s", strerror(errno));
+  capture_settings_changed(dev);
+  if (restart && !restart_device(dev, width, height, l->fps)) {
+    fprintf(stderr, "! adapt: camera not restarted\n");
+    ev_break(dev->loop, EVBREAK_ALL);
     return false;
   }
-
-  dev->trg.file_idx++;
   return true;
 }
 
 static void
-capture_process(struct devinfo *dev,
-                struct v4l2_buffer *cam_buf, uint8_t *p)
+adapt_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
 {
-  frame_index_t fi = FI_INIT_VALUE;
-  struct timeval frame_time;
-
-  if ((dev->trg.index.written + sizeof(frame_index_t) +
-       dev->trg.frame.written + cam_buf->bytesused > dev->trg.size_limit) ||
-      (dev->trg.frame.fd <= 0 || dev->trg.index.fd <= 0)) {
-    if (!wbf_make_increment(dev)) {
-      fprintf(stderr, "! error while create new files\n");
-      ev_break(dev->loop, EVBREAK_ALL);
-      return;
-    }
-  }
+  struct wth_context *ctx = devinfo.trg.ctx;
+  struct adapt_level l;
+
+  if (adapt_update(&adapt, now_ns(), ctx->occupied_percent,
+                   devinfo.c.bytes_queued, ctx->written, &l))
+    adapt_apply(&devinfo, &l);
+}
 
-  if (!wbf_write(dev, &dev->trg.frame, p, cam_buf->bytesused)) {
-    fprintf(stderr, "! frame %zu not written\n", dev->c.frames_arrived);
-    /* skip frame */
+static void
+stats_pmu(struct stats_pmu *sp, const struct pmu_stat *s)
+{
+  struct pmu_sum last;
+
+  pmu_last(s, &last);
+  sp->mask = s->mask;
+  sp->frames = last.frames;
+  sp->cycles = last.v[PMU_CYCLES];
+  sp->instructions = last.v[PMU_INSTRUCTIONS];
+  sp->cache_misses = last.v[PMU_CACHE_MISSES];
+  sp->page_faults = last.v[PMU_PAGE_FAULTS];
+  sp->task_clock_ns = last.v[PMU_TASK_CLOCK];
+}
+
+/* copy counters to stats page: plain stores, no syscalls
+ * lat: also summarize latency histograms (slower, from timer)
+ */
+static void
+stats_update(struct devinfo *dev, bool lat)
+{
+  struct wth_context *ctx = dev->trg.ctx;
+  struct stats_data *d;
+  size_t i;
+
+  if (!stats)
     return;
+  d = &stats->data;
+
+  stats_write_begin(stats);
+  d->update_ns = now_ns();
+  d->start_utc = dev->c.start_time_utc.tv_sec;
+  d->frames_arrived = dev->c.frames_arrived;
+  d->frames_dropped = dev->c.frames_dropped;
+  d->drops_full = dev->c.drops[CAPTURE_DROP_FULL];
+  d->drops_oldest = dev->c.drops[CAPTURE_DROP_OLDEST];
+  d->drops_decimate = dev->c.drops[CAPTURE_DROP_DECIMATE];
+  d->gap_markers = dev->c.gap_markers;
+  d->v4l2_queued = dev->queued;
+  d->v4l2_buffers = dev->queue_size;
+  d->fps = dev->cam_info.frame_per_second;
+  d->quality = dev->cam_info.quality;
+  d->adapt_level = adapt.level;
+  d->adapt_levels = adapt.levels;
+  d->adapt_steps_down = adapt.steps_down;
+  d->adapt_steps_up = adapt.steps_up;
+
+  d->segment = dev->trg.file_idx;
+  d->files_limit = dev->trg.files_limit;
+  d->size_limit = dev->trg.size_limit;
+  d->frame_file_bytes = dev->trg.frame.written;
+  d->index_file_bytes = dev->trg.index.written;
+  memcpy(d->frame_file, dev->trg.frame.path, sizeof(d->frame_file));
+  memcpy(d->index_file, dev->trg.index.path, sizeof(d->index_file));
+  if (dev->lapse) {
+    d->lapse_frames = dev->lapse->frames;
+    d->lapse_gap_markers = dev->lapse->gap_markers;
+    d->lapse_segment = dev->lapse->trg.file_idx;
+    d->lapse_files_limit = dev->lapse->trg.files_limit;
+  }
+  if (dev->event) {
+    d->event_ring_capacity = dev->event->ring.capacity;
+    d->event_ring_percent = event_percent(dev->event);
+    d->event_recording = dev->event->recording;
+    d->event_triggers = dev->event->triggers;
+    d->events = dev->event->events;
+    d->event_discarded = dev->event->discarded;
   }
 
-  timersub(&cam_buf->timestamp, &dev->c.first_frame_time, &frame_time);
-  timebin_from_timeval(&fi.tv, &frame_time);
-  fi.offset_be = BSWAP_BE64(dev->trg.frame.written - cam_buf->bytesused);
-  fi.size_be = BSWAP_BE32(cam_buf->bytesused);
-  fi.seq_be = BSWAP_BE64((uint64_t)dev->c.frames_arrived);
+  d->ring_capacity = ctx->buffer.capacity;
+  d->ring_percent = ctx->occupied_percent;
+  d->ring_percent_max = ctx->occupied_percent_max;
+  d->ring_dropped = ctx->dropped;
+  d->written_bytes = ctx->written;
+  d->write_errors = ctx->write_errors;
+  d->short_writes = ctx->short_writes;
+  d->flushes = ctx->flushes;
+  d->flushes_deadline = ctx->flushes_deadline;
+
+  if (lat && ctx->pmu_window) {
+    stats_pmu(&d->pmu[STATS_PMU_CAPTURE], &pmu_capture);
+    stats_pmu(&d->pmu[STATS_PMU_WRITE], &ctx->pmu_stat);
+  }
 
-  if (!wbf_write(dev, &dev->trg.index, (uint8_t*)&fi, sizeof(fi))) {
-    fprintf(stderr, "! write index for frame  %zu failed\n",
-            dev->c.frames_arrived);
-    /* skip frame info (result: frame droped) */
-    return;
+  for (i = 0u; lat && i < STATS_LAT_STAGES; i++) {
+    d->lat[i].count = ctx->lat[i].count;
+    d->lat[i].sum_ns = ctx->lat[i].sum;
+    d->lat[i].p50_ns = hist_permille(&ctx->lat[i], 500u);
+    d->lat[i].p99_ns = hist_permille(&ctx->lat[i], 990u);
+    d->lat[i].max_ns = ctx->lat[i].max;
   }
+  stats_write_end(stats);
 }
 
+/* bookkeeping and diagnostics of dequeued buffer */
 static void
-camera_cb(struct ev_loop *loop, ev_io *w, int revents)
+frame_arrived(struct devinfo *dev, struct v4l2_buffer *buf)
 {
-  struct v4l2_buffer buf = {
-                            .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
-                            .memory = V4L2_MEMORY_USERPTR
-                           };
-  struct devinfo *dev = (struct devinfo*)w;
-#if LOG_NOISY
   static size_t frame_counter = 0;
-  struct timeval host_tv_cur = {0};
-  struct timeval host_tvr = {0};
-#endif
-
-#if LOG_NOISY
-  get_precise_time(&host_tv_cur);
-#endif
+  static struct timeval last_tv;
+  static uint64_t last_dqbuf_ns;
 
-  if (!xioctl(dev->fd, VIDIOC_DQBUF, &buf)) {
-    fprintf(stderr, "! ioctl(VIDIOC_DQBUF) failed: %s\n", strerror(errno));
-    return;
-  }
-  dev->queued--;
-
-#if LOG_NOISY
   /* get fps */
-  {
+  if (alog_level >= ALOG_TRACE) {
     struct timeval _tlast = {0};
     struct timeval _tcur = {0};
     timersub(&dev->c.last_frame_time, &dev->c.first_frame_time, &_tlast);
-    timersub(&buf.timestamp, &dev->c.first_frame_time, &_tcur);
+    timersub(&buf->timestamp, &dev->c.first_frame_time, &_tcur);
     if (_tlast.tv_sec != _tcur.tv_sec) {
-      fprintf(stderr, "@ fps = %zu\n", dev->c.frames_arrived - frame_counter);
+      alog(ALOG_TRACE, "capture", "fps = %zu",
+           dev->c.frames_arrived - frame_counter);
       frame_counter = dev->c.frames_arrived;
     }
   }
-#endif
 
   if (!dev->c.frames_arrived) {
     /* first frame arrived */
     struct timeval ttv = {0};
+    startup.first_dqbuf = dev->c.dqbuf_ns;
     /* get frame time */
-    memcpy(&dev->c.first_frame_time, &buf.timestamp, sizeof(struct timeval));
+    memcpy(&dev->c.first_frame_time, &buf->timestamp, sizeof(struct timeval));
 
     /* make UTC first frame time */
     timersub(&dev->c.first_frame_time, &dev->c.start_time, &ttv);
@@ -564,59 +627,144 @@ camera_cb(struct ev_loop *loop, ev_io *w, int revents)
             "* first frame arrived in: "TV_FMT" seconds\n",
             TV_ARGS(&ttv));
     /* diff from kernel time */
-    timersub(&dev->c.first_frame_time, &buf.timestamp, &ttv);
+    timersub(&dev->c.first_frame_time, &buf->timestamp, &ttv);
     fprintf(stderr, "* diff kernel time: "TV_FMT"\n", TV_ARGS(&ttv));
   }
   /* update time for each frame */
-  memcpy(&dev->c.last_frame_time, &buf.timestamp, sizeof(struct timeval));
+  memcpy(&dev->c.last_frame_time, &buf->timestamp, sizeof(struct timeval));
 
-#if LOG_NOISY
-  {
-  struct timeval tvr = {0};
-    static struct timeval tv = {0};
-    static struct timeval host_tv = {0};
+  if (alog_level >= ALOG_TRACE) {
+    struct timeval tvr = {0};
     struct timeval cap_tv = {0};
-    timersub(&buf.timestamp, &tv, &tvr);
-    timersub(&host_tv_cur, &host_tv, &host_tvr);
-    timersub(&buf.timestamp, &dev->c.first_frame_time, &cap_tv);
-    memcpy(&tv, &buf.timestamp, sizeof(tv));
-    memcpy(&host_tv, &host_tv_cur, sizeof(host_tv));
-    fprintf(stderr,
-            "@ buf: index=%"PRIu32", "
-            "bytesused=%"PRIu32", "
-            "flags=0x%08"PRIx32", "
-            "sequence=%"PRIu32", "
-            "queued=%zu, "
-            "frame time: "TV_FMT" ["TV_FMT"], "
-            "from last: "TV_FMT", "
-            "host last: " TV_FMT
-            "\n",
-            buf.index, buf.bytesused, buf.flags, buf.sequence,
-            dev->queued,
-            TV_ARGS(&buf.timestamp),
-            TV_ARGS(&cap_tv),
-            TV_ARGS(&tvr),
-            TV_ARGS(&host_tvr));
+    timersub(&buf->timestamp, &last_tv, &tvr);
+    timersub(&buf->timestamp, &dev->c.first_frame_time, &cap_tv);
+    alog(ALOG_TRACE, "capture",
+         "buf: index=%"PRIu32", "
+         "bytesused=%"PRIu32", "
+         "flags=0x%08"PRIx32", "
+         "sequence=%"PRIu32", "
+         "queued=%zu, "
+         "frame time: "TV_FMT" ["TV_FMT"], "
+         "from last: "TV_FMT", "
+         "host last: %"PRIu64" us",
+         buf->index, buf->bytesused, buf->flags, buf->sequence,
+         dev->queued,
+         TV_ARGS(&buf->timestamp),
+         TV_ARGS(&cap_tv),
+         TV_ARGS(&tvr),
+         (dev->c.dqbuf_ns - last_dqbuf_ns) / 1000u);
+    memcpy(&last_tv, &buf->timestamp, sizeof(last_tv));
+    last_dqbuf_ns = dev->c.dqbuf_ns;
   }
-#endif
 
   dev->c.frames_arrived++;
+}
+
+/* drain all ready buffers, write them as one batch, queue them back */
+static void
+camera_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+  struct v4l2_buffer batch[BUFFERS_SWAP_COUNT];
+  uint64_t dqbuf_ns[BUFFERS_SWAP_COUNT];
+  struct devinfo *dev = (struct devinfo*)w;
+  uint64_t pmu_before[PMU_EVENTS];
+  uint64_t pmu_after[PMU_EVENTS];
+  size_t n = 0u;
+  size_t i;
 
-  capture_process(dev, &buf, dev->queue[buf.index].p);
+  if (pmu.mask)
+    pmu_read(&pmu, pmu_before);
+
+  trace_begin("camera_cb");
+  while (n < BUFFERS_SWAP_COUNT && dev->queued) {
+    memset(&batch[n], 0, sizeof(batch[n]));
+    batch[n].type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    batch[n].memory = V4L2_MEMORY_USERPTR;
+    if (!xioctl(dev->fd, VIDIOC_DQBUF, &batch[n])) {
+      if (errno != EAGAIN)
+        fprintf(stderr, "! ioctl(VIDIOC_DQBUF) failed: %s\n",
+                strerror(errno));
+      break;
+    }
+    dqbuf_ns[n] = now_ns();
+    dev->queued--;
+    n++;
+  }
 
-  if (!xioctl(dev->fd, VIDIOC_QBUF, &buf)) {
-    fprintf(stderr, "! error while queue buffer %"PRIu32": %s\n",
-            buf.index, strerror(errno));
-  } else {
-    dev->queued++;
+  if (!n) {
+    trace_end("camera_cb");
+    return;
   }
 
+  dev->c.wakeups++;
+  if (n > dev->c.batch_max)
+    dev->c.batch_max = n;
+  trace_counter("dqbuf_batch", n);
+
+  /* one lock of write thread ring and one wakeup for batch */
+  wth_batch_begin(dev->trg.ctx);
+  capture_batch(dev, batch, n);
+  for (i = 0u; i < n; i++) {
+    dev->c.dqbuf_ns = dqbuf_ns[i];
+    frame_arrived(dev, &batch[i]);
+
+    trace_begin_arg("capture_process", batch[i].sequence);
+    capture_process(dev, &batch[i], dev->queue[batch[i].index].p);
+    trace_end("capture_process");
+  }
+  wth_batch_end(dev->trg.ctx);
+
+  for (i = 0u; i < n; i++) {
+    if (!xioctl(dev->fd, VIDIOC_QBUF, &batch[i])) {
+      fprintf(stderr, "! error while queue buffer %"PRIu32": %s\n",
+              batch[i].index, strerror(errno));
+    } else {
+      dev->queued++;
+    }
+  }
+
+  stats_update(dev, false);
+  trace_counter("v4l2_queued", dev->queued);
+  trace_end("camera_cb");
+
+  if (pmu.mask && pmu_read(&pmu, pmu_after))
+    pmu_account(&pmu_capture, pmu_before, pmu_after, n);
+
   if (!dev->queued) {
     fprintf(stderr, "! queue empty");
     ev_break(loop, EVBREAK_ALL);
   }
 }
 
+static double
+startup_ms(uint64_t ns)
+{
+  return ns > startup.launch ? (ns - startup.launch) / 1e6 : 0.0;
+}
+
+/* write thread: report time from launch to first frame on disk */
+static void
+written_cb(struct wth_context *ctx, unsigned idx, size_t size,
+           const struct wth_times *t)
+{
+  if (startup.reported)
+    return;
+  /* frame is found by readers when index record after it is written */
+  if (t->dqbuf) {
+    startup.frame_written = true;
+    return;
+  }
+  if (!startup.frame_written)
+    return;
+  startup.reported = true;
+  fprintf(stderr, "@ startup: device %.3f ms, writer %.3f ms, "
+          "stream on %.3f ms, first frame %.3f ms, "
+          "first frame written %.3f ms after launch\n",
+          startup_ms(startup.device), startup_ms(ctx->ready_ns),
+          startup_ms(startup.stream), startup_ms(startup.first_dqbuf),
+          startup_ms(now_ns()));
+}
+
 static void
 sig_int_cb(struct ev_loop *loop, ev_signal *w, int revents)
 {
@@ -624,36 +772,377 @@ sig_int_cb(struct ev_loop *loop, ev_signal *w, int revents)
   ev_break(loop, EVBREAK_ALL);
 }
 
+/* SIGUSR1 or stats timer: print frame latency of pipeline stages */
+static void
+lat_print(struct wth_context *ctx)
+{
+  fprintf(stderr, "@ frames: %zu arrived, %zu dropped, buffer max %u%%, "
+          "%"PRIu64" wakeups, batch max %zu\n",
+          devinfo.c.frames_arrived, devinfo.c.frames_dropped,
+          ctx->occupied_percent_max, devinfo.c.wakeups, devinfo.c.batch_max);
+  fprintf(stderr, "@ drops: %"PRIu64" buffer full, %"PRIu64" oldest, "
+          "%"PRIu64" decimated, gap markers %"PRIu64" (%"PRIu64" lost)\n",
+          devinfo.c.drops[CAPTURE_DROP_FULL],
+          devinfo.c.drops[CAPTURE_DROP_OLDEST],
+          devinfo.c.drops[CAPTURE_DROP_DECIMATE],
+          devinfo.c.gap_markers, devinfo.c.gap_markers_lost);
+  fprintf(stderr, "@ flushes: %"PRIu64", by age deadline %"PRIu64"\n",
+          ctx->flushes, ctx->flushes_deadline);
+  if (devinfo.lapse) {
+    fprintf(stderr, "@ lapse: %"PRIu64" frames, gap markers %"PRIu64", "
+            "segment %"PRIu32"\n",
+            devinfo.lapse->frames, devinfo.lapse->gap_markers,
+            devinfo.lapse->trg.file_idx);
+  }
+  if (devinfo.event) {
+    fprintf(stderr, "@ event: %s, %"PRIu64" triggers, %"PRIu64" events, "
+            "%"PRIu64" idle frames discarded, ring %u%%\n",
+            devinfo.event->recording ? "recording" : "idle",
+            devinfo.event->triggers, devinfo.event->events,
+            devinfo.event->discarded, event_percent(devinfo.event));
+  }
+  if (adapt.levels) {
+    fprintf(stderr, "@ adapt: level %u/%u, quality %u, fps %u, %zux%zu, "
+            "%"PRIu64" steps down, %"PRIu64" up\n",
+            adapt.level, adapt.levels - 1u, devinfo.cam_info.quality,
+            devinfo.cam_info.frame_per_second,
+            devinfo.frame_width, devinfo.frame_height,
+            adapt.steps_down, adapt.steps_up);
+  }
+  wth_lat_print(ctx->lat, stderr);
+  if (ctx->pmu_window) {
+    fprintf(stderr, "@ perf counters per frame:\n");
+    pmu_print("camera_cb", &pmu_capture, stderr);
+    pmu_print("async_write_cb", &ctx->pmu_stat, stderr);
+  }
+}
 
+static void
+sig_usr1_cb(struct ev_loop *loop, ev_signal *w, int revents)
+{
+  lat_print(w->data);
+}
+
+static void
+sig_hup_cb(struct ev_loop *loop, ev_signal *w, int revents)
+{
+  event_trigger(w->data, "SIGHUP");
+}
+
+static void
+event_socket_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+  event_socket_read(w->data);
+}
+
+static void
+sig_usr2_cb(struct ev_loop *loop, ev_signal *w, int revents)
+{
+  if (!trace_dump())
+    fprintf(stderr, "! trace: disabled or dump in progress\n");
+}
+
+static void
+lat_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+  lat_print(w->data);
+}
+
+static void
+stats_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+  stats_update(&devinfo, true);
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "capture frames from /dev/video0 to current directory\n");
+  fprintf(stderr, "usage: [-v] [-i <seconds>] [-s <stats file>] "
+          "[-t <trace prefix>] [-P <frames>]\n"
+          "       [-R capture|writer:<spec>] [-M] [-H none|thp|hugetlb] "
+          "[-A <ms>]\n"
+          "       [-O newest|oldest[,decimate=<N>[:<high>:<low>]]] "
+          "[-Q <spec>]\n"
+          "       [-D every=<N>|interval=<ms>[,dir=<path>][,files=<N>]"
+          "[,size=<MB>]]\n"
+          "       [-E pre=<s>,post=<s>,ram=<MB>,activity=<%%>,"
+          "socket=<path>]\n");
+  fprintf(stderr, "  -v  log each frame\n");
+  fprintf(stderr, "  -i  print frame latency of pipeline stages "
+          "each interval\n");
+  fprintf(stderr, "  -s  export counters to memory mapped file "
+          "(read with metrics tool)\n");
+  fprintf(stderr, "  -t  record timeline, dump to <prefix>.<n>.json "
+          "on SIGUSR2 and frame drop\n");
+  fprintf(stderr, "  -P  perf counters of capture and write threads, "
+          "averaged over window of frames\n");
+  fprintf(stderr, "  -R  scheduling of thread, spec: sched=fifo:<prio>|"
+          "rr:<prio>|other,\n"
+          "      cpus=<n>[+<n>-<m>],io=rt:<0-7>|be:<0-7>|idle\n"
+          "      e.g. -R capture:sched=fifo:50,cpus=2 "
+          "-R writer:cpus=3,io=rt:0\n");
+  fprintf(stderr, "  -M  lock process memory (mlockall)\n");
+  fprintf(stderr, "  -H  huge pages of frame buffers and write buffer: "
+          "none (default),\n"
+          "      thp (transparent) or hugetlb (/proc/sys/vm/nr_hugepages)\n");
+  fprintf(stderr, "  -A  write buffered data not later than age, "
+          "default 1000 ms, 0 = off\n");
+  fprintf(stderr, "  -O  frames to drop when write buffer is full: "
+          "newest (default) or\n"
+          "      oldest of batch; decimate keeps every Nth frame above "
+          "high%% of buffer\n"
+          "      until below low%% (default 50:25). "
+          "drops are gap markers in index\n");
+  fprintf(stderr, "  -Q  adaptive quality: step camera down when write "
+          "buffer fills, spec:\n"
+          "      quality=<min>-<max>[:<step>],fps=<min>,resolution,"
+          "buffer=<high>:<low>,\n"
+          "      hold=<down s>:<up s>, e.g. -Q quality=40-90,fps=5 "
+          "(default 50-90:10,\n"
+          "      buffer=30:15,hold=2:30). "
+          "each step starts new segment\n");
+  fprintf(stderr, "  -D  decimated second stream: every Nth frame or one "
+          "frame per interval\n"
+          "      to own files ring in dir (default lapse, 32 files "
+          "of 128 MB),\n"
+          "      frame data shared with main stream\n");
+  fprintf(stderr, "  -E  triggered recording: frames kept in RAM ring of "
+          "pre seconds (default 10,\n"
+          "      ring 64 MB) and written from trigger until post "
+          "seconds (default 30)\n"
+          "      after last one. triggers: SIGHUP, 'trigger' datagram "
+          "to socket, frame size\n"
+          "      average changed by activity percent. spec: pre=<s>,post=<s>,"
+          "ram=<MB>,\n"
+          "      activity=<%%>,socket=<path>, e.g. -E pre=5,activity=40\n");
+  fprintf(stderr, "SIGUSR1 prints frame latency of pipeline stages\n");
+  fprintf(stderr, "SIGHUP triggers recording with -E\n");
+}
 
 int
 main(int argc, char *argv[])
 {
   struct ev_loop *loop = EV_DEFAULT;
   struct wth_context wth_ctx = {0};
-  
+  ev_signal sigusr1;
+  ev_signal sigusr2;
+  ev_timer lat_timer;
+  ev_timer stats_timer;
+  ev_timer adapt_timer;
+  struct adapt_cfg adapt_cfg;
+  bool adapt_set = false;
+  struct capture_lapse lapse;
+  bool lapse_set = false;
+  struct event_cfg event_cfg;
+  struct event event;
+  bool event_set = false;
+  ev_signal sighup;
+  ev_io event_io;
+  double lat_interval = 0.0;
+  const char *stats_path = NULL;
+  const char *trace_prefix = NULL;
+  uint64_t pmu_window = 0u;
+  uint64_t flush_age_ms = 1000u;
+  struct rt_cfg rt_capture;
+  struct rt_cfg rt_writer;
+  bool rt_capture_set = false;
+  bool rt_writer_set = false;
+  bool mlock = false;
+  int opt;
+
+  startup.launch = now_ns();
+  while ((opt = getopt(argc, argv, "vi:s:t:P:R:MH:A:O:Q:D:E:")) != -1) {
+    switch (opt) {
+    case 'v':
+      alog_level = ALOG_TRACE;
+      break;
+    case 'i':
+      lat_interval = strtod(optarg, NULL);
+      break;
+    case 's':
+      stats_path = optarg;
+      break;
+    case 't':
+      trace_prefix = optarg;
+      break;
+    case 'P':
+      pmu_window = strtoull(optarg, NULL, 10);
+      break;
+    case 'R':
+      if (!strncmp(optarg, "capture:", 8)) {
+        if (!rt_parse(&rt_capture, optarg + 8))
+          return EXIT_FAILURE;
+        rt_capture_set = true;
+      } else if (!strncmp(optarg, "writer:", 7)) {
+        if (!rt_parse(&rt_writer, optarg + 7))
+          return EXIT_FAILURE;
+        rt_writer_set = true;
+      } else {
+        usage();
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'M':
+      mlock = true;
+      break;
+    case 'H':
+      if (!mem_parse_huge(optarg, &mem_flags)) {
+        usage();
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'A':
+      flush_age_ms = strtoull(optarg, NULL, 10);
+      break;
+    case 'O':
+      if (!capture_overload_parse(&devinfo.ovl, optarg))
+        return EXIT_FAILURE;
+      break;
+    case 'Q':
+      if (!adapt_parse(&adapt_cfg, optarg))
+        return EXIT_FAILURE;
+      adapt_set = true;
+      break;
+    case 'D':
+      if (!capture_lapse_parse(&lapse, optarg))
+        return EXIT_FAILURE;
+      lapse_set = true;
+      break;
+    case 'E':
+      if (!event_parse(&event_cfg, optarg))
+        return EXIT_FAILURE;
+      event_set = true;
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!alog_start())
+    return EXIT_FAILURE;
+
+  if (mlock)
+    rt_mlockall();
+
+  trace_thread("capture");
+  if (trace_prefix && !trace_start(trace_prefix))
+    return EXIT_FAILURE;
+
+  /* write thread faults its buffer while device is set up */
+  if (!write_thread_start(&wth_ctx, mem_flags))
+    return EXIT_FAILURE;
+  wth_ctx.written_cb = written_cb;
+  if (rt_writer_set)
+    wth_ctx.rt = &rt_writer;
+
   if (!init_device(loop, &devinfo))
     return EXIT_FAILURE;
+  startup.device = now_ns();
 
   ev_signal sigint;
   ev_signal_init(&sigint, sig_int_cb, SIGINT);
   ev_signal_start(loop, &sigint);
 
+  ev_signal_init(&sigusr1, sig_usr1_cb, SIGUSR1);
+  sigusr1.data = &wth_ctx;
+  ev_signal_start(loop, &sigusr1);
+
+  ev_signal_init(&sigusr2, sig_usr2_cb, SIGUSR2);
+  ev_signal_start(loop, &sigusr2);
+
+  ev_signal_init(&sighup, sig_hup_cb, SIGHUP);
+  sighup.data = &event;
+  ev_io_init(&event_io, event_socket_cb, -1, EV_READ);
+  if (event_set) {
+    if (!event_init(&event, &event_cfg, mem_flags))
+      return EXIT_FAILURE;
+    devinfo.event = &event;
+    ev_signal_start(loop, &sighup);
+    if (event.sock != -1) {
+      ev_io_set(&event_io, event.sock, EV_READ);
+      event_io.data = &event;
+      ev_io_start(loop, &event_io);
+    }
+  }
+
+  ev_timer_init(&lat_timer, lat_timer_cb, lat_interval, lat_interval);
+  lat_timer.data = &wth_ctx;
+  if (lat_interval > 0.0)
+    ev_timer_start(loop, &lat_timer);
+
+  ev_timer_init(&adapt_timer, adapt_timer_cb, 1.0, 1.0);
+  if (adapt_set) {
+    if (!devinfo.cam_info.quality) {
+      fprintf(stderr, "! adapt: camera has no JPEG quality control, "
+              "frame rate and resolution levels only\n");
+      adapt_cfg.quality_min = adapt_cfg.quality_max;
+    }
+    adapt_init(&adapt, &adapt_cfg, devinfo.cam_info.frame_per_second);
+    adapt_width = devinfo.frame_width;
+    adapt_height = devinfo.frame_height;
+    if (devinfo.cam_info.quality) {
+      struct adapt_level l;
+
+      adapt_level(&adapt, 0u, &l);
+      adapt_apply(&devinfo, &l);
+    }
+    ev_timer_start(loop, &adapt_timer);
+  }
+
+  if (stats_path && !(stats = stats_create(stats_path)))
+    return EXIT_FAILURE;
+  ev_timer_init(&stats_timer, stats_timer_cb, 1.0, 1.0);
+  if (stats)
+    ev_timer_start(loop, &stats_timer);
+
   ev_io_init(&devinfo.ev, camera_cb, devinfo.fd, EV_READ);
   ev_io_start(loop, &devinfo.ev);
 
-  write_thread_alloc(&wth_ctx);
+  if (!wth_wait_ready(&wth_ctx))
+    return EXIT_FAILURE;
+  wth_ctx.flush_age_ns = flush_age_ms * 1000000u;
+  /* after threads start: not inherited by them */
+  if (rt_capture_set)
+    rt_apply("capture", &rt_capture);
+  if (pmu_window) {
+    wth_ctx.pmu_window = pmu_window;
+    pmu_open(&pmu);
+    pmu_stat_init(&pmu_capture, &pmu, pmu_window);
+  }
 
   devinfo.trg.ctx = &wth_ctx;
+  if (lapse_set && !capture_lapse_open(&devinfo, &lapse, AT_FDCWD))
+    return EXIT_FAILURE;
   capture(&devinfo);
+  startup.stream = now_ns();
+  stats_update(&devinfo, true);
 
   ev_run(loop, 0);
 
   ev_io_stop(loop, &devinfo.ev);
   ev_signal_stop(loop, &sigint);
+  ev_signal_stop(loop, &sigusr1);
+  ev_signal_stop(loop, &sigusr2);
+  ev_signal_stop(loop, &sighup);
+  ev_io_stop(loop, &event_io);
+  ev_timer_stop(loop, &lat_timer);
+  ev_timer_stop(loop, &stats_timer);
+  ev_timer_stop(loop, &adapt_timer);
+  /* pre-event frames of active event not lost on exit */
+  capture_event_flush(&devinfo, CAPTURE_FLUSH_TIMEOUT_MS);
+  stats_update(&devinfo, true);
+  lat_print(&wth_ctx);
 
   write_thread_free(&wth_ctx);
+  if (devinfo.event)
+    event_free(devinfo.event);
   ev_loop_destroy(loop);
+  if (pmu_window)
+    pmu_close(&pmu);
+  trace_stop();
+  alog_stop();
 
   return EXIT_SUCCESS;
 }
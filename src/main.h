@@ -6,26 +6,66 @@
 
 #include <stdatomic.h>
 
-#define log(_module, _level, ...)                   \
-  do {                                              \
-    fprintf(stderr, "%s: [%s] ", _level, _module);  \
-    fprintf(stderr, __VA_ARGS__);                   \
-    fprintf(stderr, "\n");                          \
-  } while(0)
-
 #define WTH_MAX_FILES 16
 
 #include "frame_index.h"
 #include "circle_buffer.h"
+#include "hist.h"
+#include "pmu.h"
+#include "rt.h"
 
 struct wth_file_desc {
   int fd;
+  /* directory of path */
+  int dirfd;
   char path[FH_PATH_SIZE + 1];
   bool acquired;
   atomic_ulong pending_to_write;
   bool expect_close;
 };
 
+struct wth_context;
+
+/* pipeline times of record, CLOCK_MONOTONIC ns, 0 = not known */
+struct wth_times {
+  /* V4L2 buffer timestamp */
+  uint64_t sensor;
+  /* VIDIOC_DQBUF returned */
+  uint64_t dqbuf;
+  /* wth_write() */
+  uint64_t enqueue;
+  /* record taken from buffer by write thread */
+  uint64_t dequeue;
+  /* write() of record completed */
+  uint64_t written;
+};
+
+/* frame latency between pipeline stages */
+enum wth_lat_stage {
+  WTH_LAT_SENSOR_DQBUF,
+  WTH_LAT_DQBUF_ENQUEUE,
+  WTH_LAT_ENQUEUE_DEQUEUE,
+  WTH_LAT_DEQUEUE_WRITTEN,
+  WTH_LAT_SENSOR_WRITTEN,
+  WTH_LAT_STAGES
+};
+
+/* called by write thread after record written to file */
+typedef void (*wth_written_cb)(struct wth_context *ctx, unsigned idx,
+                               size_t size, const struct wth_times *t);
+
+/* file operations of write thread, called in write thread only */
+struct wth_sink_ops {
+  /* return file descriptor or -1, path relative to dirfd */
+  int (*open)(struct wth_context *ctx, int dirfd, const char *path);
+  ssize_t (*write)(struct wth_context *ctx, int fd,
+                   const uint8_t *p, size_t size);
+  int (*close)(struct wth_context *ctx, int fd);
+};
+
+/* openat(), write() and close() */
+extern const struct wth_sink_ops wth_posix_sink;
+
 struct wth_context {
   struct ev_loop *loop;
   struct ev_async sig_kill;
@@ -38,20 +78,123 @@ struct wth_context {
   struct circle_buffer buffer;
 
   unsigned occupied_percent;
+  /* high-water mark of occupied_percent */
+  unsigned occupied_percent_max;
+  /* records not accepted by wth_write() */
+  uint64_t dropped;
+  /* bytes written to files by write thread */
+  uint64_t written;
+  /* failed writes, data of record lost */
+  uint64_t write_errors;
+  uint64_t short_writes;
+
+  /* directory for relative paths of wth_open(), AT_FDCWD by default */
+  int dirfd;
+  wth_written_cb written_cb;
+  void *userdata;
+  /* set before first wth_open() */
+  const struct wth_sink_ops *sink;
+  void *sink_data;
+
+  /* frame latency histograms, no locks:
+   * sensor and dqbuf stages updated by wth_write() caller thread,
+   * others by write thread. readers get approximate values
+   */
+  struct hist *lat;
+
+  /* frames in window of perf counters, 0 = off,
+   * set after write_thread_alloc() before first write.
+   * counters opened by write thread on first callback
+   */
+  uint64_t pmu_window;
+  bool pmu_ready;
+  struct pmu_group pmu;
+  /* async_write_cb per frame record */
+  struct pmu_stat pmu_stat;
+
+  /* scheduling of write thread, NULL = default,
+   * set after write_thread_alloc() before first wth_open()
+   */
+  const struct rt_cfg *rt;
+  bool rt_applied;
+
+  /* wakeup of write thread when buffer holds flush_bytes,
+   * 10% of buffer by default, set after write_thread_alloc()
+   */
+  size_t flush_bytes;
+  /* write when oldest byte in buffer is older, ns, 0 = off,
+   * set after write_thread_alloc() before first wth_open()
+   */
+  uint64_t flush_age_ns;
+  /* enqueue time of oldest byte in buffer, 0 when empty,
+   * stored under write_lock
+   */
+  atomic_uint_least64_t oldest_ns;
+  struct ev_timer flush_timer;
+  /* async_write_cb with data in buffer, of them by flush_age_ns */
+  uint64_t flushes;
+  uint64_t flushes_deadline;
+
+  /* producer between wth_batch_begin() and wth_batch_end():
+   * write_lock held, wakeup of write thread postponed
+   */
+  bool batch;
+  bool batch_wakeup;
+
+  /* enum mem_flags of buffer, buffer allocated by write thread itself */
+  unsigned mem_flags;
+  /* 0 = buffer not allocated yet, 1 = running, -1 = failed.
+   * under write_lock, signaled by ready_cond
+   */
+  int ready;
+  pthread_cond_t ready_cond;
+  /* CLOCK_MONOTONIC ns of ready */
+  uint64_t ready_ns;
 
   pthread_mutex_t write_lock;
 
   pthread_t thread;
 };
 
+/* start write thread and wait until it is ready */
 extern bool write_thread_alloc(struct wth_context *ctx);
+/* start write thread, buffer is allocated and prefaulted by thread:
+ * call wth_wait_ready() before first wth_open() or wth_write()
+ */
+extern bool write_thread_start(struct wth_context *ctx, unsigned mem_flags);
+/* false if write thread failed to start */
+extern bool wth_wait_ready(struct wth_context *ctx);
 extern void write_thread_free(struct wth_context *ctx);
 
 typedef int wth_fd;
 /* open file for writing, return fd */
 extern wth_fd wth_open(struct wth_context *ctx, char path[FH_PATH_SIZE + 1]);
+/* open file relative to dirfd instead of ctx->dirfd */
+extern wth_fd wth_open_at(struct wth_context *ctx, int dirfd,
+                          char path[FH_PATH_SIZE + 1]);
 extern ssize_t wth_write(struct wth_context *ctx, wth_fd fd, uint8_t *p, size_t size);
+/* write frame with known sensor and dqbuf times */
+extern ssize_t wth_write_times(struct wth_context *ctx, wth_fd fd,
+                               uint8_t *p, size_t size,
+                               const struct wth_times *t);
+/* write data once to buffer and by write thread to both files,
+ * tee = -1 is wth_write_times()
+ */
+extern ssize_t wth_write_tee(struct wth_context *ctx, wth_fd fd, wth_fd tee,
+                             uint8_t *p, size_t size,
+                             const struct wth_times *t);
 extern void wth_close(struct wth_context *ctx, wth_fd fd);
+/* bytes of data fitting to buffer as `records` records,
+ * free space only grows for producer
+ */
+extern size_t wth_space(struct wth_context *ctx, unsigned records);
+/* group writes of producer: one lock of buffer and one wakeup
+ * of write thread for all records, keep batch short
+ */
+extern void wth_batch_begin(struct wth_context *ctx);
+extern void wth_batch_end(struct wth_context *ctx);
+/* print frame latency histograms, lat is WTH_LAT_STAGES array */
+extern void wth_lat_print(const struct hist *lat, FILE *f);
 
 #endif /* _SRC_MAIN_1554547715_H_ */
 
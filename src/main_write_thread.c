@@ -2,6 +2,7 @@
  * file: src/main_write_tread.c
  */
 #include <inttypes.h>
+#include <stdlib.h>
 #include <sys/time.h>
 #include <stdint.h>
 #include <assert.h>
@@ -13,19 +14,23 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "main.h"
+#include "alog.h"
+#include "trace.h"
+#include "clock.h"
 
 #define WTH_FD_SAFETY_OFFSET 1000
 
 #define log_info(...) \
-  log("write_thread", "INFO", __VA_ARGS__)
+  alog(ALOG_INFO, "write_thread", __VA_ARGS__)
 
 #define log_debug(...) \
-  log("write_thread", "DEBUG", __VA_ARGS__)
+  alog(ALOG_DEBUG, "write_thread", __VA_ARGS__)
 
 #define log_error(...) \
-  log("write_thread", "ERROR", __VA_ARGS__)
+  alog(ALOG_ERROR, "write_thread", __VA_ARGS__)
 
 #define WRITE_BLOCK_SIZE (1024 * 1024 /* 1MB */)
 static void
@@ -38,22 +43,50 @@ sig_kill_cb(struct ev_loop *loop, ev_async *w, int revents)
 void *
 write_thread(struct wth_context *ctx)
 {
-  ev_run(ctx->loop, 0);
+  bool ok;
+
+  trace_thread("write_thread");
+  /* pages of ring faulted here, while caller sets up device */
+  trace_begin("ring_alloc");
+  ok = cbf_init_mem(&ctx->buffer, 90 * 1024 * 1024 /* 90 MB */,
+                    ctx->mem_flags);
+  trace_end("ring_alloc");
+  if (!ok)
+    log_error("allocate buffer failed");
+  ctx->flush_bytes = ctx->buffer.capacity / 10u;
+
+  pthread_mutex_lock(&ctx->write_lock);
+  ctx->ready_ns = now_ns();
+  ctx->ready = ok ? 1 : -1;
+  pthread_cond_broadcast(&ctx->ready_cond);
+  pthread_mutex_unlock(&ctx->write_lock);
+
+  if (ok)
+    ev_run(ctx->loop, 0);
   return NULL;
 }
 
 wth_fd wth_open(struct wth_context *ctx, char path[FH_PATH_SIZE + 1])
+{
+  return wth_open_at(ctx, ctx->dirfd, path);
+}
+
+wth_fd
+wth_open_at(struct wth_context *ctx, int dirfd, char path[FH_PATH_SIZE + 1])
 {
   int i;
 
   for (i = 0u; i < WTH_MAX_FILES; i++) {
     if (!ctx->fd[i].acquired) {
       log_debug("open(%s) -> fd#%d", path, i + WTH_FD_SAFETY_OFFSET);
-      ctx->fd[i].acquired = true;
       ctx->fd[i].fd = -1;
+      ctx->fd[i].dirfd = dirfd;
       ctx->fd[i].expect_close = false;
       atomic_init(&ctx->fd[i].pending_to_write, 0lu);
       memcpy(ctx->fd[i].path, path, sizeof(ctx->fd[i].path));
+      /* last: write thread checks slot after acquired */
+      atomic_thread_fence(memory_order_release);
+      ctx->fd[i].acquired = true;
       ev_async_send(ctx->loop, &ctx->async_open);
       return i + WTH_FD_SAFETY_OFFSET;
     }
@@ -70,9 +103,8 @@ void wth_close(struct wth_context *ctx, wth_fd fd)
   assert(fd >= 0);
   assert(fd < WTH_MAX_FILES);
 
-  if (ctx->fd[fd].fd != -1) {
-   ctx->fd[fd].expect_close = true;
-  }
+  /* file may be not opened by write thread yet */
+  ctx->fd[fd].expect_close = true;
 
   ev_async_send(ctx->loop, &ctx->async_open);
 }
@@ -80,13 +112,49 @@ void wth_close(struct wth_context *ctx, wth_fd fd)
 struct header {
   char guard_l[2]; /* must be zeros */
   unsigned idx;
+  /* second file of same data or WTH_NO_TEE */
+  unsigned tee;
   size_t data_size;
+  struct wth_times times;
   char guard_r[2];  /* must be zeros */
 };
 
 #define HEADER_INIT {.guard_l = {'A', 'Z'}, .guard_r = {'F', 'N'}};
 
+#define WTH_NO_TEE WTH_MAX_FILES
+
+static inline void
+lat_add(struct wth_context *ctx, enum wth_lat_stage stage,
+        uint64_t from, uint64_t to)
+{
+  if (from && to)
+    hist_add(&ctx->lat[stage], to > from ? to - from : 0u);
+}
+
+size_t
+wth_space(struct wth_context *ctx, unsigned records)
+{
+  size_t free_space = cbf_free_space(&ctx->buffer);
+  size_t headers = sizeof(struct header) * records;
+
+  return free_space > headers ? free_space - headers : 0u;
+}
+
 ssize_t wth_write(struct wth_context *ctx, wth_fd fd, uint8_t *p, size_t size)
+{
+  return wth_write_times(ctx, fd, p, size, NULL);
+}
+
+ssize_t
+wth_write_times(struct wth_context *ctx, wth_fd fd, uint8_t *p, size_t size,
+                const struct wth_times *t)
+{
+  return wth_write_tee(ctx, fd, -1, p, size, t);
+}
+
+ssize_t
+wth_write_tee(struct wth_context *ctx, wth_fd fd, wth_fd tee,
+              uint8_t *p, size_t size, const struct wth_times *t)
 {
   struct header hd = HEADER_INIT;
 
@@ -98,16 +166,34 @@ ssize_t wth_write(struct wth_context *ctx, wth_fd fd, uint8_t *p, size_t size)
   fd -= WTH_FD_SAFETY_OFFSET;
   assert(fd >= 0);
   assert(fd < WTH_MAX_FILES);
+  hd.tee = WTH_NO_TEE;
+  if (tee != -1) {
+    tee -= WTH_FD_SAFETY_OFFSET;
+    assert(tee >= 0);
+    assert(tee < WTH_MAX_FILES);
+    assert(tee != fd);
+    hd.tee = tee;
+  }
 
   if (cbf_free_space(&ctx->buffer) < sizeof(hd) + size) {
     /* no free space */
+    ctx->dropped++;
     return 0;
   }
 
   hd.idx = fd;
   hd.data_size = size;
+  if (t)
+    hd.times = *t;
+  hd.times.enqueue = now_ns();
 
-  pthread_mutex_lock(&ctx->write_lock);
+  if (!ctx->batch) {
+    pthread_mutex_lock(&ctx->write_lock);
+    trace_begin("write_lock");
+  }
+  if (!cbf_occupied_space(&ctx->buffer))
+    atomic_store_explicit(&ctx->oldest_ns, hd.times.enqueue,
+                          memory_order_relaxed);
   cbf_save(&ctx->buffer, (uint8_t*)&hd, sizeof(hd));
   cbf_save(&ctx->buffer, p, size);
   free_space = cbf_free_space(&ctx->buffer);
@@ -115,8 +201,19 @@ ssize_t wth_write(struct wth_context *ctx, wth_fd fd, uint8_t *p, size_t size)
   occupied_percent_last = ctx->occupied_percent;
   occupied_percent = (unsigned)((uint64_t)occupied_space * 100 / (uint64_t)(occupied_space + free_space));
   ctx->occupied_percent = occupied_percent;
+  if (occupied_percent > ctx->occupied_percent_max)
+    ctx->occupied_percent_max = occupied_percent;
   atomic_fetch_add(&ctx->fd[fd].pending_to_write, size);
-  pthread_mutex_unlock(&ctx->write_lock);
+  if (hd.tee != WTH_NO_TEE)
+    atomic_fetch_add(&ctx->fd[hd.tee].pending_to_write, size);
+  if (!ctx->batch) {
+    trace_end("write_lock");
+    pthread_mutex_unlock(&ctx->write_lock);
+  }
+  trace_counter("ring_percent", occupied_percent);
+
+  lat_add(ctx, WTH_LAT_SENSOR_DQBUF, hd.times.sensor, hd.times.dqbuf);
+  lat_add(ctx, WTH_LAT_DQBUF_ENQUEUE, hd.times.dqbuf, hd.times.enqueue);
 
   if (occupied_percent > 95 || occupied_percent / 10 != occupied_percent_last / 10) {
     log_debug("buffer load: %u%% (total: %"PRIuPTR", free: %"PRIuPTR")",
@@ -125,13 +222,93 @@ ssize_t wth_write(struct wth_context *ctx, wth_fd fd, uint8_t *p, size_t size)
               free_space);
   }
 
-  /* decrease interrupt count */
-  if (occupied_percent > 10) {
-    ev_async_send(ctx->loop, &ctx->async_write);
+  /* decrease interrupt count, small amounts written by flush_timer */
+  if (occupied_space >= ctx->flush_bytes) {
+    if (ctx->batch)
+      ctx->batch_wakeup = true;
+    else
+      ev_async_send(ctx->loop, &ctx->async_write);
   }
   return size;
 }
 
+void
+wth_batch_begin(struct wth_context *ctx)
+{
+  assert(!ctx->batch);
+  pthread_mutex_lock(&ctx->write_lock);
+  trace_begin("write_lock");
+  ctx->batch = true;
+  ctx->batch_wakeup = false;
+}
+
+void
+wth_batch_end(struct wth_context *ctx)
+{
+  assert(ctx->batch);
+  ctx->batch = false;
+  trace_end("write_lock");
+  pthread_mutex_unlock(&ctx->write_lock);
+  if (ctx->batch_wakeup)
+    ev_async_send(ctx->loop, &ctx->async_write);
+}
+
+static int
+posix_open(struct wth_context *ctx, int dirfd, const char *path)
+{
+  return openat(dirfd, path, O_CREAT | O_TRUNC | O_WRONLY,
+                S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+}
+
+static ssize_t
+posix_write(struct wth_context *ctx, int fd, const uint8_t *p, size_t size)
+{
+  return write(fd, p, size);
+}
+
+static int
+posix_close(struct wth_context *ctx, int fd)
+{
+  return close(fd);
+}
+
+const struct wth_sink_ops wth_posix_sink = {
+  .open = posix_open,
+  .write = posix_write,
+  .close = posix_close
+};
+
+/* write all bytes, continue after short writes
+ * on error rest of data is lost, file will have hole in data
+ */
+static bool
+sink_write(struct wth_context *ctx, unsigned idx, int fd,
+           const uint8_t *p, size_t size)
+{
+  ssize_t written;
+
+  while (size) {
+    trace_begin_arg("write", size);
+    written = ctx->sink->write(ctx, fd, p, size);
+    trace_end("write");
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0) {
+      ctx->write_errors++;
+      log_error("write(fd#%d) -> written=%"PRIdPTR", expected=%"PRIuPTR": %s",
+                idx + WTH_FD_SAFETY_OFFSET, written, size,
+                written ? strerror(errno) : "no progress");
+      return false;
+    }
+    if ((size_t)written != size)
+      ctx->short_writes++;
+    p += written;
+    size -= written;
+    ctx->written += written;
+  }
+  return true;
+}
+
 static struct wth_file_desc *
 open_file(struct wth_context *ctx, unsigned idx)
 {
@@ -146,8 +323,9 @@ open_file(struct wth_context *ctx, unsigned idx)
 
   log_debug("open fd#%d", idx + WTH_FD_SAFETY_OFFSET);
 
-  fd_desc->fd = open(ctx->fd[idx].path, O_CREAT | O_TRUNC | O_WRONLY,
-                                        S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+  trace_begin("open");
+  fd_desc->fd = ctx->sink->open(ctx, fd_desc->dirfd, fd_desc->path);
+  trace_end("open");
   if (ctx->fd[idx].fd == -1) {
     log_error("sys open(%s) fd#%d failed: %s",
               ctx->fd[idx].path, idx + WTH_FD_SAFETY_OFFSET,
@@ -161,6 +339,79 @@ open_file(struct wth_context *ctx, unsigned idx)
   return fd_desc;
 }
 
+/* part of record data to its file and tee file,
+ * data of file not opened is skipped
+ */
+static void
+record_write(struct wth_context *ctx, const struct header *hd,
+             const uint8_t *p, size_t size)
+{
+  struct wth_file_desc *fd_desc;
+
+  if ((fd_desc = open_file(ctx, hd->idx))) {
+    assert(fd_desc->acquired == true);
+    assert(atomic_load(&fd_desc->pending_to_write) >= size);
+    sink_write(ctx, hd->idx, fd_desc->fd, p, size);
+  } else {
+    log_error("skip data of fd#%d because file not openned",
+              hd->idx + WTH_FD_SAFETY_OFFSET);
+  }
+  atomic_fetch_sub(&ctx->fd[hd->idx].pending_to_write, size);
+
+  if (hd->tee == WTH_NO_TEE)
+    return;
+  if ((fd_desc = open_file(ctx, hd->tee))) {
+    assert(fd_desc->acquired == true);
+    sink_write(ctx, hd->tee, fd_desc->fd, p, size);
+  } else {
+    log_error("skip data of fd#%d because file not openned",
+              hd->tee + WTH_FD_SAFETY_OFFSET);
+  }
+  atomic_fetch_sub(&ctx->fd[hd->tee].pending_to_write, size);
+}
+
+/* close files without pending data after wth_close() */
+static void
+close_files(struct wth_context *ctx)
+{
+  int i;
+
+  for (i = 0u; i < WTH_MAX_FILES; i++) {
+    if (ctx->fd[i].acquired &&
+        ctx->fd[i].expect_close &&
+        atomic_load(&ctx->fd[i].pending_to_write) == 0u) {
+      log_debug("close fd#%d[%d]", i + WTH_FD_SAFETY_OFFSET, ctx->fd[i].fd);
+
+      if (ctx->fd[i].fd != -1) {
+        trace_begin("close");
+        ctx->sink->close(ctx, ctx->fd[i].fd);
+        trace_end("close");
+        ctx->fd[i].fd = -1;
+      }
+      ctx->fd[i].acquired = false;
+    }
+  }
+}
+
+/* settings of write thread itself, configured after thread start */
+static void
+thread_setup(struct wth_context *ctx)
+{
+  if (ctx->rt && !ctx->rt_applied) {
+    rt_apply("write_thread", ctx->rt);
+    ctx->rt_applied = true;
+  }
+  if (ctx->pmu_window && !ctx->pmu_ready) {
+    pmu_open(&ctx->pmu);
+    pmu_stat_init(&ctx->pmu_stat, &ctx->pmu, ctx->pmu_window);
+    ctx->pmu_ready = true;
+  }
+  if (ctx->flush_age_ns && !ev_is_active(&ctx->flush_timer)) {
+    ctx->flush_timer.repeat = ctx->flush_age_ns / 1e9;
+    ev_timer_again(ctx->loop, &ctx->flush_timer);
+  }
+}
+
 static void
 async_write_cb(struct ev_loop *loop, ev_async *w, int revents)
 {
@@ -168,44 +419,55 @@ async_write_cb(struct ev_loop *loop, ev_async *w, int revents)
   struct header hd = HEADER_INIT;
   struct wth_context *ctx = ev_userdata(loop);
 
-  struct wth_file_desc *fd_desc;
-
   size_t header_filled = 0u;
-
+  size_t record_size = 0u;
+  uint64_t dequeued = 0u;
+  uint64_t pmu_before[PMU_EVENTS];
+  uint64_t pmu_after[PMU_EVENTS];
+  uint64_t frames = 0u;
+
+  thread_setup(ctx);
+  if (ctx->pmu.mask)
+    pmu_read(&ctx->pmu, pmu_before);
+
+  trace_begin("async_write_cb");
+  if (cbf_occupied_space(&ctx->buffer) > 0)
+    ctx->flushes++;
   while (cbf_occupied_space(&ctx->buffer) > 0) {
     size_t offset = 0u;
     size_t size;
-    ssize_t written;
     /* get data */
     pthread_mutex_lock(&ctx->write_lock);
-
-    assert(cbf_occupied_space(&ctx->buffer) > sizeof(hd));
+    trace_begin("write_lock");
 
     size = cbf_get(&ctx->buffer, wrblk, sizeof(wrblk));
+    dequeued = now_ns();
 
     assert(size > 0u);
 
     cbf_discard(&ctx->buffer, size);
+    if (!cbf_occupied_space(&ctx->buffer))
+      atomic_store_explicit(&ctx->oldest_ns, 0u, memory_order_relaxed);
+    trace_end("write_lock");
     pthread_mutex_unlock(&ctx->write_lock);
 
     while (offset != size) {
       if (header_filled != sizeof(hd)) {
-        /* full or second part of scattered header */
-        memcpy(((uint8_t*)&hd) + header_filled,
-               wrblk + offset,
-               sizeof(hd) - header_filled);
-        offset += sizeof(hd) - header_filled;
-        header_filled = sizeof(hd);
-      }
-      else if (sizeof(hd) > size - offset) {
-        assert(size - offset > 0u);
-        /* scattered header
-         * copy first part of header
-         */
-        header_filled = size - offset;
-        memcpy(&hd, wrblk + offset, header_filled);
-        /* need more bytes */
-        break;
+        /* full header or part of header scattered by block end */
+        size_t header_part = sizeof(hd) - header_filled;
+
+        if (header_part > size - offset)
+          header_part = size - offset;
+        memcpy(((uint8_t*)&hd) + header_filled, wrblk + offset, header_part);
+        offset += header_part;
+        header_filled += header_part;
+        record_size = hd.data_size;
+        hd.times.dequeue = dequeued;
+        if (header_filled != sizeof(hd) ||
+            (offset == size && hd.data_size != 0u)) {
+          /* need more bytes */
+          break;
+        }
       }
 
       assert(hd.guard_l[0] == 'A' &&
@@ -213,91 +475,116 @@ async_write_cb(struct ev_loop *loop, ev_async *w, int revents)
              hd.guard_r[0] == 'F' &&
              hd.guard_r[1] == 'N');
 
-      fd_desc = open_file(ctx, hd.idx);
-      if (!fd_desc) {
-        log_error("skip frame because file not openned");
-        /* skip data */
-        if (hd.data_size >= size - offset) {
-          hd.data_size -= (size - offset);
-          /* get new data */
-          break;
-        }
-        else {
-          offset += hd.data_size;
-          /* go to next header */
-          continue;
-        }
-      }
-
-      assert(fd_desc->acquired == true);
-      assert(atomic_load(&fd_desc->pending_to_write) >= hd.data_size);
-
       if (hd.data_size > size - offset) {
         /* scattered copy */
         size_t write_size = size - offset;
 
         assert(write_size != 0);
 
-        written = write(fd_desc->fd, wrblk + offset, write_size);
-        if (written != write_size) {
-          /* FIXME: what next? */
-          log_error("write(fd#%d) -> written=%"PRIdPTR", expected=%"PRIuPTR": %s",
-                    hd.idx, written, hd.data_size, strerror(errno));
-        }
+        record_write(ctx, &hd, wrblk + offset, write_size);
         hd.data_size -= write_size;
-        atomic_fetch_sub(&fd_desc->pending_to_write, write_size);
         /* need more bytes */
         break;
       } else {
-        written = write(fd_desc->fd, wrblk + offset, hd.data_size);
-        if (written != hd.data_size) {
-          /* FIXME: what next? */
-          log_error("write(fd#%d) -> written=%"PRIdPTR", expected=%"PRIuPTR": %s",
-                    hd.idx, written, hd.data_size, strerror(errno));
-        }
+        record_write(ctx, &hd, wrblk + offset, hd.data_size);
         offset += hd.data_size;
-        atomic_fetch_sub(&fd_desc->pending_to_write, hd.data_size);
+        hd.times.written = now_ns();
+        if (hd.times.dqbuf) {
+          /* frame record */
+          frames++;
+          lat_add(ctx, WTH_LAT_ENQUEUE_DEQUEUE,
+                  hd.times.enqueue, hd.times.dequeue);
+          lat_add(ctx, WTH_LAT_DEQUEUE_WRITTEN,
+                  hd.times.dequeue, hd.times.written);
+          lat_add(ctx, WTH_LAT_SENSOR_WRITTEN,
+                  hd.times.sensor, hd.times.written);
+        }
+        if (ctx->written_cb)
+          ctx->written_cb(ctx, hd.idx, record_size, &hd.times);
         /* read next header */
         header_filled = 0u;
         continue;
       }
     }
+
+    /* wth_close() may be called while data was in buffer */
+    close_files(ctx);
+  }
+  trace_end("async_write_cb");
+
+  if (ctx->pmu.mask && pmu_read(&ctx->pmu, pmu_after))
+    pmu_account(&ctx->pmu_stat, pmu_before, pmu_after, frames);
+}
+
+/* write below flush_bytes when oldest byte reached flush_age_ns */
+static void
+flush_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+  struct wth_context *ctx = ev_userdata(loop);
+  uint64_t oldest = atomic_load_explicit(&ctx->oldest_ns,
+                                         memory_order_relaxed);
+  uint64_t now = now_ns();
+  uint64_t deadline;
+
+  if (oldest && now - oldest >= ctx->flush_age_ns) {
+    ctx->flushes_deadline++;
+    trace_instant("flush_deadline", (now - oldest) / 1000u);
+    async_write_cb(loop, &ctx->async_write, EV_ASYNC);
+    oldest = atomic_load_explicit(&ctx->oldest_ns, memory_order_relaxed);
+    now = now_ns();
   }
+
+  /* next check at deadline of oldest byte, data enqueued into empty
+   * buffer after check is not older than flush_age_ns at next check
+   */
+  deadline = (oldest ? oldest : now) + ctx->flush_age_ns;
+  w->repeat = deadline > now + 1000000u ? (deadline - now) / 1e9 : 1e-3;
+  ev_timer_again(loop, w);
 }
 
 static void
 async_open_cb(struct ev_loop *loop, ev_async *w, int revents)
 {
-  int i;
   struct wth_context *ctx = ev_userdata(loop);
   log_debug("async open invoked");
+  thread_setup(ctx);
 
-  for (i = 0u; i < WTH_MAX_FILES; i++) {
-    if (ctx->fd[i].acquired &&
-        ctx->fd[i].expect_close &&
-        atomic_load(&ctx->fd[i].pending_to_write) == 0u) {
-      log_debug("close fd#%d[%d]", i + WTH_FD_SAFETY_OFFSET, ctx->fd[i].fd);
-
-      if (ctx->fd[i].fd != -1) {
-        close(ctx->fd[i].fd);
-        ctx->fd[i].fd = -1;
-      }
-      ctx->fd[i].acquired = false;
-    }
-  }
+  trace_begin("async_open_cb");
+  close_files(ctx);
+  trace_end("async_open_cb");
 }
 
 bool
 write_thread_alloc(struct wth_context *ctx)
+{
+  return write_thread_start(ctx, 0u) && wth_wait_ready(ctx);
+}
+
+bool
+write_thread_start(struct wth_context *ctx, unsigned mem_flags)
 {
   size_t i = 0u;
+  int r;
   memset(ctx, 0, sizeof(*ctx));
+  ctx->mem_flags = mem_flags;
   log_info("allocate write thread");
+  ctx->lat = calloc(WTH_LAT_STAGES, sizeof(*ctx->lat));
+  if (!ctx->lat) {
+    log_error("allocate latency histograms failed");
+    return false;
+  }
   ctx->loop = ev_loop_new(EVFLAG_AUTO);
+  if (!ctx->loop) {
+    log_error("event loop not created");
+    free(ctx->lat);
+    ctx->lat = NULL;
+    return false;
+  }
 
   ev_async_init(&ctx->sig_kill, sig_kill_cb);
   ev_async_init(&ctx->async_open, async_open_cb);
   ev_async_init(&ctx->async_write, async_write_cb);
+  ev_init(&ctx->flush_timer, flush_timer_cb);
 
   ev_async_start(ctx->loop, &ctx->sig_kill);
   ev_async_start(ctx->loop, &ctx->async_open);
@@ -305,18 +592,43 @@ write_thread_alloc(struct wth_context *ctx)
 
   ev_set_userdata(ctx->loop, ctx);
 
-  cbf_init(&ctx->buffer, 90 * 1024 * 1024); /* 90 MB */
-
   for (i = 0u; i < WTH_MAX_FILES; i++) {
     ctx->fd[i].fd = -1;
   }
+  ctx->dirfd = AT_FDCWD;
+  ctx->sink = &wth_posix_sink;
 
   pthread_mutex_init(&ctx->write_lock, NULL);
-
-  pthread_create(&ctx->thread, NULL, (void*(*)(void*))&write_thread, ctx);
+  pthread_cond_init(&ctx->ready_cond, NULL);
+
+  r = pthread_create(&ctx->thread, NULL, (void*(*)(void*))&write_thread, ctx);
+  if (r != 0) {
+    /* wth_wait_ready() would wait forever */
+    log_error("write thread not started: %s", strerror(r));
+    pthread_mutex_destroy(&ctx->write_lock);
+    pthread_cond_destroy(&ctx->ready_cond);
+    ev_loop_destroy(ctx->loop);
+    ctx->loop = NULL;
+    free(ctx->lat);
+    ctx->lat = NULL;
+    return false;
+  }
   return true;
 }
 
+bool
+wth_wait_ready(struct wth_context *ctx)
+{
+  int ready;
+
+  pthread_mutex_lock(&ctx->write_lock);
+  while (!ctx->ready)
+    pthread_cond_wait(&ctx->ready_cond, &ctx->write_lock);
+  ready = ctx->ready;
+  pthread_mutex_unlock(&ctx->write_lock);
+  return ready == 1;
+}
+
 void
 write_thread_free(struct wth_context *ctx)
 {
@@ -330,10 +642,41 @@ write_thread_free(struct wth_context *ctx)
   ev_async_stop(ctx->loop, &ctx->async_open);
   ev_async_stop(ctx->loop, &ctx->async_write);
   ev_async_stop(ctx->loop, &ctx->sig_kill);
+  ev_timer_stop(ctx->loop, &ctx->flush_timer);
 
   pthread_mutex_destroy(&ctx->write_lock);
+  pthread_cond_destroy(&ctx->ready_cond);
 
   ev_loop_destroy(ctx->loop);
   cbf_destroy(&ctx->buffer);
+  free(ctx->lat);
+  ctx->lat = NULL;
+  if (ctx->pmu_ready)
+    pmu_close(&ctx->pmu);
+  ctx->pmu_ready = false;
 }
 
+void
+wth_lat_print(const struct hist *lat, FILE *f)
+{
+  static const char *names[WTH_LAT_STAGES] = {
+    [WTH_LAT_SENSOR_DQBUF] = "sensor-dqbuf",
+    [WTH_LAT_DQBUF_ENQUEUE] = "dqbuf-enqueue",
+    [WTH_LAT_ENQUEUE_DEQUEUE] = "enqueue-dequeue",
+    [WTH_LAT_DEQUEUE_WRITTEN] = "dequeue-written",
+    [WTH_LAT_SENSOR_WRITTEN] = "sensor-written"
+  };
+  const struct hist *h;
+  unsigned i;
+
+  for (i = 0u; i < WTH_LAT_STAGES; i++) {
+    h = &lat[i];
+    fprintf(f, "%-16s frames = %8"PRIu64", p50 = %9.3f ms, "
+            "p90 = %9.3f ms, p99 = %9.3f ms, p99.9 = %9.3f ms, "
+            "max = %9.3f ms\n",
+            names[i], h->count,
+            hist_permille(h, 500u) / 1e6, hist_permille(h, 900u) / 1e6,
+            hist_permille(h, 990u) / 1e6, hist_permille(h, 999u) / 1e6,
+            h->max / 1e6);
+  }
+}
@@ -0,0 +1,116 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/mem.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "mem.h"
+#include "clock.h"
+
+/* MAP_HUGETLB default size, /proc/meminfo Hugepagesize */
+#define MEM_HUGE_SIZE (2u * 1024u * 1024u)
+
+static size_t
+mem_round(size_t size, size_t align)
+{
+  return (size + align - 1u) / align * align;
+}
+
+void *
+mem_alloc(const char *name, size_t *size, unsigned flags)
+{
+  const char *pages = "normal pages";
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t length = *size ? *size : 1u;
+  uint64_t start = now_ns();
+  struct rlimit rl;
+  char *p = MAP_FAILED;
+  size_t i;
+
+  /* buffers smaller than half of huge page are not worth reserving one */
+  if ((flags & MEM_HUGETLB) && length >= MEM_HUGE_SIZE / 2u) {
+    length = mem_round(length, MEM_HUGE_SIZE);
+    p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED)
+      fprintf(stderr, "@ mem: %s: hugetlb %zu MB not mapped: %s, "
+              "see /proc/sys/vm/nr_hugepages\n",
+              name, length >> 20, strerror(errno));
+    else
+      pages = "hugetlb pages";
+  }
+
+  if (p == MAP_FAILED) {
+    length = mem_round(*size ? *size : 1u, page);
+    p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      fprintf(stderr, "! mem: %s: %zu bytes not mapped: %s\n",
+              name, length, strerror(errno));
+      return NULL;
+    }
+    if ((flags & (MEM_THP | MEM_HUGETLB))) {
+      if (madvise(p, length, MADV_HUGEPAGE) == 0)
+        pages = "transparent huge pages";
+      else
+        fprintf(stderr, "@ mem: %s: MADV_HUGEPAGE: %s\n",
+                name, strerror(errno));
+    }
+  }
+
+  if (flags & MEM_PREFAULT) {
+    /* write, not MAP_POPULATE: after madvise() and not shared zero page */
+    for (i = 0u; i < length; i += page)
+      ((volatile char *)p)[i] = 0;
+  }
+
+  if (flags & MEM_LOCK) {
+    if (mlock(p, length) == -1) {
+      fprintf(stderr, "@ mem: %s: mlock: %s", name, strerror(errno));
+      if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        fprintf(stderr, " (RLIMIT_MEMLOCK %llu KB)",
+                (unsigned long long)rl.rlim_cur / 1024u);
+      fprintf(stderr, "\n");
+      flags &= ~(unsigned)MEM_LOCK;
+    }
+  }
+
+  if (flags) {
+    fprintf(stderr, "@ mem: %s: %zu KB, %s%s%s in %.3f ms\n",
+            name, length >> 10, pages,
+            (flags & MEM_PREFAULT) ? ", prefaulted" : "",
+            (flags & MEM_LOCK) ? ", locked" : "",
+            (now_ns() - start) / 1e6);
+  }
+  *size = length;
+  return p;
+}
+
+void
+mem_free(void *p, size_t size)
+{
+  if (p)
+    munmap(p, size);
+}
+
+bool
+mem_parse_huge(const char *mode, unsigned *flags)
+{
+  *flags &= ~(unsigned)(MEM_HUGETLB | MEM_THP);
+  if (!strcmp(mode, "hugetlb"))
+    *flags |= MEM_HUGETLB;
+  else if (!strcmp(mode, "thp"))
+    *flags |= MEM_THP;
+  else if (strcmp(mode, "none"))
+    return false;
+  return true;
+}
@@ -0,0 +1,39 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/mem.h
+ */
+#ifndef _MEM_1562059034_H_
+#define _MEM_1562059034_H_
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * large buffers allocated with mmap:
+ * pages faulted and locked at startup, not while frames are timed
+ */
+enum mem_flags {
+  /* touch every page */
+  MEM_PREFAULT = 1u << 0,
+  /* mlock, failure is reported but not fatal */
+  MEM_LOCK = 1u << 1,
+  /* MAP_HUGETLB, fallback to normal pages when pool is empty */
+  MEM_HUGETLB = 1u << 2,
+  /* madvise(MADV_HUGEPAGE) for transparent huge pages */
+  MEM_THP = 1u << 3
+};
+
+/*
+ * zeroed memory, NULL on error.
+ * name is used in report to stderr, printed when flags are set.
+ * size is rounded up to length of mapping, pass it to mem_free()
+ */
+void *
+mem_alloc(const char *name, size_t *size, unsigned flags);
+
+void
+mem_free(void *p, size_t size);
+
+/* parse huge pages mode: none, thp or hugetlb */
+bool
+mem_parse_huge(const char *mode, unsigned *flags);
+
+#endif /* _MEM_1562059034_H_ */
@@ -0,0 +1,277 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/metrics.c
+ *
+ * render capture stats page as Prometheus text exposition format,
+ * to stdout or atomically to file for node_exporter textfile collector
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+
+#include "stats.h"
+#include "pmu.h"
+#include "clock.h"
+
+/* names of enum wth_lat_stage */
+static const char *const stage_names[STATS_LAT_STAGES] = {
+  "sensor_dqbuf",
+  "dqbuf_enqueue",
+  "enqueue_dequeue",
+  "dequeue_written",
+  "sensor_written"
+};
+
+static const char *const pmu_stage_names[STATS_PMU_STAGES] = {
+  "camera_cb",
+  "async_write_cb"
+};
+
+static void
+pmu_metric(FILE *f, const struct stats_data *d, enum pmu_event ev,
+           const char *name, const char *help, double scale)
+{
+  const struct stats_pmu *p;
+  size_t i;
+  bool header = false;
+
+  for (i = 0u; i < STATS_PMU_STAGES; i++) {
+    p = &d->pmu[i];
+    if (!(p->mask & (1u << ev)) || !p->frames)
+      continue;
+    if (!header) {
+      fprintf(f, "# HELP camcap_pmu_%s_per_frame %s\n", name, help);
+      fprintf(f, "# TYPE camcap_pmu_%s_per_frame gauge\n", name);
+      header = true;
+    }
+    fprintf(f, "camcap_pmu_%s_per_frame{stage=\"%s\"} %.3f\n",
+            name, pmu_stage_names[i],
+            (ev == PMU_CYCLES ? p->cycles :
+             ev == PMU_INSTRUCTIONS ? p->instructions :
+             ev == PMU_CACHE_MISSES ? p->cache_misses :
+             ev == PMU_PAGE_FAULTS ? p->page_faults :
+             p->task_clock_ns) * scale / p->frames);
+  }
+}
+
+static void
+metric(FILE *f, const char *name, const char *type, const char *help,
+       uint64_t value)
+{
+  fprintf(f, "# HELP camcap_%s %s\n", name, help);
+  fprintf(f, "# TYPE camcap_%s %s\n", name, type);
+  fprintf(f, "camcap_%s %" PRIu64 "\n", name, value);
+}
+
+static void
+render(FILE *f, const struct stats_page *sp, const struct stats_data *d)
+{
+  uint64_t now = now_ns();
+  size_t i;
+
+
+  fprintf(f, "# HELP camcap_up Capture process is alive\n");
+  fprintf(f, "# TYPE camcap_up gauge\n");
+  fprintf(f, "camcap_up{pid=\"%u\"} %d\n",
+          sp->pid, kill((pid_t)sp->pid, 0) == 0 || errno == EPERM);
+  fprintf(f, "# HELP camcap_stats_age_seconds Time since last update\n");
+  fprintf(f, "# TYPE camcap_stats_age_seconds gauge\n");
+  fprintf(f, "camcap_stats_age_seconds %.3f\n",
+          now > d->update_ns ? (now - d->update_ns) / 1e9 : 0.0);
+  metric(f, "start_time_seconds", "gauge",
+         "Capture start time, UTC", d->start_utc);
+
+  metric(f, "frames_arrived_total", "counter",
+         "Frames received from camera", d->frames_arrived);
+  metric(f, "frames_dropped_total", "counter",
+         "Frames not written", d->frames_dropped);
+  fprintf(f, "# HELP camcap_frame_drops_total Frames not written "
+          "by reason\n");
+  fprintf(f, "# TYPE camcap_frame_drops_total counter\n");
+  fprintf(f, "camcap_frame_drops_total{reason=\"buffer_full\"} %" PRIu64 "\n",
+          d->drops_full);
+  fprintf(f, "camcap_frame_drops_total{reason=\"oldest\"} %" PRIu64 "\n",
+          d->drops_oldest);
+  fprintf(f, "camcap_frame_drops_total{reason=\"decimate\"} %" PRIu64 "\n",
+          d->drops_decimate);
+  metric(f, "gap_markers_total", "counter",
+         "Dropped frames recorded in index", d->gap_markers);
+  metric(f, "v4l2_queued_buffers", "gauge",
+         "Buffers queued to driver", d->v4l2_queued);
+  metric(f, "v4l2_buffers", "gauge",
+         "Buffers allocated in driver", d->v4l2_buffers);
+  metric(f, "fps", "gauge", "Nominal frames per second", d->fps);
+  metric(f, "jpeg_quality", "gauge",
+         "JPEG quality set on camera, 0 = unknown", d->quality);
+  if (d->adapt_levels) {
+    metric(f, "adapt_level", "gauge",
+           "Adaptive quality level, 0 = best", d->adapt_level);
+    fprintf(f, "# HELP camcap_adapt_steps_total Adaptive quality level "
+            "changes\n");
+    fprintf(f, "# TYPE camcap_adapt_steps_total counter\n");
+    fprintf(f, "camcap_adapt_steps_total{direction=\"down\"} %" PRIu64 "\n",
+            d->adapt_steps_down);
+    fprintf(f, "camcap_adapt_steps_total{direction=\"up\"} %" PRIu64 "\n",
+            d->adapt_steps_up);
+  }
+
+  fprintf(f, "# HELP camcap_segment Current files ring position\n");
+  fprintf(f, "# TYPE camcap_segment gauge\n");
+  fprintf(f, "camcap_segment{frame_file=\"%.*s\",index_file=\"%.*s\"} "
+          "%" PRIu64 "\n",
+          (int)sizeof(d->frame_file), d->frame_file,
+          (int)sizeof(d->index_file), d->index_file, d->segment);
+  metric(f, "segment_limit", "gauge",
+         "Files in ring", d->files_limit);
+  metric(f, "segment_size_limit_bytes", "gauge",
+         "Maximum frame file size", d->size_limit);
+  metric(f, "frame_file_bytes", "gauge",
+         "Bytes in current frame file", d->frame_file_bytes);
+  metric(f, "index_file_bytes", "gauge",
+         "Bytes in current index file", d->index_file_bytes);
+  if (d->lapse_segment || d->lapse_files_limit) {
+    metric(f, "lapse_frames_total", "counter",
+           "Frames written to decimated stream", d->lapse_frames);
+    metric(f, "lapse_gap_markers_total", "counter",
+           "Dropped frames recorded in decimated stream index",
+           d->lapse_gap_markers);
+    metric(f, "lapse_segment", "gauge",
+           "Decimated stream files ring position", d->lapse_segment);
+    metric(f, "lapse_segment_limit", "gauge",
+           "Files in decimated stream ring", d->lapse_files_limit);
+  }
+  if (d->event_ring_capacity) {
+    metric(f, "event_recording", "gauge",
+           "Triggered recording writes frames", d->event_recording);
+    metric(f, "event_triggers_total", "counter",
+           "Triggers of recording", d->event_triggers);
+    metric(f, "events_total", "counter",
+           "Recordings started after idle", d->events);
+    metric(f, "event_frames_discarded_total", "counter",
+           "Idle frames not recorded", d->event_discarded);
+    metric(f, "event_ring_capacity_bytes", "gauge",
+           "Pre-event buffer size", d->event_ring_capacity);
+    metric(f, "event_ring_occupied_percent", "gauge",
+           "Pre-event buffer occupancy", d->event_ring_percent);
+  }
+
+  metric(f, "ring_capacity_bytes", "gauge",
+         "Write thread buffer size", d->ring_capacity);
+  metric(f, "ring_occupied_percent", "gauge",
+         "Write thread buffer occupancy", d->ring_percent);
+  metric(f, "ring_occupied_percent_max", "gauge",
+         "Write thread buffer occupancy maximum", d->ring_percent_max);
+  metric(f, "ring_dropped_total", "counter",
+         "Records not fitted in write thread buffer", d->ring_dropped);
+  metric(f, "written_bytes_total", "counter",
+         "Bytes written to disk", d->written_bytes);
+  metric(f, "write_errors_total", "counter",
+         "Failed writes", d->write_errors);
+  metric(f, "short_writes_total", "counter",
+         "Partial writes", d->short_writes);
+  metric(f, "flushes_total", "counter",
+         "Write thread wakeups with data in buffer", d->flushes);
+  metric(f, "deadline_flushes_total", "counter",
+         "Writes started by age of oldest buffered byte",
+         d->flushes_deadline);
+
+  fprintf(f, "# HELP camcap_latency_seconds Frame pipeline stage latency\n");
+  fprintf(f, "# TYPE camcap_latency_seconds summary\n");
+  for (i = 0u; i < STATS_LAT_STAGES; i++) {
+    const struct stats_lat *l = &d->lat[i];
+
+    fprintf(f, "camcap_latency_seconds{stage=\"%s\",quantile=\"0.5\"} %.9f\n",
+            stage_names[i], l->p50_ns / 1e9);
+    fprintf(f, "camcap_latency_seconds{stage=\"%s\",quantile=\"0.99\"} %.9f\n",
+            stage_names[i], l->p99_ns / 1e9);
+    fprintf(f, "camcap_latency_seconds{stage=\"%s\",quantile=\"1\"} %.9f\n",
+            stage_names[i], l->max_ns / 1e9);
+    fprintf(f, "camcap_latency_seconds_sum{stage=\"%s\"} %.9f\n",
+            stage_names[i], l->sum_ns / 1e9);
+    fprintf(f, "camcap_latency_seconds_count{stage=\"%s\"} %" PRIu64 "\n",
+            stage_names[i], l->count);
+  }
+
+  pmu_metric(f, d, PMU_CYCLES, "cycles",
+             "CPU cycles in user space, last window", 1.0);
+  pmu_metric(f, d, PMU_INSTRUCTIONS, "instructions",
+             "Instructions in user space, last window", 1.0);
+  pmu_metric(f, d, PMU_CACHE_MISSES, "cache_misses",
+             "Last level cache misses, last window", 1.0);
+  pmu_metric(f, d, PMU_PAGE_FAULTS, "page_faults",
+             "Page faults, last window", 1.0);
+  pmu_metric(f, d, PMU_TASK_CLOCK, "cpu_seconds",
+             "CPU time of thread, last window", 1e-9);
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-o <file>] <stats file>\n", name);
+  fprintf(stderr, "  -o  write to file (via temporary file and rename)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  const struct stats_page *sp;
+  struct stats_data d;
+  const char *output = NULL;
+  char tmp[4096];
+  FILE *f = stdout;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:")) != -1) {
+    switch (opt) {
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (!(sp = stats_open(argv[optind])))
+    return EXIT_FAILURE;
+
+  if (!stats_read(sp, &d)) {
+    fprintf(stderr, "ERROR: stats page is locked by writer\n");
+    stats_close(sp);
+    return EXIT_FAILURE;
+  }
+
+  if (output) {
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", output, (int)getpid());
+    if (!(f = fopen(tmp, "w"))) {
+      fprintf(stderr, "ERROR: '%s' not opened: %s\n", tmp, strerror(errno));
+      stats_close(sp);
+      return EXIT_FAILURE;
+    }
+  }
+
+  render(f, sp, &d);
+  stats_close(sp);
+
+  if (output) {
+    if (fclose(f) != 0 || rename(tmp, output) == -1) {
+      fprintf(stderr, "ERROR: '%s' not written: %s\n",
+              output, strerror(errno));
+      unlink(tmp);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
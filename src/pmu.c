@@ -0,0 +1,211 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/pmu.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "pmu.h"
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} events[PMU_EVENTS] = {
+  [PMU_CYCLES] = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  [PMU_INSTRUCTIONS] = {"instructions",
+                        PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  [PMU_CACHE_MISSES] = {"cache-misses",
+                        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  [PMU_PAGE_FAULTS] = {"page-faults",
+                       PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+  [PMU_TASK_CLOCK] = {"task-clock",
+                      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}
+};
+
+/* read() layout for PERF_FORMAT_GROUP | ID | TOTAL_TIME_* */
+struct pmu_read_format {
+  uint64_t nr;
+  uint64_t time_enabled;
+  uint64_t time_running;
+  struct {
+    uint64_t value;
+    uint64_t id;
+  } v[PMU_EVENTS];
+};
+
+bool
+pmu_open(struct pmu_group *g)
+{
+  struct perf_event_attr attr;
+  int leader = -1;
+  size_t i;
+
+  memset(g, 0, sizeof(*g));
+  for (i = 0u; i < PMU_EVENTS; i++) {
+    g->fd[i] = -1;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+                       PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* pid 0, cpu -1: calling thread on any cpu */
+    g->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader,
+                            PERF_FLAG_FD_CLOEXEC);
+    if (g->fd[i] == -1) {
+      fprintf(stderr, "! pmu: %s not available: %s\n",
+              events[i].name, strerror(errno));
+      continue;
+    }
+    if (ioctl(g->fd[i], PERF_EVENT_IOC_ID, &g->id[i]) == -1) {
+      close(g->fd[i]);
+      g->fd[i] = -1;
+      continue;
+    }
+    if (leader == -1)
+      leader = g->fd[i];
+    g->mask |= 1u << i;
+  }
+
+  if (leader == -1) {
+    fprintf(stderr, "! pmu: no counters\n");
+    return false;
+  }
+  return true;
+}
+
+void
+pmu_close(struct pmu_group *g)
+{
+  size_t i;
+
+  /* members before leader */
+  for (i = PMU_EVENTS; i-- > 0u;) {
+    if (g->fd[i] != -1)
+      close(g->fd[i]);
+    g->fd[i] = -1;
+  }
+  g->mask = 0u;
+}
+
+bool
+pmu_read(const struct pmu_group *g, uint64_t v[PMU_EVENTS])
+{
+  struct pmu_read_format rf;
+  int leader = -1;
+  size_t i;
+  size_t j;
+
+  for (i = 0u; i < PMU_EVENTS && leader == -1; i++)
+    leader = g->fd[i];
+  if (leader == -1 || read(leader, &rf, sizeof(rf)) <= 0)
+    return false;
+
+  memset(v, 0, sizeof(*v) * PMU_EVENTS);
+  for (j = 0u; j < rf.nr && j < PMU_EVENTS; j++) {
+    for (i = 0u; i < PMU_EVENTS; i++) {
+      if (g->fd[i] == -1 || g->id[i] != rf.v[j].id)
+        continue;
+      /* group was multiplexed with other events */
+      if (rf.time_running && rf.time_running < rf.time_enabled)
+        v[i] = (uint64_t)((double)rf.v[j].value *
+                          rf.time_enabled / rf.time_running);
+      else
+        v[i] = rf.v[j].value;
+    }
+  }
+  return true;
+}
+
+void
+pmu_stat_init(struct pmu_stat *s, const struct pmu_group *g, uint64_t window)
+{
+  memset(&s->cur, 0, sizeof(s->cur));
+  memset(&s->last, 0, sizeof(s->last));
+  atomic_init(&s->seq, 0u);
+  s->window = window ? window : 1u;
+  s->mask = g->mask;
+}
+
+void
+pmu_account(struct pmu_stat *s, const uint64_t before[PMU_EVENTS],
+            const uint64_t after[PMU_EVENTS], uint64_t frames)
+{
+  unsigned seq;
+  size_t i;
+
+  for (i = 0u; i < PMU_EVENTS; i++) {
+    if (after[i] > before[i])
+      s->cur.v[i] += after[i] - before[i];
+  }
+  s->cur.frames += frames;
+  if (s->cur.frames < s->window)
+    return;
+
+  seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+  atomic_store_explicit(&s->seq, seq + 1u, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  s->last = s->cur;
+  atomic_store_explicit(&s->seq, seq + 2u, memory_order_release);
+  memset(&s->cur, 0, sizeof(s->cur));
+}
+
+void
+pmu_last(const struct pmu_stat *s, struct pmu_sum *out)
+{
+  unsigned seq;
+
+  do {
+    seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    *out = s->last;
+    atomic_thread_fence(memory_order_acquire);
+  } while ((seq & 1u) ||
+           seq != atomic_load_explicit(&s->seq, memory_order_relaxed));
+}
+
+void
+pmu_print(const char *name, const struct pmu_stat *s, FILE *f)
+{
+  struct pmu_sum last;
+  double frames;
+  size_t i;
+
+  pmu_last(s, &last);
+  if (!s->mask) {
+    fprintf(f, "%-14s counters not available\n", name);
+    return;
+  }
+  if (!last.frames) {
+    fprintf(f, "%-14s window of %"PRIu64" frames not complete\n",
+            name, s->window);
+    return;
+  }
+
+  frames = (double)last.frames;
+  fprintf(f, "%-14s frames = %8"PRIu64, name, last.frames);
+  for (i = 0u; i < PMU_EVENTS; i++) {
+    if (!(s->mask & (1u << i)))
+      continue;
+    if (i == PMU_TASK_CLOCK)
+      fprintf(f, ", %s = %.3f us", events[i].name, last.v[i] / frames / 1e3);
+    else
+      fprintf(f, ", %s = %.1f", events[i].name, last.v[i] / frames);
+  }
+  if ((s->mask & (1u << PMU_CYCLES)) &&
+      (s->mask & (1u << PMU_INSTRUCTIONS)) && last.v[PMU_CYCLES])
+    fprintf(f, ", IPC = %.2f",
+            (double)last.v[PMU_INSTRUCTIONS] / last.v[PMU_CYCLES]);
+  fprintf(f, "\n");
+}
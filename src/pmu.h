@@ -0,0 +1,78 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/pmu.h
+ */
+#ifndef _PMU_1561885127_H_
+#define _PMU_1561885127_H_
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * perf_event_open counters of calling thread in one group,
+ * read with one read() before and after pipeline stage.
+ * events not supported by cpu or kernel (virtual machines,
+ * perf_event_paranoid) are skipped.
+ * counters are user space only (exclude_kernel), except software events.
+ */
+enum pmu_event {
+  PMU_CYCLES = 0,
+  PMU_INSTRUCTIONS,
+  PMU_CACHE_MISSES,
+  PMU_PAGE_FAULTS,
+  PMU_TASK_CLOCK,
+  PMU_EVENTS
+};
+
+struct pmu_group {
+  /* -1 when event not opened */
+  int fd[PMU_EVENTS];
+  uint64_t id[PMU_EVENTS];
+  /* bit of enum pmu_event for opened counters */
+  unsigned mask;
+};
+
+struct pmu_sum {
+  uint64_t frames;
+  uint64_t v[PMU_EVENTS];
+};
+
+/* counters of stage summed over window of frames */
+struct pmu_stat {
+  /* frames in window */
+  uint64_t window;
+  unsigned mask;
+  struct pmu_sum cur;
+  /* last complete window, odd seq while updating */
+  atomic_uint seq;
+  struct pmu_sum last;
+};
+
+/* open counters for calling thread */
+bool
+pmu_open(struct pmu_group *g);
+
+void
+pmu_close(struct pmu_group *g);
+
+/* current values, false on read error */
+bool
+pmu_read(const struct pmu_group *g, uint64_t v[PMU_EVENTS]);
+
+void
+pmu_stat_init(struct pmu_stat *s, const struct pmu_group *g, uint64_t window);
+
+/* add difference of counters for frames */
+void
+pmu_account(struct pmu_stat *s, const uint64_t before[PMU_EVENTS],
+            const uint64_t after[PMU_EVENTS], uint64_t frames);
+
+/* copy of last complete window from other thread */
+void
+pmu_last(const struct pmu_stat *s, struct pmu_sum *out);
+
+/* print counters per frame of last window */
+void
+pmu_print(const char *name, const struct pmu_stat *s, FILE *f);
+
+#endif /* _PMU_1561885127_H_ */
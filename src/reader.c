@@ -0,0 +1,516 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/reader.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "files.h"
+#include "reader.h"
+
+/* mapping size granularity, power of 2 */
+#define RDR_MAP_RESERVE (16u << 20)
+
+/* message of last failure of thread */
+static _Thread_local char rdr_errmsg[256];
+
+static void
+rdr_fail(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void
+rdr_fail(const char *fmt, ...)
+{
+  va_list ap;
+  int saved = errno;
+
+  va_start(ap, fmt);
+  vsnprintf(rdr_errmsg, sizeof(rdr_errmsg), fmt, ap);
+  va_end(ap);
+  errno = saved;
+}
+
+const char *
+rdr_error(void)
+{
+  return rdr_errmsg;
+}
+
+/* map file with reserve for growth: pages after EOF are not touched,
+ * data appended by writer visible without remap
+ */
+static bool
+rdr_map(int fd, const uint8_t **map, size_t *map_size, size_t *size)
+{
+  struct stat st;
+  size_t len;
+  void *p;
+
+  if (fstat(fd, &st) == -1) {
+    rdr_fail("stat failed: %s", strerror(errno));
+    return false;
+  }
+
+  if ((size_t)st.st_size <= *map_size) {
+    *size = st.st_size;
+    return true;
+  }
+
+  if (*map) {
+    munmap((void *)*map, *map_size);
+    *map = NULL;
+    *map_size = 0u;
+  }
+
+  len = ((size_t)st.st_size + RDR_MAP_RESERVE) & ~(RDR_MAP_RESERVE - 1);
+  p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    rdr_fail("mmap %zu bytes failed: %s",
+             len, strerror(errno));
+    return false;
+  }
+
+  *map = p;
+  *map_size = len;
+  *size = st.st_size;
+  return true;
+}
+
+static void
+rdr_index_update(struct rdr_index *ix)
+{
+  size_t records;
+
+  ix->fh = (const frame_header_t *)ix->map;
+  records = ix->size - FH_SIZE(ix->fh);
+  ix->fi = (const frame_index_t *)(ix->map + FH_SIZE(ix->fh));
+  ix->count = records / sizeof(frame_index_t);
+  ix->tail = records % sizeof(frame_index_t);
+}
+
+bool
+rdr_index_open(struct rdr_index *ix, int dirfd, const char *path)
+{
+  memset(ix, 0, sizeof(*ix));
+  ix->fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+  if (ix->fd == -1) {
+    rdr_fail("file '%s' not oppened: %s", path, strerror(errno));
+    return false;
+  }
+
+  if (!rdr_map(ix->fd, &ix->map, &ix->map_size, &ix->size)) {
+    rdr_index_close(ix);
+    return false;
+  }
+
+  if (ix->size < FH_SIZE_MIN) {
+    rdr_fail("file '%s' has no header", path);
+    rdr_index_close(ix);
+    return false;
+  }
+
+  if (!FH_KEY_VALID((const frame_header_t *)ix->map)) {
+    rdr_fail("file '%s' has invalid header magic key", path);
+    rdr_index_close(ix);
+    return false;
+  }
+
+  if (ix->size < FH_SIZE((const frame_header_t *)ix->map)) {
+    rdr_fail("file '%s' has no header", path);
+    rdr_index_close(ix);
+    return false;
+  }
+
+  rdr_index_update(ix);
+  return true;
+}
+
+bool
+rdr_index_refresh(struct rdr_index *ix)
+{
+  if (!rdr_map(ix->fd, &ix->map, &ix->map_size, &ix->size))
+    return false;
+
+  if (ix->size < FH_SIZE((const frame_header_t *)ix->map)) {
+    rdr_fail("index file truncated");
+    return false;
+  }
+
+  rdr_index_update(ix);
+  return true;
+}
+
+void
+rdr_index_close(struct rdr_index *ix)
+{
+  if (ix->map)
+    munmap((void *)ix->map, ix->map_size);
+  if (ix->fd != -1)
+    close(ix->fd);
+  memset(ix, 0, sizeof(*ix));
+  ix->fd = -1;
+}
+
+size_t
+rdr_index_lower_bound(const struct rdr_index *ix, size_t lo, size_t hi,
+                      const struct timeval *tv)
+{
+  struct timebin tb;
+  struct timeval frame_time;
+  size_t mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    memcpy(&tb, &ix->fi[mid].tv, sizeof(tb));
+    timebin_to_timeval(&tb, &frame_time);
+    if (timercmp(&frame_time, tv, <))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void
+rdr_pack_init(struct rdr_pack *pk)
+{
+  memset(pk, 0, sizeof(*pk));
+  pk->fd = -1;
+}
+
+bool
+rdr_pack_frame(struct rdr_pack *pk, int dirfd, const char *path,
+               const frame_index_t *fi, const uint8_t **p)
+{
+  uint64_t offset = BSWAP_BE64(fi->offset_be);
+  uint32_t size = BSWAP_BE32(fi->size_be);
+
+  if (pk->fd == -1 || strcmp(pk->path, path)) {
+    rdr_pack_close(pk);
+    pk->fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (pk->fd == -1) {
+      rdr_fail("open frm file '%s' failed: %s",
+               path, strerror(errno));
+      return false;
+    }
+    snprintf(pk->path, sizeof(pk->path), "%s", path);
+  }
+
+  if (offset + size > pk->size) {
+    /* file in writing or not mapped yet */
+    if (!rdr_map(pk->fd, &pk->map, &pk->map_size, &pk->size))
+      return false;
+    if (offset + size > pk->size) {
+      rdr_fail("frm unexpected EOF: size=%zu, expected=%"PRIu64,
+               pk->size, offset + size);
+      return false;
+    }
+  }
+
+  *p = pk->map + offset;
+  return true;
+}
+
+void
+rdr_pack_close(struct rdr_pack *pk)
+{
+  if (pk->map)
+    munmap((void *)pk->map, pk->map_size);
+  if (pk->fd != -1)
+    close(pk->fd);
+  rdr_pack_init(pk);
+}
+
+bool
+rdr_segment_load(struct rdr_segment *seg, int dirfd, const char *path,
+                 bool allow_empty)
+{
+  frame_index_t fi = {0};
+  off_t file_size;
+  int fd;
+
+  fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    rdr_fail("file '%s' not oppened: %s", path, strerror(errno));
+    return false;
+  }
+
+  memset(&seg->fh, 0, sizeof(seg->fh));
+  file_size = lseek(fd, 0, SEEK_END);
+  if (file_size < (off_t)FH_SIZE_MIN ||
+      pread(fd, &seg->fh, FH_SIZE_MIN, 0) != FH_SIZE_MIN) {
+    rdr_fail("file '%s' has no header", path);
+    close(fd);
+    return false;
+  }
+
+  if (!FH_KEY_VALID(&seg->fh)) {
+    rdr_fail("file '%s' has invalid header magic key", path);
+    close(fd);
+    return false;
+  }
+
+  if (file_size < (off_t)FH_SIZE(&seg->fh) ||
+      pread(fd, &seg->fh, FH_SIZE(&seg->fh), 0) != FH_SIZE(&seg->fh)) {
+    rdr_fail("file '%s' has no header", path);
+    close(fd);
+    return false;
+  }
+
+  /* last record can be incomplete when file in writing */
+  seg->frame_count = (file_size - FH_SIZE(&seg->fh)) / sizeof(frame_index_t);
+  if (seg->frame_count) {
+    if (pread(fd, &fi, sizeof(fi),
+              FH_SIZE(&seg->fh) +
+              (seg->frame_count - 1) * sizeof(frame_index_t)) != sizeof(fi) ||
+        !FI_KEY_VALID(&fi)) {
+      rdr_fail("file '%s' has invalid last record magic key", path);
+      close(fd);
+      return false;
+    }
+    timebin_to_timeval(&fi.tv, &seg->last);
+  } else if (allow_empty) {
+    /* first frame not written yet */
+    timebin_to_timeval(&seg->fh.cap_time.local, &seg->last);
+  } else {
+    rdr_fail("file '%s' has no frames", path);
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  snprintf(seg->path, sizeof(seg->path), "%s", path);
+  memcpy(seg->frm, seg->fh.path, FH_PATH_SIZE);
+  seg->frm[FH_PATH_SIZE] = '\0';
+  timebin_to_timeval(&seg->fh.cap_time.utc, &seg->utc);
+  timebin_to_timeval(&seg->fh.cap_time.local, &seg->first);
+  return true;
+}
+
+static int
+rdr_segment_cmp(const void *a, const void *b)
+{
+  const struct rdr_segment *sa = a;
+  const struct rdr_segment *sb = b;
+  struct timeval ta;
+  struct timeval tb;
+
+  timeradd(&sa->utc, &sa->first, &ta);
+  timeradd(&sb->utc, &sb->first, &tb);
+
+  if (timercmp(&ta, &tb, !=))
+    return timercmp(&ta, &tb, <) ? -1 : 1;
+
+  if (BSWAP_BE32(sa->fh.seq_be) != BSWAP_BE32(sb->fh.seq_be))
+    return BSWAP_BE32(sa->fh.seq_be) < BSWAP_BE32(sb->fh.seq_be) ? -1 : 1;
+  return 0;
+}
+
+bool
+rdr_open(struct rdr_archive *ar, const char *dirpath, bool allow_empty)
+{
+  DIR *dirp;
+  struct dirent *rd;
+  struct rdr_segment *seg;
+  size_t alloc = 0u;
+  int fd;
+
+  memset(ar, 0, sizeof(*ar));
+  ar->dirfd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (ar->dirfd == -1) {
+    rdr_fail("directory '%s' not openned: %s", dirpath, strerror(errno));
+    rdr_close(ar);
+    return false;
+  }
+  /* closedir() closes descriptor of stream */
+  fd = dup(ar->dirfd);
+  if (fd == -1 || (dirp = fdopendir(fd)) == NULL) {
+    rdr_fail("directory '%s' not read: %s", dirpath, strerror(errno));
+    if (fd != -1)
+      close(fd);
+    rdr_close(ar);
+    return false;
+  }
+
+  while ((rd = readdir(dirp)) != NULL) {
+    if (strncmp(rd->d_name, FILE_IDX_PREFIX, sizeof(FILE_IDX_PREFIX) - 1))
+      continue;
+
+    if (ar->seg_count == alloc) {
+      alloc = alloc ? alloc * 2 : 64u;
+      seg = realloc(ar->segs, alloc * sizeof(*seg));
+      if (!seg) {
+        rdr_fail("allocate %zu bytes failed: %s",
+                 alloc * sizeof(*seg), strerror(errno));
+        closedir(dirp);
+        rdr_close(ar);
+        return false;
+      }
+      ar->segs = seg;
+    }
+
+    if (rdr_segment_load(&ar->segs[ar->seg_count], ar->dirfd, rd->d_name,
+                         allow_empty)) {
+      ar->seg_count++;
+    } else {
+      ar->skipped++;
+    }
+  }
+
+  closedir(dirp);
+
+  if (!ar->seg_count) {
+    rdr_fail("no frame index files found in path: '%s'", dirpath);
+    rdr_close(ar);
+    return false;
+  }
+
+  qsort(ar->segs, ar->seg_count, sizeof(*ar->segs), rdr_segment_cmp);
+  return true;
+}
+
+void
+rdr_close(struct rdr_archive *ar)
+{
+  if (ar->dirfd != -1)
+    close(ar->dirfd);
+  free(ar->segs);
+  memset(ar, 0, sizeof(*ar));
+  ar->dirfd = -1;
+}
+
+bool
+rdr_coverage(const struct rdr_archive *ar,
+             struct timeval *start, struct timeval *end)
+{
+  const struct rdr_segment *seg;
+  struct timeval tv;
+  size_t i;
+
+  if (!ar->seg_count)
+    return false;
+
+  seg = &ar->segs[0];
+  timeradd(&seg->utc, &seg->first, start);
+  timerclear(end);
+  /* packs may overlap after clock adjustment */
+  for (i = 0u; i < ar->seg_count; i++) {
+    seg = &ar->segs[i];
+    timeradd(&seg->utc, &seg->last, &tv);
+    if (timercmp(&tv, end, >))
+      memcpy(end, &tv, sizeof(*end));
+  }
+  return true;
+}
+
+void
+rdr_cursor_init(struct rdr_cursor *c, struct rdr_archive *ar)
+{
+  memset(c, 0, sizeof(*c));
+  c->ar = ar;
+  c->ix.fd = -1;
+  rdr_pack_init(&c->pk);
+}
+
+bool
+rdr_seek(struct rdr_cursor *c, const struct timeval *utc)
+{
+  struct rdr_segment *seg;
+  struct timeval seg_end;
+  struct timeval local;
+
+  rdr_index_close(&c->ix);
+  c->failed = false;
+  c->pos = 0u;
+  for (c->seg = 0u; c->seg < c->ar->seg_count; c->seg++) {
+    seg = &c->ar->segs[c->seg];
+    timeradd(&seg->utc, &seg->last, &seg_end);
+    if (!timercmp(&seg_end, utc, <))
+      break;
+  }
+
+  if (c->seg == c->ar->seg_count)
+    return true;
+
+  if (!rdr_index_open(&c->ix, c->ar->dirfd, seg->path)) {
+    c->failed = true;
+    return false;
+  }
+
+  timersub(utc, &seg->utc, &local);
+  c->pos = rdr_index_lower_bound(&c->ix, 0u, c->ix.count, &local);
+  return true;
+}
+
+bool
+rdr_next(struct rdr_cursor *c, struct rdr_frame *f)
+{
+  const struct rdr_segment *seg;
+  const frame_index_t *fi;
+  struct timebin tb;
+  struct timeval local;
+
+  while (c->seg < c->ar->seg_count) {
+    seg = &c->ar->segs[c->seg];
+    if (c->ix.fd == -1 &&
+        !rdr_index_open(&c->ix, c->ar->dirfd, seg->path)) {
+      c->failed = true;
+      return false;
+    }
+
+    if (c->pos >= c->ix.count) {
+      rdr_index_close(&c->ix);
+      c->seg++;
+      c->pos = 0u;
+      continue;
+    }
+
+    fi = &c->ix.fi[c->pos];
+    if (!FI_KEY_VALID(fi)) {
+      rdr_fail("invalid frame index magic key in '%s' at record %zu",
+               seg->path, c->pos);
+      c->invalid++;
+      c->pos++;
+      continue;
+    }
+
+    if (FI_IS_GAP(fi)) {
+      c->gaps++;
+      c->pos++;
+      continue;
+    }
+
+    if (!rdr_pack_frame(&c->pk, c->ar->dirfd, seg->frm, fi, &f->data)) {
+      c->failed = true;
+      return false;
+    }
+
+    memcpy(&tb, &fi->tv, sizeof(tb));
+    timebin_to_timeval(&tb, &local);
+    timeradd(&seg->utc, &local, &f->utc);
+    f->seq = BSWAP_BE64(fi->seq_be);
+    f->size = BSWAP_BE32(fi->size_be);
+    f->fps = seg->fh.frame.fps;
+    f->width = BSWAP_BE16(seg->fh.frame.width_be);
+    f->height = BSWAP_BE16(seg->fh.frame.height_be);
+    f->seg = seg;
+    f->pos = c->pos++;
+    return true;
+  }
+
+  return false;
+}
+
+void
+rdr_cursor_close(struct rdr_cursor *c)
+{
+  rdr_index_close(&c->ix);
+  rdr_pack_close(&c->pk);
+}
@@ -0,0 +1,177 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/reader.h
+ */
+#ifndef _READER_1560766502_H_
+#define _READER_1560766502_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include "frame_index.h"
+
+/*
+ * libcamcap-reader: read capture archive in process
+ *
+ * index and frame files are mapped, frame data is returned
+ * as pointer to mapping (no copy).
+ * files in archive must not be truncated while mapped:
+ * reader lagging more than whole files ring behind capture
+ * can receive SIGBUS
+ *
+ * functions do not print: on failure rdr_error() describes the cause
+ */
+
+/* mapped index file */
+struct rdr_index {
+  int fd;
+  const uint8_t *map;
+  size_t map_size;
+  /* file size */
+  size_t size;
+  const frame_header_t *fh;
+  /* complete records */
+  const frame_index_t *fi;
+  size_t count;
+  /* bytes of incomplete last record */
+  size_t tail;
+};
+
+/* mapped frames file */
+struct rdr_pack {
+  int fd;
+  char path[FH_PATH_SIZE + 1];
+  const uint8_t *map;
+  size_t map_size;
+  /* file size */
+  size_t size;
+};
+
+/* index file in archive */
+struct rdr_segment {
+  char path[FH_PATH_SIZE + 1];
+  /* frames file from header */
+  char frm[FH_PATH_SIZE + 1];
+  frame_header_t fh;
+  /* complete records in file */
+  size_t frame_count;
+  /* UTC time of seq=0 frame */
+  struct timeval utc;
+  /* local time of first and last frames */
+  struct timeval first;
+  struct timeval last;
+};
+
+struct rdr_archive {
+  int dirfd;
+  /* index files sorted by time */
+  struct rdr_segment *segs;
+  size_t seg_count;
+  /* index files not usable, cause of last in rdr_error() */
+  size_t skipped;
+};
+
+struct rdr_frame {
+  struct timeval utc;
+  uint64_t seq;
+  /* data points to mapping, valid until next rdr_next() */
+  const uint8_t *data;
+  uint32_t size;
+
+  unsigned fps;
+  unsigned width;
+  unsigned height;
+  /* position in archive */
+  const struct rdr_segment *seg;
+  size_t pos;
+};
+
+/* sequential frames reader */
+struct rdr_cursor {
+  struct rdr_archive *ar;
+  size_t seg;
+  size_t pos;
+  struct rdr_index ix;
+  struct rdr_pack pk;
+  /* rdr_next() stopped by error, not by end of archive */
+  bool failed;
+  /* gap markers passed by rdr_next(): frames dropped by capture */
+  uint64_t gaps;
+  /* records with invalid magic key passed by rdr_next() */
+  uint64_t invalid;
+};
+
+/* message of last failure in calling thread, errno is kept as set
+ * by failed call
+ */
+const char *
+rdr_error(void);
+
+/* map index file, dirfd may be AT_FDCWD
+ * return false when file has no valid header
+ */
+bool
+rdr_index_open(struct rdr_index *ix, int dirfd, const char *path);
+
+/* remap when file grown */
+bool
+rdr_index_refresh(struct rdr_index *ix);
+
+void
+rdr_index_close(struct rdr_index *ix);
+
+/* first record with local time >= tv in records [lo, hi) */
+size_t
+rdr_index_lower_bound(const struct rdr_index *ix, size_t lo, size_t hi,
+                      const struct timeval *tv);
+
+void
+rdr_pack_init(struct rdr_pack *pk);
+
+/* map frames file `path` (when not mapped yet) and point *p to frame data */
+bool
+rdr_pack_frame(struct rdr_pack *pk, int dirfd, const char *path,
+               const frame_index_t *fi, const uint8_t **p);
+
+void
+rdr_pack_close(struct rdr_pack *pk);
+
+/* load index file header and time of last frame
+ * return false when file not usable
+ */
+bool
+rdr_segment_load(struct rdr_segment *seg, int dirfd, const char *path,
+                 bool allow_empty);
+
+/* read headers of all index files in directory, sort by time
+ * allow_empty: keep files without frames (capture in progress)
+ */
+bool
+rdr_open(struct rdr_archive *ar, const char *dirpath, bool allow_empty);
+
+void
+rdr_close(struct rdr_archive *ar);
+
+/* UTC time of first and last frames in archive */
+bool
+rdr_coverage(const struct rdr_archive *ar,
+             struct timeval *start, struct timeval *end);
+
+void
+rdr_cursor_init(struct rdr_cursor *c, struct rdr_archive *ar);
+
+/* move cursor to first frame with UTC time >= utc */
+bool
+rdr_seek(struct rdr_cursor *c, const struct timeval *utc);
+
+/* get next frame, gap markers are skipped
+ * return false on end of archive or error (c->failed)
+ */
+bool
+rdr_next(struct rdr_cursor *c, struct rdr_frame *f);
+
+void
+rdr_cursor_close(struct rdr_cursor *c);
+
+#endif /* _READER_1560766502_H_ */
+
@@ -0,0 +1,282 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/rt.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "rt.h"
+
+/* linux/ioprio.h, not exported by libc */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+static const char *const io_classes[] = {
+  [IOPRIO_CLASS_RT] = "rt",
+  [IOPRIO_CLASS_BE] = "be",
+  [IOPRIO_CLASS_IDLE] = "idle"
+};
+
+static bool
+parse_cpus(struct rt_cfg *cfg, const char *list)
+{
+  unsigned long first;
+  unsigned long last;
+  char *end;
+
+  memset(cfg->cpumask, 0, sizeof(cfg->cpumask));
+  while (*list) {
+    first = strtoul(list, &end, 10);
+    if (end == list)
+      return false;
+    last = first;
+    if (*end == '-') {
+      list = end + 1;
+      last = strtoul(list, &end, 10);
+      if (end == list)
+        return false;
+    }
+    if (first > last || last >= RT_CPUS)
+      return false;
+    for (; first <= last; first++)
+      cfg->cpumask[first / 64u] |= 1ull << (first % 64u);
+    /* cpus list separated by '+' or ':' as ',' separates options */
+    if (*end == '+' || *end == ':')
+      end++;
+    else if (*end)
+      return false;
+    list = end;
+  }
+  return true;
+}
+
+bool
+rt_parse(struct rt_cfg *cfg, const char *spec)
+{
+  char buf[256];
+  char *save = NULL;
+  char *tok;
+  char *val;
+  char *end;
+
+  memset(cfg, 0, sizeof(*cfg));
+  if (strlen(spec) >= sizeof(buf)) {
+    fprintf(stderr, "! rt: spec too long\n");
+    return false;
+  }
+  strcpy(buf, spec);
+
+  for (tok = strtok_r(buf, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    val = strchr(tok, '=');
+    if (!val) {
+      fprintf(stderr, "! rt: '%s' without value\n", tok);
+      return false;
+    }
+    *val++ = '\0';
+
+    if (!strcmp(tok, "sched")) {
+      cfg->sched = true;
+      if (!strcmp(val, "other")) {
+        cfg->policy = SCHED_OTHER;
+        continue;
+      } else if (!strncmp(val, "fifo:", 5)) {
+        cfg->policy = SCHED_FIFO;
+      } else if (!strncmp(val, "rr:", 3)) {
+        cfg->policy = SCHED_RR;
+      } else {
+        fprintf(stderr, "! rt: sched expect fifo:<prio>, rr:<prio> "
+                "or other\n");
+        return false;
+      }
+      val = strchr(val, ':') + 1;
+      cfg->priority = (int)strtol(val, &end, 10);
+      if (end == val || *end ||
+          cfg->priority < sched_get_priority_min(cfg->policy) ||
+          cfg->priority > sched_get_priority_max(cfg->policy)) {
+        fprintf(stderr, "! rt: invalid priority '%s'\n", val);
+        return false;
+      }
+    } else if (!strcmp(tok, "cpus")) {
+      cfg->cpus = true;
+      if (!parse_cpus(cfg, val)) {
+        fprintf(stderr, "! rt: invalid cpus '%s', expect e.g. 2 or 0+2-3\n",
+                val);
+        return false;
+      }
+    } else if (!strcmp(tok, "io")) {
+      cfg->io = true;
+      if (!strcmp(val, "idle")) {
+        cfg->io_class = IOPRIO_CLASS_IDLE;
+        continue;
+      } else if (!strncmp(val, "rt:", 3)) {
+        cfg->io_class = IOPRIO_CLASS_RT;
+      } else if (!strncmp(val, "be:", 3)) {
+        cfg->io_class = IOPRIO_CLASS_BE;
+      } else {
+        fprintf(stderr, "! rt: io expect rt:<level>, be:<level> or idle\n");
+        return false;
+      }
+      val += 3;
+      cfg->io_level = (int)strtol(val, &end, 10);
+      if (end == val || *end || cfg->io_level < 0 || cfg->io_level > 7) {
+        fprintf(stderr, "! rt: invalid io level '%s', expect 0..7\n", val);
+        return false;
+      }
+    } else {
+      fprintf(stderr, "! rt: unknown option '%s=%s'\n", tok, val);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* cpus of mask not listed in sysfs file (isolated, nohz_full) */
+static void
+hint_cpus(const char *name, const struct rt_cfg *cfg, const char *file,
+          const char *param)
+{
+  struct rt_cfg listed;
+  char line[1024] = {0};
+  FILE *f;
+  size_t i;
+
+  if (!(f = fopen(file, "r")))
+    return;
+  if (!fgets(line, sizeof(line), f))
+    line[0] = '\0';
+  fclose(f);
+  line[strcspn(line, "\n")] = '\0';
+  /* sysfs format: 0,2-3 */
+  for (i = 0u; line[i]; i++) {
+    if (line[i] == ',')
+      line[i] = '+';
+  }
+  if (!parse_cpus(&listed, line))
+    memset(listed.cpumask, 0, sizeof(listed.cpumask));
+
+  for (i = 0u; i < RT_CPUS / 64u; i++) {
+    if (cfg->cpumask[i] & ~listed.cpumask[i]) {
+      fprintf(stderr, "@ rt: %s: hint: cpus are not in %s (%s=)\n",
+              name, file, param);
+      return;
+    }
+  }
+}
+
+/* affinity of process before first rt_apply(): for helper threads */
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+static cpu_set_t default_cpus;
+static bool default_cpus_valid;
+
+static void
+default_cpus_save(void)
+{
+  default_cpus_valid = pthread_getaffinity_np(pthread_self(),
+                                              sizeof(default_cpus),
+                                              &default_cpus) == 0;
+}
+
+bool
+rt_apply(const char *name, const struct rt_cfg *cfg)
+{
+  struct sched_param param = {.sched_priority = cfg->priority};
+  cpu_set_t set;
+  bool ok = true;
+  size_t i;
+  int r;
+
+  pthread_once(&default_once, default_cpus_save);
+
+  if (cfg->sched) {
+    r = pthread_setschedparam(pthread_self(), cfg->policy, &param);
+    fprintf(stderr, "@ rt: %s: sched %s/%d: %s\n", name,
+            cfg->policy == SCHED_FIFO ? "fifo" :
+            cfg->policy == SCHED_RR ? "rr" : "other",
+            cfg->priority, r ? strerror(r) : "applied");
+    ok &= !r;
+  }
+
+  if (cfg->cpus) {
+    CPU_ZERO(&set);
+    for (i = 0u; i < RT_CPUS && i < CPU_SETSIZE; i++) {
+      if (cfg->cpumask[i / 64u] & (1ull << (i % 64u)))
+        CPU_SET(i, &set);
+    }
+    r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    fprintf(stderr, "@ rt: %s: cpus", name);
+    for (i = 0u; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &set))
+        fprintf(stderr, " %zu", i);
+    }
+    fprintf(stderr, ": %s\n", r ? strerror(r) : "applied");
+    ok &= !r;
+    if (!r) {
+      hint_cpus(name, cfg, "/sys/devices/system/cpu/isolated", "isolcpus");
+      hint_cpus(name, cfg, "/sys/devices/system/cpu/nohz_full", "nohz_full");
+    }
+  }
+
+  if (cfg->io) {
+    /* thread id: io priority is per thread */
+    r = (int)syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS,
+                     (int)syscall(SYS_gettid),
+                     cfg->io_class << IOPRIO_CLASS_SHIFT | cfg->io_level);
+    fprintf(stderr, "@ rt: %s: io %s/%d: %s\n", name,
+            io_classes[cfg->io_class], cfg->io_level,
+            r == -1 ? strerror(errno) : "applied");
+    ok &= r != -1;
+  }
+
+  return ok;
+}
+
+void
+rt_helper_attr(pthread_attr_t *attr)
+{
+  struct sched_param param = {.sched_priority = 0};
+
+  pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(attr, SCHED_OTHER);
+  pthread_attr_setschedparam(attr, &param);
+  pthread_once(&default_once, default_cpus_save);
+  if (default_cpus_valid)
+    pthread_attr_setaffinity_np(attr, sizeof(default_cpus), &default_cpus);
+}
+
+void
+rt_helper_io(void)
+{
+  /* class none: io priority derived from nice value */
+  syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, (int)syscall(SYS_gettid), 0);
+}
+
+bool
+rt_mlockall(void)
+{
+  struct rlimit rl;
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+    fprintf(stderr, "@ rt: mlockall: %s", strerror(errno));
+    if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+      fprintf(stderr, " (RLIMIT_MEMLOCK %llu KB)",
+              (unsigned long long)rl.rlim_cur / 1024u);
+    fprintf(stderr, "\n");
+    return false;
+  }
+  fprintf(stderr, "@ rt: mlockall: applied\n");
+  return true;
+}
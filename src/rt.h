@@ -0,0 +1,61 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/rt.h
+ */
+#ifndef _RT_1561972650_H_
+#define _RT_1561972650_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* highest cpu number + 1 in affinity mask */
+#define RT_CPUS 1024
+
+/*
+ * scheduling of thread: real-time policy, cpu affinity, io priority.
+ *
+ * spec: comma separated list of
+ *   sched=fifo:<prio>|rr:<prio>|other   scheduling policy
+ *   cpus=<list>                         affinity, e.g. 2 or 0+2-3
+ *   io=rt:<level>|be:<level>|idle       io priority (level 0 highest)
+ *
+ * applied by thread itself, result reported to stderr.
+ * threads created later by that thread inherit its policy, affinity and
+ * io priority: helper threads (trace dumps) are created with
+ * rt_helper_attr() and call rt_helper_io()
+ */
+struct rt_cfg {
+  bool sched;
+  int policy;
+  int priority;
+
+  bool cpus;
+  uint64_t cpumask[RT_CPUS / 64];
+
+  bool io;
+  int io_class;
+  int io_level;
+};
+
+/* parse spec, return false on invalid spec */
+bool
+rt_parse(struct rt_cfg *cfg, const char *spec);
+
+/* apply to calling thread, false if any setting failed */
+bool
+rt_apply(const char *name, const struct rt_cfg *cfg);
+
+/* attr of helper thread: SCHED_OTHER, affinity of process before
+ * rt_apply(), not inherited from creating thread
+ */
+void
+rt_helper_attr(pthread_attr_t *attr);
+
+/* in helper thread: io priority not inherited from creating thread */
+void
+rt_helper_io(void);
+
+/* lock current and future memory of process */
+bool
+rt_mlockall(void);
+
+#endif /* _RT_1561972650_H_ */
@@ -0,0 +1,127 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/stats.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+/* reader retries before give up */
+#define STATS_READ_RETRY 1000u
+
+struct stats_page *
+stats_create(const char *path)
+{
+  struct stats_page *sp;
+  int fd;
+
+  fd = open(path, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    fprintf(stderr, "! stats file '%s' not opened: %s\n",
+            path, strerror(errno));
+    return NULL;
+  }
+
+  if (ftruncate(fd, sizeof(*sp)) == -1) {
+    fprintf(stderr, "! stats file '%s' not resized: %s\n",
+            path, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  sp = mmap(NULL, sizeof(*sp), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (sp == MAP_FAILED) {
+    fprintf(stderr, "! stats file '%s' not mapped: %s\n",
+            path, strerror(errno));
+    return NULL;
+  }
+
+  /* invalid for readers until initialized */
+  memset(sp->magic, 0, sizeof(sp->magic));
+  atomic_thread_fence(memory_order_release);
+  atomic_store(&sp->seq, 0u);
+  memset(&sp->data, 0, sizeof(sp->data));
+  sp->version = STATS_VERSION;
+  sp->size = sizeof(*sp);
+  sp->pid = (uint32_t)getpid();
+  atomic_thread_fence(memory_order_release);
+  memcpy(sp->magic, STATS_MAGIC, sizeof(sp->magic));
+
+  fprintf(stderr, "@ stats file: %s\n", path);
+  return sp;
+}
+
+const struct stats_page *
+stats_open(const char *path)
+{
+  const struct stats_page *sp;
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    fprintf(stderr, "ERROR: stats file '%s' not opened: %s\n",
+            path, strerror(errno));
+    return NULL;
+  }
+
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(*sp)) {
+    fprintf(stderr, "ERROR: stats file '%s' too small\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  sp = mmap(NULL, sizeof(*sp), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (sp == MAP_FAILED) {
+    fprintf(stderr, "ERROR: stats file '%s' not mapped: %s\n",
+            path, strerror(errno));
+    return NULL;
+  }
+
+  if (memcmp(sp->magic, STATS_MAGIC, sizeof(sp->magic)) ||
+      sp->version != STATS_VERSION || sp->size != sizeof(*sp)) {
+    fprintf(stderr, "ERROR: stats file '%s' has unknown format\n", path);
+    munmap((void *)sp, sizeof(*sp));
+    return NULL;
+  }
+
+  return sp;
+}
+
+void
+stats_close(const struct stats_page *sp)
+{
+  if (sp)
+    munmap((void *)sp, sizeof(*sp));
+}
+
+bool
+stats_read(const struct stats_page *sp, struct stats_data *data)
+{
+  unsigned before;
+  unsigned after;
+  unsigned i;
+
+  for (i = 0u; i < STATS_READ_RETRY; i++) {
+    before = atomic_load_explicit(&sp->seq, memory_order_acquire);
+    if (before & 1u) {
+      sched_yield();
+      continue;
+    }
+    memcpy(data, (const void *)&sp->data, sizeof(*data));
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&sp->seq, memory_order_relaxed);
+    if (before == after)
+      return true;
+  }
+  return false;
+}
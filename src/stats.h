@@ -0,0 +1,157 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/stats.h
+ */
+#ifndef _STATS_1561627360_H_
+#define _STATS_1561627360_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+
+#include "frame_index.h"
+
+/*
+ * capture counters in memory mapped file:
+ * one writer (capture main thread) updates page under seqlock,
+ * readers map file read-only and retry on concurrent update.
+ * updates are plain stores, no syscalls
+ */
+#define STATS_MAGIC "CCST"
+#define STATS_VERSION 7u
+#define STATS_LAT_STAGES 5u
+
+/* perf counters of thread stage */
+enum stats_pmu_stage {
+  STATS_PMU_CAPTURE = 0,
+  STATS_PMU_WRITE,
+  STATS_PMU_STAGES
+};
+
+struct stats_lat {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  uint64_t max_ns;
+};
+
+/* sums over last window of frames, mask: bits of enum pmu_event */
+struct stats_pmu {
+  uint64_t mask;
+  uint64_t frames;
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t cache_misses;
+  uint64_t page_faults;
+  uint64_t task_clock_ns;
+};
+
+struct stats_data {
+  /* CLOCK_MONOTONIC of last update */
+  uint64_t update_ns;
+  /* UTC of process start */
+  uint64_t start_utc;
+
+  /* camera */
+  uint64_t frames_arrived;
+  uint64_t frames_dropped;
+  /* frames_dropped by reason */
+  uint64_t drops_full;
+  uint64_t drops_oldest;
+  uint64_t drops_decimate;
+  uint64_t gap_markers;
+  uint64_t v4l2_queued;
+  uint64_t v4l2_buffers;
+  uint64_t fps;
+  /* JPEG quality, 0 = unknown */
+  uint64_t quality;
+  /* adaptive quality: level (0 = best) of levels, 0 levels = off */
+  uint64_t adapt_level;
+  uint64_t adapt_levels;
+  uint64_t adapt_steps_down;
+  uint64_t adapt_steps_up;
+
+  /* files ring */
+  uint64_t segment;
+  uint64_t files_limit;
+  uint64_t size_limit;
+  uint64_t frame_file_bytes;
+  uint64_t index_file_bytes;
+  char frame_file[FH_PATH_SIZE + 1];
+  char index_file[FH_PATH_SIZE + 1];
+
+  /* decimated stream, 0 files limit and segment = off */
+  uint64_t lapse_frames;
+  uint64_t lapse_gap_markers;
+  uint64_t lapse_segment;
+  uint64_t lapse_files_limit;
+
+  /* triggered recording, 0 ring capacity = off */
+  uint64_t event_ring_capacity;
+  uint64_t event_ring_percent;
+  uint64_t event_recording;
+  uint64_t event_triggers;
+  uint64_t events;
+  uint64_t event_discarded;
+
+  /* write thread */
+  uint64_t ring_capacity;
+  uint64_t ring_percent;
+  uint64_t ring_percent_max;
+  uint64_t ring_dropped;
+  uint64_t written_bytes;
+  uint64_t write_errors;
+  uint64_t short_writes;
+  uint64_t flushes;
+  uint64_t flushes_deadline;
+
+  /* indexed by enum wth_lat_stage */
+  struct stats_lat lat[STATS_LAT_STAGES];
+
+  /* zero mask when counters disabled */
+  struct stats_pmu pmu[STATS_PMU_STAGES];
+};
+
+struct stats_page {
+  char magic[4];
+  uint32_t version;
+  uint32_t size;
+  uint32_t pid;
+  /* odd while update in progress */
+  atomic_uint seq;
+  struct stats_data data;
+};
+
+/* create and map stats file for writing */
+struct stats_page *
+stats_create(const char *path);
+
+/* map stats file for reading */
+const struct stats_page *
+stats_open(const char *path);
+
+void
+stats_close(const struct stats_page *sp);
+
+static inline void
+stats_write_begin(struct stats_page *sp)
+{
+  unsigned seq = atomic_load_explicit(&sp->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&sp->seq, seq + 1u, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline void
+stats_write_end(struct stats_page *sp)
+{
+  unsigned seq = atomic_load_explicit(&sp->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&sp->seq, seq + 1u, memory_order_release);
+}
+
+/* consistent copy of data, false when writer holds page too long */
+bool
+stats_read(const struct stats_page *sp, struct stats_data *data);
+
+#endif /* _STATS_1561627360_H_ */
@@ -0,0 +1,248 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/trace.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "rt.h"
+#include "clock.h"
+
+#define TRACE_NAME_SIZE 32
+
+struct trace_ring {
+  struct trace_ring *next;
+  pid_t tid;
+  char name[TRACE_NAME_SIZE];
+  /* count of recorded events */
+  atomic_size_t head;
+  struct trace_event ev[TRACE_RING_SIZE];
+};
+
+atomic_bool trace_on;
+
+/* rings of all threads ever traced, never freed */
+static _Atomic(struct trace_ring *) rings;
+static _Thread_local struct trace_ring *self;
+
+static char prefix[4096];
+static atomic_bool dumping;
+static atomic_uint dumps;
+static uint64_t drop_dump_last;
+
+static struct trace_ring *
+ring_acquire(void)
+{
+  struct trace_ring *r;
+
+  if (!(r = calloc(1, sizeof(*r))))
+    return NULL;
+  r->tid = (pid_t)syscall(SYS_gettid);
+  snprintf(r->name, sizeof(r->name), "thread %d", (int)r->tid);
+  r->next = atomic_load(&rings);
+  while (!atomic_compare_exchange_weak(&rings, &r->next, r));
+  return r;
+}
+
+void
+trace_thread(const char *name)
+{
+  if (!self && !(self = ring_acquire()))
+    return;
+  snprintf(self->name, sizeof(self->name), "%s", name);
+}
+
+void
+trace_event(char ph, const char *name, uint64_t arg)
+{
+  struct trace_event *ev;
+  size_t head;
+
+  if (!self && !(self = ring_acquire()))
+    return;
+
+  head = atomic_load_explicit(&self->head, memory_order_relaxed);
+  ev = &self->ev[head & (TRACE_RING_SIZE - 1u)];
+  ev->ts = now_ns();
+  ev->name = name;
+  ev->arg = arg;
+  ev->ph = ph;
+  atomic_store_explicit(&self->head, head + 1u, memory_order_release);
+}
+
+/* copy events not overwritten while copying, return count */
+static size_t
+ring_snapshot(struct trace_ring *r, struct trace_event *out)
+{
+  size_t head;
+  size_t first;
+  size_t after;
+  size_t i;
+
+  head = atomic_load_explicit(&r->head, memory_order_acquire);
+  first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0u;
+  for (i = first; i < head; i++)
+    out[i - first] = r->ev[i & (TRACE_RING_SIZE - 1u)];
+
+  atomic_thread_fence(memory_order_acquire);
+  after = atomic_load_explicit(&r->head, memory_order_relaxed);
+  /* slot of event 'after' may be in writing */
+  if (after - first >= TRACE_RING_SIZE) {
+    i = after - TRACE_RING_SIZE + 1u - first;
+    if (i >= head - first)
+      return 0u;
+    memmove(out, out + i, (head - first - i) * sizeof(*out));
+    return head - first - i;
+  }
+  return head - first;
+}
+
+static void
+write_event(FILE *f, const struct trace_event *ev, pid_t pid, pid_t tid,
+            bool *first)
+{
+  fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03u,"
+          "\"pid\":%d,\"tid\":%d",
+          *first ? "" : ",", ev->name, ev->ph,
+          ev->ts / 1000u, (unsigned)(ev->ts % 1000u), (int)pid, (int)tid);
+  if (ev->ph == 'C')
+    fprintf(f, ",\"args\":{\"value\":%" PRIu64 "}", ev->arg);
+  else if (ev->arg)
+    fprintf(f, ",\"args\":{\"arg\":%" PRIu64 "}", ev->arg);
+  if (ev->ph == 'i')
+    fprintf(f, ",\"s\":\"t\"");
+  fprintf(f, "}");
+  *first = false;
+}
+
+static void *
+dump_thread(void *arg)
+{
+  char path[sizeof(prefix) + 32];
+  char tmp[sizeof(path) + 8];
+  struct trace_event *evs;
+  struct trace_ring *r;
+  pid_t pid = getpid();
+  bool first = true;
+  size_t count;
+  size_t total = 0u;
+  size_t i;
+  FILE *f;
+
+  rt_helper_io();
+  snprintf(path, sizeof(path), "%s.%u.json", prefix, (unsigned)(uintptr_t)arg);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  if (!(evs = malloc(sizeof(*evs) * TRACE_RING_SIZE))) {
+    fprintf(stderr, "! trace: out of memory\n");
+    atomic_store(&dumping, false);
+    return NULL;
+  }
+  if (!(f = fopen(tmp, "w"))) {
+    fprintf(stderr, "! trace: '%s' not opened: %s\n", tmp, strerror(errno));
+    free(evs);
+    atomic_store(&dumping, false);
+    return NULL;
+  }
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (r = atomic_load(&rings); r; r = r->next) {
+    fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",", (int)pid, (int)r->tid, r->name);
+    first = false;
+    count = ring_snapshot(r, evs);
+    for (i = 0u; i < count; i++)
+      write_event(f, &evs[i], pid, r->tid, &first);
+    total += count;
+  }
+  fprintf(f, "\n]}\n");
+  free(evs);
+
+  if (fclose(f) != 0 || rename(tmp, path) == -1) {
+    fprintf(stderr, "! trace: '%s' not written: %s\n", path, strerror(errno));
+    unlink(tmp);
+  } else {
+    fprintf(stderr, "@ trace: %zu events to %s\n", total, path);
+  }
+  atomic_store(&dumping, false);
+  return NULL;
+}
+
+bool
+trace_dump(void)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  bool expected = false;
+  unsigned n;
+  int r;
+
+  if (!atomic_load(&trace_on) ||
+      !atomic_compare_exchange_strong(&dumping, &expected, true))
+    return false;
+
+  n = atomic_fetch_add(&dumps, 1u);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  /* creator may be real-time capture thread pinned to its cpu */
+  rt_helper_attr(&attr);
+  r = pthread_create(&thread, &attr, dump_thread, (void *)(uintptr_t)n);
+  pthread_attr_destroy(&attr);
+  if (r != 0) {
+    fprintf(stderr, "! trace: dump thread not started: %s\n", strerror(r));
+    atomic_store(&dumping, false);
+    return false;
+  }
+  return true;
+}
+
+void
+trace_drop(void)
+{
+  uint64_t now;
+
+  if (!atomic_load_explicit(&trace_on, memory_order_relaxed))
+    return;
+
+  trace_event('i', "frame_drop", 0u);
+  now = now_ns();
+  if (drop_dump_last &&
+      now - drop_dump_last < TRACE_DROP_DUMP_INTERVAL * 1000000000ull)
+    return;
+  if (trace_dump())
+    drop_dump_last = now;
+}
+
+bool
+trace_start(const char *path_prefix)
+{
+  if (strlen(path_prefix) >= sizeof(prefix)) {
+    fprintf(stderr, "! trace: prefix too long\n");
+    return false;
+  }
+  strcpy(prefix, path_prefix);
+  atomic_store(&trace_on, true);
+  fprintf(stderr, "@ trace: enabled, dumps to %s.<n>.json\n", prefix);
+  return true;
+}
+
+void
+trace_stop(void)
+{
+  struct timespec wait = {.tv_sec = 0, .tv_nsec = 1000000};
+
+  atomic_store(&trace_on, false);
+  while (atomic_load(&dumping))
+    nanosleep(&wait, NULL);
+}
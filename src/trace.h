@@ -0,0 +1,73 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/trace.h
+ */
+#ifndef _TRACE_1561798410_H_
+#define _TRACE_1561798410_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * timeline of capture and write threads in Chrome trace event format
+ * (chrome://tracing, ui.perfetto.dev).
+ *
+ * each thread records events to own ring, oldest events are overwritten
+ * (flight recorder). dump writes last events of all threads to
+ * <prefix>.<n>.json from background thread.
+ *
+ * disabled tracing costs one relaxed load per event.
+ * event names must be string literals: only pointers are stored.
+ */
+
+/* events in ring of each thread, power of 2 */
+#define TRACE_RING_SIZE 65536u
+/* minimal interval between dumps on frame drop */
+#define TRACE_DROP_DUMP_INTERVAL 10u
+
+struct trace_event {
+  /* CLOCK_MONOTONIC, ns */
+  uint64_t ts;
+  const char *name;
+  uint64_t arg;
+  /* 'B' begin, 'E' end, 'i' instant, 'C' counter */
+  char ph;
+};
+
+extern atomic_bool trace_on;
+
+/* enable recording, dumps go to <prefix>.<n>.json */
+bool
+trace_start(const char *prefix);
+
+/* disable recording, wait for dump in progress */
+void
+trace_stop(void);
+
+/* name of current thread in trace */
+void
+trace_thread(const char *name);
+
+void
+trace_event(char ph, const char *name, uint64_t arg);
+
+/* dump in background, false when tracing is off or dump in progress */
+bool
+trace_dump(void);
+
+/* mark frame drop and dump timeline (not often than interval) */
+void
+trace_drop(void);
+
+#define TRACE_EVENT(_ph, _name, _arg)                               \
+  do {                                                              \
+    if (atomic_load_explicit(&trace_on, memory_order_relaxed))      \
+      trace_event((_ph), (_name), (_arg));                          \
+  } while (0)
+
+#define trace_begin(_name) TRACE_EVENT('B', (_name), 0u)
+#define trace_begin_arg(_name, _arg) TRACE_EVENT('B', (_name), (_arg))
+#define trace_end(_name) TRACE_EVENT('E', (_name), 0u)
+#define trace_instant(_name, _arg) TRACE_EVENT('i', (_name), (_arg))
+#define trace_counter(_name, _value) TRACE_EVENT('C', (_name), (_value))
+
+#endif /* _TRACE_1561798410_H_ */
@@ -0,0 +1,164 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/wth_fault.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <ev.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "wth_fault.h"
+
+static uint32_t
+fault_rand(struct wth_fault *f)
+{
+  /* xorshift32 */
+  f->rnd ^= f->rnd << 13;
+  f->rnd ^= f->rnd >> 17;
+  f->rnd ^= f->rnd << 5;
+  return f->rnd;
+}
+
+static void
+fault_sleep(uint64_t us)
+{
+  struct timespec ts = {
+    .tv_sec = us / 1000000u,
+    .tv_nsec = (us % 1000000u) * 1000u
+  };
+
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+static int
+fault_open(struct wth_context *ctx, int dirfd, const char *path)
+{
+  return wth_posix_sink.open(ctx, dirfd, path);
+}
+
+static ssize_t
+fault_write(struct wth_context *ctx, int fd, const uint8_t *p, size_t size)
+{
+  struct wth_fault *f = ctx->sink_data;
+  struct timespec now;
+  uint64_t elapsed_ms;
+  ssize_t r;
+
+  if (f->latency_us)
+    fault_sleep(f->latency_us);
+
+  if (f->stall_ms) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!f->stall_last.tv_sec && !f->stall_last.tv_nsec)
+      f->stall_last = now;
+    elapsed_ms = (uint64_t)(now.tv_sec - f->stall_last.tv_sec) * 1000u +
+                 (now.tv_nsec - f->stall_last.tv_nsec) / 1000000;
+    if (elapsed_ms >= f->stall_period_ms) {
+      f->stalls++;
+      fault_sleep((uint64_t)f->stall_ms * 1000u);
+      clock_gettime(CLOCK_MONOTONIC, &f->stall_last);
+    }
+  }
+
+  if (f->enospc_after && f->written >= f->enospc_after) {
+    f->enospc_errors++;
+    errno = ENOSPC;
+    return -1;
+  }
+
+  if (f->short_percent && size > 1u &&
+      fault_rand(f) % 100u < f->short_percent) {
+    f->short_writes++;
+    size = 1u + fault_rand(f) % (size - 1u);
+  }
+
+  r = wth_posix_sink.write(ctx, fd, p, size);
+  if (r > 0) {
+    f->written += r;
+    if (f->rate)
+      fault_sleep((uint64_t)r * 1000000u / f->rate);
+  }
+  return r;
+}
+
+static int
+fault_close(struct wth_context *ctx, int fd)
+{
+  return wth_posix_sink.close(ctx, fd);
+}
+
+const struct wth_sink_ops wth_fault_sink = {
+  .open = fault_open,
+  .write = fault_write,
+  .close = fault_close
+};
+
+bool
+wth_fault_parse(struct wth_fault *f, const char *spec)
+{
+  char buf[256];
+  char *save = NULL;
+  char *tok;
+  char *val;
+  char *end;
+  unsigned long long v;
+
+  memset(f, 0, sizeof(*f));
+  f->rnd = 2463534242u;
+
+  if (strlen(spec) >= sizeof(buf)) {
+    fprintf(stderr, "ERROR: fault spec too long\n");
+    return false;
+  }
+  strcpy(buf, spec);
+
+  for (tok = strtok_r(buf, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    val = strchr(tok, '=');
+    if (!val) {
+      fprintf(stderr, "ERROR: fault '%s' without value\n", tok);
+      return false;
+    }
+    *val++ = '\0';
+    v = strtoull(val, &end, 10);
+    if (end == val) {
+      fprintf(stderr, "ERROR: fault '%s' invalid value '%s'\n", tok, val);
+      return false;
+    }
+
+    if (!strcmp(tok, "latency") && !*end) {
+      f->latency_us = (unsigned)v;
+    } else if (!strcmp(tok, "rate") && !*end) {
+      f->rate = v * 1024u;
+    } else if (!strcmp(tok, "stall") && *end == ':') {
+      f->stall_period_ms = (unsigned)v;
+      val = end + 1;
+      f->stall_ms = (unsigned)strtoul(val, &end, 10);
+      if (end == val || *end) {
+        fprintf(stderr, "ERROR: fault stall expect <period ms>:<ms>\n");
+        return false;
+      }
+    } else if (!strcmp(tok, "short") && !*end && v <= 100u) {
+      f->short_percent = (unsigned)v;
+    } else if (!strcmp(tok, "enospc") && !*end) {
+      f->enospc_after = v * 1024u * 1024u;
+    } else if (!strcmp(tok, "seed") && !*end) {
+      f->rnd = (uint32_t)v ? (uint32_t)v : 1u;
+    } else {
+      fprintf(stderr, "ERROR: unknown fault '%s=%s'\n", tok, val);
+      return false;
+    }
+  }
+
+  fprintf(stderr, "INFO: fault sink: latency %u us, rate %llu KB/s, "
+          "stall %u ms every %u ms, short %u%%, enospc after %llu MB\n",
+          f->latency_us, (unsigned long long)(f->rate / 1024u),
+          f->stall_ms, f->stall_period_ms, f->short_percent,
+          (unsigned long long)(f->enospc_after / 1024u / 1024u));
+  return true;
+}
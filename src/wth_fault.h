@@ -0,0 +1,50 @@
+/* vim: ft=c ff=unix fenc=utf-8 ts=2 sw=2 et
+ * file: src/wth_fault.h
+ */
+#ifndef _WTH_FAULT_1561458011_H_
+#define _WTH_FAULT_1561458011_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * write thread sink with injected faults (slow disk emulation),
+ * wraps wth_posix_sink.
+ *
+ * spec: comma separated list of
+ *   latency=<us>         delay of each write()
+ *   rate=<KB/s>          write() takes time of its size at rate
+ *   stall=<ms>:<ms>      every first ms one write() blocks second ms
+ *   short=<percent>      part of writes truncated to random length
+ *   enospc=<MB>          all writes fail with ENOSPC after MB written
+ *   seed=<n>             random seed
+ */
+struct wth_fault {
+  /* configuration */
+  unsigned latency_us;
+  /* bytes per second, 0 = unlimited */
+  uint64_t rate;
+  unsigned stall_period_ms;
+  unsigned stall_ms;
+  unsigned short_percent;
+  uint64_t enospc_after;
+
+  /* state */
+  uint32_t rnd;
+  uint64_t written;
+  struct timespec stall_last;
+
+  /* counters */
+  uint64_t stalls;
+  uint64_t short_writes;
+  uint64_t enospc_errors;
+};
+
+/* parse spec, return false on invalid spec */
+bool
+wth_fault_parse(struct wth_fault *f, const char *spec);
+
+/* sink_data of wth_context must point to struct wth_fault */
+extern const struct wth_sink_ops wth_fault_sink;
+
+#endif /* _WTH_FAULT_1561458011_H_ */